@@ -0,0 +1,441 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "simulation.h"
+
+// Per-system tick cost at increasing population sizes.
+//
+//   bench [--sizes 1000,10000,...] [--ticks N] [--threads N] [--json FILE]
+//
+// Every system is timed on its own through systems.update<S>() so one system's
+// cost never hides in another's. Allocations are counted by replacing every
+// form of the global operator new and delete for this binary.
+
+static std::atomic<uint64_t> allocations(0);
+
+// Kept out of line: once a replaced delete is inlined into a caller, GCC sees
+// free() on a pointer from operator new and warns about a mismatch
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+BENCH_NOINLINE static void release(void* p) {
+    free(p);
+}
+
+BENCH_NOINLINE static void* allocate(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size > 0 ? size : 1);
+}
+
+void* operator new(size_t size) {
+    void* p = allocate(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, size_t) noexcept { release(p); }
+void operator delete[](void* p, size_t) noexcept { release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { release(p); }
+
+#ifdef __cpp_aligned_new
+// Over-aligned types come through here, and are freed by the matching forms below
+BENCH_NOINLINE static void* allocateAligned(size_t size, std::align_val_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    size_t align = std::max(sizeof(void*), (size_t) alignment);
+    size = size > 0 ? size : 1;
+#ifdef _WIN32
+    return _aligned_malloc(size, align);
+#else
+    void* p = nullptr;
+    return posix_memalign(&p, align, size) == 0 ? p : nullptr;
+#endif
+}
+
+BENCH_NOINLINE static void freeAligned(void* p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    void* p = allocateAligned(size, alignment);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocateAligned(size, alignment);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept { freeAligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { freeAligned(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { freeAligned(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { freeAligned(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { freeAligned(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { freeAligned(p); }
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+struct Result {
+    std::string system;
+    uint entities;
+    uint ticks;
+    double nsPerTick;
+    double nsPerEntity;
+    double allocationsPerTick;
+};
+
+static float randomCoordinate() {
+    return (float) rand() / RAND_MAX * 2 - 1;
+}
+
+// Times `tick` over `ticks` calls. `prepare` runs before each call, outside the
+// timed region, to set up per-tick input such as new jobs or drag updates.
+static Result measure(const std::string& system, uint entities, uint ticks,
+                      std::function<void(uint)> prepare, std::function<void()> tick) {
+    // one untimed warm-up tick so first-touch costs are not counted
+    prepare(0);
+    tick();
+
+    double totalNs = 0;
+    uint64_t totalAllocations = 0;
+    for (uint t = 1; t <= ticks; t++) {
+        prepare(t);
+        uint64_t allocationsBefore = allocations.load(std::memory_order_relaxed);
+        auto start = Clock::now();
+        tick();
+        totalNs += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        totalAllocations += allocations.load(std::memory_order_relaxed) - allocationsBefore;
+    }
+
+    Result result;
+    result.system = system;
+    result.entities = entities;
+    result.ticks = ticks;
+    result.nsPerTick = totalNs / ticks;
+    result.nsPerEntity = entities > 0 ? result.nsPerTick / entities : 0;
+    result.allocationsPerTick = (double) totalAllocations / ticks;
+    return result;
+}
+
+static Result measureBlob(uint count, uint ticks, unsigned threads);
+static std::vector<Result> measureIdle(uint count, uint ticks, unsigned threads);
+static Result measureUnmatched(uint count, uint ticks, unsigned threads);
+
+static std::vector<Result> run(uint count, uint ticks, unsigned threads) {
+    std::vector<Result> results;
+    const double dt = 1.0 / 30.0;
+
+    srand(1);
+    engine::Simulation simulation(0.05f, threads);
+    for (uint u = 0; u < count; u++) {
+        auto entity = simulation.spawnUnit(randomCoordinate(), randomCoordinate());
+        entity.component<engine::Velocity>()->value = glm::vec3(randomCoordinate(), randomCoordinate(), 0.0f) * 0.2f;
+    }
+
+    auto& systems = simulation.systems;
+    auto nothing = [](uint) {};
+
+    auto movement = systems.system<engine::MovementSystem>();
+    for (auto& kernel : engine::kernels::available()) {
+        movement->setKernel(kernel);
+        results.push_back(measure(std::string("MovementSystem/") + kernel.name, count, ticks, nothing, [&]() {
+            systems.update<engine::MovementSystem>(dt);
+        }));
+    }
+    movement->setKernel(engine::kernels::best());
+
+    results.push_back(measure("SpriteOrientationSystem", count, ticks, nothing, [&]() {
+        systems.update<engine::SpriteOrientationSystem>(dt);
+    }));
+
+    // the camera on the middle tenth of the map; the rest is turned every few ticks
+    simulation.lod.setView(engine::ViewRect { glm::vec2(-0.3f), glm::vec2(0.3f) });
+    results.push_back(measure("SpriteOrientation/view", count, ticks, nothing, [&]() {
+        systems.update<engine::SpriteOrientationSystem>(dt);
+    }));
+    simulation.lod.clearView();
+
+    // a drag that sweeps across the map, updated every tick
+    simulation.startSelection(engine::Selection(0, -0.1f, -0.1f, 0.1f, 0.1f));
+    results.push_back(measure("SelectionSystem", count, ticks, [&](uint t) {
+        float offset = (float) (t % 20) / 20.0f - 0.5f;
+        simulation.changeSelection(engine::Selection(0, offset - 0.1f, -0.1f, offset + 0.1f, 0.1f));
+        simulation.applyCommands();
+    }, [&]() {
+        systems.update<engine::SelectionSystem>(dt);
+        simulation.scheduler.commands().flush();
+    }));
+    simulation.stopSelection(engine::Selection(0, 0, 0, 0, 0));
+    simulation.applyCommands();
+
+    // keep about 1% of the population's worth of orders arriving every tick
+    uint jobsPerTick = std::max(1u, count / 100);
+    results.push_back(measure("JobSystem", count, ticks, [&](uint) {
+        for (uint j = 0; j < jobsPerTick; j++) {
+            simulation.addTarget(glm::vec3(randomCoordinate(), randomCoordinate(), 0.0f));
+        }
+        simulation.applyCommands();
+    }, [&]() {
+        systems.update<engine::JobSystem>(dt);
+    }));
+
+    results.push_back(measure("AvoidanceSystem", count, ticks, nothing, [&]() {
+        systems.update<engine::AvoidanceSystem>(dt);
+    }));
+    results.push_back(measureUnmatched(count, ticks, threads));
+
+    results.push_back(measureBlob(count, ticks, threads));
+    for (auto& r : measureIdle(count, ticks, threads)) {
+        results.push_back(r);
+    }
+    return results;
+}
+
+// A backlog of urgent deliveries no unit can make, ahead of ordinary moves
+// that every unit can. The deliveries should cost nothing while they wait
+// and the moves should go out at the usual rate.
+static Result measureUnmatched(uint count, uint ticks, unsigned threads) {
+    const double dt = 1.0 / 30.0;
+
+    srand(5);
+    engine::Simulation simulation(0.05f, threads);
+    for (uint u = 0; u < count; u++) {
+        auto entity = simulation.spawnUnit(randomCoordinate(), randomCoordinate());
+        entity.component<engine::Worker>()->capabilities = engine::jobBit(engine::JobType::Goto);
+    }
+    auto jobs = simulation.systems.system<engine::JobSystem>();
+    for (uint j = 0; j < count; j++) {
+        glm::vec3 target(randomCoordinate(), randomCoordinate(), 0.0f);
+        jobs->queueJob(engine::Job(target, engine::JobType::DepositItem, 1));
+    }
+
+    // the moves share nine targets, so building flow fields does not drown out the matching
+    uint jobsPerTick = std::max(1u, count / 100);
+    return measure("JobSystem/unmatched", count, ticks, [&](uint) {
+        for (uint j = 0; j < jobsPerTick; j++) {
+            jobs->queueJob(engine::Job(glm::vec3((float) (j % 3) * 0.5f - 0.5f, (float) (j / 3 % 3) * 0.5f - 0.5f, 0.0f)));
+        }
+    }, [&]() {
+        simulation.systems.update<engine::JobSystem>(dt);
+    });
+}
+
+// Nine in ten units standing about with nothing to do, as in a settled
+// colony. They fall asleep on the warm-up tick and should cost nothing after.
+static std::vector<Result> measureIdle(uint count, uint ticks, unsigned threads) {
+    const double dt = 1.0 / 30.0;
+
+    srand(4);
+    engine::Simulation simulation(0.05f, threads);
+    for (uint u = 0; u < count; u++) {
+        auto entity = simulation.spawnUnit(randomCoordinate(), randomCoordinate());
+        if (u % 10 == 0) {
+            entity.component<engine::Velocity>()->value = glm::vec3(randomCoordinate(), randomCoordinate(), 0.0f) * 0.2f;
+        }
+    }
+
+    std::vector<Result> results;
+    results.push_back(measure("MovementSystem/90% idle", count, ticks, [](uint) {}, [&]() {
+        simulation.systems.update<engine::MovementSystem>(dt);
+    }));
+    results.push_back(measure("AvoidanceSystem/90% idle", count, ticks, [](uint) {}, [&]() {
+        simulation.systems.update<engine::AvoidanceSystem>(dt);
+    }));
+    return results;
+}
+
+// Avoidance in one dense blob converging on the origin, packed at the same
+// density whatever the count, so the per-entity cost should stay flat; the
+// scaling table at the end shows how flat it really is
+static Result measureBlob(uint count, uint ticks, unsigned threads) {
+    const double dt = 1.0 / 30.0;
+    float side = std::sqrt((float) count) * 0.01f;
+
+    srand(3);
+    engine::Simulation simulation(0.05f, threads);
+    for (uint u = 0; u < count; u++) {
+        glm::vec3 position(randomCoordinate() * side, randomCoordinate() * side, 0.0f);
+        auto entity = simulation.spawnUnit(position.x, position.y);
+        if (glm::length(position) > 0) {
+            entity.component<engine::Velocity>()->value = glm::normalize(-position) * 0.2f;
+        }
+    }
+
+    return measure("AvoidanceSystem/blob", count, ticks, [](uint) {}, [&]() {
+        simulation.systems.update<engine::AvoidanceSystem>(dt);
+    });
+}
+
+// Every movement kernel has to match the scalar one bit for bit
+static bool checkKernels() {
+    srand(2);
+    engine::MovementArrays reference;
+    reference.resize(1003);
+    for (size_t i = 0; i < reference.size(); i++) {
+        reference.px[i] = randomCoordinate() * 1.2f; reference.py[i] = randomCoordinate() * 1.2f; reference.pz[i] = 0;
+        reference.vx[i] = randomCoordinate() * 5; reference.vy[i] = randomCoordinate() * 5; reference.vz[i] = randomCoordinate();
+    }
+
+    auto kernels = engine::kernels::available();
+    std::vector<engine::MovementArrays> results(kernels.size(), reference);
+    for (int step = 0; step < 100; step++) {
+        for (size_t k = 0; k < kernels.size(); k++) {
+            kernels[k].kernel(results[k].lanes(), 0, results[k].size(), 1.0f / 30.0f);
+        }
+    }
+
+    bool ok = true;
+    for (size_t k = 1; k < kernels.size(); k++) {
+        auto& a = results[0];
+        auto& b = results[k];
+        size_t bytes = a.size() * sizeof(float);
+        bool same = memcmp(a.px.data(), b.px.data(), bytes) == 0 && memcmp(a.py.data(), b.py.data(), bytes) == 0
+            && memcmp(a.pz.data(), b.pz.data(), bytes) == 0 && memcmp(a.vx.data(), b.vx.data(), bytes) == 0
+            && memcmp(a.vy.data(), b.vy.data(), bytes) == 0 && memcmp(a.vz.data(), b.vz.data(), bytes) == 0;
+        if (!same) {
+            fprintf(stderr, "movement kernel '%s' does not match the scalar kernel\n", kernels[k].name);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// ns/entity of every system at each size, relative to the smallest size it ran at,
+// so a system whose per-entity cost stays flat reads 1.00 all the way across
+static void printScaling(const std::vector<uint>& sizes, const std::vector<Result>& results) {
+    std::vector<std::string> systems;
+    for (auto& r : results) {
+        if (std::find(systems.begin(), systems.end(), r.system) == systems.end()) systems.push_back(r.system);
+    }
+
+    printf("\nns/entity relative to %u entities\n%-24s", sizes.front(), "system");
+    for (uint count : sizes) printf(" %10u", count);
+    printf("\n");
+    for (auto& system : systems) {
+        printf("%-24s", system.c_str());
+        double base = 0;
+        for (uint count : sizes) {
+            auto found = std::find_if(results.begin(), results.end(), [&](const Result& r) {
+                return r.system == system && r.entities == count;
+            });
+            if (found == results.end() || found->nsPerEntity <= 0) {
+                printf(" %10s", "-");
+                continue;
+            }
+            if (base == 0) base = found->nsPerEntity;
+            printf(" %10.2f", found->nsPerEntity / base);
+        }
+        printf("\n");
+    }
+}
+
+static void writeJson(FILE* out, const std::vector<Result>& results) {
+    fprintf(out, "{\n  \"benchmark\": \"rts_engine\",\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        auto& r = results[i];
+        fprintf(out, "    {\"system\": \"%s\", \"entities\": %u, \"ticks\": %u, \"ns_per_tick\": %.1f, "
+                     "\"ns_per_entity\": %.3f, \"allocations_per_tick\": %.2f}%s\n",
+                r.system.c_str(), r.entities, r.ticks, r.nsPerTick, r.nsPerEntity, r.allocationsPerTick,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+    std::vector<uint> sizes = { 1000, 10000, 100000, 1000000 };
+    uint ticks = 50;
+    std::string jsonPath;
+    unsigned threads = engine::ThreadPool::defaultThreadCount();
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--sizes" && hasValue) {
+            sizes.clear();
+            std::string list = argv[++i];
+            size_t start = 0;
+            while (start < list.size()) {
+                size_t end = list.find(',', start);
+                if (end == std::string::npos) end = list.size();
+                sizes.push_back((uint) atoi(list.substr(start, end - start).c_str()));
+                start = end + 1;
+            }
+        } else if (arg == "--ticks" && hasValue) {
+            ticks = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--threads" && hasValue) {
+            threads = (unsigned) atoi(argv[++i]);
+        } else if (arg == "--json" && hasValue) {
+            jsonPath = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--sizes 1000,10000,...] [--ticks N] [--threads N] [--json FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (!checkKernels()) {
+        return 1;
+    }
+
+    std::vector<Result> results;
+    printf("%-24s %10s %14s %12s %12s\n", "system", "entities", "us/tick", "ns/entity", "allocs/tick");
+    for (uint count : sizes) {
+        for (auto& r : run(count, ticks, threads)) {
+            printf("%-24s %10u %14.1f %12.2f %12.1f\n", r.system.c_str(), r.entities, r.nsPerTick / 1000, r.nsPerEntity, r.allocationsPerTick);
+            results.push_back(r);
+        }
+    }
+    if (sizes.size() > 1) {
+        printScaling(sizes, results);
+    }
+
+    if (!jsonPath.empty()) {
+        FILE* out = jsonPath == "-" ? stdout : fopen(jsonPath.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "Unable to open '%s'\n", jsonPath.c_str());
+            return 1;
+        }
+        writeJson(out, results);
+        if (out != stdout) fclose(out);
+    }
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "image_decoder.h"
+
+// PNG decode throughput of the ImageDecoder the TextureManager loads with, at
+// increasing thread counts. No window or GL context is needed.
+//
+//   decode_bench [--repeat N] [--threads 0,1,2,4] [FILE...]
+//
+// Every file is decoded --repeat times per thread count; defaults to res/ant.png.
+// The calling thread decodes too while it waits, so 0 workers is the serial case.
+
+using Clock = std::chrono::steady_clock;
+
+static std::vector<unsigned> parseList(const std::string& list) {
+    std::vector<unsigned> values;
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        values.push_back((unsigned) atoi(list.substr(start, end - start).c_str()));
+        start = end + 1;
+    }
+    return values;
+}
+
+int main(int argc, char** argv) {
+    uint repeat = 50;
+    std::vector<unsigned> threadCounts = { 0, 1, 2, 4, engine::ThreadPool::defaultThreadCount() };
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--repeat" && hasValue) {
+            repeat = (uint) atoi(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            threadCounts = parseList(argv[++i]);
+        } else if (arg[0] != '-') {
+            files.push_back(arg);
+        } else {
+            fprintf(stderr, "usage: %s [--repeat N] [--threads 0,1,2,4] [FILE...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (files.empty()) {
+        files.push_back("res/ant.png");
+    }
+
+    for (auto& file : files) {
+        if (!engine::ImageDecoder::decodeNow(file).ok()) {
+            fprintf(stderr, "Unable to decode '%s'\n", file.c_str());
+            return 1;
+        }
+    }
+
+    printf("%-8s %10s %10s %12s %10s\n", "workers", "images", "ms", "images/s", "MB/s");
+    for (unsigned threads : threadCounts) {
+        engine::ThreadPool pool(threads);
+        engine::ImageDecoder decoder(pool);
+        std::vector<std::future<engine::DecodedImage>> decoding;
+        decoding.reserve(files.size() * repeat);
+
+        auto start = Clock::now();
+        for (uint r = 0; r < repeat; r++) {
+            for (auto& file : files) {
+                decoding.push_back(decoder.decode(file));
+            }
+        }
+        size_t bytes = 0;
+        for (auto& future : decoding) {
+            bytes += decoder.wait(future).bytes();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        printf("%-8u %10zu %10.1f %12.1f %10.1f\n", threads, decoding.size(), seconds * 1000,
+               decoding.size() / seconds, bytes / seconds / (1024 * 1024));
+    }
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "simulation.h"
+
+// Runs the foraging economy headless at increasing colony sizes and reports
+// what ForagingSystem costs per tick next to the whole tick, plus how often
+// foragers lose the race for an item they picked (conflicts per decision)
+// and how many flow fields the trips cost to build per tick.
+//
+//   forage_bench [--sizes 1000,10000,50000] [--ticks N] [--threads N]
+//
+// Every size gets the same density of sugar: one spawner per 50 ants, half an
+// item per ant on the map at the start, and four caches around the centre.
+
+static float randomCoordinate() {
+    return (float) rand() / RAND_MAX * 1.8f - 0.9f;
+}
+
+struct Result {
+    double tickUs, foragingUs, fieldsBuilt;
+    engine::ForagingStats stats;
+    size_t itemsOut, waiting;
+};
+
+static double foragingUs(const engine::SystemScheduler& scheduler) {
+    for (auto& timing : scheduler.timings()) {
+        if (timing.name == "ForagingSystem") return timing.endUs - timing.startUs;
+    }
+    return 0;
+}
+
+static Result run(uint count, uint ticks, unsigned threads) {
+    const double dt = 1.0 / 30.0;
+    engine::Simulation simulation(0.05f, threads);
+    auto foraging = simulation.systems.system<engine::ForagingSystem>();
+    foraging->getSettings().maxItems = count;
+
+    srand(1);
+    for (uint c = 0; c < 4; c++) {
+        float angle = c * 1.5707963f;
+        simulation.spawnItemCache(std::cos(angle) * 0.3f, std::sin(angle) * 0.3f);
+    }
+    for (uint s = 0; s < std::max(1u, count / 50); s++) {
+        simulation.spawnItemSpawner(randomCoordinate(), randomCoordinate());
+    }
+    for (uint i = 0; i < count / 2; i++) {
+        simulation.spawnItem(randomCoordinate(), randomCoordinate(), 5);
+    }
+    for (uint u = 0; u < count; u++) {
+        simulation.spawnForager(randomCoordinate(), randomCoordinate());
+    }
+
+    // let the first wave of decisions go out before measuring
+    for (uint t = 0; t < 30; t++) {
+        simulation.step(dt);
+    }
+    foraging->resetStats();
+    uint64_t builds = simulation.flowFields.builds();
+
+    Result result = Result();
+    for (uint t = 0; t < ticks; t++) {
+        auto start = std::chrono::steady_clock::now();
+        simulation.step(dt);
+        result.tickUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        result.foragingUs += foragingUs(simulation.scheduler);
+    }
+    result.tickUs /= ticks;
+    result.fieldsBuilt = (double) (simulation.flowFields.builds() - builds) / ticks;
+    result.foragingUs /= ticks;
+    result.stats = foraging->stats();
+    result.itemsOut = foraging->totalItems();
+    result.waiting = foraging->waitingForagers();
+    return result;
+}
+
+int main(int argc, char** argv) {
+    std::vector<uint> sizes = { 1000, 10000, 50000 };
+    uint ticks = 150;
+    unsigned threads = engine::ThreadPool::defaultThreadCount();
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--sizes" && hasValue) {
+            sizes.clear();
+            std::string list = argv[++i];
+            size_t start = 0;
+            while (start < list.size()) {
+                size_t end = list.find(',', start);
+                if (end == std::string::npos) end = list.size();
+                sizes.push_back((uint) atoi(list.substr(start, end - start).c_str()));
+                start = end + 1;
+            }
+        } else if (arg == "--ticks" && hasValue) {
+            ticks = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--threads" && hasValue) {
+            threads = (unsigned) std::max(0, atoi(argv[++i]));
+        } else {
+            fprintf(stderr, "usage: %s [--sizes 1000,10000,...] [--ticks N] [--threads N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("%8s %10s %12s %12s %11s %10s %10s %10s %9s %8s %9s\n", "ants", "tick us", "forage us", "ns/ant",
+           "decided/t", "conflict%", "pickups", "deposits", "items", "waiting", "fields/t");
+    for (uint count : sizes) {
+        Result r = run(count, ticks, threads);
+        double decisions = (double) r.stats.decisions;
+        printf("%8u %10.1f %12.1f %12.2f %11.1f %9.2f%% %10llu %10llu %9zu %8zu %9.1f\n", count, r.tickUs, r.foragingUs,
+               r.foragingUs * 1000 / count, decisions / ticks,
+               decisions > 0 ? r.stats.conflicts * 100.0 / decisions : 0.0,
+               (unsigned long long) r.stats.pickups, (unsigned long long) r.stats.deposits, r.itemsOut, r.waiting,
+               r.fieldsBuilt);
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "simulation.h"
+
+// Compares the old full-scan box selection, which assigned and removed
+// Selection components, against SelectionSystem::select (a SpatialGrid query
+// applied to a SelectionSet) at increasing population sizes.
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchWorld : public entityx::EntityX {
+    BenchWorld(uint count, float cellSize) : grid(cellSize) {
+        systems.add<engine::SpatialIndexSystem>(grid);
+        systems.configure();
+
+        srand(1);
+        for (uint u = 0; u < count; u++) {
+            entityx::Entity entity = entities.create();
+            entity.assign<engine::Position>((float) rand() / RAND_MAX * 2 - 1, (float) rand() / RAND_MAX * 2 - 1, 0.0f);
+            entity.assign<engine::Worker>();
+        }
+    }
+
+    engine::SpatialGrid grid;
+};
+
+// What SelectionSystem::update did before the grid existed
+static void fullScanSelect(entityx::EntityManager& entities, const engine::Selection& selection) {
+    entities.each<engine::Position>([&selection](entityx::Entity entity, engine::Position& position) {
+        auto pos = position.value;
+        bool isSelected = false;
+
+        if (pos.x > selection.minX && pos.y > selection.minY && pos.x < selection.maxX && pos.y < selection.maxY) {
+            if (!entity.has_component<engine::Selection>()) {
+                entity.assign_from_copy<engine::Selection>(selection);
+            }
+            isSelected = true;
+        }
+
+        if (!isSelected && entity.has_component<engine::Selection>()) {
+            entity.remove<engine::Selection>();
+        }
+    });
+}
+
+static uint countSelected(entityx::EntityManager& entities) {
+    uint count = 0;
+    entities.each<engine::Selection>([&count](entityx::Entity, engine::Selection&) { count++; });
+    return count;
+}
+
+// A drag that grows from the centre outwards, one step per frame
+static engine::Selection dragBox(int frame, int frames, float size) {
+    float half = size * 0.5f * (frame + 1) / frames;
+    return engine::Selection(0, -half, -half, half, half);
+}
+
+int main(int argc, char** argv) {
+    const int frames = 60;
+    const float boxSize = 0.2f;
+    uint counts[] = { 10000, 100000, 1000000 };
+
+    printf("%10s %14s %14s %10s %10s\n", "entities", "scan us/frame", "grid us/frame", "speedup", "selected");
+    for (uint count : counts) {
+        BenchWorld scanWorld(count, 0.05f);
+        auto start = Clock::now();
+        for (int frame = 0; frame < frames; frame++) {
+            fullScanSelect(scanWorld.entities, dragBox(frame, frames, boxSize));
+        }
+        double scanUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / frames;
+        uint scanSelected = countSelected(scanWorld.entities);
+
+        BenchWorld gridWorld(count, 0.05f);
+        engine::SelectionSystem selection(gridWorld.grid);
+        start = Clock::now();
+        for (int frame = 0; frame < frames; frame++) {
+            selection.select(gridWorld.entities, dragBox(frame, frames, boxSize));
+        }
+        double gridUs = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / frames;
+        uint gridSelected = (uint) selection.selected().size();
+
+        if (scanSelected != gridSelected) {
+            fprintf(stderr, "selection mismatch at %u entities: scan %u, grid %u\n", count, scanSelected, gridSelected);
+            return 1;
+        }
+
+        printf("%10u %14.1f %14.1f %9.1fx %10u\n", count, scanUs, gridUs, scanUs / gridUs, gridSelected);
+    }
+
+    return 0;
+}
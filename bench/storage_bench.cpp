@@ -0,0 +1,240 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "simulation.h"
+
+// MovementSystem and SpriteOrientationSystem on UnitChunks, against the
+// same work done straight on entityx's pools: the awake set looked up
+// component by component, as both systems did before they had chunks.
+//
+//   storage_bench [--sizes 10000,100000,...] [--ticks N] [--threads N]
+//
+// The entityx side runs on a second Simulation with the same units and the
+// same ticks, and at the end every unit's position, velocity and rotation
+// and the awake set have to match bit for bit, so it cannot drift from what
+// the systems do. One unit in ten stands still and falls asleep after the
+// first tick. Threads default to none, so only the storage differs.
+
+using Clock = std::chrono::steady_clock;
+
+static float randomCoordinate() {
+    return (float) rand() / RAND_MAX * 2 - 1;
+}
+
+static double timeNs(uint ticks, std::function<void()> tick) {
+    // one untimed warm-up tick so first-touch costs are not counted
+    tick();
+    auto start = Clock::now();
+    for (uint t = 0; t < ticks; t++) {
+        tick();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ticks;
+}
+
+static void bounce(float& position, float& velocity) {
+    if (position > 1) {
+        position = 1;
+        velocity *= -1;
+    } else if (position < -1) {
+        position = -1;
+        velocity *= -1;
+    }
+}
+
+// MovementSystem's work through entityx
+class PoolMovement {
+public:
+    explicit PoolMovement(engine::Simulation& simulation) : simulation(simulation) {}
+
+    void update(float dt) {
+        auto& es = simulation.entities;
+        moving.clear();
+        for (auto id : simulation.lod.awakeUnits()) {
+            entityx::Entity entity = es.get(id);
+            auto position = entity.component<engine::Position>();
+            auto velocity = entity.component<engine::Velocity>();
+            if (!position || !velocity) continue;
+            moving.push_back(Moving { id, position.get(), velocity.get() });
+        }
+
+        simulation.pool.parallelFor(moving.size(), engine::ThreadPool::cacheChunk(sizeof(Moving)), [this, dt](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                glm::vec3& position = moving[i].position->value;
+                glm::vec3& velocity = moving[i].velocity->value;
+                moving[i].position->previous = position;
+                position += velocity * dt;
+                bounce(position.x, velocity.x);
+                bounce(position.y, velocity.y);
+            }
+        });
+
+        for (auto& unit : moving) {
+            glm::vec3& position = unit.position->value;
+            simulation.grid.update(unit.id, glm::vec2(position.x, position.y));
+            if (unit.velocity->value == glm::vec3(0.0f) && !es.get(unit.id).has_component<engine::Job>()) {
+                simulation.lod.sleep(unit.id);
+            }
+        }
+    }
+
+private:
+    struct Moving {
+        entityx::Entity::Id id;
+        engine::Position* position;
+        engine::Velocity* velocity;
+    };
+
+    engine::Simulation& simulation;
+    std::vector<Moving> moving;
+};
+
+// SpriteOrientationSystem's work through entityx
+class PoolOrientation {
+public:
+    explicit PoolOrientation(engine::Simulation& simulation) : simulation(simulation) {}
+
+    void update() {
+        auto& lod = simulation.lod;
+        oriented.clear();
+        for (auto id : lod.awakeUnits()) {
+            entityx::Entity entity = simulation.entities.get(id);
+            auto sprite = entity.component<engine::Sprite>();
+            auto position = entity.component<engine::Position>();
+            auto velocity = entity.component<engine::Velocity>();
+            if (!sprite || !position || !velocity) continue;
+            if (!lod.due(lod.bucket(id, glm::vec2(position->value.x, position->value.y)), id, tick)) continue;
+            oriented.push_back(std::make_pair(sprite.get(), velocity.get()));
+        }
+        tick++;
+
+        simulation.pool.parallelFor(oriented.size(), engine::ThreadPool::cacheChunk(sizeof(engine::Sprite) + sizeof(engine::Velocity)),
+                                    [this](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const glm::vec3& velocity = oriented[i].second->value;
+                if (velocity.x != 0) {
+                    oriented[i].first->rotation = (float) (atan(velocity.y / velocity.x) - M_PI_2);
+                }
+            }
+        });
+    }
+
+private:
+    engine::Simulation& simulation;
+    std::vector<std::pair<engine::Sprite*, engine::Velocity*>> oriented;
+    uint64_t tick = 0;
+};
+
+static void populate(engine::Simulation& simulation, uint count) {
+    srand(1);
+    for (uint u = 0; u < count; u++) {
+        auto entity = simulation.spawnUnit(randomCoordinate(), randomCoordinate());
+        glm::vec3 velocity = glm::vec3(randomCoordinate(), randomCoordinate(), 0.0f) * 0.2f;
+        entity.component<engine::Velocity>()->value = u % 10 == 0 ? glm::vec3(0.0f) : velocity;
+    }
+}
+
+// Both simulations spawned the same units in the same order, so their entity ids line up
+static bool same(engine::Simulation& chunks, engine::Simulation& pools) {
+    bool matched = true;
+    size_t units = 0;
+    chunks.entities.each<engine::Position, engine::Velocity, engine::Sprite>(
+        [&](entityx::Entity entity, engine::Position& position, engine::Velocity& velocity, engine::Sprite& sprite) {
+            entityx::Entity other = pools.entities.get(entity.id());
+            auto p = other.component<engine::Position>();
+            auto v = other.component<engine::Velocity>();
+            auto s = other.component<engine::Sprite>();
+            units++;
+            if (memcmp(&position.value, &p->value, sizeof(glm::vec3)) != 0 ||
+                memcmp(&position.previous, &p->previous, sizeof(glm::vec3)) != 0 ||
+                memcmp(&velocity.value, &v->value, sizeof(glm::vec3)) != 0 ||
+                memcmp(&sprite.rotation, &s->rotation, sizeof(float)) != 0 ||
+                chunks.lod.isAwake(entity.id()) != pools.lod.isAwake(entity.id())) {
+                matched = false;
+            }
+        });
+    return matched && units > 0 && chunks.lod.awakeUnits().size() == pools.lod.awakeUnits().size();
+}
+
+struct Row {
+    const char* system;
+    double entityxNs, chunkNs;
+};
+
+static std::vector<Row> run(uint count, uint ticks, unsigned threads, bool& matched) {
+    const double dt = 1.0 / 30.0;
+    engine::Simulation chunks(0.05f, threads), pools(0.05f, threads);
+    populate(chunks, count);
+    populate(pools, count);
+    PoolMovement poolMovement(pools);
+    PoolOrientation poolOrientation(pools);
+    auto& systems = chunks.systems;
+
+    std::vector<Row> rows;
+    rows.push_back(Row { "MovementSystem",
+        timeNs(ticks, [&]() { poolMovement.update((float) dt); }),
+        timeNs(ticks, [&]() { systems.update<engine::MovementSystem>(dt); }) });
+
+    rows.push_back(Row { "SpriteOrientationSystem",
+        timeNs(ticks, [&]() { poolOrientation.update(); }),
+        timeNs(ticks, [&]() { systems.update<engine::SpriteOrientationSystem>(dt); }) });
+
+    // the camera on the middle tenth of the map; the rest is turned every few ticks
+    engine::ViewRect view { glm::vec2(-0.3f), glm::vec2(0.3f) };
+    chunks.lod.setView(view);
+    pools.lod.setView(view);
+    rows.push_back(Row { "SpriteOrientation/view",
+        timeNs(ticks, [&]() { poolOrientation.update(); }),
+        timeNs(ticks, [&]() { systems.update<engine::SpriteOrientationSystem>(dt); }) });
+
+    if (!same(chunks, pools)) {
+        fprintf(stderr, "chunks and entityx disagree at %u units\n", count);
+        matched = false;
+    }
+    return rows;
+}
+
+int main(int argc, char** argv) {
+    std::vector<uint> sizes = { 10000, 100000, 1000000 };
+    uint ticks = 20;
+    unsigned threads = 0;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--sizes" && hasValue) {
+            sizes.clear();
+            std::string list = argv[++i];
+            size_t start = 0;
+            while (start < list.size()) {
+                size_t end = list.find(',', start);
+                if (end == std::string::npos) end = list.size();
+                sizes.push_back((uint) atoi(list.substr(start, end - start).c_str()));
+                start = end + 1;
+            }
+        } else if (arg == "--ticks" && hasValue) {
+            ticks = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--threads" && hasValue) {
+            threads = (unsigned) atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--sizes 10000,100000,...] [--ticks N] [--threads N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bool matched = true;
+    printf("movement kernel: %s\n", engine::kernels::best().name);
+    printf("%-24s %10s %16s %16s %9s\n", "system", "units", "entityx ns/unit", "chunks ns/unit", "speedup");
+    for (uint count : sizes) {
+        for (auto& row : run(count, ticks, threads, matched)) {
+            printf("%-24s %10u %16.2f %16.2f %8.2fx\n", row.system, count,
+                   row.entityxNs / count, row.chunkNs / count, row.entityxNs / row.chunkNs);
+        }
+    }
+    return matched ? 0 : 1;
+}
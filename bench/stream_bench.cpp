@@ -0,0 +1,255 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include "batch.h"
+#include "stream_buffer.h"
+#include "thread_pool.h"
+
+// Streams frames of sprite instances through StreamBuffer, in every mode the
+// context supports, and checks that each frame reaches the GPU intact.
+//
+//   stream_bench [--instances N] [--frames N] [--regions N] [--threads N]
+//
+// Correctness: frame f is written by the thread pool straight into mapped
+// memory, then copied on the GPU into slot f of a check buffer before the
+// frame is fenced. The CPU carries on with later frames. If a region were
+// handed out again before the GPU had finished copying it, a slot would end
+// up holding a later frame's data. Timing: the same instances go through
+// SpriteBatchBuilder::write into mapped memory, against the old path of
+// orphaning and glBufferSubData from a vector.
+//
+// Needs only a GL 3.3 context, so it runs on Mesa's llvmpipe without a GPU:
+//
+//   LIBGL_ALWAYS_SOFTWARE=1 stream_bench
+
+using Clock = std::chrono::steady_clock;
+
+static engine::SpriteInstance pattern(uint frame, uint i) {
+    return engine::SpriteInstance(glm::vec3((float) frame, (float) i, 1.0f), (float) (frame ^ i), 0.5f,
+                                  glm::vec3(0.25f), glm::vec4((float) frame, 0.0f, 1.0f, 1.0f));
+}
+
+static bool same(const engine::SpriteInstance& a, const engine::SpriteInstance& b) {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+static bool checkMode(bool persistent, uint instances, uint frames, uint regions, engine::ThreadPool& pool,
+                      engine::StreamBufferStats& stats) {
+    const size_t frameBytes = sizeof(engine::SpriteInstance) * instances;
+    engine::StreamBuffer stream;
+    // start small so the first frame also exercises growing the regions
+    stream.init(GL_ARRAY_BUFFER, frameBytes / 2, regions, persistent);
+
+    uint check = 0;
+    glGenBuffers(1, &check);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, check);
+    glBufferData(GL_COPY_WRITE_BUFFER, frameBytes * frames, nullptr, GL_STATIC_READ);
+
+    for (uint f = 0; f < frames; f++) {
+        auto region = static_cast<engine::SpriteInstance*>(stream.map(frameBytes));
+        if (!region) {
+            fprintf(stderr, "map failed on frame %u\n", f);
+            return false;
+        }
+        pool.parallelFor(instances, 1024, [region, f](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) region[i] = pattern(f, (uint) i);
+        });
+        if (!stream.unmap()) {
+            fprintf(stderr, "frame %u lost on unmap\n", f);
+            return false;
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, stream.buffer());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, check);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, stream.offset(), frameBytes * f, frameBytes);
+        stream.fence();
+    }
+    // the copies bound buffers behind GLState's back
+    engine::GLState::instance().invalidate();
+
+    std::vector<engine::SpriteInstance> readBack(instances * (size_t) frames);
+    glBindBuffer(GL_COPY_READ_BUFFER, check);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, frameBytes * frames, readBack.data());
+    glDeleteBuffers(1, &check);
+
+    bool ok = true;
+    for (uint f = 0; f < frames && ok; f++) {
+        for (uint i = 0; i < instances; i++) {
+            if (!same(readBack[f * (size_t) instances + i], pattern(f, i))) {
+                fprintf(stderr, "%s: frame %u instance %u does not match what was written\n",
+                        persistent ? "persistent" : "orphan", f, i);
+                ok = false;
+                break;
+            }
+        }
+    }
+    stats = stream.stats();
+    stream.cleanup();
+    return ok;
+}
+
+struct Row {
+    const char* path;
+    double usPerFrame;
+    engine::StreamBufferStats stats;
+};
+
+static engine::SpriteBatchBuilder makeBatches(uint instances) {
+    engine::SpriteBatchBuilder batches;
+    batches.begin();
+    for (uint i = 0; i < instances; i++) {
+        batches.add(i % 4, pattern(0, i));
+    }
+    batches.end();
+    return batches;
+}
+
+// Per frame: the instances are written, then read by a GPU copy as a draw would
+static Row timeStream(bool persistent, const engine::SpriteBatchBuilder& batches, uint frames, uint regions,
+                      engine::ThreadPool& pool) {
+    const size_t frameBytes = sizeof(engine::SpriteInstance) * batches.size();
+    engine::StreamBuffer stream;
+    stream.init(GL_ARRAY_BUFFER, frameBytes, regions, persistent);
+    uint sink = 0;
+    glGenBuffers(1, &sink);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, sink);
+    glBufferData(GL_COPY_WRITE_BUFFER, frameBytes, nullptr, GL_STREAM_COPY);
+
+    auto start = Clock::now();
+    for (uint f = 0; f < frames; f++) {
+        auto region = static_cast<engine::SpriteInstance*>(stream.map(frameBytes));
+        pool.parallelFor(batches.size(), 4096, [&batches, region](size_t begin, size_t end) {
+            batches.write(region, begin, end);
+        });
+        stream.unmap();
+        glBindBuffer(GL_COPY_READ_BUFFER, stream.buffer());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, sink);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, stream.offset(), 0, frameBytes);
+        stream.fence();
+    }
+    glFinish();
+    double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / frames;
+    engine::GLState::instance().invalidate();
+
+    Row row { persistent && stream.mode() == engine::StreamBuffer::PERSISTENT ? "persistent map" : "orphan + map",
+              us, stream.stats() };
+    glDeleteBuffers(1, &sink);
+    stream.cleanup();
+    return row;
+}
+
+// What EntityRenderer did before: gather into a vector, orphan, glBufferSubData
+static Row timeSubData(const engine::SpriteBatchBuilder& batches, uint frames) {
+    const size_t frameBytes = sizeof(engine::SpriteInstance) * batches.size();
+    std::vector<engine::SpriteInstance> instances(batches.size());
+    uint buffer = 0, sink = 0;
+    glGenBuffers(1, &buffer);
+    glGenBuffers(1, &sink);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, sink);
+    glBufferData(GL_COPY_WRITE_BUFFER, frameBytes, nullptr, GL_STREAM_COPY);
+
+    auto start = Clock::now();
+    for (uint f = 0; f < frames; f++) {
+        batches.write(instances.data());
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glBufferData(GL_COPY_READ_BUFFER, frameBytes, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_COPY_READ_BUFFER, 0, frameBytes, instances.data());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, sink);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, frameBytes);
+    }
+    glFinish();
+    double us = std::chrono::duration<double, std::micro>(Clock::now() - start).count() / frames;
+
+    glDeleteBuffers(1, &buffer);
+    glDeleteBuffers(1, &sink);
+    return Row { "glBufferSubData", us, engine::StreamBufferStats() };
+}
+
+int main(int argc, char** argv) {
+    uint instances = 100000;
+    uint frames = 200;
+    uint regions = engine::StreamBuffer::DEFAULT_REGIONS;
+    unsigned threads = engine::ThreadPool::defaultThreadCount();
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--instances" && hasValue) {
+            instances = (uint) std::max(1, atoi(argv[++i]));
+        } else if (arg == "--frames" && hasValue) {
+            frames = (uint) std::max(1, atoi(argv[++i]));
+        } else if (arg == "--regions" && hasValue) {
+            regions = (uint) std::max(1, atoi(argv[++i]));
+        } else if (arg == "--threads" && hasValue) {
+            threads = (unsigned) std::max(0, atoi(argv[++i]));
+        } else {
+            fprintf(stderr, "usage: %s [--instances N] [--frames N] [--regions N] [--threads N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (!glfwInit()) {
+        fprintf(stderr, "Unable to initialize GLFW\n");
+        return 1;
+    }
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(64, 64, "stream_bench", nullptr, nullptr);
+    if (!window) {
+        fprintf(stderr, "Unable to create a GL 3.3 context\n");
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(window);
+    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+        fprintf(stderr, "Unable to initialize GLAD\n");
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return 1;
+    }
+
+    engine::ThreadPool pool(threads);
+    bool persistent = engine::StreamBuffer::persistentSupported();
+    printf("%s, persistent mapping %s\n", (const char*) glGetString(GL_RENDERER), persistent ? "supported" : "not supported");
+
+    // the check buffer holds every frame, so the correctness pass stays small
+    uint checkInstances = std::min(instances, 4096u);
+    uint checkFrames = std::min(frames, 64u);
+    bool ok = true;
+    for (bool mode : { true, false }) {
+        if (mode && !persistent) continue;
+        engine::StreamBufferStats stats;
+        bool passed = checkMode(mode, checkInstances, checkFrames, regions, pool, stats);
+        printf("check %-10s %s: %llu frames, %llu fence waits, %llu reallocations\n", mode ? "persistent" : "orphan",
+               passed ? "ok" : "FAILED", (unsigned long long) stats.frames, (unsigned long long) stats.waits,
+               (unsigned long long) stats.reallocations);
+        ok = ok && passed;
+    }
+
+    engine::SpriteBatchBuilder batches = makeBatches(instances);
+    std::vector<Row> rows;
+    rows.push_back(timeSubData(batches, frames));
+    rows.push_back(timeStream(false, batches, frames, regions, pool));
+    if (persistent) {
+        rows.push_back(timeStream(true, batches, frames, regions, pool));
+    }
+
+    printf("\n%-16s %10s %12s %12s %12s\n", "path", "instances", "us/frame", "fence waits", "wait us");
+    for (auto& row : rows) {
+        printf("%-16s %10u %12.1f %12llu %12.1f\n", row.path, instances, row.usPerFrame,
+               (unsigned long long) row.stats.waits, row.stats.waitUs);
+    }
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,401 @@
+#ifndef RTS_ARCHETYPE_H
+#define RTS_ARCHETYPE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace engine {
+
+    const size_t MAX_CHUNK_COMPONENTS = 64;
+    const size_t CHUNK_BYTES = 16 * 1024;
+    const size_t CHUNK_ALIGNMENT = 64;
+
+    inline size_t nextComponentId() {
+        static std::atomic<size_t> next(0);
+        return next++;
+    }
+
+    // A small dense id per component type, shared by every ArchetypeStorage
+    template <typename C>
+    size_t componentId() {
+        static const size_t id = nextComponentId();
+        assert(id < MAX_CHUNK_COMPONENTS);
+        return id;
+    }
+
+    // Generational handle: the index is recycled once the entity is
+    // destroyed, the generation is not, so a stale handle never resolves
+    struct EntityHandle {
+        uint32_t index = 0xffffffffu;
+        uint32_t generation = 0;
+
+        bool operator==(const EntityHandle& other) const { return index == other.index && generation == other.generation; }
+        bool operator!=(const EntityHandle& other) const { return !(*this == other); }
+    };
+
+    // Every entity with exactly one set of components. Its entities are
+    // packed into CHUNK_BYTES blocks, each holding one 64-byte aligned array
+    // per component plus the handles, so a view walks each array linearly
+    // without looking at masks. Entity n of the archetype is always row
+    // n % capacity of chunk n / capacity; removal moves the last entity into
+    // the hole.
+    class Archetype {
+    public:
+        Archetype(uint64_t mask, const std::vector<size_t>& sizes) : _mask(mask) {
+            memset(_column, -1, sizeof(_column));
+            size_t rowBytes = sizeof(EntityHandle);
+            for (size_t id = 0; id < MAX_CHUNK_COMPONENTS; id++) {
+                if (mask & (1ull << id)) {
+                    _column[id] = (int8_t) _columns.size();
+                    _columns.push_back(Column { id, sizes[id], 0 });
+                    rowBytes += sizes[id];
+                }
+            }
+
+            // leave room for rounding every array up to the alignment
+            size_t usable = CHUNK_BYTES - CHUNK_ALIGNMENT * (_columns.size() + 1);
+            _capacity = std::max<size_t>(1, usable / rowBytes);
+
+            size_t offset = align(sizeof(EntityHandle) * _capacity);
+            for (auto& column : _columns) {
+                column.offset = offset;
+                offset += align(column.size * _capacity);
+            }
+            _chunkBytes = std::max(CHUNK_BYTES, offset);
+        }
+
+        ~Archetype() {
+            for (auto chunk : _chunks) {
+                free(chunk.original);
+            }
+        }
+
+        Archetype(const Archetype&) = delete;
+        Archetype& operator=(const Archetype&) = delete;
+
+        uint64_t mask() const { return _mask; }
+        size_t size() const { return _size; }
+        size_t capacity() const { return _capacity; }
+        size_t chunkCount() const { return (_size + _capacity - 1) / _capacity; }
+
+        // Entities in use in chunk c
+        size_t chunkSize(size_t c) const {
+            return std::min(_capacity, _size - c * _capacity);
+        }
+
+        EntityHandle* handles(size_t c) const {
+            return reinterpret_cast<EntityHandle*>(_chunks[c].data);
+        }
+
+        // The array for component id in chunk c, nullptr if this archetype does not have it
+        void* column(size_t id, size_t c) const {
+            int column = _column[id];
+            if (column < 0) return nullptr;
+            return _chunks[c].data + _columns[column].offset;
+        }
+
+        void* component(size_t id, uint32_t row) const {
+            int column = _column[id];
+            if (column < 0) return nullptr;
+            return _chunks[row / _capacity].data + _columns[column].offset + _columns[column].size * (row % _capacity);
+        }
+
+        // Appends an entity with uninitialised components and returns its row
+        uint32_t push(EntityHandle handle) {
+            if (_size == _chunks.size() * _capacity) {
+                void* original = malloc(_chunkBytes + CHUNK_ALIGNMENT);
+                if (!original) throw std::bad_alloc();
+                uintptr_t aligned = ((uintptr_t) original + CHUNK_ALIGNMENT - 1) & ~(uintptr_t) (CHUNK_ALIGNMENT - 1);
+                _chunks.push_back(Chunk { reinterpret_cast<unsigned char*>(aligned), original });
+            }
+            uint32_t row = (uint32_t) _size++;
+            handles(row / _capacity)[row % _capacity] = handle;
+            return row;
+        }
+
+        // Moves the last entity into row and returns its handle, or an invalid
+        // handle if row was the last one
+        EntityHandle erase(uint32_t row) {
+            uint32_t last = (uint32_t) _size - 1;
+            EntityHandle moved;
+            if (row != last) {
+                for (auto& column : _columns) {
+                    memcpy(component(column.id, row), component(column.id, last), column.size);
+                }
+                moved = handles(last / _capacity)[last % _capacity];
+                handles(row / _capacity)[row % _capacity] = moved;
+            }
+            _size--;
+            return moved;
+        }
+
+        // Copies the components both archetypes share from row here to row in other
+        void copyShared(uint32_t row, Archetype& other, uint32_t otherRow) const {
+            for (auto& column : _columns) {
+                void* target = other.component(column.id, otherRow);
+                if (target) {
+                    memcpy(target, component(column.id, row), column.size);
+                }
+            }
+        }
+
+        // Archetype reached by adding (or removing) one component, cached per id
+        Archetype* added[MAX_CHUNK_COMPONENTS] = {};
+        Archetype* removed[MAX_CHUNK_COMPONENTS] = {};
+
+    private:
+        struct Column {
+            size_t id;
+            size_t size;
+            size_t offset;
+        };
+
+        struct Chunk {
+            unsigned char* data;
+            void* original;
+        };
+
+        static size_t align(size_t bytes) {
+            return (bytes + CHUNK_ALIGNMENT - 1) / CHUNK_ALIGNMENT * CHUNK_ALIGNMENT;
+        }
+
+        uint64_t _mask;
+        int8_t _column[MAX_CHUNK_COMPONENTS];
+        std::vector<Column> _columns;
+        std::vector<Chunk> _chunks;
+        size_t _capacity;
+        size_t _chunkBytes;
+        size_t _size = 0;
+    };
+
+    // One chunk out of a view: its entities and each component's array in it.
+    // Chunks are independent, so a view's chunks can be split over a ThreadPool.
+    struct ChunkRef {
+        const Archetype* archetype;
+        size_t index;
+
+        size_t size() const { return archetype->chunkSize(index); }
+        const EntityHandle* handles() const { return archetype->handles(index); }
+
+        // Only for components the view asked for, which every one of its chunks has
+        template <typename C>
+        C* array() const {
+            return static_cast<C*>(archetype->column(componentId<C>(), index));
+        }
+    };
+
+    // Component storage grouped by archetype, as an alternative to entityx's
+    // one pool per component type, for data that systems stream over every
+    // tick (see UnitChunks). Adding or removing a component moves the
+    // entity to the archetype for its new set (a copy of its components, O(1)
+    // in the population); destroy() is a swap-back. Components must be plain
+    // data: they are moved with memcpy and never destroyed.
+    //
+    // Pointers returned by get() are only good until the next structural
+    // change, since any of those may move entities between rows.
+    class ArchetypeStorage {
+    public:
+        ArchetypeStorage() : _sizes(MAX_CHUNK_COMPONENTS, 0) {
+            _empty = archetype(0);
+        }
+
+        EntityHandle create() {
+            uint32_t index;
+            if (!_free.empty()) {
+                index = _free.back();
+                _free.pop_back();
+            } else {
+                index = (uint32_t) _records.size();
+                _records.push_back(Record());
+            }
+            Record& record = _records[index];
+            EntityHandle handle;
+            handle.index = index;
+            handle.generation = record.generation;
+            record.archetype = _empty;
+            record.row = _empty->push(handle);
+            _alive++;
+            return handle;
+        }
+
+        void destroy(EntityHandle handle) {
+            if (!valid(handle)) return;
+            Record& record = _records[handle.index];
+            detach(record);
+            record.archetype = nullptr;
+            record.generation++;
+            _free.push_back(handle.index);
+            _alive--;
+        }
+
+        bool valid(EntityHandle handle) const {
+            return handle.index < _records.size() && _records[handle.index].archetype &&
+                   _records[handle.index].generation == handle.generation;
+        }
+
+        // Replaces the component if the entity already has one
+        template <typename C, typename... Args>
+        C* assign(EntityHandle handle, Args&&... args) {
+            // not is_trivially_copyable: older glm vectors declare a copy
+            // constructor, though copying their bytes is just as good
+            static_assert(std::is_trivially_destructible<C>::value, "chunk components must be plain data");
+            if (!valid(handle)) return nullptr;
+            size_t id = registered<C>();
+            Record& record = _records[handle.index];
+            if (!(record.archetype->mask() & bit(id))) {
+                Archetype* from = record.archetype;
+                Archetype* to = from->added[id];
+                if (!to) {
+                    to = from->added[id] = archetype(from->mask() | bit(id));
+                }
+                move(handle, record, to);
+            }
+            return new (record.archetype->component(id, record.row)) C(std::forward<Args>(args)...);
+        }
+
+        template <typename C>
+        void remove(EntityHandle handle) {
+            if (!valid(handle)) return;
+            size_t id = registered<C>();
+            Record& record = _records[handle.index];
+            Archetype* from = record.archetype;
+            if (!(from->mask() & bit(id))) return;
+            Archetype* to = from->removed[id];
+            if (!to) {
+                to = from->removed[id] = archetype(from->mask() & ~bit(id));
+            }
+            move(handle, record, to);
+        }
+
+        template <typename C>
+        C* get(EntityHandle handle) const {
+            if (!valid(handle)) return nullptr;
+            const Record& record = _records[handle.index];
+            return static_cast<C*>(record.archetype->component(componentId<C>(), record.row));
+        }
+
+        template <typename C>
+        bool has(EntityHandle handle) const {
+            return valid(handle) && (_records[handle.index].archetype->mask() & bit(componentId<C>())) != 0;
+        }
+
+        // Calls f(count, handles, C1*, C2*, ...) once per chunk holding every
+        // one of Cs, with each pointer the start of that component's array
+        template <typename... Cs, typename F>
+        void eachChunk(F f) const {
+            uint64_t required = maskOf<Cs...>();
+            for (auto& archetype : _archetypes) {
+                if ((archetype->mask() & required) != required || archetype->size() == 0) continue;
+                for (size_t c = 0; c < archetype->chunkCount(); c++) {
+                    f(archetype->chunkSize(c), archetype->handles(c),
+                      static_cast<Cs*>(archetype->column(componentId<Cs>(), c))...);
+                }
+            }
+        }
+
+        // Every chunk holding every one of Cs, in the order eachChunk() visits them
+        template <typename... Cs>
+        void chunks(std::vector<ChunkRef>& out) const {
+            out.clear();
+            uint64_t required = maskOf<Cs...>();
+            for (auto& archetype : _archetypes) {
+                if ((archetype->mask() & required) != required) continue;
+                for (size_t c = 0; c < archetype->chunkCount(); c++) {
+                    out.push_back(ChunkRef { archetype.get(), c });
+                }
+            }
+        }
+
+        // How many entities hold every one of Cs
+        template <typename... Cs>
+        size_t count() const {
+            uint64_t required = maskOf<Cs...>();
+            size_t total = 0;
+            for (auto& archetype : _archetypes) {
+                if ((archetype->mask() & required) == required) total += archetype->size();
+            }
+            return total;
+        }
+
+        // Calls f(handle, C1&, C2&, ...) for every entity holding every one of Cs
+        template <typename... Cs, typename F>
+        void each(F f) const {
+            eachChunk<Cs...>([&f](size_t count, const EntityHandle* handles, Cs*... arrays) {
+                for (size_t i = 0; i < count; i++) {
+                    f(handles[i], arrays[i]...);
+                }
+            });
+        }
+
+        size_t size() const { return _alive; }
+        size_t archetypeCount() const { return _archetypes.size(); }
+
+    private:
+        struct Record {
+            Archetype* archetype = nullptr;
+            uint32_t row = 0;
+            uint32_t generation = 0;
+        };
+
+        static uint64_t bit(size_t id) { return 1ull << id; }
+
+        template <typename... Cs>
+        static uint64_t maskOf() {
+            uint64_t mask = 0;
+            int expand[] = { 0, ((mask |= bit(componentId<Cs>())), 0)... };
+            (void) expand;
+            return mask;
+        }
+
+        template <typename C>
+        size_t registered() {
+            size_t id = componentId<C>();
+            _sizes[id] = sizeof(C);
+            return id;
+        }
+
+        Archetype* archetype(uint64_t mask) {
+            auto found = _byMask.find(mask);
+            if (found != _byMask.end()) return found->second;
+            _archetypes.emplace_back(new Archetype(mask, _sizes));
+            Archetype* created = _archetypes.back().get();
+            _byMask[mask] = created;
+            return created;
+        }
+
+        // Takes the entity out of its archetype's rows, fixing up whoever moved into its place
+        void detach(Record& record) {
+            EntityHandle moved = record.archetype->erase(record.row);
+            if (moved.index != 0xffffffffu) {
+                _records[moved.index].row = record.row;
+            }
+        }
+
+        void move(EntityHandle handle, Record& record, Archetype* to) {
+            uint32_t row = to->push(handle);
+            record.archetype->copyShared(record.row, *to, row);
+            detach(record);
+            record.archetype = to;
+            record.row = row;
+        }
+
+        std::vector<std::unique_ptr<Archetype>> _archetypes;
+        std::unordered_map<uint64_t, Archetype*> _byMask;
+        std::vector<size_t> _sizes;
+        Archetype* _empty;
+        std::vector<Record> _records;
+        std::vector<uint32_t> _free;
+        size_t _alive = 0;
+    };
+}
+
+#endif//RTS_ARCHETYPE_H
@@ -0,0 +1,195 @@
+#ifndef RTS_ATLAS_H
+#define RTS_ATLAS_H
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstddef>
+
+namespace engine {
+
+    struct AtlasSize {
+        uint width, height;
+    };
+
+    struct AtlasRect {
+        uint page;
+        uint x, y, width, height;
+    };
+
+    struct AtlasPageStats {
+        uint width, height;
+        uint rects;
+        size_t usedPixels;
+        float occupancy;
+    };
+
+    // Skyline bottom-left rectangle packer. Pages are opened on demand, so an
+    // insert always succeeds; anything bigger than a page gets a page of its own.
+    // Knows nothing about GL so it can be exercised headless.
+    class AtlasPacker {
+    public:
+        AtlasPacker(uint pageWidth = 1024, uint pageHeight = 1024, uint padding = 1)
+            : _pageWidth(pageWidth), _pageHeight(pageHeight), _padding(padding) {}
+
+        // Every rect gets padding pixels of gutter on all four sides, so
+        // filtering and the first mip levels never sample a neighbour
+        AtlasRect insert(uint width, uint height) {
+            uint paddedWidth = width + 2 * _padding;
+            uint paddedHeight = height + 2 * _padding;
+            uint page = 0, x = 0, y = 0;
+
+            if (paddedWidth > _pageWidth || paddedHeight > _pageHeight) {
+                page = (uint) _pages.size();
+                _pages.push_back(Page(paddedWidth, paddedHeight));
+                insertInto(_pages.back(), paddedWidth, paddedHeight, x, y);
+            } else {
+                while (page < _pages.size() && !insertInto(_pages[page], paddedWidth, paddedHeight, x, y)) {
+                    page++;
+                }
+                if (page == _pages.size()) {
+                    _pages.push_back(Page(_pageWidth, _pageHeight));
+                    insertInto(_pages.back(), paddedWidth, paddedHeight, x, y);
+                }
+            }
+
+            _pages[page].usedPixels += (size_t) width * height;
+            return AtlasRect { page, x + _padding, y + _padding, width, height };
+        }
+
+        // Packs tallest-first, which wastes far less space than arrival order.
+        // Results are returned in the same order as sizes.
+        std::vector<AtlasRect> insert(const std::vector<AtlasSize>& sizes) {
+            std::vector<size_t> order(sizes.size());
+            for (size_t i = 0; i < order.size(); i++) order[i] = i;
+            std::stable_sort(order.begin(), order.end(), [&sizes](size_t a, size_t b) {
+                if (sizes[a].height != sizes[b].height) return sizes[a].height > sizes[b].height;
+                return sizes[a].width > sizes[b].width;
+            });
+
+            std::vector<AtlasRect> rects(sizes.size());
+            for (size_t i : order) {
+                rects[i] = insert(sizes[i].width, sizes[i].height);
+            }
+            return rects;
+        }
+
+        size_t pageCount() const { return _pages.size(); }
+        uint pageWidth(uint page) const { return _pages[page].width; }
+        uint pageHeight(uint page) const { return _pages[page].height; }
+
+        std::vector<AtlasPageStats> report() const {
+            std::vector<AtlasPageStats> stats;
+            for (auto& page : _pages) {
+                size_t area = (size_t) page.width * page.height;
+                stats.push_back(AtlasPageStats {
+                    page.width, page.height, page.rects, page.usedPixels,
+                    area > 0 ? (float) page.usedPixels / area : 0.0f
+                });
+            }
+            return stats;
+        }
+
+        void clear() {
+            _pages.clear();
+        }
+
+    private:
+        struct SkylineNode {
+            uint x, y, width;
+        };
+
+        struct Page {
+            Page(uint width, uint height) : width(width), height(height) {
+                skyline.push_back(SkylineNode { 0, 0, width });
+            }
+            uint width, height;
+            uint rects = 0;
+            size_t usedPixels = 0;
+            std::vector<SkylineNode> skyline;
+        };
+
+        // Lowest y at which a width x height rect fits starting at node index,
+        // or false if it runs off the right or top edge
+        bool fit(const Page& page, size_t index, uint width, uint height, uint& y) const {
+            uint x = page.skyline[index].x;
+            if (x + width > page.width) {
+                return false;
+            }
+
+            y = 0;
+            uint remaining = width;
+            for (size_t i = index; remaining > 0; i++) {
+                if (i >= page.skyline.size()) {
+                    return false;
+                }
+                y = std::max(y, page.skyline[i].y);
+                if (y + height > page.height) {
+                    return false;
+                }
+                remaining -= std::min(remaining, page.skyline[i].width);
+            }
+            return true;
+        }
+
+        bool insertInto(Page& page, uint width, uint height, uint& outX, uint& outY) {
+            size_t bestIndex = page.skyline.size();
+            uint bestY = std::numeric_limits<uint>::max();
+            uint bestWidth = std::numeric_limits<uint>::max();
+
+            for (size_t i = 0; i < page.skyline.size(); i++) {
+                uint y;
+                if (fit(page, i, width, height, y)) {
+                    if (y + height < bestY || (y + height == bestY && page.skyline[i].width < bestWidth)) {
+                        bestIndex = i;
+                        bestY = y + height;
+                        bestWidth = page.skyline[i].width;
+                        outX = page.skyline[i].x;
+                        outY = y;
+                    }
+                }
+            }
+
+            if (bestIndex == page.skyline.size()) {
+                return false;
+            }
+
+            page.skyline.insert(page.skyline.begin() + bestIndex, SkylineNode { outX, outY + height, width });
+
+            // trim or drop the nodes now covered by the new one
+            for (size_t i = bestIndex + 1; i < page.skyline.size(); i++) {
+                auto& prev = page.skyline[i - 1];
+                auto& node = page.skyline[i];
+                if (node.x >= prev.x + prev.width) {
+                    break;
+                }
+                uint shrink = prev.x + prev.width - node.x;
+                if (node.width <= shrink) {
+                    page.skyline.erase(page.skyline.begin() + i);
+                    i--;
+                } else {
+                    node.x += shrink;
+                    node.width -= shrink;
+                    break;
+                }
+            }
+
+            // merge neighbours at the same height
+            for (size_t i = 0; i + 1 < page.skyline.size(); i++) {
+                if (page.skyline[i].y == page.skyline[i + 1].y) {
+                    page.skyline[i].width += page.skyline[i + 1].width;
+                    page.skyline.erase(page.skyline.begin() + i + 1);
+                    i--;
+                }
+            }
+
+            page.rects++;
+            return true;
+        }
+
+        uint _pageWidth, _pageHeight, _padding;
+        std::vector<Page> _pages;
+    };
+}
+
+#endif//RTS_ATLAS_H
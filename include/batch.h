@@ -0,0 +1,120 @@
+#ifndef RTS_BATCH_H
+#define RTS_BATCH_H
+
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace engine {
+
+    // Per-instance data as laid out in EntityRenderer's instance buffer
+    struct SpriteInstance {
+        SpriteInstance() {}
+        SpriteInstance(glm::vec3 position, float rotation, float scale, glm::vec3 tint, glm::vec4 uv)
+            : position(position), rotation(rotation), scale(scale), tint(tint), uv(uv) {}
+
+        glm::vec3 position;
+        float rotation = 0.0f;
+        float scale = 1.0f;
+        glm::vec3 tint;
+        glm::vec4 uv; // u, v, width, height within the atlas page
+    };
+
+    // A run of instances, as laid out by SpriteBatchBuilder::write(), that share an atlas page
+    struct SpriteBatch {
+        uint texture;
+        uint first;
+        uint count;
+    };
+
+    struct RenderStats {
+        uint drawCalls = 0;
+        uint instances = 0;
+    };
+
+    // Collects sprite instances for a frame and groups them by texture so that
+    // each texture can be drawn with a single instanced call. Pure CPU, no GL.
+    //
+    // end() only works out where each instance goes; write() then puts them
+    // there, straight into the GPU's mapped memory if given it, so the
+    // grouped frame is never copied whole on the CPU.
+    class SpriteBatchBuilder {
+    public:
+        void begin() {
+            _keys.clear();
+            _unsorted.clear();
+            _slots.clear();
+            _batches.clear();
+            _lastBatch = 0;
+        }
+
+        void add(uint texture, const SpriteInstance& instance) {
+            _keys.push_back(texture);
+            _unsorted.push_back(instance);
+        }
+
+        // Counting sort on texture: the number of distinct textures is tiny
+        // compared to the number of instances, so this stays O(n)
+        void end() {
+            for (uint key : _keys) {
+                batchFor(key).count++;
+            }
+
+            uint first = 0;
+            for (auto& batch : _batches) {
+                batch.first = first;
+                first += batch.count;
+                batch.count = 0;
+            }
+
+            _slots.resize(_unsorted.size());
+            for (size_t i = 0; i < _unsorted.size(); i++) {
+                auto& batch = batchFor(_keys[i]);
+                _slots[i] = batch.first + batch.count++;
+            }
+
+            _stats.drawCalls = _batches.size();
+            _stats.instances = _unsorted.size();
+        }
+
+        // Writes instances [begin, end), in the order they were added, to
+        // their places in out, which must hold size() instances. Disjoint
+        // ranges touch disjoint parts of out, so they can be written from
+        // different threads.
+        void write(SpriteInstance* out, size_t begin, size_t end) const {
+            for (size_t i = begin; i < end; i++) {
+                out[_slots[i]] = _unsorted[i];
+            }
+        }
+
+        void write(SpriteInstance* out) const {
+            write(out, 0, _unsorted.size());
+        }
+
+        size_t size() const { return _unsorted.size(); }
+        const std::vector<SpriteBatch>& batches() const { return _batches; }
+        const RenderStats& stats() const { return _stats; }
+
+    private:
+        SpriteBatch& batchFor(uint texture) {
+            if (_lastBatch < _batches.size() && _batches[_lastBatch].texture == texture) {
+                return _batches[_lastBatch];
+            }
+            for (_lastBatch = 0; _lastBatch < _batches.size(); _lastBatch++) {
+                if (_batches[_lastBatch].texture == texture) {
+                    return _batches[_lastBatch];
+                }
+            }
+            _batches.push_back(SpriteBatch { texture, 0, 0 });
+            return _batches.back();
+        }
+
+        std::vector<uint> _keys;
+        std::vector<SpriteInstance> _unsorted;
+        std::vector<uint> _slots; // where each added instance goes
+        std::vector<SpriteBatch> _batches;
+        size_t _lastBatch = 0;
+        RenderStats _stats;
+    };
+}
+
+#endif//RTS_BATCH_H
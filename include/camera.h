@@ -0,0 +1,111 @@
+#ifndef RTS_CAMERA_H
+#define RTS_CAMERA_H
+
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace engine {
+
+    // World-space rectangle, e.g. what the camera currently sees
+    struct ViewRect {
+        glm::vec2 min, max;
+
+        ViewRect expanded(float margin) const {
+            return ViewRect { min - glm::vec2(margin), max + glm::vec2(margin) };
+        }
+
+        bool contains(glm::vec2 point) const {
+            return point.x >= min.x && point.y >= min.y && point.x <= max.x && point.y <= max.y;
+        }
+    };
+
+    // Orthographic 2D camera. At zoom 1 the viewport shows viewHeight world
+    // units from bottom to top, and as many from left to right as the aspect
+    // ratio allows; zooming in by 2 halves both. Screen coordinates are GLFW's:
+    // pixels from the top left of the viewport. No GL, so it can be used by the
+    // simulation side for picking as well.
+    class Camera {
+    public:
+        Camera(int viewportWidth = 800, int viewportHeight = 600, float viewHeight = 2.0f)
+            : _viewHeight(viewHeight) {
+            setViewport(viewportWidth, viewportHeight);
+        }
+
+        void setViewport(int width, int height) {
+            _viewport = glm::vec2((float) std::max(1, width), (float) std::max(1, height));
+        }
+
+        glm::vec2 viewport() const { return _viewport; }
+
+        glm::vec2 position() const { return _position; }
+        void setPosition(glm::vec2 position) { _position = position; }
+
+        // Moves by a world-space offset
+        void pan(glm::vec2 offset) { _position += offset; }
+
+        // Moves by a screen-space offset in pixels, e.g. a mouse drag
+        void panPixels(glm::vec2 pixels) {
+            pan(glm::vec2(-pixels.x, pixels.y) * worldPerPixel());
+        }
+
+        float zoom() const { return _zoom; }
+
+        void setZoom(float zoom) {
+            _zoom = glm::clamp(zoom, _minZoom, _maxZoom);
+        }
+
+        void setZoomLimits(float minZoom, float maxZoom) {
+            _minZoom = minZoom;
+            _maxZoom = maxZoom;
+            setZoom(_zoom);
+        }
+
+        // Zooms by factor while keeping the world point under the screen point
+        // where it is, as map editors and RTS cameras do for the scroll wheel
+        void zoomAt(glm::vec2 screen, float factor) {
+            glm::vec2 anchor = screenToWorld(screen);
+            setZoom(_zoom * factor);
+            _position += anchor - screenToWorld(screen);
+        }
+
+        // Half the visible world extent on each axis
+        glm::vec2 halfExtent() const {
+            float halfHeight = _viewHeight * 0.5f / _zoom;
+            return glm::vec2(halfHeight * _viewport.x / _viewport.y, halfHeight);
+        }
+
+        ViewRect view() const {
+            glm::vec2 half = halfExtent();
+            return ViewRect { _position - half, _position + half };
+        }
+
+        glm::mat4 viewProjection() const {
+            ViewRect rect = view();
+            return glm::ortho(rect.min.x, rect.max.x, rect.min.y, rect.max.y, -1.0f, 1.0f);
+        }
+
+        glm::vec2 screenToWorld(glm::vec2 screen) const {
+            glm::vec2 ndc(screen.x / _viewport.x * 2 - 1, 1 - screen.y / _viewport.y * 2);
+            return _position + ndc * halfExtent();
+        }
+
+        glm::vec2 worldToScreen(glm::vec2 world) const {
+            glm::vec2 ndc = (world - _position) / halfExtent();
+            return glm::vec2((ndc.x + 1) * 0.5f * _viewport.x, (1 - ndc.y) * 0.5f * _viewport.y);
+        }
+
+        float worldPerPixel() const {
+            return _viewHeight / _zoom / _viewport.y;
+        }
+
+    private:
+        glm::vec2 _viewport;
+        glm::vec2 _position = glm::vec2(0.0f);
+        float _viewHeight;
+        float _zoom = 1.0f;
+        float _minZoom = 0.25f, _maxZoom = 16.0f;
+    };
+}
+
+#endif//RTS_CAMERA_H
@@ -0,0 +1,79 @@
+#ifndef RTS_COMMAND_BUFFER_H
+#define RTS_COMMAND_BUFFER_H
+
+#include <functional>
+#include <vector>
+#include <entityx/entityx.h>
+
+#include <thread_pool.h>
+
+namespace engine {
+
+    // Structural changes (assigning or removing components, destroying entities)
+    // recorded from inside a parallelFor and applied later on one thread, since
+    // entityx's pools must not be resized while other threads are reading them.
+    // Each pool worker records into its own lane so recording never contends.
+    class CommandBuffer {
+    public:
+        typedef std::function<void()> Command;
+
+        explicit CommandBuffer(size_t workers = 0) : _lanes(workers + 1) {}
+
+        template <typename C>
+        void assign(entityx::Entity entity, const C& component) {
+            push([entity, component]() mutable {
+                if (!entity.valid()) return;
+                if (entity.has_component<C>()) {
+                    entity.remove<C>();
+                }
+                entity.assign_from_copy<C>(component);
+            });
+        }
+
+        template <typename C>
+        void remove(entityx::Entity entity) {
+            push([entity]() mutable {
+                if (entity.valid() && entity.has_component<C>()) {
+                    entity.remove<C>();
+                }
+            });
+        }
+
+        void destroy(entityx::Entity entity) {
+            push([entity]() mutable {
+                if (entity.valid()) {
+                    entity.destroy();
+                }
+            });
+        }
+
+        void push(Command command) {
+            int worker = ThreadPool::workerIndex();
+            size_t lane = worker >= 0 && (size_t) worker + 1 < _lanes.size() ? (size_t) worker + 1 : 0;
+            _lanes[lane].push_back(std::move(command));
+        }
+
+        // Applies everything recorded so far, lane by lane. Call from the thread
+        // that owns the EntityManager, after the parallel section has finished.
+        void flush() {
+            for (auto& lane : _lanes) {
+                for (auto& command : lane) {
+                    command();
+                }
+                lane.clear();
+            }
+        }
+
+        bool empty() const {
+            for (auto& lane : _lanes) {
+                if (!lane.empty()) return false;
+            }
+            return true;
+        }
+
+    private:
+        std::vector<std::vector<Command>> _lanes;
+    };
+}
+
+#endif//RTS_COMMAND_BUFFER_H
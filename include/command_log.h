@@ -0,0 +1,338 @@
+#ifndef RTS_COMMAND_LOG_H
+#define RTS_COMMAND_LOG_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <components.h>
+
+namespace engine {
+
+    enum class CommandType : uint8_t {
+        SpawnUnit = 1,
+        AddJob,
+        StartSelection,
+        ChangeSelection,
+        StopSelection,
+        BlockArea,
+        SaveGroup,
+        RecallGroup,
+        SpawnForaging,
+    };
+
+    // What a SpawnForaging command places
+    enum class ForagingSpawn : int32_t {
+        Forager,
+        Cache,
+        Spawner,
+    };
+
+    // A player (or load generator) input, applied at the start of a tick
+    struct PlayerCommand {
+        CommandType type;
+        float values[4];  // spawns: x, y; job: target; selection and block: minX, minY, maxX, maxY
+        int32_t extra[2]; // job: type, priority; selection: cursor; block: blocked; group: number; foraging: what
+
+        static PlayerCommand spawnUnit(float x, float y) {
+            PlayerCommand command = of(CommandType::SpawnUnit);
+            command.values[0] = x;
+            command.values[1] = y;
+            return command;
+        }
+
+        static PlayerCommand spawnForaging(ForagingSpawn what, float x, float y) {
+            PlayerCommand command = of(CommandType::SpawnForaging);
+            command.values[0] = x;
+            command.values[1] = y;
+            command.extra[0] = (int32_t) what;
+            return command;
+        }
+
+        static PlayerCommand addJob(const Job& job) {
+            PlayerCommand command = of(CommandType::AddJob);
+            command.values[0] = job.target.x;
+            command.values[1] = job.target.y;
+            command.values[2] = job.target.z;
+            command.extra[0] = (int32_t) job.type;
+            command.extra[1] = job.priority;
+            return command;
+        }
+
+        static PlayerCommand selection(CommandType type, const Selection& selection) {
+            PlayerCommand command = of(type);
+            command.values[0] = selection.minX;
+            command.values[1] = selection.minY;
+            command.values[2] = selection.maxX;
+            command.values[3] = selection.maxY;
+            command.extra[0] = (int32_t) selection.cursor;
+            return command;
+        }
+
+        static PlayerCommand blockArea(glm::vec2 min, glm::vec2 max, bool blocked) {
+            PlayerCommand command = of(CommandType::BlockArea);
+            command.values[0] = min.x;
+            command.values[1] = min.y;
+            command.values[2] = max.x;
+            command.values[3] = max.y;
+            command.extra[0] = blocked ? 1 : 0;
+            return command;
+        }
+
+        static PlayerCommand group(CommandType type, uint n) {
+            PlayerCommand command = of(type);
+            command.extra[0] = (int32_t) n;
+            return command;
+        }
+
+        Job job() const {
+            return Job(glm::vec3(values[0], values[1], values[2]), (JobType) extra[0], extra[1]);
+        }
+
+        Selection selection() const {
+            return Selection((uint) extra[0], values[0], values[1], values[2], values[3]);
+        }
+
+        // How many of values and extra the binary log stores for this type
+        static size_t valueCount(CommandType type) {
+            switch (type) {
+                case CommandType::SpawnUnit:
+                case CommandType::SpawnForaging: return 2;
+                case CommandType::AddJob: return 3;
+                case CommandType::SaveGroup:
+                case CommandType::RecallGroup: return 0;
+                default: return 4;
+            }
+        }
+
+        static size_t extraCount(CommandType type) {
+            switch (type) {
+                case CommandType::SpawnUnit: return 0;
+                case CommandType::AddJob: return 2;
+                default: return 1;
+            }
+        }
+
+        // A command of that type with every value zeroed
+        static PlayerCommand of(CommandType type) {
+            PlayerCommand command;
+            command.type = type;
+            memset(command.values, 0, sizeof(command.values));
+            memset(command.extra, 0, sizeof(command.extra));
+            return command;
+        }
+    };
+
+    // Binary command log, little-endian throughout:
+    //
+    //   header  "RTSLOG" u16 version, u64 seed, f64 tick length, u32 hash interval
+    //   record  u8 kind, varint ticks since the previous record, then
+    //           command: u8 type, f32 values, zigzag varint extras (count by type)
+    //           hash:    u64 state hash after that tick
+    //           end:     nothing; the tick is the total ticks recorded
+    //
+    // Commands for a tick come before that tick's hash.
+    struct CommandLogHeader {
+        uint64_t seed = 1;
+        double tickLength = 1.0 / 30.0; // seconds, exactly as passed to step()
+        uint32_t hashInterval = 1; // a state hash every this many ticks, 0 for none
+    };
+
+    struct CommandLogRecord {
+        enum Kind : uint8_t { Command = 1, Hash = 2, End = 3 };
+        Kind kind;
+        uint64_t tick;
+        PlayerCommand command;
+        uint64_t hash;
+    };
+
+    const char COMMAND_LOG_MAGIC[6] = { 'R', 'T', 'S', 'L', 'O', 'G' };
+    const uint16_t COMMAND_LOG_VERSION = 1;
+
+    class CommandLogWriter {
+    public:
+        CommandLogWriter(const std::string& path, const CommandLogHeader& header) : _header(header) {
+            _file = fopen(path.c_str(), "wb");
+            if (!_file) return;
+            fwrite(COMMAND_LOG_MAGIC, 1, sizeof(COMMAND_LOG_MAGIC), _file);
+            writeFixed(COMMAND_LOG_VERSION, 2);
+            writeFixed(header.seed, 8);
+            uint64_t length;
+            memcpy(&length, &header.tickLength, 8);
+            writeFixed(length, 8);
+            writeFixed(header.hashInterval, 4);
+        }
+
+        ~CommandLogWriter() {
+            if (_file) fclose(_file);
+        }
+
+        CommandLogWriter(const CommandLogWriter&) = delete;
+        CommandLogWriter& operator=(const CommandLogWriter&) = delete;
+
+        bool ok() const { return _file != nullptr; }
+        const CommandLogHeader& header() const { return _header; }
+
+        void command(uint64_t tick, const PlayerCommand& command) {
+            begin(CommandLogRecord::Command, tick);
+            fputc((int) command.type, _file);
+            for (size_t i = 0; i < PlayerCommand::valueCount(command.type); i++) {
+                uint32_t bits;
+                memcpy(&bits, &command.values[i], 4);
+                writeFixed(bits, 4);
+            }
+            for (size_t i = 0; i < PlayerCommand::extraCount(command.type); i++) {
+                int32_t value = command.extra[i];
+                writeVarint(((uint32_t) value << 1) ^ (uint32_t) (value >> 31));
+            }
+        }
+
+        void hash(uint64_t tick, uint64_t hash) {
+            begin(CommandLogRecord::Hash, tick);
+            writeFixed(hash, 8);
+        }
+
+        // Marks the total number of ticks recorded and flushes
+        void end(uint64_t ticks) {
+            begin(CommandLogRecord::End, ticks);
+            fflush(_file);
+        }
+
+    private:
+        void begin(CommandLogRecord::Kind kind, uint64_t tick) {
+            fputc(kind, _file);
+            writeVarint(tick - _lastTick);
+            _lastTick = tick;
+        }
+
+        void writeFixed(uint64_t value, int bytes) {
+            for (int i = 0; i < bytes; i++) {
+                fputc((int) ((value >> (8 * i)) & 0xff), _file);
+            }
+        }
+
+        void writeVarint(uint64_t value) {
+            while (value >= 0x80) {
+                fputc((int) (value & 0x7f) | 0x80, _file);
+                value >>= 7;
+            }
+            fputc((int) value, _file);
+        }
+
+        FILE* _file;
+        CommandLogHeader _header;
+        uint64_t _lastTick = 0;
+    };
+
+    class CommandLogReader {
+    public:
+        explicit CommandLogReader(const std::string& path) {
+            _file = fopen(path.c_str(), "rb");
+            if (!_file) {
+                _error = "unable to open '" + path + "'";
+                return;
+            }
+
+            char magic[sizeof(COMMAND_LOG_MAGIC)];
+            uint64_t version = 0, length = 0, interval = 0;
+            if (fread(magic, 1, sizeof(magic), _file) != sizeof(magic) || memcmp(magic, COMMAND_LOG_MAGIC, sizeof(magic)) != 0) {
+                _error = "not a command log";
+            } else if (!readFixed(version, 2) || version != COMMAND_LOG_VERSION) {
+                _error = "unsupported command log version " + std::to_string(version);
+            } else if (!readFixed(_header.seed, 8) || !readFixed(length, 8) || !readFixed(interval, 4)) {
+                _error = "truncated header";
+            } else {
+                memcpy(&_header.tickLength, &length, 8);
+                _header.hashInterval = (uint32_t) interval;
+            }
+        }
+
+        ~CommandLogReader() {
+            if (_file) fclose(_file);
+        }
+
+        CommandLogReader(const CommandLogReader&) = delete;
+        CommandLogReader& operator=(const CommandLogReader&) = delete;
+
+        bool ok() const { return _error.empty(); }
+        const std::string& error() const { return _error; }
+        const CommandLogHeader& header() const { return _header; }
+
+        // False at the end of the file or on a malformed record (see error())
+        bool next(CommandLogRecord& record) {
+            if (!ok()) return false;
+            int kind = fgetc(_file);
+            if (kind == EOF) return false;
+
+            uint64_t delta;
+            if (!readVarint(delta)) return fail("truncated record");
+            _tick += delta;
+            record.kind = (CommandLogRecord::Kind) kind;
+            record.tick = _tick;
+
+            switch (record.kind) {
+                case CommandLogRecord::Command: {
+                    int type = fgetc(_file);
+                    if (type < (int) CommandType::SpawnUnit || type > (int) CommandType::SpawnForaging) {
+                        return fail("unknown command type");
+                    }
+                    PlayerCommand& command = record.command;
+                    command = PlayerCommand::of((CommandType) type);
+                    for (size_t i = 0; i < PlayerCommand::valueCount(command.type); i++) {
+                        uint64_t bits;
+                        if (!readFixed(bits, 4)) return fail("truncated command");
+                        uint32_t value = (uint32_t) bits;
+                        memcpy(&command.values[i], &value, 4);
+                    }
+                    for (size_t i = 0; i < PlayerCommand::extraCount(command.type); i++) {
+                        uint64_t zigzag;
+                        if (!readVarint(zigzag)) return fail("truncated command");
+                        command.extra[i] = (int32_t) ((uint32_t) (zigzag >> 1) ^ -(uint32_t) (zigzag & 1));
+                    }
+                    return true;
+                }
+                case CommandLogRecord::Hash:
+                    return readFixed(record.hash, 8) || fail("truncated hash");
+                case CommandLogRecord::End:
+                    return true;
+                default:
+                    return fail("unknown record kind");
+            }
+        }
+
+    private:
+        bool fail(const std::string& error) {
+            _error = error;
+            return false;
+        }
+
+        bool readFixed(uint64_t& value, int bytes) {
+            value = 0;
+            for (int i = 0; i < bytes; i++) {
+                int c = fgetc(_file);
+                if (c == EOF) return false;
+                value |= (uint64_t) c << (8 * i);
+            }
+            return true;
+        }
+
+        bool readVarint(uint64_t& value) {
+            value = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                int c = fgetc(_file);
+                if (c == EOF) return false;
+                value |= (uint64_t) (c & 0x7f) << shift;
+                if (!(c & 0x80)) return true;
+            }
+            return false;
+        }
+
+        FILE* _file = nullptr;
+        std::string _error;
+        CommandLogHeader _header;
+        uint64_t _tick = 0;
+    };
+}
+
+#endif//RTS_COMMAND_LOG_H
@@ -0,0 +1,108 @@
+#ifndef RTS_COMPONENTS_H
+#define RTS_COMPONENTS_H
+
+#include <cmath>
+#include <string>
+#include <glm/glm.hpp>
+
+namespace engine {
+
+    typedef uint TextureHandle;
+    const TextureHandle INVALID_TEXTURE = (TextureHandle) -1;
+
+    struct Position {
+        Position(float x, float y, float z) : value(x, y, z), previous(x, y, z) {}
+        glm::vec3 value;
+        glm::vec3 previous; // value as of the previous tick, for render interpolation
+    };
+
+    struct Velocity {
+        Velocity(float x, float y, float z) : value(x, y, z) {}
+        glm::vec3 value;
+    };
+
+    struct Sprite {
+        Sprite(TextureHandle texture, float scale, float rotation, glm::vec4 uv = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f))
+            : texture(texture), uv(uv), scale(scale), rotation(rotation) {}
+
+        TextureHandle texture;
+        glm::vec4 uv; // sub-rectangle of the texture, e.g. a frame of a sprite sheet
+        float scale;
+        float rotation;
+    };
+
+    struct Selection {
+        Selection(uint cursor, float minX, float minY, float maxX, float maxY)
+            : cursor(cursor), minX(minX), minY(minY), maxX(maxX), maxY(maxY) {}
+        uint cursor;
+        float minX, minY, maxX, maxY;
+    };
+
+    enum class JobType : uint {
+        Goto,
+        CollectItem,
+        DepositItem,
+    };
+
+    inline uint jobBit(JobType type) {
+        return 1u << (uint) type;
+    }
+
+    enum : uint { JOB_TYPE_COUNT = 3 };
+    const uint ALL_JOB_TYPES = (1u << JOB_TYPE_COUNT) - 1;
+
+    struct Job {
+        Job(float x = 0.0f, float y = 0.0f, float z = 0.0f) : target(x, y, z) {}
+        explicit Job(const glm::vec3& target, JobType type = JobType::Goto, int priority = 0)
+            : target(target), type(type), priority(priority) {}
+        glm::vec3 target;
+        JobType type = JobType::Goto;
+        int priority = 0; // higher runs first
+        float groupRadius = 0.0f; // how far from target a unit in a group order may stop
+        float arriveRadius = 0.01f; // done once this close to target
+        bool direct = false; // walk straight at target instead of along a flow field
+
+        // progress towards target, so a unit stuck behind others can give up
+        float closest = INFINITY;
+        uint stalledTicks = 0;
+    };
+
+    // An entity the JobSystem may hand jobs to, limited to the job types in capabilities
+    struct Worker {
+        Worker(uint capabilities = ALL_JOB_TYPES) : capabilities(capabilities) {}
+        uint capabilities;
+
+        bool canDo(JobType type) const { return (capabilities & jobBit(type)) != 0; }
+    };
+
+    // A pile on the map that Foragers carry off, up to their capacity per trip
+    struct Item {
+        Item(uint amount = 1) : amount(amount) {}
+        uint amount;
+    };
+
+    // Where Foragers drop what they carry
+    struct ItemCache {
+        uint stored = 0;
+    };
+
+    // Drops an Item of amount somewhere within radius every interval seconds
+    struct ItemSpawner {
+        ItemSpawner(float interval = 1.0f, float radius = 0.1f, uint amount = 5)
+            : interval(interval), radius(radius), amount(amount) {}
+        float interval;
+        float radius;
+        uint amount;
+        float timer = 0.0f;
+    };
+
+    // A Worker that, whenever it has no job, fetches Items and takes them to
+    // the nearest ItemCache
+    struct Forager {
+        Forager(uint capacity = 1) : capacity(capacity) {}
+        uint capacity;
+        uint carried = 0;
+    };
+}
+
+#endif//RTS_COMPONENTS_H
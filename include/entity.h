@@ -4,7 +4,6 @@
 #include <iostream>
 #include <cstdlib>
 #include <cmath>
-#include <queue>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -12,94 +11,130 @@
 #include <entityx/entityx.h>
 #include <map>
 
+#include <camera.h>
 #include <render.h>
+#include <simulation.h>
 
 namespace engine {
     
-    struct Position {
-        Position(float x, float y, float z) : value(x, y, z) {}
-        glm::vec3 value;
-    };
-
-    struct Velocity {
-        Velocity(float x, float y, float z) : value(x, y, z) {}
-        glm::vec3 value;
-    };
-
-    struct Sprite {
-        Sprite(std::string texture, float scale, float rotation) : texture(texture), scale(scale), rotation(rotation) {}
-
-        std::string texture;
-        float scale;
-        float rotation;
-    };
-
-    class MovementSystem : public entityx::System<MovementSystem> {
+    // Builds and draws the sprite instances inside the camera's view. With a
+    // SpatialGrid the visible entities come from a rect query, so the cost of
+    // a frame follows what is on screen rather than the size of the map. Units
+    // and props (items, caches) sit in separate grids and both are queried.
+    // With a ThreadPool the instances are written into the mapped instance
+    // stream in parallel.
+    class EntityRenderSystem : public entityx::System<EntityRenderSystem> {
     public:
-        void update(entityx::EntityManager& es, entityx::EventManager& events, entityx::TimeDelta dt) override {
-            es.each<Position, Velocity>([dt](entityx::Entity entity, Position& position, Velocity& velocity) {
-                position.value += velocity.value * static_cast<float>(dt);
+        EntityRenderSystem(EntityRenderer& renderer, TextureManager& textures, const Camera& camera,
+                           const SpatialGrid* grid = nullptr, const SpatialGrid* props = nullptr,
+                           const SelectionSet* selection = nullptr, ThreadPool* pool = nullptr)
+            : renderer(renderer), textures(textures), camera(camera), grid(grid), props(props), selection(selection),
+              pool(pool) {}
 
-                if (position.value.x > 1) {
-                    position.value.x = 1;
-                    velocity.value.x *= -1;
-                } else if (position.value.x < -1) {
-                    position.value.x = -1;
-                    velocity.value.x *= -1;
-                }
+        void update(entityx::EntityManager& es, entityx::EventManager& events, entityx::TimeDelta dt) override {
+            buildBatches(es);
 
-                if (position.value.y > 1) {
-                    position.value.y = 1;
-                    velocity.value.y *= -1;
-                } else if (position.value.y < -1) {
-                    position.value.y = -1;
-                    velocity.value.y *= -1;
-                }
-            });
+            if (renderer.isInitialized()) {
+                renderer.use();
+                renderer.render(batches, textures, camera.viewProjection(), pool);
+            }
         }
-    };
 
-    class SpriteOrientationSystem : public entityx::System<SpriteOrientationSystem> {
-    public:
-        void update(entityx::EntityManager& es, entityx::EventManager& events, entityx::TimeDelta dt) override {
-            es.each<Sprite, Velocity>([this, dt](entityx::Entity entity, Sprite& sprite, Velocity& velocity) {
-                if (velocity.value.x == 0) {
-                } else {
-                    dummy = glm::normalize(velocity.value);
-                    sprite.rotation = (float) (atan(dummy.y / dummy.x) - M_PI_2);
+        // CPU side of the frame: gathers instance data grouped by atlas page, no GL calls
+        void buildBatches(entityx::EntityManager& es) {
+            // the grid holds this tick's positions while sprites are drawn
+            // between the last two, and sprites have a size; the margin covers both
+            ViewRect view = camera.view().expanded(CULL_MARGIN);
+            culled = 0;
+            batches.begin();
+
+            glm::vec2 extent = view.max - view.min;
+            float cells = extent.x * extent.y / (grid ? grid->cellSize() * grid->cellSize() : 1.0f);
+            size_t indexed = grid ? grid->size() + (props ? props->size() : 0) : 0;
+            if (grid && cells < indexed) {
+                visible.clear();
+                grid->queryRect(view.min.x, view.min.y, view.max.x, view.max.y, visible);
+                if (props) props->queryRect(view.min.x, view.min.y, view.max.x, view.max.y, visible);
+                for (auto id : visible) {
+                    entityx::Entity entity = es.get(id);
+                    auto position = entity.component<Position>();
+                    auto sprite = entity.component<Sprite>();
+                    if (position && sprite) {
+                        addSprite(entity, *position, *sprite);
+                    }
                 }
-            });
+                culled = indexed - visible.size();
+            } else {
+                // zoomed out far enough that walking the grid's cells would
+                // cost more than testing every entity
+                es.each<Position, Sprite>([this, &view](entityx::Entity entity, Position& position, Sprite& sprite) {
+                    if (view.contains(glm::vec2(position.value.x, position.value.y))) {
+                        addSprite(entity, position, sprite);
+                    } else {
+                        culled++;
+                    }
+                });
+            }
+            batches.end();
         }
-    private:
-        glm::vec3 dummy;
-    };
 
-    struct Selection {
-        Selection(uint cursor, float minX, float minY, float maxX, float maxY)
-            : cursor(cursor), minX(minX), minY(minY), maxX(maxX), maxY(maxY) {}
-        uint cursor;
-        float minX, minY, maxX, maxY;
-    };
+        const RenderStats& stats() const { return batches.stats(); }
 
-    struct SelectionStartedEvent {
-        SelectionStartedEvent(Selection selection) : selection(selection) {}
-        Selection selection;
-    };
+        // Entities left out by the last buildBatches() for being off screen
+        size_t culledCount() const { return culled; }
 
-    struct SelectionChangedEvent {
-        SelectionChangedEvent(Selection selection) : selection(selection) {}
-        Selection selection;
-    };
+        // Fraction of the way from the previous tick's positions to the current ones
+        void setInterpolation(float alpha) { this->alpha = alpha; }
 
-    struct SelectionEndedEvent {
-        SelectionEndedEvent(Selection selection) : selection(selection) {}
-        Selection selection;
+    private:
+        static constexpr float CULL_MARGIN = 0.1f;
+
+        void addSprite(entityx::Entity entity, Position& position, Sprite& sprite) {
+            if (textures.valid(sprite.texture)) {
+                auto& region = textures.region(sprite.texture);
+                glm::vec4 uv(
+                    region.uv.x + sprite.uv.x * region.uv.z,
+                    region.uv.y + sprite.uv.y * region.uv.w,
+                    sprite.uv.z * region.uv.z,
+                    sprite.uv.w * region.uv.w
+                );
+
+                glm::vec3 color(0.0f, 0.0f, 0.0f);
+
+                if (selection && selection->contains(entity.id())) {
+                    color.g = color.b = 1.0f;
+                } 
+                if (entity.has_component<Job>()) {
+                    color.r = 1.0f;
+                }
+
+                glm::vec3 interpolated = position.previous + (position.value - position.previous) * alpha;
+                batches.add(region.page, SpriteInstance(interpolated, sprite.rotation, sprite.scale, color, uv));
+            } else {
+                std::cerr << "No texture found for handle " << sprite.texture << std::endl;
+                entity.remove<Sprite>();
+            }
+        }
+
+        EntityRenderer& renderer;
+        TextureManager& textures;
+        const Camera& camera;
+        const SpatialGrid* grid;
+        const SpatialGrid* props;
+        const SelectionSet* selection;
+        ThreadPool* pool;
+        SpriteBatchBuilder batches;
+        std::vector<entityx::Entity::Id> visible;
+        size_t culled = 0;
+        float alpha = 1.0f;
     };
 
-    class SelectionSystem : public entityx::System<SelectionSystem>, public entityx::Receiver<SelectionSystem> {
+    // Draws the drag box. Tracks the selection events itself so the simulation
+    // side of selection never touches GL.
+    class SelectionBoxRenderSystem : public entityx::System<SelectionBoxRenderSystem>, public entityx::Receiver<SelectionBoxRenderSystem> {
     public:
-        SelectionSystem(SelectionBoxRenderer& renderer) 
-            : renderer(renderer), selection(0, 0, 0, 0, 0), selectionColor(0, 1, 1, 0.1f) {}
+        SelectionBoxRenderSystem(SelectionBoxRenderer& renderer, const Camera& camera)
+            : renderer(renderer), camera(camera), selectionColor(0, 1, 1, 0.1f) {}
 
         void configure(entityx::EventManager& eventManager) {
             eventManager.subscribe<SelectionStartedEvent>(*this);
@@ -107,36 +142,26 @@ namespace engine {
             eventManager.subscribe<SelectionEndedEvent>(*this);
         }
 
-        void update(entityx::EntityManager &entities, entityx::EventManager &events, entityx::TimeDelta dt) {
+        void update(entityx::EntityManager& es, entityx::EventManager& events, entityx::TimeDelta dt) override {
             if (isSelecting) {
-                renderer.render(selectionColor);
-                entities.each<Position>([this](entityx::Entity entity, Position& position) {
-                    auto pos = position.value;
-                    bool isSelected = false;
-
-                    if (pos.x > selection.minX && pos.y > selection.minY && pos.x < selection.maxX && pos.y < selection.maxY) {
-                        if (!entity.has_component<Selection>()) {
-                            entity.assign_from_copy<Selection>(selection);
-                        }
-                        isSelected = true;
-                    }
-
-                    if (!isSelected && entity.has_component<Selection>()) {
-                        entity.remove<Selection>();
-                    }
-                });
+                // several ticks' worth of changes cost one upload
+                if (isDirty) {
+                    renderer.update(box.minX, box.minY, box.maxX, box.maxY);
+                    isDirty = false;
+                }
+                renderer.render(selectionColor, camera.viewProjection());
             }
         }
 
         void receive(const SelectionStartedEvent &event) {
-            selection = event.selection;
             isSelecting = true;
-            renderer.update(selection.minX, selection.minY, selection.maxX, selection.maxY);
+            box = event.selection;
+            isDirty = true;
         }
 
         void receive(const SelectionChangedEvent &event) {
-            selection = event.selection;
-            renderer.update(selection.minX, selection.minY, selection.maxX, selection.maxY);
+            box = event.selection;
+            isDirty = true;
         }
 
         void receive(const SelectionEndedEvent &event) {
@@ -144,171 +169,65 @@ namespace engine {
         }
 
     private:
-        Selection selection;
-        bool isSelecting;
-        glm::vec4 selectionColor;
         SelectionBoxRenderer& renderer;
+        const Camera& camera;
+        glm::vec4 selectionColor;
+        Selection box = Selection(0, 0, 0, 0, 0);
+        bool isSelecting = false;
+        bool isDirty = false;
     };
 
-
-    struct Job {
-        Job(float x = 0.0f, float y = 0.0f, float z = 0.0f) : target(x, y, z) {}
-        explicit Job(glm::vec3& target) : target(target) {}
-        glm::vec3 target;
-
-        // GotoJob
-        // ItemSpawner/ItemCache
-        // CollectItemJob
-        // DepositItemJob
-        // Item
-        // Change how velocity works
-    };
-
-    struct JobAddedEvent {
-        JobAddedEvent(Job job) : job(job) {}
-        Job job;
-    };
-
-    class JobSystem : public entityx::System<JobSystem>, public entityx::Receiver<JobSystem> {
-    public:
-        void configure(entityx::EventManager& eventManager) {
-            eventManager.subscribe<JobAddedEvent>(*this);
-        }
-
-        void update(entityx::EntityManager& es, entityx::EventManager& events, entityx::TimeDelta dt) override {
-            es.each<Position, Velocity, Job>([dt, this](entityx::Entity entity, Position& position, Velocity& velocity, Job& job) {
-                auto direction = job.target - position.value;
-                if (glm::length(direction) < 0.01f) {
-                    entity.remove<Job>();
-                    velocity.value.x = 0;
-                    velocity.value.y = 0;
-                    velocity.value.z = 0;
-                } else {
-                    auto speed = 0.2f;
-                    velocity.value = glm::normalize(direction) * speed;
-                }
-            });
-
-            if (jobQueue.size() > 0) {
-                entityx::ComponentHandle<Position> position;
-                entityx::ComponentHandle<Velocity> velocity;
-                entityx::ComponentHandle<Selection> selection;
-
-                bool jobTaken = false;
-                for (entityx::Entity entity : es.entities_with_components(position, velocity, selection)) {
-                    if (entity.has_component<Job>()) {    
-                        entity.remove<Job>();
-                    }
-                    auto job = jobQueue.front().job;
-                    entity.assign_from_copy<Job>(job);
-                    jobTaken = true;
-                }
-                if (jobTaken) jobQueue.pop();
-
-                for (entityx::Entity entity : es.entities_with_components(position, velocity)) {
-                    if (jobQueue.size() <= 0) break;
-                    if (entity.has_component<Job>()) continue;
-
-                    auto job = jobQueue.front().job;
-                    jobQueue.pop();
-                    entity.assign_from_copy<Job>(job);
-                }
-            }
-        }
-
-        void receive(const JobAddedEvent& event) {
-            jobQueue.push(event);
-        }
-
-    private:
-        std::queue<JobAddedEvent> jobQueue;
-    };
-
-
-    class EntityRenderSystem : public entityx::System<EntityRenderSystem> {
+    class World : public Simulation {
     public:
-        EntityRenderSystem(EntityRenderer& renderer, TextureManager& textures) : renderer(renderer), textures(textures) {}
-
-        void update(entityx::EntityManager& es, entityx::EventManager& events, entityx::TimeDelta dt) override {
-            if (renderer.isInitialized()) {
-                renderer.use();
-                es.each<Position, Sprite>([this](entityx::Entity entity, Position& position, Sprite& sprite) {
-                    Texture* texture = textures.get(sprite.texture);
-
-                    if (texture) {
-                        texture->use();
-                        glm::vec3 color(0.0f, 0.0f, 0.0f);
-
-                        if (entity.has_component<Selection>()) {
-                            color.g = color.b = 1.0f;
-                        } 
-                        if (entity.has_component<Job>()) {
-                            color.r = 1.0f;
-                        }
-
-                        glm::mat4 transform = glm::mat4(1.0f);
-                        transform = glm::translate(transform, position.value);
-                        transform = glm::rotate(transform, sprite.rotation, glm::vec3(0.0f, 0.0f, 1.0f));
-                        transform = glm::scale(transform, glm::vec3(sprite.scale));
-
-                        renderer.render(transform, color);
-                    } else {
-                        std::cerr << "No texture found for '" << sprite.texture << "'" << std::endl;
-                        entity.remove<Sprite>();
-                    }
-                });
+        World(EntityRenderer& renderer, SelectionBoxRenderer& selectionBoxRenderer, TextureManager& textures,
+              const Camera& camera, uint64_t seed = 1) : camera(camera) {
+            this->seed(seed);
+
+            // the simulation systems are already configured, so only configure the new ones
+            // the simulation's pool sits idle while a frame is drawn, so it writes the instances
+            systems.add<EntityRenderSystem>(renderer, textures, camera, &grid, &props,
+                                            &systems.system<SelectionSystem>()->selected(), &pool);
+            systems.add<SelectionBoxRenderSystem>(selectionBoxRenderer, camera)->configure(events);
+
+            // drawn as the placeholder until the main loop's uploadPending() picks it up
+            unitTexture = textures.loadAsync("res/ant.png");
+            systems.system<ForagingSystem>()->setTextures(textures.loadAsync("res/sugar.png"),
+                                                           textures.loadAsync("res/sugar-cubes.png"));
+
+            // a separate generator, so laying out the start does not advance the
+            // simulation's own before the first tick
+            Random layout(seed);
+            addForaging(ForagingSpawn::Cache, 0.0f, 0.0f);
+            for (uint s = 0; s < 3; s++) {
+                addForaging(ForagingSpawn::Spawner, layout.range(-0.8f, 0.8f), layout.range(-0.8f, 0.8f));
             }
-        }
-    private:
-        EntityRenderer& renderer;
-        TextureManager& textures;
-    };
-
-    class World : public entityx::EntityX {
-    public:
-        World(EntityRenderer& renderer, SelectionBoxRenderer& selectionBoxRenderer, TextureManager& textures) {
-            systems.add<MovementSystem>();
-            systems.add<SpriteOrientationSystem>();
-            systems.add<JobSystem>();
-            systems.add<EntityRenderSystem>(renderer, textures);
-            systems.add<SelectionSystem>(selectionBoxRenderer);
-            systems.configure();
-
-            std::string texture = "res/ant.png";
-            textures.load(texture);
-
             for (uint u = 0; u < 10; u++) {
-                entityx::Entity entity = entities.create();
-                entity.assign<Position>((float) rand() / RAND_MAX - 0.5f, (float) rand() / RAND_MAX - 0.5f, 0.0f);
-                entity.assign<Velocity>(0.0f, 0.0f, 0.0f);
-                entity.assign<Sprite>(texture, 0.05f, (float) rand() / RAND_MAX * 2 - 1);
+                addForaging(ForagingSpawn::Forager, layout.range(-0.5f, 0.5f), layout.range(-0.5f, 0.5f));
             }
         }
 
+        // Steps the simulation with the camera's view as its level-of-detail
+        // focus, then renders once with positions interpolated between the
+        // last two ticks
         void update(entityx::TimeDelta dt) {
-            systems.update<MovementSystem>(dt);
-            systems.update<SpriteOrientationSystem>(dt);
-            systems.update<JobSystem>(dt);
-            systems.update<SelectionSystem>(dt);
-            systems.update<EntityRenderSystem>(dt);
-        }
-
-        void addTarget(glm::vec3 target) {
-            events.emit<JobAddedEvent>(Job(target));
-        }
-
-        void startSelection(Selection selection) {
-            events.emit<SelectionStartedEvent>(selection);
+            lod.setView(camera.view());
+            advance(dt);
+            render(interpolation());
         }
 
-        void changeSelection(Selection selection) {
-            events.emit<SelectionChangedEvent>(selection);
+        void render(float alpha) {
+            {
+                RTS_PROFILE_ZONE("SelectionBoxRenderSystem");
+                systems.update<SelectionBoxRenderSystem>(0);
+            }
+            RTS_PROFILE_ZONE("EntityRenderSystem");
+            systems.system<EntityRenderSystem>()->setInterpolation(alpha);
+            systems.update<EntityRenderSystem>(0);
         }
 
-        void stopSelection(Selection selection) {
-            events.emit<SelectionEndedEvent>(selection);
-        }
+    private:
+        const Camera& camera;
     };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,377 @@
+#ifndef RTS_FORAGING_H
+#define RTS_FORAGING_H
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <vector>
+#include <glm/glm.hpp>
+#include <entityx/entityx.h>
+
+#include <components.h>
+#include <pathfinding.h>
+#include <spatial.h>
+#include <thread_pool.h>
+#include <random.h>
+
+namespace engine {
+
+    struct ForagingSettings {
+        size_t candidates = 4;             // nearest unclaimed items each forager considers
+        size_t maxDecisionsPerTick = 4096; // idle foragers handed a job per tick at most
+        size_t maxItems = 20000;           // spawners pause while this many items are out
+        float pickupRadius = 0.02f;
+        float depositRadius = 0.06f;
+        float directRange = 0.3f;          // items closer than this with nothing in the way are walked to straight
+    };
+
+    struct ForagingStats {
+        uint64_t decisions = 0; // idle foragers looked at
+        uint64_t conflicts = 0; // candidates another forager claimed earlier in the same tick
+        uint64_t starved = 0;   // foragers left without anything to go for
+        uint64_t pickups = 0;
+        uint64_t deposits = 0;
+    };
+
+    // Runs the sugar economy: ItemSpawners drop Items, idle Foragers claim the
+    // nearest unclaimed one, carry it off and take it to the nearest
+    // ItemCache, all through ordinary CollectItem and DepositItem jobs that
+    // the JobSystem steers. A trip to an item within directRange that no
+    // wall stands in front of is a direct job, walked in a straight line, so
+    // the many scattered item targets never need flow fields of their own;
+    // only trips to caches and to items out of sight go by flow field.
+    //
+    // Unclaimed items and caches live in spatial grids of their own, so
+    // choosing a target is a k-nearest ring search, never a scan. A claim
+    // takes the item out of the grid until it is picked up or given back, so
+    // no two foragers go for the same one. Foragers decide in batches: the
+    // searches run in parallel against the grid as it was at the start of the
+    // tick, then claims are made one by one in entity order. A forager whose
+    // candidates were all claimed by others in the same batch (a conflict)
+    // tries again next tick.
+    class ForagingSystem : public entityx::System<ForagingSystem>, public entityx::Receiver<ForagingSystem> {
+    public:
+        ForagingSystem(ThreadPool& pool, Random& random, const GridMap* map = nullptr, float cellSize = 0.05f,
+                       ForagingSettings settings = ForagingSettings())
+            : pool(pool), random(random), map(map), items(cellSize), caches(cellSize * 4), settings(settings) {}
+
+        void configure(entityx::EventManager& eventManager) {
+            eventManager.subscribe<entityx::ComponentAddedEvent<Item>>(*this);
+            eventManager.subscribe<entityx::ComponentRemovedEvent<Item>>(*this);
+            eventManager.subscribe<entityx::ComponentAddedEvent<ItemCache>>(*this);
+            eventManager.subscribe<entityx::ComponentRemovedEvent<ItemCache>>(*this);
+            eventManager.subscribe<entityx::ComponentAddedEvent<Forager>>(*this);
+            eventManager.subscribe<entityx::ComponentRemovedEvent<Job>>(*this);
+        }
+
+        void update(entityx::EntityManager& es, entityx::EventManager& events, entityx::TimeDelta dt) override {
+            spawn(es, (float) dt);
+            settle(es);
+            decide(es);
+        }
+
+        entityx::Entity spawnItem(entityx::EntityManager& es, float x, float y, uint amount) {
+            entityx::Entity entity = es.create();
+            entity.assign<Position>(x, y, 0.0f);
+            entity.assign<Sprite>(itemTexture, 0.03f, 0.0f);
+            entity.assign<Item>(amount);
+            return entity;
+        }
+
+        entityx::Entity spawnCache(entityx::EntityManager& es, float x, float y) {
+            entityx::Entity entity = es.create();
+            entity.assign<Position>(x, y, 0.0f);
+            entity.assign<Sprite>(cacheTexture, 0.1f, 0.0f);
+            entity.assign<ItemCache>();
+            return entity;
+        }
+
+        entityx::Entity spawnSpawner(entityx::EntityManager& es, float x, float y, const ItemSpawner& spawner) {
+            entityx::Entity entity = es.create();
+            entity.assign<Position>(x, y, 0.0f);
+            entity.assign_from_copy<ItemSpawner>(spawner);
+            return entity;
+        }
+
+        void receive(const entityx::ComponentAddedEvent<Item>& event) {
+            entityx::Entity entity = event.entity;
+            itemCount++;
+            auto position = entity.component<Position>();
+            if (!position) return;
+            items.insert(entity.id(), glm::vec2(position->value.x, position->value.y));
+        }
+
+        void receive(const entityx::ComponentRemovedEvent<Item>& event) {
+            uint32_t index = event.entity.id().index();
+            items.remove(event.entity.id());
+            if (index < claimedBy.size()) {
+                claimedBy[index] = entityx::Entity::INVALID;
+            }
+            itemCount--;
+        }
+
+        void receive(const entityx::ComponentAddedEvent<ItemCache>& event) {
+            entityx::Entity entity = event.entity;
+            auto position = entity.component<Position>();
+            if (!position) return;
+            caches.insert(entity.id(), glm::vec2(position->value.x, position->value.y));
+        }
+
+        void receive(const entityx::ComponentRemovedEvent<ItemCache>& event) {
+            caches.remove(event.entity.id());
+        }
+
+        void receive(const entityx::ComponentAddedEvent<Forager>& event) {
+            arrived.push_back(event.entity.id());
+        }
+
+        // Looked at in the next update; most are foragers done with a trip
+        void receive(const entityx::ComponentRemovedEvent<Job>& event) {
+            arrived.push_back(event.entity.id());
+        }
+
+        void setTextures(TextureHandle item, TextureHandle cache) {
+            itemTexture = item;
+            cacheTexture = cache;
+        }
+
+        // The item forager is on its way to pick up, or INVALID
+        entityx::Entity::Id claimedItem(entityx::Entity::Id forager) const {
+            return reservation(forager);
+        }
+
+        // Hands item to forager as if it had claimed it, for restoring a snapshot
+        void adoptClaim(entityx::Entity::Id item, entityx::Entity::Id forager) {
+            if (!claimed(item)) claim(item, forager);
+        }
+
+        size_t totalItems() const { return itemCount; }
+        size_t unclaimedItems() const { return items.size(); }
+        size_t waitingForagers() const { return waiting.size(); }
+
+        const ForagingStats& stats() const { return totals; }
+        void resetStats() { totals = ForagingStats(); }
+
+        ForagingSettings& getSettings() { return settings; }
+
+    private:
+        struct Decision {
+            entityx::Entity::Id id;
+            glm::vec2 position;
+            bool deposit;
+        };
+
+        void spawn(entityx::EntityManager& es, float dt) {
+            drops.clear();
+            es.each<Position, ItemSpawner>([this, dt](entityx::Entity, Position& position, ItemSpawner& spawner) {
+                spawner.timer += dt;
+                while (spawner.timer >= spawner.interval) {
+                    spawner.timer -= spawner.interval;
+                    if (itemCount + drops.size() >= settings.maxItems) continue;
+                    float angle = random.range(0.0f, 6.2831853f);
+                    float distance = spawner.radius * std::sqrt(random.uniform());
+                    glm::vec2 at(position.value.x + std::cos(angle) * distance, position.value.y + std::sin(angle) * distance);
+                    drops.push_back(std::make_pair(glm::clamp(at, glm::vec2(-0.95f), glm::vec2(0.95f)), spawner.amount));
+                }
+            });
+            // created after the loop, since creating entities may move the components it is walking
+            for (auto& drop : drops) {
+                spawnItem(es, drop.first.x, drop.first.y, drop.second);
+            }
+        }
+
+        // Foragers whose job just ended (or that just became foragers): pick
+        // up or drop off if they got there, hand back any claim, and queue
+        // them for a new decision
+        void settle(entityx::EntityManager& es) {
+            std::sort(arrived.begin(), arrived.end());
+            arrived.erase(std::unique(arrived.begin(), arrived.end()), arrived.end());
+            for (auto id : arrived) {
+                if (!es.valid(id)) continue;
+                entityx::Entity entity = es.get(id);
+                auto forager = entity.component<Forager>();
+                if (!forager) continue;
+                auto job = entity.component<Job>();
+                if (job) {
+                    // a player order replaced the trip
+                    if (job->type != JobType::CollectItem) release(es, id);
+                    continue;
+                }
+
+                glm::vec3 position = entity.component<Position>()->value;
+                entityx::Entity::Id itemId = reservation(id);
+                if (itemId != entityx::Entity::INVALID && es.valid(itemId)) {
+                    entityx::Entity item = es.get(itemId);
+                    auto stock = item.component<Item>();
+                    auto at = item.component<Position>();
+                    if (stock && at && glm::length(at->value - position) <= settings.pickupRadius * 2) {
+                        uint taken = std::min(stock->amount, forager->capacity - forager->carried);
+                        forager->carried += taken;
+                        stock->amount -= taken;
+                        totals.pickups++;
+                        if (stock->amount == 0) {
+                            reserved[id.index()] = entityx::Entity::INVALID;
+                            item.destroy();
+                        }
+                    }
+                }
+                release(es, id);
+
+                if (forager->carried > 0) {
+                    caches.forEachInRadiusWhile(glm::vec2(position.x, position.y), settings.depositRadius,
+                        [&](const SpatialGrid::Entry& entry) {
+                            es.get(entry.id).component<ItemCache>()->stored += forager->carried;
+                            forager->carried = 0;
+                            totals.deposits++;
+                            return false;
+                        });
+                }
+                enqueue(id);
+            }
+            arrived.clear();
+        }
+
+        void decide(entityx::EntityManager& es) {
+            deciding.clear();
+            while (deciding.size() < settings.maxDecisionsPerTick && !waiting.empty()) {
+                auto id = waiting.front();
+                waiting.pop_front();
+                queued[id.index()] = 0;
+                if (!es.valid(id)) continue;
+                entityx::Entity entity = es.get(id);
+                auto forager = entity.component<Forager>();
+                if (!forager || entity.has_component<Job>()) continue;
+                glm::vec3 position = entity.component<Position>()->value;
+                deciding.push_back(Decision { id, glm::vec2(position.x, position.y), forager->carried > 0 });
+            }
+            if (deciding.empty()) return;
+
+            // the searches only read the grids, so they run in parallel
+            size_t k = std::max<size_t>(1, settings.candidates);
+            candidates.resize(deciding.size() * k);
+            direct.assign(deciding.size() * k, 0);
+            counts.assign(deciding.size(), 0);
+            pool.parallelFor(deciding.size(), 64, [this, k](size_t begin, size_t end) {
+                std::vector<SpatialGrid::Entry> found;
+                float range = settings.directRange * settings.directRange;
+                for (size_t i = begin; i < end; i++) {
+                    const Decision& d = deciding[i];
+                    if (d.deposit) {
+                        caches.nearest(d.position, 1, found);
+                    } else {
+                        items.nearest(d.position, k, found);
+                    }
+                    std::copy(found.begin(), found.end(), candidates.begin() + i * k);
+                    counts[i] = (uint32_t) found.size();
+                    if (d.deposit) continue;
+                    for (size_t c = 0; c < found.size(); c++) {
+                        glm::vec2 offset = found[c].position - d.position;
+                        bool near = glm::dot(offset, offset) <= range;
+                        direct[i * k + c] = near && (!map || map->clearLine(d.position, found[c].position));
+                    }
+                }
+            });
+
+            // claims in entity order, so the outcome does not depend on the threads
+            totals.decisions += deciding.size();
+            for (size_t i = 0; i < deciding.size(); i++) {
+                const Decision& d = deciding[i];
+                entityx::Entity entity = es.get(d.id);
+                const SpatialGrid::Entry* chosen = nullptr;
+                bool straight = false;
+                for (uint32_t c = 0; c < counts[i]; c++) {
+                    const SpatialGrid::Entry& candidate = candidates[i * k + c];
+                    if (d.deposit || !claimed(candidate.id)) {
+                        chosen = &candidate;
+                        straight = direct[i * k + c] != 0;
+                        break;
+                    }
+                    totals.conflicts++;
+                }
+                if (!chosen) {
+                    totals.starved++;
+                    enqueue(d.id);
+                    continue;
+                }
+
+                Job job(glm::vec3(chosen->position, 0.0f), d.deposit ? JobType::DepositItem : JobType::CollectItem);
+                if (d.deposit) {
+                    job.arriveRadius = settings.depositRadius * 0.5f;
+                    job.groupRadius = settings.depositRadius;
+                } else {
+                    job.arriveRadius = settings.pickupRadius;
+                    job.direct = straight;
+                    claim(chosen->id, d.id);
+                }
+                entity.assign_from_copy<Job>(job);
+            }
+        }
+
+        bool claimed(entityx::Entity::Id item) const {
+            return item.index() < claimedBy.size() && claimedBy[item.index()] != entityx::Entity::INVALID;
+        }
+
+        void claim(entityx::Entity::Id item, entityx::Entity::Id forager) {
+            if (item.index() >= claimedBy.size()) {
+                claimedBy.resize(item.index() + 1, entityx::Entity::INVALID);
+            }
+            if (forager.index() >= reserved.size()) {
+                reserved.resize(forager.index() + 1, entityx::Entity::INVALID);
+            }
+            claimedBy[item.index()] = forager;
+            reserved[forager.index()] = item;
+            items.remove(item);
+        }
+
+        entityx::Entity::Id reservation(entityx::Entity::Id forager) const {
+            return forager.index() < reserved.size() ? reserved[forager.index()] : entityx::Entity::INVALID;
+        }
+
+        // Gives the forager's claimed item, if it still exists, back to the grid
+        void release(entityx::EntityManager& es, entityx::Entity::Id forager) {
+            entityx::Entity::Id item = reservation(forager);
+            if (item == entityx::Entity::INVALID) return;
+            reserved[forager.index()] = entityx::Entity::INVALID;
+            if (!es.valid(item) || item.index() >= claimedBy.size() || claimedBy[item.index()] != forager) return;
+
+            claimedBy[item.index()] = entityx::Entity::INVALID;
+            auto position = es.get(item).component<Position>();
+            if (position) {
+                items.insert(item, glm::vec2(position->value.x, position->value.y));
+            }
+        }
+
+        void enqueue(entityx::Entity::Id forager) {
+            if (forager.index() >= queued.size()) {
+                queued.resize(forager.index() + 1, 0);
+            }
+            if (queued[forager.index()]) return;
+            queued[forager.index()] = 1;
+            waiting.push_back(forager);
+        }
+
+        ThreadPool& pool;
+        Random& random;
+        const GridMap* map;
+        SpatialGrid items;  // unclaimed only
+        SpatialGrid caches;
+        ForagingSettings settings;
+        ForagingStats totals;
+        TextureHandle itemTexture = INVALID_TEXTURE, cacheTexture = INVALID_TEXTURE;
+        size_t itemCount = 0;
+
+        std::vector<entityx::Entity::Id> claimedBy; // by item index
+        std::vector<entityx::Entity::Id> reserved;  // by forager index
+        std::vector<entityx::Entity::Id> arrived;
+        std::deque<entityx::Entity::Id> waiting;
+        std::vector<uint8_t> queued;                // by forager index, whether in waiting
+
+        std::vector<Decision> deciding;
+        std::vector<SpatialGrid::Entry> candidates;
+        std::vector<uint8_t> direct; // alongside candidates
+        std::vector<uint32_t> counts;
+        std::vector<std::pair<glm::vec2, uint>> drops;
+    };
+}
+
+#endif//RTS_FORAGING_H
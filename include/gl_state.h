@@ -0,0 +1,184 @@
+#ifndef RTS_GL_STATE_H
+#define RTS_GL_STATE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <glad/glad.h>
+
+namespace engine {
+
+    struct GLBindStats {
+        uint64_t issued = 0;
+        uint64_t skipped = 0;
+    };
+
+    // Shadows the GL binding state so binds that would change nothing are never
+    // issued. Every program, vertex array, array buffer and texture bind in the
+    // renderer goes through here; anything that binds behind its back must call
+    // invalidate() afterwards. Deleting an object has to be reported through
+    // the matching deleted*() call, since GL reuses names.
+    //
+    // The element array buffer binding belongs to the vertex array, so it is
+    // forgotten whenever the vertex array changes.
+    class GLState {
+    public:
+        enum Kind { PROGRAM, VERTEX_ARRAY, ARRAY_BUFFER, ELEMENT_BUFFER, TEXTURE, ACTIVE_TEXTURE, KIND_COUNT };
+
+        static const uint MAX_TEXTURE_UNITS = 16;
+
+        static GLState& instance() {
+            static GLState state;
+            return state;
+        }
+
+        void useProgram(uint program) {
+            if (track(PROGRAM, program, _program)) glUseProgram(program);
+        }
+
+        void bindVertexArray(uint vao) {
+            if (track(VERTEX_ARRAY, vao, _vertexArray)) {
+                glBindVertexArray(vao);
+                _elementBuffer = UNKNOWN;
+            }
+        }
+
+        void bindBuffer(GLenum target, uint buffer) {
+            if (target == GL_ARRAY_BUFFER) {
+                if (track(ARRAY_BUFFER, buffer, _arrayBuffer)) glBindBuffer(target, buffer);
+            } else if (target == GL_ELEMENT_ARRAY_BUFFER) {
+                if (track(ELEMENT_BUFFER, buffer, _elementBuffer)) glBindBuffer(target, buffer);
+            } else {
+                glBindBuffer(target, buffer);
+            }
+        }
+
+        // Only GL_TEXTURE_2D bindings are tracked
+        void bindTexture(uint texture, uint unit = 0) {
+            if (unit >= MAX_TEXTURE_UNITS) {
+                activeTexture(unit);
+                glBindTexture(GL_TEXTURE_2D, texture);
+                return;
+            }
+            if (_textures[unit] == texture) {
+                _stats[TEXTURE].skipped++;
+                return;
+            }
+            activeTexture(unit);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            _textures[unit] = texture;
+            _stats[TEXTURE].issued++;
+        }
+
+        void deletedProgram(uint program) {
+            if (_program == program) _program = UNKNOWN;
+        }
+
+        void deletedVertexArray(uint vao) {
+            if (_vertexArray == vao) {
+                _vertexArray = UNKNOWN;
+                _elementBuffer = UNKNOWN;
+            }
+        }
+
+        void deletedBuffer(uint buffer) {
+            if (_arrayBuffer == buffer) _arrayBuffer = UNKNOWN;
+            if (_elementBuffer == buffer) _elementBuffer = UNKNOWN;
+        }
+
+        void deletedTexture(uint texture) {
+            for (auto& bound : _textures) {
+                if (bound == texture) bound = UNKNOWN;
+            }
+        }
+
+        // Forgets everything, so the next bind of each kind is always issued
+        void invalidate() {
+            _program = _vertexArray = _arrayBuffer = _elementBuffer = _activeTexture = UNKNOWN;
+            for (auto& bound : _textures) {
+                bound = UNKNOWN;
+            }
+        }
+
+        // Compares the shadow state with what GL reports and prints any
+        // mismatch. Slow (it stalls on the driver); meant for --gl-stats runs.
+        bool verify(FILE* out) const {
+            bool ok = true;
+            auto check = [&](const char* name, GLenum query, uint expected) {
+                if (expected == UNKNOWN) return;
+                GLint actual = 0;
+                glGetIntegerv(query, &actual);
+                if ((uint) actual != expected) {
+                    fprintf(out, "GLState: %s is %d, expected %u\n", name, actual, expected);
+                    ok = false;
+                }
+            };
+            check("program", GL_CURRENT_PROGRAM, _program);
+            check("vertex array", GL_VERTEX_ARRAY_BINDING, _vertexArray);
+            check("array buffer", GL_ARRAY_BUFFER_BINDING, _arrayBuffer);
+            check("element buffer", GL_ELEMENT_ARRAY_BUFFER_BINDING, _elementBuffer);
+            check("active texture", GL_ACTIVE_TEXTURE, _activeTexture == UNKNOWN ? UNKNOWN : GL_TEXTURE0 + _activeTexture);
+            if (_activeTexture < MAX_TEXTURE_UNITS) {
+                check("texture", GL_TEXTURE_BINDING_2D, _textures[_activeTexture]);
+            }
+            return ok;
+        }
+
+        const GLBindStats& stats(Kind kind) const { return _stats[kind]; }
+
+        GLBindStats total() const {
+            GLBindStats total;
+            for (auto& stats : _stats) {
+                total.issued += stats.issued;
+                total.skipped += stats.skipped;
+            }
+            return total;
+        }
+
+        void resetStats() {
+            for (auto& stats : _stats) {
+                stats = GLBindStats();
+            }
+        }
+
+        void writeStats(FILE* out, uint64_t frames) const {
+            static const char* names[KIND_COUNT] = {
+                "program", "vertex array", "array buffer", "element buffer", "texture", "active texture"
+            };
+            double perFrame = frames > 0 ? 1.0 / frames : 0.0;
+            fprintf(out, "%-16s %14s %14s\n", "binds per frame", "issued", "skipped");
+            for (int kind = 0; kind < KIND_COUNT; kind++) {
+                fprintf(out, "%-16s %14.1f %14.1f\n", names[kind],
+                        _stats[kind].issued * perFrame, _stats[kind].skipped * perFrame);
+            }
+            GLBindStats all = total();
+            fprintf(out, "%-16s %14.1f %14.1f\n", "total", all.issued * perFrame, all.skipped * perFrame);
+        }
+
+    private:
+        enum : uint { UNKNOWN = 0xffffffffu };
+
+        GLState() {
+            invalidate();
+        }
+
+        bool track(Kind kind, uint value, uint& bound) {
+            if (bound == value) {
+                _stats[kind].skipped++;
+                return false;
+            }
+            bound = value;
+            _stats[kind].issued++;
+            return true;
+        }
+
+        void activeTexture(uint unit) {
+            if (track(ACTIVE_TEXTURE, unit, _activeTexture)) glActiveTexture(GL_TEXTURE0 + unit);
+        }
+
+        uint _program, _vertexArray, _arrayBuffer, _elementBuffer, _activeTexture;
+        uint _textures[MAX_TEXTURE_UNITS];
+        GLBindStats _stats[KIND_COUNT];
+    };
+}
+
+#endif//RTS_GL_STATE_H
@@ -0,0 +1,68 @@
+#ifndef RTS_IMAGE_DECODER_H
+#define RTS_IMAGE_DECODER_H
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+
+#include <profiler.h>
+#include <thread_pool.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+namespace engine {
+
+    // An image decoded to tightly packed RGBA8, or no pixels if it failed
+    struct DecodedImage {
+        std::string filename;
+        uint width = 0, height = 0;
+        std::shared_ptr<unsigned char> pixels;
+
+        bool ok() const { return pixels != nullptr; }
+        size_t bytes() const { return (size_t) width * height * 4; }
+    };
+
+    // Decodes images on a ThreadPool. Knows nothing about GL so that decode
+    // throughput can be measured headless; uploading is the TextureManager's job.
+    class ImageDecoder {
+    public:
+        explicit ImageDecoder(ThreadPool& pool) : pool(pool) {}
+
+        // Decodes on the calling thread. stbi_load keeps no shared state once
+        // its global flags are left alone, so any number of these can run at once.
+        static DecodedImage decodeNow(const std::string& filename) {
+            RTS_PROFILE_ZONE("stbi_load");
+            DecodedImage image;
+            image.filename = filename;
+            int width, height, numChannels;
+            unsigned char* data = stbi_load(filename.c_str(), &width, &height, &numChannels, 4);
+            if (data) {
+                image.width = (uint) width;
+                image.height = (uint) height;
+                image.pixels.reset(data, [](unsigned char* pixels) { stbi_image_free(pixels); });
+            }
+            return image;
+        }
+
+        // Queues the decode on the pool; with a pool of no threads it runs before returning
+        std::future<DecodedImage> decode(const std::string& filename) {
+            auto promise = std::make_shared<std::promise<DecodedImage>>();
+            std::future<DecodedImage> future = promise->get_future();
+            pool.submit([promise, filename]() { promise->set_value(decodeNow(filename)); });
+            return future;
+        }
+
+        // Blocks until future is ready, decoding queued images on the calling thread meanwhile
+        DecodedImage wait(std::future<DecodedImage>& future) {
+            pool.waitUntil([&future]() { return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready; });
+            return future.get();
+        }
+
+    private:
+        ThreadPool& pool;
+    };
+}
+
+#endif//RTS_IMAGE_DECODER_H
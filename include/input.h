@@ -1,14 +1,49 @@
 #ifndef RTS_INPUT_H
 #define RTS_INPUT_H
 
+#include <cstdint>
 #include <vector>
 #include <iostream>
 #include <exception>
 #include <functional>
 #include <GLFW/glfw3.h>
 
+#include <profiler.h>
+
 namespace engine {
 
+    enum class InputEventType : uint8_t {
+        Key,
+        CursorPos,
+        MouseButton,
+        Scroll,
+        Resize,
+    };
+
+    // One GLFW callback, as recorded by InputManager until the next dispatch()
+    struct InputEvent {
+        InputEventType type;
+        int code = 0;     // key or mouse button
+        int scancode = 0;
+        int action = 0;
+        int mods = 0;
+        double x = 0, y = 0; // cursor position, scroll offset or window size
+
+        InputEvent(InputEventType type) : type(type) {}
+    };
+
+    struct InputStats {
+        uint64_t received = 0;
+        uint64_t dispatched = 0;
+    };
+
+    // GLFW's callbacks only record events into a per-frame buffer; dispatch()
+    // then runs the registered callbacks once per frame. Consecutive cursor
+    // moves collapse into the last one (and with them the drag-moved
+    // callbacks), as do consecutive scrolls and resizes, so a 1000 Hz mouse
+    // costs one selection update per frame rather than one per report. Key
+    // and button events are never merged and keep their order relative to
+    // the cursor, so a click still lands where the cursor was at the time.
     class InputManager {
     public:
         InputManager(GLFWwindow* window) : _window(window) {
@@ -20,21 +55,63 @@ namespace engine {
             glfwSetKeyCallback(_window, KEY_CALLBACK);
             glfwSetCursorPosCallback(_window, CURSOR_POS_CALLBACK);
             glfwSetMouseButtonCallback(_window, MOUSE_BUTTON_CALLBACK);
+            glfwSetScrollCallback(_window, SCROLL_CALLBACK);
+            glfwSetWindowSizeCallback(_window, WINDOW_SIZE_CALLBACK);
         }
 
         using KeyCallback = std::function<void(InputManager* input, int key, int scancode, int action, int mods)>;
         using CursorPosCallback = std::function<void(InputManager* input, double xpos, double ypos)>;
         using MouseButtonCallback = std::function<void(InputManager* input, int button, int action, int mods)>;
         using DragCallback = std::function<void(InputManager* input, double startedX, double startedY, double endedX, double endedY)>;
+        using ScrollCallback = std::function<void(InputManager* input, double xoffset, double yoffset)>;
+        // Window size in screen coordinates, the same units as the cursor
+        using ResizeCallback = std::function<void(InputManager* input, int width, int height)>;
+
+        void registerKeyCallback(KeyCallback callback) { _keyCallbacks.push_back(std::move(callback)); }
+        void registerCursorPosCallback(CursorPosCallback callback) { _cursorPosCallbacks.push_back(std::move(callback)); }
+        void registerMouseButtonCallback(MouseButtonCallback callback) { _mouseButtonCallbacks.push_back(std::move(callback)); }
+        void registerMouseButtonJustPressedCallback(MouseButtonCallback callback) { _mouseButtonJustPressedCallbacks.push_back(std::move(callback)); }
+
+        void registerDragStartedCallback(DragCallback callback) { _dragStartedCallbacks.push_back(std::move(callback)); }
+        void registerDragMovedCallback(DragCallback callback) { _dragMovedCallbacks.push_back(std::move(callback)); }
+        void registerDragEndedCallback(DragCallback callback) { _dragEndedCallbacks.push_back(std::move(callback)); }
+
+        void registerScrollCallback(ScrollCallback callback) { _scrollCallbacks.push_back(std::move(callback)); }
+        void registerResizeCallback(ResizeCallback callback) { _resizeCallbacks.push_back(std::move(callback)); }
+
+        double getCursorX() const { return cursorX; }
+        double getCursorY() const { return cursorY; }
+
+        // Runs the callbacks for everything recorded since the last call.
+        // Call once per frame, after glfwPollEvents().
+        void dispatch() {
+            RTS_PROFILE_ZONE("input.dispatch");
+            // a callback may poll events itself; anything it records waits for the next frame
+            _dispatching.swap(_pending);
+            _pending.clear();
+            for (auto& event : _dispatching) {
+                switch (event.type) {
+                    case InputEventType::Key:
+                        for (auto& c : _keyCallbacks) c(this, event.code, event.scancode, event.action, event.mods);
+                        break;
+                    case InputEventType::CursorPos:
+                        dispatchCursorPos(event.x, event.y);
+                        break;
+                    case InputEventType::MouseButton:
+                        dispatchMouseButton(event.code, event.action, event.mods);
+                        break;
+                    case InputEventType::Scroll:
+                        for (auto& c : _scrollCallbacks) c(this, event.x, event.y);
+                        break;
+                    case InputEventType::Resize:
+                        for (auto& c : _resizeCallbacks) c(this, (int) event.x, (int) event.y);
+                        break;
+                }
+            }
+            _stats.dispatched += _dispatching.size();
+        }
 
-        void registerKeyCallback(KeyCallback callback) { _keyCallbacks.push_back(callback); }
-        void registerCursorPosCallback(CursorPosCallback callback) { _cursorPosCallbacks.push_back(callback); }
-        void registerMouseButtonCallback(MouseButtonCallback callback) { _mouseButtonCallbacks.push_back(callback); }
-        void registerMouseButtonJustPressedCallback(MouseButtonCallback callback) { _mouseButtonJustPressedCallbacks.push_back(callback); }
-
-        void registerDragStartedCallback(DragCallback callback) { _dragStartedCallbacks.push_back(callback); }
-        void registerDragMovedCallback(DragCallback callback) { _dragMovedCallbacks.push_back(callback); }
-        void registerDragEndedCallback(DragCallback callback) { _dragEndedCallbacks.push_back(callback); }
+        const InputStats& stats() const { return _stats; }
 
     private:
         GLFWwindow* _window;
@@ -49,52 +126,115 @@ namespace engine {
         std::vector<DragCallback> _dragMovedCallbacks;
         std::vector<DragCallback> _dragEndedCallbacks;
 
-        double cursorX, cursorY;
-        double dragStartX, dragStartY;
+        std::vector<ScrollCallback> _scrollCallbacks;
+        std::vector<ResizeCallback> _resizeCallbacks;
+
+        std::vector<InputEvent> _pending;
+        std::vector<InputEvent> _dispatching;
+        InputStats _stats;
+
+        double cursorX = 0, cursorY = 0;
+        double dragStartX = 0, dragStartY = 0;
         bool isDragActive = false;
 
-        bool mouseButtonsPressed[GLFW_MOUSE_BUTTON_LAST + 1];
+        bool mouseButtonsPressed[GLFW_MOUSE_BUTTON_LAST + 1] = {};
 
-        static void KEY_CALLBACK(GLFWwindow* window, int key, int scancode, int action, int mods) {
+        static InputManager* from(GLFWwindow* window) {
             auto input = reinterpret_cast<InputManager*>(glfwGetWindowUserPointer(window));
-            for (auto c : input->_keyCallbacks) c(input, key, scancode, action, mods);
+            input->_stats.received++;
+            return input;
         }
 
-        static void CURSOR_POS_CALLBACK(GLFWwindow* window, double xpos, double ypos) {
-            auto input = reinterpret_cast<InputManager*>(glfwGetWindowUserPointer(window));
-            for (auto c : input->_cursorPosCallbacks) c(input, xpos, ypos);
+        // The last pending event if it has the given type, for merging into
+        InputEvent* mergeable(InputEventType type) {
+            if (_pending.empty() || _pending.back().type != type) return nullptr;
+            return &_pending.back();
+        }
+
+        void dispatchCursorPos(double xpos, double ypos) {
+            for (auto& c : _cursorPosCallbacks) c(this, xpos, ypos);
 
-            input->cursorX = xpos;
-            input->cursorY = ypos;
+            cursorX = xpos;
+            cursorY = ypos;
 
-            if (input->isDragActive) {
-                for (auto c : input->_dragMovedCallbacks) c(input, input->dragStartX, input->dragStartY, xpos, ypos);
+            if (isDragActive) {
+                for (auto& c : _dragMovedCallbacks) c(this, dragStartX, dragStartY, xpos, ypos);
             }
         }
 
-        static void MOUSE_BUTTON_CALLBACK(GLFWwindow* window, int button, int action, int mods) {
-            auto input = reinterpret_cast<InputManager*>(glfwGetWindowUserPointer(window));
-            if (!input->mouseButtonsPressed[button] && action == GLFW_PRESS) {
-                for (auto c : input->_mouseButtonJustPressedCallbacks) c(input, button, action, mods);
+        void dispatchMouseButton(int button, int action, int mods) {
+            if (button < 0 || button > GLFW_MOUSE_BUTTON_LAST) return;
+            if (!mouseButtonsPressed[button] && action == GLFW_PRESS) {
+                for (auto& c : _mouseButtonJustPressedCallbacks) c(this, button, action, mods);
             }
 
             bool isActionPressed = action == GLFW_PRESS;
-            input->mouseButtonsPressed[button] = isActionPressed;
+            mouseButtonsPressed[button] = isActionPressed;
 
-            for (auto c : input->_mouseButtonCallbacks) c(input, button, action, mods);
+            for (auto& c : _mouseButtonCallbacks) c(this, button, action, mods);
 
             bool isLeftMouseButtonPressed = isActionPressed && button == GLFW_MOUSE_BUTTON_LEFT;
             if (isLeftMouseButtonPressed) {
-                input->dragStartX = input->cursorX;
-                input->dragStartY = input->cursorY;
-                input->isDragActive = true;
-                for (auto c : input->_dragStartedCallbacks) c(input, input->dragStartX, input->dragStartY, input->cursorX, input->cursorY);
+                dragStartX = cursorX;
+                dragStartY = cursorY;
+                isDragActive = true;
+                for (auto& c : _dragStartedCallbacks) c(this, dragStartX, dragStartY, cursorX, cursorY);
             } else {
-                for (auto c : input->_dragEndedCallbacks) c(input, input->dragStartX, input->dragStartY, input->cursorX, input->cursorY);
-                input->isDragActive = false;
+                for (auto& c : _dragEndedCallbacks) c(this, dragStartX, dragStartY, cursorX, cursorY);
+                isDragActive = false;
+            }
+        }
+
+        static void KEY_CALLBACK(GLFWwindow* window, int key, int scancode, int action, int mods) {
+            InputEvent event(InputEventType::Key);
+            event.code = key;
+            event.scancode = scancode;
+            event.action = action;
+            event.mods = mods;
+            from(window)->_pending.push_back(event);
+        }
+
+        static void CURSOR_POS_CALLBACK(GLFWwindow* window, double xpos, double ypos) {
+            auto input = from(window);
+            InputEvent* last = input->mergeable(InputEventType::CursorPos);
+            if (!last) {
+                input->_pending.push_back(InputEvent(InputEventType::CursorPos));
+                last = &input->_pending.back();
+            }
+            last->x = xpos;
+            last->y = ypos;
+        }
+
+        static void MOUSE_BUTTON_CALLBACK(GLFWwindow* window, int button, int action, int mods) {
+            InputEvent event(InputEventType::MouseButton);
+            event.code = button;
+            event.action = action;
+            event.mods = mods;
+            from(window)->_pending.push_back(event);
+        }
+
+        static void SCROLL_CALLBACK(GLFWwindow* window, double xoffset, double yoffset) {
+            auto input = from(window);
+            InputEvent* last = input->mergeable(InputEventType::Scroll);
+            if (!last) {
+                input->_pending.push_back(InputEvent(InputEventType::Scroll));
+                last = &input->_pending.back();
+            }
+            last->x += xoffset;
+            last->y += yoffset;
+        }
+
+        static void WINDOW_SIZE_CALLBACK(GLFWwindow* window, int width, int height) {
+            auto input = from(window);
+            InputEvent* last = input->mergeable(InputEventType::Resize);
+            if (!last) {
+                input->_pending.push_back(InputEvent(InputEventType::Resize));
+                last = &input->_pending.back();
             }
+            last->x = width;
+            last->y = height;
         }
     };
 }
 
-#endif//RTS_INPUT_H
\ No newline at end of file
+#endif//RTS_INPUT_H
@@ -0,0 +1,123 @@
+#ifndef RTS_LOD_H
+#define RTS_LOD_H
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <entityx/entityx.h>
+
+#include <camera.h>
+#include <components.h>
+#include <selection_set.h>
+
+namespace engine {
+
+    // How much attention a unit gets, most first
+    enum class LodBucket : uint8_t {
+        Visible,  // on screen (or no view set, as when running headless)
+        Selected, // off screen but selected, so about to be given orders
+        Moving,   // off screen and awake
+        Idle,     // asleep
+    };
+
+    struct LodSettings {
+        uint offscreenInterval = 4; // Moving units are presented every this many ticks
+        float viewMargin = 0.1f;    // counted as visible this far outside the view
+    };
+
+    // Simulation level of detail, in two parts.
+    //
+    // Sleep: a unit standing still with no job cannot move until something
+    // gives it a job, so MovementSystem puts it to sleep and movement,
+    // orientation and avoidance skip it entirely rather than looking at it
+    // every tick. Adding a Job or a Velocity wakes it. Whoever writes a
+    // sleeping unit's Velocity by hand must wake() it.
+    //
+    // Buckets: presentation-only work (sprite orientation) is done every
+    // tick for Visible and Selected units and every offscreenInterval ticks
+    // for Moving ones, a round-robin slice by entity index each tick, so the
+    // cost follows what the player can see. Anything that feeds the state
+    // hash runs at full rate for every awake unit whatever the camera does,
+    // or replays would depend on where the player was looking.
+    class SimulationLod : public entityx::Receiver<SimulationLod> {
+    public:
+        explicit SimulationLod(LodSettings settings = LodSettings()) : settings(settings) {}
+
+        void configure(entityx::EventManager& eventManager) {
+            eventManager.subscribe<entityx::ComponentAddedEvent<Velocity>>(*this);
+            eventManager.subscribe<entityx::ComponentRemovedEvent<Velocity>>(*this);
+            eventManager.subscribe<entityx::ComponentAddedEvent<Job>>(*this);
+            eventManager.subscribe<entityx::EntityDestroyedEvent>(*this);
+        }
+
+        void receive(const entityx::ComponentAddedEvent<Velocity>& event) {
+            wake(event.entity.id());
+        }
+
+        void receive(const entityx::ComponentRemovedEvent<Velocity>& event) {
+            sleep(event.entity.id());
+        }
+
+        void receive(const entityx::ComponentAddedEvent<Job>& event) {
+            if (event.entity.has_component<Velocity>()) wake(event.entity.id());
+        }
+
+        void receive(const entityx::EntityDestroyedEvent& event) {
+            sleep(event.entity.id());
+        }
+
+        void wake(entityx::Entity::Id id) { if (awake.insert(id)) changeCount++; }
+        void sleep(entityx::Entity::Id id) { if (awake.erase(id)) changeCount++; }
+        bool isAwake(entityx::Entity::Id id) const { return awake.contains(id); }
+
+        // Goes up whenever a unit wakes or sleeps, so anything that follows
+        // the awake set (UnitChunks) can tell when it has nothing to catch up on
+        uint64_t changes() const { return changeCount; }
+
+        // The awake units, in no particular order
+        const SelectionSet& awakeUnits() const { return awake; }
+
+        // The selection counts towards the Selected bucket
+        void setSelection(const SelectionSet* selection) { this->selection = selection; }
+
+        // What the player can see this frame; until set, everything is Visible
+        void setView(const ViewRect& view) {
+            this->view = view.expanded(settings.viewMargin);
+            hasView = true;
+        }
+
+        void clearView() { hasView = false; }
+
+        LodBucket bucket(entityx::Entity::Id id, glm::vec2 position) const {
+            if (!awake.contains(id)) return LodBucket::Idle;
+            if (!hasView || view.contains(position)) return LodBucket::Visible;
+            if (selection && selection->contains(id)) return LodBucket::Selected;
+            return LodBucket::Moving;
+        }
+
+        // Whether a unit in bucket gets its presentation update on tick
+        bool due(LodBucket bucket, entityx::Entity::Id id, uint64_t tick) const {
+            switch (bucket) {
+                case LodBucket::Visible:
+                case LodBucket::Selected:
+                    return true;
+                case LodBucket::Moving:
+                    return settings.offscreenInterval <= 1 || (id.index() + tick) % settings.offscreenInterval == 0;
+                default:
+                    return false;
+            }
+        }
+
+        const LodSettings& getSettings() const { return settings; }
+        void setSettings(const LodSettings& settings) { this->settings = settings; }
+
+    private:
+        LodSettings settings;
+        SelectionSet awake; // any sparse set of ids does
+        uint64_t changeCount = 0;
+        const SelectionSet* selection = nullptr;
+        ViewRect view = ViewRect { glm::vec2(0.0f), glm::vec2(0.0f) };
+        bool hasView = false;
+    };
+}
+
+#endif//RTS_LOD_H
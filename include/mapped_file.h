@@ -0,0 +1,83 @@
+#ifndef RTS_MAPPED_FILE_H
+#define RTS_MAPPED_FILE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace engine {
+
+    // The binary formats mapped with MappedFile are little-endian and read in place
+    inline bool hostIsLittleEndian() {
+        uint16_t one = 1;
+        unsigned char first;
+        memcpy(&first, &one, 1);
+        return first == 1;
+    }
+
+    // Read-only view of a whole file, mapped where the platform allows it
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+            FILE* file = fopen(path.c_str(), "rb");
+            if (!file) return;
+            fseek(file, 0, SEEK_END);
+            long size = ftell(file);
+            fseek(file, 0, SEEK_SET);
+            if (size > 0) {
+                buffer.resize((size_t) size);
+                if (fread(buffer.data(), 1, buffer.size(), file) == buffer.size()) {
+                    _data = buffer.data();
+                    _size = buffer.size();
+                }
+            }
+            fclose(file);
+#else
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0) return;
+            struct stat info;
+            if (fstat(fd, &info) == 0 && info.st_size > 0) {
+                void* mapped = mmap(nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped != MAP_FAILED) {
+                    madvise(mapped, (size_t) info.st_size, MADV_SEQUENTIAL);
+                    _data = static_cast<const unsigned char*>(mapped);
+                    _size = (size_t) info.st_size;
+                }
+            }
+            close(fd);
+#endif
+        }
+
+        ~MappedFile() {
+#ifndef _WIN32
+            if (_data) munmap(const_cast<unsigned char*>(_data), _size);
+#endif
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool ok() const { return _data != nullptr; }
+        const unsigned char* data() const { return _data; }
+        size_t size() const { return _size; }
+
+    private:
+        const unsigned char* _data = nullptr;
+        size_t _size = 0;
+#ifdef _WIN32
+        std::vector<unsigned char> buffer;
+#endif
+    };
+}
+
+#endif//RTS_MAPPED_FILE_H
@@ -0,0 +1,160 @@
+#ifndef RTS_MOVEMENT_KERNEL_H
+#define RTS_MOVEMENT_KERNEL_H
+
+#include <cstddef>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RTS_MOVEMENT_X86 1
+#include <immintrin.h>
+#endif
+
+namespace engine {
+
+    // Positions and velocities as structure-of-arrays, so the movement kernels
+    // can work on 4 or 8 units per instruction. The arrays belong to whoever
+    // runs the kernel: a chunk of UnitChunks, or MovementArrays.
+    struct MovementLanes {
+        float* px; float* py; float* pz;
+        float* vx; float* vy; float* vz;
+    };
+
+    // MovementLanes with arrays of their own, for checking the kernels against each other
+    struct MovementArrays {
+        void resize(size_t count) {
+            px.resize(count); py.resize(count); pz.resize(count);
+            vx.resize(count); vy.resize(count); vz.resize(count);
+        }
+
+        size_t size() const { return px.size(); }
+
+        MovementLanes lanes() {
+            return MovementLanes { px.data(), py.data(), pz.data(), vx.data(), vy.data(), vz.data() };
+        }
+
+        std::vector<float> px, py, pz;
+        std::vector<float> vx, vy, vz;
+    };
+
+    // Processes units [begin, end) so a range can be split across threads
+    typedef void (*MovementKernel)(const MovementLanes& lanes, size_t begin, size_t end, float dt);
+
+    // Integrates position += velocity * dt and reflects off the +-1 bounds. Every
+    // variant does the same float operations in the same order (a multiply then
+    // an add, never fused) so all of them produce bit-identical results; the
+    // build passes -ffp-contract=off to keep the compiler from fusing them.
+    namespace kernels {
+
+        inline void bounce(float& position, float& velocity) {
+            if (position > 1) {
+                position = 1;
+                velocity *= -1;
+            } else if (position < -1) {
+                position = -1;
+                velocity *= -1;
+            }
+        }
+
+        inline void integrateScalar(const MovementLanes& a, size_t begin, size_t end, float dt) {
+            float* px = a.px; float* py = a.py; float* pz = a.pz;
+            float* vx = a.vx; float* vy = a.vy; float* vz = a.vz;
+            for (size_t i = begin; i < end; i++) {
+                px[i] = px[i] + vx[i] * dt;
+                py[i] = py[i] + vy[i] * dt;
+                pz[i] = pz[i] + vz[i] * dt;
+                bounce(px[i], vx[i]);
+                bounce(py[i], vy[i]);
+            }
+        }
+
+#ifdef RTS_MOVEMENT_X86
+        // Clamp with the constant as the first operand so a NaN position stays NaN
+        // like it does in the scalar compare, and flip the velocity's sign bit
+        // wherever the clamp kicked in
+        __attribute__((target("sse2")))
+        inline void bounceSse(__m128& p, __m128& v) {
+            const __m128 one = _mm_set1_ps(1.0f);
+            const __m128 minusOne = _mm_set1_ps(-1.0f);
+            const __m128 sign = _mm_set1_ps(-0.0f);
+            __m128 outside = _mm_or_ps(_mm_cmpgt_ps(p, one), _mm_cmplt_ps(p, minusOne));
+            p = _mm_min_ps(one, _mm_max_ps(minusOne, p));
+            v = _mm_xor_ps(v, _mm_and_ps(outside, sign));
+        }
+
+        __attribute__((target("sse2")))
+        inline void integrateSse(const MovementLanes& a, size_t begin, size_t end, float dt) {
+            float* px = a.px; float* py = a.py; float* pz = a.pz;
+            float* vx = a.vx; float* vy = a.vy; float* vz = a.vz;
+            const __m128 step = _mm_set1_ps(dt);
+            size_t i = begin;
+            for (; i + 4 <= end; i += 4) {
+                __m128 x = _mm_loadu_ps(px + i), y = _mm_loadu_ps(py + i), z = _mm_loadu_ps(pz + i);
+                __m128 u = _mm_loadu_ps(vx + i), v = _mm_loadu_ps(vy + i), w = _mm_loadu_ps(vz + i);
+                x = _mm_add_ps(x, _mm_mul_ps(u, step));
+                y = _mm_add_ps(y, _mm_mul_ps(v, step));
+                z = _mm_add_ps(z, _mm_mul_ps(w, step));
+                bounceSse(x, u);
+                bounceSse(y, v);
+                _mm_storeu_ps(px + i, x); _mm_storeu_ps(py + i, y); _mm_storeu_ps(pz + i, z);
+                _mm_storeu_ps(vx + i, u); _mm_storeu_ps(vy + i, v);
+            }
+            integrateScalar(a, i, end, dt);
+        }
+
+        __attribute__((target("avx2")))
+        inline void bounceAvx2(__m256& p, __m256& v) {
+            const __m256 one = _mm256_set1_ps(1.0f);
+            const __m256 minusOne = _mm256_set1_ps(-1.0f);
+            const __m256 sign = _mm256_set1_ps(-0.0f);
+            __m256 outside = _mm256_or_ps(_mm256_cmp_ps(p, one, _CMP_GT_OQ), _mm256_cmp_ps(p, minusOne, _CMP_LT_OQ));
+            p = _mm256_min_ps(one, _mm256_max_ps(minusOne, p));
+            v = _mm256_xor_ps(v, _mm256_and_ps(outside, sign));
+        }
+
+        __attribute__((target("avx2")))
+        inline void integrateAvx2(const MovementLanes& a, size_t begin, size_t end, float dt) {
+            float* px = a.px; float* py = a.py; float* pz = a.pz;
+            float* vx = a.vx; float* vy = a.vy; float* vz = a.vz;
+            const __m256 step = _mm256_set1_ps(dt);
+            size_t i = begin;
+            for (; i + 8 <= end; i += 8) {
+                __m256 x = _mm256_loadu_ps(px + i), y = _mm256_loadu_ps(py + i), z = _mm256_loadu_ps(pz + i);
+                __m256 u = _mm256_loadu_ps(vx + i), v = _mm256_loadu_ps(vy + i), w = _mm256_loadu_ps(vz + i);
+                x = _mm256_add_ps(x, _mm256_mul_ps(u, step));
+                y = _mm256_add_ps(y, _mm256_mul_ps(v, step));
+                z = _mm256_add_ps(z, _mm256_mul_ps(w, step));
+                bounceAvx2(x, u);
+                bounceAvx2(y, v);
+                _mm256_storeu_ps(px + i, x); _mm256_storeu_ps(py + i, y); _mm256_storeu_ps(pz + i, z);
+                _mm256_storeu_ps(vx + i, u); _mm256_storeu_ps(vy + i, v);
+            }
+            integrateScalar(a, i, end, dt);
+        }
+#endif
+
+        struct Entry {
+            const char* name;
+            MovementKernel kernel;
+        };
+
+        // Every kernel the running CPU can execute, best last
+        inline std::vector<Entry> available() {
+            std::vector<Entry> result;
+            result.push_back(Entry { "scalar", integrateScalar });
+#ifdef RTS_MOVEMENT_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("sse2")) result.push_back(Entry { "sse2", integrateSse });
+            if (__builtin_cpu_supports("avx2")) result.push_back(Entry { "avx2", integrateAvx2 });
+#endif
+            return result;
+        }
+
+        inline Entry best() {
+            return available().back();
+        }
+    }
+}
+
+#endif//RTS_MOVEMENT_KERNEL_H
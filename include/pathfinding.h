@@ -0,0 +1,365 @@
+#ifndef RTS_PATHFINDING_H
+#define RTS_PATHFINDING_H
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace engine {
+
+    // Walkability of the world on a regular grid. Every change bumps version()
+    // so flow fields built against an older layout know they are stale.
+    class GridMap {
+    public:
+        GridMap(int columns = 64, int rows = 64, glm::vec2 min = glm::vec2(-1.0f), glm::vec2 max = glm::vec2(1.0f))
+            : _columns(columns), _rows(rows), _min(min), _cellSize((max - min) / glm::vec2(columns, rows)),
+              _blocked((size_t) (columns * rows), 0) {}
+
+        int columns() const { return _columns; }
+        int rows() const { return _rows; }
+        size_t cellCount() const { return _blocked.size(); }
+        uint64_t version() const { return _version; }
+
+        // The cell containing position, clamped to the map
+        glm::ivec2 cellOf(glm::vec2 position) const {
+            glm::ivec2 cell((position - _min) / _cellSize);
+            return glm::clamp(cell, glm::ivec2(0), glm::ivec2(_columns - 1, _rows - 1));
+        }
+
+        glm::vec2 center(glm::ivec2 cell) const {
+            return _min + (glm::vec2(cell) + 0.5f) * _cellSize;
+        }
+
+        bool contains(glm::ivec2 cell) const {
+            return cell.x >= 0 && cell.y >= 0 && cell.x < _columns && cell.y < _rows;
+        }
+
+        uint32_t index(glm::ivec2 cell) const {
+            return (uint32_t) (cell.y * _columns + cell.x);
+        }
+
+        bool blocked(glm::ivec2 cell) const {
+            return !contains(cell) || _blocked[index(cell)] != 0;
+        }
+
+        void setBlocked(glm::ivec2 cell, bool blocked) {
+            if (!contains(cell) || (_blocked[index(cell)] != 0) == blocked) return;
+            _blocked[index(cell)] = blocked ? 1 : 0;
+            _version++;
+        }
+
+        // Whether the straight segment from one point to another stays out of
+        // blocked cells and off the map's edge. Walks every cell it crosses;
+        // where it passes exactly through a corner both cells beside the
+        // corner must be free, as for a diagonal step.
+        bool clearLine(glm::vec2 from, glm::vec2 to) const {
+            glm::vec2 a = (from - _min) / _cellSize, b = (to - _min) / _cellSize;
+            glm::ivec2 cell((int) std::floor(a.x), (int) std::floor(a.y));
+            glm::ivec2 end((int) std::floor(b.x), (int) std::floor(b.y));
+            if (blocked(cell) || blocked(end)) return false;
+
+            glm::vec2 d = b - a;
+            glm::ivec2 step(d.x > 0 ? 1 : -1, d.y > 0 ? 1 : -1);
+            // how far along the segment, as a fraction, the next column and row borders are
+            float deltaX = d.x != 0 ? std::abs(1.0f / d.x) : INFINITY;
+            float deltaY = d.y != 0 ? std::abs(1.0f / d.y) : INFINITY;
+            float nextX = d.x != 0 ? (d.x > 0 ? cell.x + 1 - a.x : a.x - cell.x) * deltaX : INFINITY;
+            float nextY = d.y != 0 ? (d.y > 0 ? cell.y + 1 - a.y : a.y - cell.y) * deltaY : INFINITY;
+
+            for (int n = std::abs(end.x - cell.x) + std::abs(end.y - cell.y); n > 0 && cell != end; n--) {
+                if (nextX < nextY) {
+                    nextX += deltaX;
+                    cell.x += step.x;
+                } else if (nextY < nextX) {
+                    nextY += deltaY;
+                    cell.y += step.y;
+                } else {
+                    if (blocked(cell + glm::ivec2(step.x, 0)) || blocked(cell + glm::ivec2(0, step.y))) return false;
+                    nextX += deltaX;
+                    nextY += deltaY;
+                    cell += step;
+                }
+                if (blocked(cell)) return false;
+            }
+            return cell == end;
+        }
+
+        // Blocks every cell overlapping the rectangle
+        void block(glm::vec2 min, glm::vec2 max, bool blocked = true) {
+            glm::ivec2 lo = cellOf(min), hi = cellOf(max);
+            for (int y = lo.y; y <= hi.y; y++) {
+                for (int x = lo.x; x <= hi.x; x++) {
+                    setBlocked(glm::ivec2(x, y), blocked);
+                }
+            }
+        }
+
+    private:
+        int _columns, _rows;
+        glm::vec2 _min, _cellSize;
+        std::vector<uint8_t> _blocked;
+        uint64_t _version = 0;
+    };
+
+    // Cost to reach one target cell from every cell of a GridMap (the
+    // integration field) and, per cell, the direction to walk to get there.
+    // Built once with Dijkstra over 8 neighbours; diagonals may not cut the
+    // corner of a blocked cell. Any number of units can then look up their
+    // direction in O(1).
+    //
+    // A blocked target is moved: the field leads instead to the passable cell
+    // nearest it in each region the walls split the map into, so every unit
+    // heads for the closest point it can reach rather than into the wall.
+    // Cells the field leads to have cost zero (goal()); a unit outside them
+    // with no direction has no way to get there.
+    class FlowField {
+    public:
+        FlowField(const GridMap& map, glm::ivec2 target) : _target(target) {
+            build(map);
+        }
+
+        // The cell asked for, which is where the field leads unless it is blocked
+        glm::ivec2 target() const { return _target; }
+        uint64_t mapVersion() const { return _mapVersion; }
+
+        float cost(glm::ivec2 cell) const { return _cost[_map->index(cell)]; }
+
+        // Whether position is in a cell the field leads to
+        bool goal(glm::vec2 position) const {
+            return _cost[_map->index(_map->cellOf(position))] == 0;
+        }
+
+        // Unit direction towards the target from position, or zero inside the
+        // target cell and where the target cannot be reached
+        glm::vec2 direction(glm::vec2 position) const {
+            return _directions[_map->index(_map->cellOf(position))];
+        }
+
+        bool reachable(glm::vec2 position) const {
+            return !std::isinf(_cost[_map->index(_map->cellOf(position))]);
+        }
+
+    private:
+        void build(const GridMap& map) {
+            _map = &map;
+            _mapVersion = map.version();
+            _cost.assign(map.cellCount(), INFINITY);
+            _directions.assign(map.cellCount(), glm::vec2(0.0f));
+
+            typedef std::pair<float, uint32_t> Open;
+            std::priority_queue<Open, std::vector<Open>, std::greater<Open>> open;
+            if (!map.blocked(_target)) {
+                _cost[map.index(_target)] = 0;
+                open.push(Open(0.0f, map.index(_target)));
+            } else {
+                for (uint32_t goal : nearestPerRegion(map)) {
+                    _cost[goal] = 0;
+                    open.push(Open(0.0f, goal));
+                }
+            }
+
+            while (!open.empty()) {
+                Open next = open.top();
+                open.pop();
+                if (next.first > _cost[next.second]) continue;
+
+                glm::ivec2 cell((int) next.second % map.columns(), (int) next.second / map.columns());
+                for (auto& step : steps()) {
+                    glm::ivec2 neighbour = cell + step.offset;
+                    if (!passable(map, cell, step.offset)) continue;
+                    float cost = next.first + step.cost;
+                    uint32_t n = map.index(neighbour);
+                    if (cost < _cost[n]) {
+                        _cost[n] = cost;
+                        open.push(Open(cost, n));
+                    }
+                }
+            }
+
+            // Blocked cells get directions too, so a unit pushed into one walks back out
+            for (int y = 0; y < map.rows(); y++) {
+                for (int x = 0; x < map.columns(); x++) {
+                    glm::ivec2 cell(x, y);
+                    float best = map.blocked(cell) ? INFINITY : _cost[map.index(cell)];
+                    glm::ivec2 bestOffset(0);
+                    for (auto& step : steps()) {
+                        glm::ivec2 neighbour = cell + step.offset;
+                        if (!map.contains(neighbour) || map.blocked(neighbour)) continue;
+                        if (!map.blocked(cell) && !passable(map, cell, step.offset)) continue;
+                        float cost = _cost[map.index(neighbour)];
+                        if (cost < best) {
+                            best = cost;
+                            bestOffset = step.offset;
+                        }
+                    }
+                    if (bestOffset != glm::ivec2(0)) {
+                        _directions[map.index(cell)] = glm::normalize(glm::vec2(bestOffset));
+                    }
+                }
+            }
+        }
+
+        // For a blocked target: labels the regions of passable cells joined by
+        // passable steps and returns, per region, the cell nearest the target
+        std::vector<uint32_t> nearestPerRegion(const GridMap& map) const {
+            enum : uint32_t { UNLABELLED = 0xffffffffu };
+            std::vector<uint32_t> region(map.cellCount(), UNLABELLED);
+            std::vector<uint32_t> nearest, frontier;
+            std::vector<float> distances;
+            glm::vec2 target(_target);
+
+            for (uint32_t start = 0; start < map.cellCount(); start++) {
+                glm::ivec2 first((int) start % map.columns(), (int) start / map.columns());
+                if (region[start] != UNLABELLED || map.blocked(first)) continue;
+                uint32_t label = (uint32_t) nearest.size();
+                nearest.push_back(start);
+                distances.push_back(INFINITY);
+                region[start] = label;
+                frontier.assign(1, start);
+                while (!frontier.empty()) {
+                    uint32_t next = frontier.back();
+                    frontier.pop_back();
+                    glm::ivec2 cell((int) next % map.columns(), (int) next / map.columns());
+                    glm::vec2 offset = glm::vec2(cell) - target;
+                    float distance = glm::dot(offset, offset);
+                    // cells are visited in no useful order, so ties go to the lowest index
+                    if (distance < distances[label] || (distance == distances[label] && next < nearest[label])) {
+                        distances[label] = distance;
+                        nearest[label] = next;
+                    }
+                    for (auto& step : steps()) {
+                        if (!passable(map, cell, step.offset)) continue;
+                        uint32_t n = map.index(cell + step.offset);
+                        if (region[n] != UNLABELLED) continue;
+                        region[n] = label;
+                        frontier.push_back(n);
+                    }
+                }
+            }
+            return nearest;
+        }
+
+        struct Step {
+            glm::ivec2 offset;
+            float cost;
+        };
+
+        static const std::vector<Step>& steps() {
+            static const std::vector<Step> all = {
+                { glm::ivec2(1, 0), 1.0f }, { glm::ivec2(-1, 0), 1.0f },
+                { glm::ivec2(0, 1), 1.0f }, { glm::ivec2(0, -1), 1.0f },
+                { glm::ivec2(1, 1), (float) M_SQRT2 }, { glm::ivec2(-1, 1), (float) M_SQRT2 },
+                { glm::ivec2(1, -1), (float) M_SQRT2 }, { glm::ivec2(-1, -1), (float) M_SQRT2 },
+            };
+            return all;
+        }
+
+        // Whether a unit can step from cell by offset without entering or
+        // clipping a blocked cell
+        static bool passable(const GridMap& map, glm::ivec2 cell, glm::ivec2 offset) {
+            if (map.blocked(cell + offset)) return false;
+            if (offset.x != 0 && offset.y != 0) {
+                return !map.blocked(cell + glm::ivec2(offset.x, 0)) && !map.blocked(cell + glm::ivec2(0, offset.y));
+            }
+            return true;
+        }
+
+        const GridMap* _map = nullptr;
+        glm::ivec2 _target;
+        uint64_t _mapVersion = 0;
+        std::vector<float> _cost;
+        std::vector<glm::vec2> _directions;
+    };
+
+    // Flow fields keyed by target cell, so every unit sent to the same cell
+    // shares one field. A field is rebuilt when the map has changed since it
+    // was built. Fields sit on a list in order of last use, and trim(), called
+    // once per tick, drops the least recently used while there are more than
+    // capacity of them. A field used since the previous trim() is never
+    // dropped, so capacity is how many are kept between ticks, not a limit on
+    // how many one tick may use.
+    class FlowFieldCache {
+    public:
+        FlowFieldCache(const GridMap& map, size_t capacity = 32) : _map(map), _capacity(capacity) {}
+
+        // Valid until the next trim()
+        const FlowField& get(glm::vec2 target) {
+            glm::ivec2 cell = _map.cellOf(target);
+            uint32_t key = _map.index(cell);
+            auto& entry = _fields[key];
+            if (!entry.field || entry.field->mapVersion() != _map.version()) {
+                entry.field.reset(new FlowField(_map, cell));
+                _builds++;
+            } else {
+                _hits++;
+            }
+            entry.key = key;
+            entry.tick = _tick;
+            unlink(&entry);
+            pushFront(&entry);
+            return *entry.field;
+        }
+
+        // Ends the tick: drops least recently used fields down to capacity,
+        // stopping at the first one used this tick
+        void trim() {
+            while (_fields.size() > _capacity && _tail && _tail->tick != _tick) {
+                Entry* oldest = _tail;
+                unlink(oldest);
+                _fields.erase(oldest->key);
+            }
+            _tick++;
+        }
+
+        void clear() {
+            _fields.clear();
+            _head = _tail = nullptr;
+        }
+
+        const GridMap& map() const { return _map; }
+
+        size_t size() const { return _fields.size(); }
+        size_t capacity() const { return _capacity; }
+        uint64_t builds() const { return _builds; }
+        uint64_t hits() const { return _hits; }
+
+    private:
+        // unordered_map never moves its elements, so they can link to each other
+        struct Entry {
+            std::unique_ptr<FlowField> field;
+            uint32_t key = 0;
+            uint64_t tick = 0;
+            Entry* prev = nullptr;
+            Entry* next = nullptr;
+        };
+
+        void unlink(Entry* entry) {
+            if (entry->prev) entry->prev->next = entry->next;
+            else if (_head == entry) _head = entry->next;
+            if (entry->next) entry->next->prev = entry->prev;
+            else if (_tail == entry) _tail = entry->prev;
+            entry->prev = entry->next = nullptr;
+        }
+
+        void pushFront(Entry* entry) {
+            entry->next = _head;
+            if (_head) _head->prev = entry;
+            _head = entry;
+            if (!_tail) _tail = entry;
+        }
+
+        const GridMap& _map;
+        size_t _capacity;
+        std::unordered_map<uint32_t, Entry> _fields;
+        Entry* _head = nullptr; // most recently used
+        Entry* _tail = nullptr; // least recently used
+        uint64_t _tick = 0, _builds = 0, _hits = 0;
+    };
+}
+
+#endif//RTS_PATHFINDING_H
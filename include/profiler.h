@@ -0,0 +1,256 @@
+#ifndef RTS_PROFILER_H
+#define RTS_PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <thread_pool.h>
+
+// Frame profiler. Wrap a block in RTS_PROFILE_ZONE("name") to time it; the
+// name is kept as a pointer, so it must stay valid until the trace has been
+// written (a string literal, or a string owned by a live system). While the
+// profiler is disabled a zone costs one relaxed atomic load. Define
+// RTS_NO_PROFILER to compile zones out entirely.
+//
+// Every thread records into its own ring buffer, so recording takes no lock
+// and never waits on other threads; when a ring wraps the oldest zones are
+// overwritten. endFrame(), writeChromeTrace() and writeStats() read the rings
+// and should be called while the other threads are idle, e.g. between frames.
+
+namespace engine {
+
+    class Profiler {
+    public:
+        struct Event {
+            const char* name;
+            uint64_t startNs, endNs;
+        };
+
+        static Profiler& instance() {
+            static Profiler profiler;
+            return profiler;
+        }
+
+        static bool enabled() {
+            return instance()._enabled.load(std::memory_order_relaxed);
+        }
+
+        static uint64_t now() {
+            return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        void setEnabled(bool enabled) {
+            if (enabled && !_enabled.load()) {
+                _frameStart = now();
+            }
+            _enabled.store(enabled, std::memory_order_relaxed);
+        }
+
+        void record(const char* name, uint64_t startNs, uint64_t endNs) {
+            ThreadBuffer& buffer = local();
+            uint64_t head = buffer.head.load(std::memory_order_relaxed);
+            buffer.events[head & (buffer.events.size() - 1)] = Event { name, startNs, endNs };
+            buffer.head.store(head + 1, std::memory_order_release);
+        }
+
+        // Closes the current frame: its length and each zone's total time in it
+        // go into the rolling windows that writeStats() reports on
+        void endFrame() {
+            if (!enabled()) return;
+            uint64_t end = now();
+            stats("frame").add(end - _frameStart);
+            _frameStart = end;
+
+            std::lock_guard<std::mutex> lock(_buffersMutex);
+            _frameTotals.clear();
+            for (auto& buffer : _buffers) {
+                uint64_t head = buffer->head.load(std::memory_order_acquire);
+                uint64_t capacity = buffer->events.size();
+                uint64_t from = std::max(buffer->read, head > capacity ? head - capacity : 0);
+                for (uint64_t i = from; i < head; i++) {
+                    const Event& event = buffer->events[i & (capacity - 1)];
+                    _frameTotals[event.name] += event.endNs - event.startNs;
+                }
+                buffer->read = head;
+            }
+            for (auto& total : _frameTotals) {
+                stats(total.first).add(total.second);
+            }
+        }
+
+        // Every zone still in the rings as Chrome trace_event JSON, for
+        // chrome://tracing or Perfetto
+        void writeChromeTrace(FILE* out) {
+            std::lock_guard<std::mutex> lock(_buffersMutex);
+            fprintf(out, "{\"traceEvents\": [\n");
+            bool first = true;
+            for (auto& buffer : _buffers) {
+                fprintf(out, "%s  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+                        first ? "" : ",\n", buffer->id, buffer->label.c_str());
+                first = false;
+
+                uint64_t head = buffer->head.load(std::memory_order_acquire);
+                uint64_t capacity = buffer->events.size();
+                for (uint64_t i = head > capacity ? head - capacity : 0; i < head; i++) {
+                    const Event& event = buffer->events[i & (capacity - 1)];
+                    fprintf(out, ",\n  {\"name\": \"");
+                    writeEscaped(out, event.name);
+                    fprintf(out, "\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                            buffer->id, (event.startNs - _epoch) / 1000.0, (event.endNs - event.startNs) / 1000.0);
+                }
+            }
+            fprintf(out, "\n]}\n");
+        }
+
+        // p50/p95/p99 over the last window of frames, in milliseconds
+        void writeStats(FILE* out) {
+            fprintf(out, "%-28s %8s %10s %10s %10s\n", "zone", "frames", "p50 ms", "p95 ms", "p99 ms");
+            for (auto& entry : _stats) {
+                auto& s = entry.second;
+                fprintf(out, "%-28s %8zu %10.3f %10.3f %10.3f\n", entry.first.c_str(), s.size(),
+                        s.percentile(0.50) / 1e6, s.percentile(0.95) / 1e6, s.percentile(0.99) / 1e6);
+            }
+        }
+
+        // Drops everything recorded so far
+        void reset() {
+            std::lock_guard<std::mutex> lock(_buffersMutex);
+            for (auto& buffer : _buffers) {
+                buffer->head.store(0);
+                buffer->read = 0;
+            }
+            _stats.clear();
+            _statsByName.clear();
+            _frameStart = now();
+        }
+
+    private:
+        // The last `window` samples of one zone (or of the whole frame)
+        class RollingStats {
+        public:
+            explicit RollingStats(size_t window = 600) : _window(window) {}
+
+            void add(uint64_t value) {
+                if (_samples.size() < _window) {
+                    _samples.push_back(value);
+                } else {
+                    _samples[_next] = value;
+                }
+                _next = (_next + 1) % _window;
+            }
+
+            size_t size() const { return _samples.size(); }
+
+            double percentile(double p) const {
+                if (_samples.empty()) return 0;
+                std::vector<uint64_t> sorted(_samples);
+                size_t rank = std::min(sorted.size() - 1, (size_t) (p * sorted.size()));
+                std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+                return (double) sorted[rank];
+            }
+
+        private:
+            size_t _window;
+            size_t _next = 0;
+            std::vector<uint64_t> _samples;
+        };
+
+        struct ThreadBuffer {
+            ThreadBuffer(size_t capacity, uint32_t id, std::string label)
+                : events(capacity), head(0), id(id), label(label) {}
+
+            std::vector<Event> events; // power of two
+            std::atomic<uint64_t> head;
+            uint64_t read = 0;         // next event endFrame() has not seen yet
+            uint32_t id;
+            std::string label;
+        };
+
+        static const size_t RING_CAPACITY = 1 << 16;
+
+        // Usually first reached from main(), so that thread is labelled "main"
+        Profiler() : _enabled(false), _epoch(now()), _frameStart(_epoch), _mainThread(std::this_thread::get_id()) {}
+
+        ThreadBuffer& local() {
+            static thread_local ThreadBuffer* buffer = nullptr;
+            if (!buffer) {
+                std::lock_guard<std::mutex> lock(_buffersMutex);
+                uint32_t id = (uint32_t) _buffers.size();
+                int worker = ThreadPool::workerIndex();
+                std::string label = worker >= 0 ? "worker " + std::to_string(worker)
+                    : std::this_thread::get_id() == _mainThread ? "main" : "thread " + std::to_string(id);
+                _buffers.emplace_back(new ThreadBuffer(RING_CAPACITY, id, label));
+                buffer = _buffers.back().get();
+            }
+            return *buffer;
+        }
+
+        // Zones are looked up by pointer first, so only a name's first sighting
+        // costs a string compare
+        RollingStats& stats(const char* name) {
+            auto found = _statsByName.find(name);
+            if (found != _statsByName.end()) return *found->second;
+            RollingStats& s = _stats[name];
+            _statsByName[name] = &s;
+            return s;
+        }
+
+        static void writeEscaped(FILE* out, const char* text) {
+            for (const char* c = text; *c; c++) {
+                if (*c == '"' || *c == '\\') fputc('\\', out);
+                fputc(*c, out);
+            }
+        }
+
+        std::atomic<bool> _enabled;
+        uint64_t _epoch;
+        uint64_t _frameStart;
+        std::thread::id _mainThread;
+
+        std::mutex _buffersMutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> _buffers;
+
+        std::map<std::string, RollingStats> _stats;
+        std::unordered_map<const char*, RollingStats*> _statsByName;
+        std::unordered_map<const char*, uint64_t> _frameTotals;
+    };
+
+    class ProfileZone {
+    public:
+        explicit ProfileZone(const char* name) : _name(Profiler::enabled() ? name : nullptr) {
+            if (_name) _start = Profiler::now();
+        }
+
+        ~ProfileZone() {
+            if (_name) Profiler::instance().record(_name, _start, Profiler::now());
+        }
+
+        ProfileZone(const ProfileZone&) = delete;
+        ProfileZone& operator=(const ProfileZone&) = delete;
+
+    private:
+        const char* _name;
+        uint64_t _start = 0;
+    };
+}
+
+#ifdef RTS_NO_PROFILER
+#define RTS_PROFILE_ZONE(name)
+#else
+#define RTS_PROFILE_CONCAT_(a, b) a##b
+#define RTS_PROFILE_CONCAT(a, b) RTS_PROFILE_CONCAT_(a, b)
+#define RTS_PROFILE_ZONE(name) engine::ProfileZone RTS_PROFILE_CONCAT(profileZone, __LINE__)(name)
+#endif
+
+#endif//RTS_PROFILER_H
@@ -0,0 +1,52 @@
+#ifndef RTS_RANDOM_H
+#define RTS_RANDOM_H
+
+#include <cstdint>
+
+namespace engine {
+
+    // Small seeded generator (xorshift64*) owned by the simulation, so the same
+    // seed and commands always produce the same world, unlike rand()
+    class Random {
+    public:
+        explicit Random(uint64_t seed = 1) { reseed(seed); }
+
+        void reseed(uint64_t seed) {
+            _seed = seed;
+            // the state must never be zero
+            _state = seed ^ 0x9e3779b97f4a7c15ull;
+            if (_state == 0) _state = 1;
+        }
+
+        // Puts the generator back exactly where seed() and state() were read
+        void restore(uint64_t seed, uint64_t state) {
+            _seed = seed;
+            _state = state != 0 ? state : 1;
+        }
+
+        uint64_t seed() const { return _seed; }
+        uint64_t state() const { return _state; }
+
+        uint32_t next() {
+            _state ^= _state >> 12;
+            _state ^= _state << 25;
+            _state ^= _state >> 27;
+            return (uint32_t) ((_state * 0x2545f4914f6cdd1dull) >> 32);
+        }
+
+        // Uniform in [0, 1)
+        float uniform() {
+            return (next() >> 8) * (1.0f / 16777216.0f);
+        }
+
+        float range(float min, float max) {
+            return min + (max - min) * uniform();
+        }
+
+    private:
+        uint64_t _seed;
+        uint64_t _state;
+    };
+}
+
+#endif//RTS_RANDOM_H
@@ -2,10 +2,17 @@
 #define RTS_RENDER_H
 
 #include <iostream>
+#include <cstddef>
+#include <cstring>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <texture.h>
+#include <batch.h>
+#include <gl_state.h>
+#include <shader.h>
+#include <stream_buffer.h>
+#include <thread_pool.h>
 
 #include <entityx/entityx.h>
 
@@ -13,50 +20,37 @@ namespace engine {
 
     class SelectionBoxRenderer {
         public:
-            void init() {
+            // False if the shaders did not build
+            bool init() {
                 cleanup();
 
+                GLState& gl = GLState::instance();
                 glGenVertexArrays(1, &_vao);
-                glGenBuffers(1, &_vbo);
                 glGenBuffers(1, &_ebo);
 
-                glBindVertexArray(_vao);
+                gl.bindVertexArray(_vao);
 
-                // _vbo -> x, y 
-                glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-                glBufferData(GL_ARRAY_BUFFER, sizeof(float) * NUM_VERTICES * NUM_FLOATS_PER_VERTEX, nullptr, GL_DYNAMIC_DRAW);
+                // _vertices -> x, y, a region per frame
+                _vertices.init(GL_ARRAY_BUFFER, VERTEX_BYTES);
                 glEnableVertexAttribArray(0);
-                glVertexAttribPointer(0, NUM_FLOATS_PER_VERTEX, GL_FLOAT, GL_FALSE, sizeof(float) * NUM_FLOATS_PER_VERTEX, nullptr);
+                bindVertexAttributes();
 
                 // _ebo
                 ushort indices[] = {
                     0, 1, 2,
                     0, 2, 3,
                 };
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+                gl.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
                 glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-                uint vs, fs;
-                int status;
-                char infoLog[256];
-
                 auto vsCode = R"(
                     #version 330 core
                     layout(location=0) in vec2 aPosition;
+                    uniform mat4 uViewProjection;
                     void main() {
-                        gl_Position = vec4(aPosition, 0.0, 1.0);
+                        gl_Position = uViewProjection * vec4(aPosition, 0.0, 1.0);
                     }
                 )";
-                vs = glCreateShader(GL_VERTEX_SHADER);
-                glShaderSource(vs, 1, &vsCode, nullptr);
-                glCompileShader(vs);
-
-                glGetShaderiv(vs, GL_COMPILE_STATUS, &status);
-                if (status == GL_FALSE) {
-                    glGetShaderInfoLog(vs, 256, nullptr, infoLog);
-                    std::cerr << "Unable to compile vertex shader\n" << infoLog << std::endl;
-                }
-
                 auto fsCode = R"(
                     #version 330 core
                     out vec4 fColor;
@@ -65,46 +59,28 @@ namespace engine {
                         fColor = uColor;
                     }
                 )";
-                fs = glCreateShader(GL_FRAGMENT_SHADER);
-                glShaderSource(fs, 1, &fsCode, nullptr);
-                glCompileShader(fs);
-
-                glGetShaderiv(fs, GL_COMPILE_STATUS, &status);
-                if (status == GL_FALSE) {
-                    glGetShaderInfoLog(fs, 256, nullptr, infoLog);
-                    std::cerr << "Unable to compile fragment shader\n" << infoLog << std::endl;
-                }
-
-                _program = glCreateProgram();
-                glAttachShader(_program, vs);
-                glAttachShader(_program, fs);
-                glLinkProgram(_program);
-
-                glGetProgramiv(_program, GL_LINK_STATUS, &status);
-                if (status == GL_FALSE) {
-                    glGetProgramInfoLog(_program, 256, nullptr, infoLog);
-                    std::cerr << "Unable to link program\n" << infoLog << std::endl;
-                }
-
-                glDeleteShader(vs);
-                glDeleteShader(fs);
+                if (!_program.build(vsCode, fsCode)) return false;
+                _uColor = _program.uniform("uColor");
+                _uViewProjection = _program.uniform("uViewProjection");
+                return true;
             }
 
             void cleanup() {
-                if (_vbo != 0) {
-                    glDeleteBuffers(1, &_vbo);
-                }
+                GLState& gl = GLState::instance();
+                _vertices.cleanup();
                 if (_ebo != 0) {
+                    gl.deletedBuffer(_ebo);
                     glDeleteBuffers(1, &_ebo);
                 }
                 if (_vao != 0) {
+                    gl.deletedVertexArray(_vao);
                     glDeleteVertexArrays(1, &_vao);
                 }
-                if (_program != 0) {
-                    glDeleteProgram(_program);
-                }
+                _program.cleanup();
+                _vao = _ebo = 0;
             }
 
+            // Corners in world space
             void update(float minX, float minY, float maxX, float maxY) {
                 float vertices[] = {
                     minX, minY, // bottom left
@@ -112,31 +88,47 @@ namespace engine {
                     maxX, maxY, // top right
                     minX, maxY, // top left
                 };
-                glBindVertexArray(_vao);
-                glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-                glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+                void* region = _vertices.map(VERTEX_BYTES);
+                if (region) {
+                    memcpy(region, vertices, VERTEX_BYTES);
+                }
+                _vertices.unmap();
             }
 
             void use() {
-                glBindVertexArray(_vao);
-                glUseProgram(_program);
+                GLState::instance().bindVertexArray(_vao);
+                _program.use();
             }
 
-            void render(glm::vec4 color) {
-                glBindVertexArray(_vao);
-                glUseProgram(_program);
-                glUniform4f(glGetUniformLocation(_program, "uColor"), color.r, color.g, color.b, color.a);
+            void render(glm::vec4 color, const glm::mat4& viewProjection) {
+                use();
+                _program.set(_uColor, color);
+                _program.set(_uViewProjection, viewProjection);
+                bindVertexAttributes();
                 glDrawElements(GL_TRIANGLES, NUM_INDICES, GL_UNSIGNED_SHORT, nullptr);
+                _vertices.fence();
             }
 
         private:
-            uint _vao, _vbo, _ebo, _program;
+            // the box moves between regions of _vertices from frame to frame
+            void bindVertexAttributes() {
+                GLState::instance().bindBuffer(GL_ARRAY_BUFFER, _vertices.buffer());
+                glVertexAttribPointer(0, NUM_FLOATS_PER_VERTEX, GL_FLOAT, GL_FALSE, sizeof(float) * NUM_FLOATS_PER_VERTEX,
+                                      (void*) _vertices.offset());
+            }
+
+            uint _vao = 0, _ebo = 0;
+            StreamBuffer _vertices;
+            ShaderProgram _program;
+            int _uColor = -1, _uViewProjection = -1;
             static const uint NUM_VERTICES = 4, NUM_INDICES = 6, NUM_FLOATS_PER_VERTEX = 2;
+            enum : size_t { VERTEX_BYTES = sizeof(float) * NUM_VERTICES * NUM_FLOATS_PER_VERTEX };
     };
 
     class EntityRenderer {
     public:
-        void init() {
+        // False if the shaders did not build
+        bool init() {
             cleanup();
 
             float vertices[] = {
@@ -151,10 +143,11 @@ namespace engine {
                 0, 2, 3,
             };
 
+            GLState& gl = GLState::instance();
             glGenVertexArrays(1, &_vao);
             glGenBuffers(1, &_vbo);
-            glBindVertexArray(_vao);
-            glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+            gl.bindVertexArray(_vao);
+            gl.bindBuffer(GL_ARRAY_BUFFER, _vbo);
             glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
             glEnableVertexAttribArray(0);
             glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 5, 0);
@@ -162,112 +155,156 @@ namespace engine {
             glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 5, (void*) (sizeof(float) * 3));
 
             glGenBuffers(1, &_ebo);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
+            gl.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
             glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
-            unsigned int vs, fs;
-            vs = glCreateShader(GL_VERTEX_SHADER);
+            // _instances -> x, y, z, rotation, scale, r, g, b, u, v, uvWidth, uvHeight, a region per frame
+            _instances.init(GL_ARRAY_BUFFER, sizeof(SpriteInstance) * INITIAL_INSTANCES);
+            glEnableVertexAttribArray(2);
+            glVertexAttribDivisor(2, 1);
+            glEnableVertexAttribArray(3);
+            glVertexAttribDivisor(3, 1);
+            glEnableVertexAttribArray(4);
+            glVertexAttribDivisor(4, 1);
+            glEnableVertexAttribArray(5);
+            glVertexAttribDivisor(5, 1);
+            bindInstanceAttributes(0);
+
             auto vsSource = R"(
                 #version 330 core
 
                 layout(location=0) in vec3 aPosition;
                 layout(location=1) in vec2 aTexCoord;
+                layout(location=2) in vec3 aOffset;
+                layout(location=3) in vec2 aRotationScale;
+                layout(location=4) in vec3 aTint;
+                layout(location=5) in vec4 aUv;
 
                 out vec2 vTexCoord;
+                out vec3 vTint;
 
-                uniform vec3 uPosition;
-                uniform mat4 uTransform;
+                uniform mat4 uViewProjection;
 
                 void main() {
-                    gl_Position = uTransform * vec4(aPosition, 1.0);
-                    vTexCoord = aTexCoord;
+                    float c = cos(aRotationScale.x);
+                    float s = sin(aRotationScale.x);
+                    vec2 local = aPosition.xy * aRotationScale.y;
+                    vec2 rotated = vec2(c * local.x - s * local.y, s * local.x + c * local.y);
+                    gl_Position = uViewProjection * vec4(aOffset + vec3(rotated, aPosition.z * aRotationScale.y), 1.0);
+                    vTexCoord = aUv.xy + aTexCoord * aUv.zw;
+                    vTint = aTint;
                 }
             )";
-            glShaderSource(vs, 1, &vsSource, nullptr);
-            glCompileShader(vs);
-
-            int status;
-            char infoLog[256];
-            glGetShaderiv(vs, GL_COMPILE_STATUS, &status);
-            if (!status) {
-                glGetShaderInfoLog(vs, 256, nullptr, infoLog);
-                std::cerr << "Unable to compile vertex shader\n" << infoLog << std::endl;
-            }
-
-            fs = glCreateShader(GL_FRAGMENT_SHADER);
             auto fsSource = R"(
                 #version 330 core
 
                 in vec2 vTexCoord;
+                in vec3 vTint;
                 out vec4 fColor;
 
-                uniform vec3 uColor;
                 uniform sampler2D uTexture;
 
                 void main() {
-                    fColor = vec4(uColor, 1.0) * texture(uTexture, vTexCoord);
+                    fColor = vec4(vTint, 1.0) * texture(uTexture, vTexCoord);
                 }
             )";
-            glShaderSource(fs, 1, &fsSource, nullptr);
-            glCompileShader(fs);
-
-            glGetShaderiv(fs, GL_COMPILE_STATUS, &status);
-            if (!status) {
-                glGetShaderInfoLog(fs, 256, nullptr, infoLog);
-                std::cerr << "Unable to compile fragment shader\n" << infoLog << std::endl;
-            }
-
-            _program = glCreateProgram();
-            glAttachShader(_program, vs);
-            glAttachShader(_program, fs);
-            glLinkProgram(_program);
-
-            glDeleteShader(vs);
-            glDeleteShader(fs);
-
-            glGetProgramiv(_program, GL_LINK_STATUS, &status);
-            if (!status) {
-                glGetProgramInfoLog(_program, 256, nullptr, infoLog);
-                std::cerr << "Unable to link shader _program\n" << infoLog << std::endl;
-            }
+            if (!_program.build(vsSource, fsSource)) return false;
+            _program.use();
+            _program.set(_program.uniform("uTexture"), 0);
+            _uViewProjection = _program.uniform("uViewProjection");
 
             _isInitialized = true;
+            return true;
         }
 
         void cleanup() {
             _isInitialized = false;
-            if (_vbo) {
-                glDeleteBuffers(1, &_vbo);
-            }
-            if (_ebo) {
-                glDeleteBuffers(1, &_ebo);
+            GLState& gl = GLState::instance();
+            _instances.cleanup();
+            for (uint* buffer : { &_vbo, &_ebo }) {
+                if (*buffer) {
+                    gl.deletedBuffer(*buffer);
+                    glDeleteBuffers(1, buffer);
+                }
             }
             if (_vao) {
+                gl.deletedVertexArray(_vao);
                 glDeleteVertexArrays(1, &_vao);
             }
-            if (_program) {
-                glDeleteProgram(_program);
-            }
-            _vbo = _ebo = _vao = _program = 0;
+            _program.cleanup();
+            _vbo = _ebo = _vao = 0;
         }
 
         void use() {
-            glUseProgram(_program);
-            glBindVertexArray(_vao);
+            _program.use();
+            GLState::instance().bindVertexArray(_vao);
         }
 
-        void render(glm::mat4& transform, glm::vec3& color) {
-            glUniformMatrix4fv(glGetUniformLocation(_program, "uTransform"), 1, GL_FALSE, glm::value_ptr(transform));
-            glUniform3f(glGetUniformLocation(_program, "uColor"), color.x, color.y, color.z);
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, nullptr);
+        // Writes every instance straight into this frame's region of the
+        // instance stream, split over pool's threads if given one, then
+        // issues one instanced draw per atlas page. The pool must be idle
+        // otherwise, as the simulation's is between ticks.
+        void render(const SpriteBatchBuilder& batches, TextureManager& textures, const glm::mat4& viewProjection,
+                    ThreadPool* pool = nullptr) {
+            if (batches.size() == 0) {
+                return;
+            }
+
+            _program.set(_uViewProjection, viewProjection);
+
+            auto region = static_cast<SpriteInstance*>(_instances.map(sizeof(SpriteInstance) * batches.size()));
+            if (!region) {
+                std::cerr << "Unable to map the instance buffer" << std::endl;
+                return;
+            }
+            if (pool) {
+                size_t chunk = ThreadPool::cacheChunk(sizeof(SpriteInstance) * 2 + sizeof(uint));
+                pool->parallelFor(batches.size(), chunk, [&batches, region](size_t begin, size_t end) {
+                    batches.write(region, begin, end);
+                });
+            } else {
+                batches.write(region);
+            }
+            if (!_instances.unmap()) {
+                return;
+            }
+
+            GLState::instance().bindBuffer(GL_ARRAY_BUFFER, _instances.buffer());
+            for (auto& batch : batches.batches()) {
+                bindInstanceAttributes(batch.first);
+                textures.page(batch.texture).use();
+                glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, nullptr, batch.count);
+            }
+            _instances.fence();
         }
 
+        const StreamBufferStats& streamStats() const { return _instances.stats(); }
+
+        // The instance stream; offset() is where the last frame went
+        const StreamBuffer& instances() const { return _instances; }
+
         bool isInitialized() {
             return _isInitialized;
         }
 
     private:
-        uint _vao, _vbo, _ebo, _program;
+        // GL 3.3 has no base instance, so each batch re-points the per-instance
+        // attributes at its slice of this frame's region
+        void bindInstanceAttributes(uint first) {
+            auto stride = sizeof(SpriteInstance);
+            auto base = _instances.offset() + stride * first;
+            glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*) (base + offsetof(SpriteInstance, position)));
+            glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, stride, (void*) (base + offsetof(SpriteInstance, rotation)));
+            glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, stride, (void*) (base + offsetof(SpriteInstance, tint)));
+            glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, stride, (void*) (base + offsetof(SpriteInstance, uv)));
+        }
+
+        enum : size_t { INITIAL_INSTANCES = 1024 };
+
+        uint _vao = 0, _vbo = 0, _ebo = 0;
+        StreamBuffer _instances;
+        ShaderProgram _program;
+        int _uViewProjection = -1;
         bool _isInitialized = false;
     };
 }
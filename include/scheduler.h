@@ -0,0 +1,277 @@
+#ifndef RTS_SCHEDULER_H
+#define RTS_SCHEDULER_H
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <entityx/entityx.h>
+
+#include <thread_pool.h>
+#include <command_buffer.h>
+#include <profiler.h>
+
+namespace engine {
+
+    const size_t MAX_ACCESS_TYPES = 64;
+
+    inline size_t nextAccessId() {
+        static std::atomic<size_t> next(0);
+        return next++;
+    }
+
+    // A small dense id per component (or shared resource such as SpatialGrid) type
+    template <typename T>
+    size_t accessId() {
+        static const size_t id = nextAccessId();
+        return id;
+    }
+
+    // What a system touches while it updates. Two systems conflict when either
+    // writes something the other reads or writes, or when either makes immediate
+    // structural changes (entityx's component masks are shared by every view).
+    struct SystemAccess {
+        template <typename... Ts>
+        SystemAccess& read() {
+            set(reads, std::initializer_list<size_t> { accessId<Ts>()... });
+            return *this;
+        }
+
+        template <typename... Ts>
+        SystemAccess& write() {
+            set(writes, std::initializer_list<size_t> { accessId<Ts>()... });
+            return *this;
+        }
+
+        // Assigns or removes components directly instead of through a CommandBuffer
+        SystemAccess& structural() {
+            isStructural = true;
+            return *this;
+        }
+
+        // Has to run on the thread that calls SystemScheduler::run, e.g. for GL calls
+        SystemAccess& mainThread() {
+            isMainThread = true;
+            return *this;
+        }
+
+        bool conflicts(const SystemAccess& other) const {
+            if (isStructural || other.isStructural) return true;
+            return (writes & (other.reads | other.writes)).any() || (other.writes & reads).any();
+        }
+
+        std::bitset<MAX_ACCESS_TYPES> reads, writes;
+        bool isStructural = false;
+        bool isMainThread = false;
+
+    private:
+        static void set(std::bitset<MAX_ACCESS_TYPES>& bits, std::initializer_list<size_t> ids) {
+            for (size_t id : ids) bits.set(id);
+        }
+    };
+
+    // Runs a set of entityx systems as a DAG. Systems are added in their serial
+    // order; a system waits for every earlier system it conflicts with and runs
+    // concurrently with everything else. Structural changes recorded into
+    // commands() are applied once the whole schedule has finished.
+    class SystemScheduler {
+    public:
+        struct Timing {
+            std::string name;
+            double startUs, endUs;
+            int thread;
+        };
+
+        SystemScheduler(entityx::EntityManager& entities, entityx::EventManager& events, ThreadPool& pool)
+            : _entities(entities), _events(events), _pool(pool), _commands(pool.size()) {}
+
+        void add(const std::string& name, std::shared_ptr<entityx::BaseSystem> system, SystemAccess access) {
+            std::unique_ptr<Node> node(new Node());
+            node->name = name;
+            node->system = system;
+            node->access = access;
+            _nodes.push_back(std::move(node));
+            _dirty = true;
+        }
+
+        CommandBuffer& commands() { return _commands; }
+
+        void run(entityx::TimeDelta dt) {
+            if (_nodes.empty()) return;
+            if (_dirty) build();
+
+            _frameStart = Clock::now();
+            _remaining = _nodes.size();
+            for (auto& node : _nodes) {
+                node->waiting = node->dependencies.size();
+            }
+            for (size_t i = 0; i < _nodes.size(); i++) {
+                if (_nodes[i]->dependencies.empty()) schedule(i, dt);
+            }
+
+            _pool.waitUntil([this, dt]() {
+                runMainThreadNodes(dt);
+                return _remaining.load() == 0;
+            });
+            _wallUs = elapsedUs();
+
+            RTS_PROFILE_ZONE("SystemScheduler::flush");
+            _commands.flush();
+        }
+
+        // Wall time of the last run
+        double wallUs() const { return _wallUs; }
+
+        // Longest chain of dependent systems in the last run, by measured duration
+        double criticalPathUs(std::vector<size_t>* path = nullptr) const {
+            std::vector<double> longest(_nodes.size(), 0);
+            std::vector<size_t> previous(_nodes.size(), _nodes.size());
+            size_t last = 0;
+            for (size_t i = 0; i < _nodes.size(); i++) {
+                for (size_t d : _nodes[i]->dependencies) {
+                    if (longest[d] > longest[i]) {
+                        longest[i] = longest[d];
+                        previous[i] = d;
+                    }
+                }
+                longest[i] += _nodes[i]->endUs - _nodes[i]->startUs;
+                if (longest[i] > longest[last]) last = i;
+            }
+            if (path) {
+                path->clear();
+                for (size_t i = last; i < _nodes.size(); i = previous[i]) path->push_back(i);
+                std::reverse(path->begin(), path->end());
+            }
+            return _nodes.empty() ? 0 : longest[last];
+        }
+
+        std::vector<Timing> timings() const {
+            std::vector<Timing> result;
+            for (auto& node : _nodes) {
+                result.push_back(Timing { node->name, node->startUs, node->endUs, node->thread });
+            }
+            return result;
+        }
+
+        // Human-readable schedule with the last run's timings
+        void dump(FILE* out) const {
+            double serialUs = 0;
+            for (auto& node : _nodes) serialUs += node->endUs - node->startUs;
+            std::vector<size_t> path;
+            double criticalUs = criticalPathUs(&path);
+
+            fprintf(out, "schedule: %zu systems, wall %.1f us, critical path %.1f us, serial sum %.1f us\n",
+                    _nodes.size(), _wallUs, criticalUs, serialUs);
+            for (auto& node : _nodes) {
+                fprintf(out, "  [stage %zu] %-28s %9.1f us  start %8.1f  %s", node->stage, node->name.c_str(),
+                        node->endUs - node->startUs, node->startUs, node->thread < 0 ? "main    " : "worker  ");
+                if (!node->dependencies.empty()) {
+                    fprintf(out, " after");
+                    for (size_t d : node->dependencies) fprintf(out, " %s", _nodes[d]->name.c_str());
+                }
+                fprintf(out, "\n");
+            }
+            fprintf(out, "  critical path:");
+            for (size_t i = 0; i < path.size(); i++) {
+                fprintf(out, "%s %s", i > 0 ? " ->" : "", _nodes[path[i]]->name.c_str());
+            }
+            fprintf(out, "\n");
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        struct Node {
+            std::string name;
+            std::shared_ptr<entityx::BaseSystem> system;
+            SystemAccess access;
+            std::vector<size_t> dependencies, dependents;
+            size_t stage = 0;
+            std::atomic<size_t> waiting;
+            double startUs = 0, endUs = 0;
+            int thread = -1;
+        };
+
+        // Only the nearest conflicting predecessor matters per chain, but extra
+        // edges are harmless at this size
+        void build() {
+            for (auto& node : _nodes) {
+                node->dependencies.clear();
+                node->dependents.clear();
+                node->stage = 0;
+            }
+            for (size_t j = 0; j < _nodes.size(); j++) {
+                for (size_t i = 0; i < j; i++) {
+                    if (_nodes[i]->access.conflicts(_nodes[j]->access)) {
+                        _nodes[j]->dependencies.push_back(i);
+                        _nodes[i]->dependents.push_back(j);
+                        _nodes[j]->stage = std::max(_nodes[j]->stage, _nodes[i]->stage + 1);
+                    }
+                }
+            }
+            _dirty = false;
+        }
+
+        void schedule(size_t index, entityx::TimeDelta dt) {
+            if (_nodes[index]->access.isMainThread) {
+                std::lock_guard<std::mutex> lock(_mainMutex);
+                _mainReady.push_back(index);
+            } else {
+                _pool.submit([this, index, dt]() { execute(index, dt); });
+            }
+        }
+
+        void runMainThreadNodes(entityx::TimeDelta dt) {
+            while (true) {
+                size_t index;
+                {
+                    std::lock_guard<std::mutex> lock(_mainMutex);
+                    if (_mainReady.empty()) return;
+                    index = _mainReady.back();
+                    _mainReady.pop_back();
+                }
+                execute(index, dt);
+            }
+        }
+
+        void execute(size_t index, entityx::TimeDelta dt) {
+            Node& node = *_nodes[index];
+            node.thread = ThreadPool::workerIndex();
+            node.startUs = elapsedUs();
+            {
+                RTS_PROFILE_ZONE(node.name.c_str());
+                node.system->update(_entities, _events, dt);
+            }
+            node.endUs = elapsedUs();
+
+            for (size_t d : node.dependents) {
+                if (--_nodes[d]->waiting == 0) schedule(d, dt);
+            }
+            _remaining--;
+        }
+
+        double elapsedUs() const {
+            return std::chrono::duration<double, std::micro>(Clock::now() - _frameStart).count();
+        }
+
+        entityx::EntityManager& _entities;
+        entityx::EventManager& _events;
+        ThreadPool& _pool;
+        CommandBuffer _commands;
+        std::vector<std::unique_ptr<Node>> _nodes;
+        bool _dirty = true;
+
+        std::mutex _mainMutex;
+        std::vector<size_t> _mainReady;
+        std::atomic<size_t> _remaining { 0 };
+        Clock::time_point _frameStart;
+        double _wallUs = 0;
+    };
+}
+
+#endif//RTS_SCHEDULER_H
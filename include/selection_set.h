@@ -0,0 +1,86 @@
+#ifndef RTS_SELECTION_SET_H
+#define RTS_SELECTION_SET_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <entityx/entityx.h>
+
+namespace engine {
+
+    // A set of entity ids as a sparse set: the ids sit packed in a dense array
+    // for iteration, and a table indexed by entity index points back into it,
+    // so insert, erase and contains are O(1) and never touch entityx's
+    // component pools. Ids carry their version, so a recycled index is not
+    // mistaken for the entity that used to have it.
+    class SelectionSet {
+    public:
+        typedef std::vector<entityx::Entity::Id>::const_iterator const_iterator;
+
+        bool contains(entityx::Entity::Id id) const {
+            uint32_t index = id.index();
+            return index < _slots.size() && _slots[index] != EMPTY && _dense[_slots[index]] == id;
+        }
+
+        // False if it was already in the set
+        bool insert(entityx::Entity::Id id) {
+            uint32_t index = id.index();
+            if (index >= _slots.size()) {
+                _slots.resize(index + 1, EMPTY);
+            }
+            uint32_t& slot = _slots[index];
+            if (slot != EMPTY) {
+                if (_dense[slot] == id) return false;
+                // a stale id for the same index; take its place
+                _dense[slot] = id;
+                return true;
+            }
+            slot = (uint32_t) _dense.size();
+            _dense.push_back(id);
+            return true;
+        }
+
+        // Swap-back removal; false if the id was not in the set
+        bool erase(entityx::Entity::Id id) {
+            if (!contains(id)) return false;
+            uint32_t slot = _slots[id.index()];
+            if (slot + 1 != _dense.size()) {
+                _dense[slot] = _dense.back();
+                _slots[_dense[slot].index()] = slot;
+            }
+            _dense.pop_back();
+            _slots[id.index()] = EMPTY;
+            return true;
+        }
+
+        void clear() {
+            for (auto id : _dense) {
+                _slots[id.index()] = EMPTY;
+            }
+            _dense.clear();
+        }
+
+        // Puts the ids in entity order, so whoever walks the set next (giving
+        // orders, say) does so the same way on every run
+        void sort() {
+            std::sort(_dense.begin(), _dense.end());
+            for (uint32_t i = 0; i < _dense.size(); i++) {
+                _slots[_dense[i].index()] = i;
+            }
+        }
+
+        size_t size() const { return _dense.size(); }
+        bool empty() const { return _dense.empty(); }
+
+        const_iterator begin() const { return _dense.begin(); }
+        const_iterator end() const { return _dense.end(); }
+
+    private:
+        enum : uint32_t { EMPTY = 0xffffffffu };
+
+        std::vector<entityx::Entity::Id> _dense;
+        std::vector<uint32_t> _slots;
+    };
+}
+
+#endif//RTS_SELECTION_SET_H
@@ -0,0 +1,124 @@
+#ifndef RTS_SHADER_H
+#define RTS_SHADER_H
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <gl_state.h>
+
+namespace engine {
+
+    // A linked vertex + fragment program. Every active uniform's location is
+    // read once at link time; renderers look up the ones they need in init()
+    // and keep the ints, so nothing queries GL by name while drawing.
+    class ShaderProgram {
+    public:
+        // Returns false, with the compile or link log on stderr, on failure;
+        // nothing is linked unless both shaders compiled, and a failed build
+        // leaves no program behind
+        bool build(const char* vertexSource, const char* fragmentSource) {
+            cleanup();
+
+            uint vs = compile(GL_VERTEX_SHADER, vertexSource, "vertex");
+            uint fs = compile(GL_FRAGMENT_SHADER, fragmentSource, "fragment");
+            if (vs == 0 || fs == 0) {
+                if (vs) glDeleteShader(vs);
+                if (fs) glDeleteShader(fs);
+                return false;
+            }
+
+            _program = glCreateProgram();
+            glAttachShader(_program, vs);
+            glAttachShader(_program, fs);
+            glLinkProgram(_program);
+
+            glDeleteShader(vs);
+            glDeleteShader(fs);
+
+            int status;
+            glGetProgramiv(_program, GL_LINK_STATUS, &status);
+            if (!status) {
+                char infoLog[256];
+                glGetProgramInfoLog(_program, 256, nullptr, infoLog);
+                std::cerr << "Unable to link program\n" << infoLog << std::endl;
+                cleanup();
+                return false;
+            }
+
+            int count = 0;
+            glGetProgramiv(_program, GL_ACTIVE_UNIFORMS, &count);
+            for (int i = 0; i < count; i++) {
+                char name[128];
+                GLsizei length;
+                GLint size;
+                GLenum type;
+                glGetActiveUniform(_program, (GLuint) i, sizeof(name), &length, &size, &type, name);
+                std::string uniform(name, length);
+                // arrays are reported as name[0]; let them be found by the bare name too
+                if (uniform.size() > 3 && uniform.compare(uniform.size() - 3, 3, "[0]") == 0) {
+                    uniform.resize(uniform.size() - 3);
+                }
+                _uniforms[uniform] = glGetUniformLocation(_program, name);
+            }
+            return true;
+        }
+
+        // -1 (which glUniform* ignores) for a uniform the program does not
+        // use; the compiler drops unused uniforms, so that is not an error
+        int uniform(const std::string& name) const {
+            auto found = _uniforms.find(name);
+            return found == _uniforms.end() ? -1 : found->second;
+        }
+
+        void use() const {
+            GLState::instance().useProgram(_program);
+        }
+
+        // The setters expect the program to be in use
+        void set(int location, int value) const { glUniform1i(location, value); }
+        void set(int location, float value) const { glUniform1f(location, value); }
+        void set(int location, const glm::vec2& value) const { glUniform2f(location, value.x, value.y); }
+        void set(int location, const glm::vec4& value) const { glUniform4f(location, value.x, value.y, value.z, value.w); }
+        void set(int location, const glm::mat4& value) const { glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value)); }
+
+        uint id() const { return _program; }
+
+        void cleanup() {
+            if (_program) {
+                GLState::instance().deletedProgram(_program);
+                glDeleteProgram(_program);
+                _program = 0;
+            }
+            _uniforms.clear();
+        }
+
+    private:
+        // The shader, or 0 if it did not compile
+        static uint compile(GLenum type, const char* source, const char* name) {
+            uint shader = glCreateShader(type);
+            glShaderSource(shader, 1, &source, nullptr);
+            glCompileShader(shader);
+
+            int status;
+            glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+            if (!status) {
+                char infoLog[256];
+                glGetShaderInfoLog(shader, 256, nullptr, infoLog);
+                std::cerr << "Unable to compile " << name << " shader\n" << infoLog << std::endl;
+                glDeleteShader(shader);
+                return 0;
+            }
+            return shader;
+        }
+
+        uint _program = 0;
+        std::map<std::string, int> _uniforms;
+    };
+}
+
+#endif//RTS_SHADER_H
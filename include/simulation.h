@@ -0,0 +1,1357 @@
+#ifndef RTS_SIMULATION_H
+#define RTS_SIMULATION_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+#include <queue>
+#include <vector>
+#include <glm/glm.hpp>
+#include <entityx/entityx.h>
+
+#include <components.h>
+#include <movement_kernel.h>
+#include <thread_pool.h>
+#include <command_buffer.h>
+#include <spatial.h>
+#include <timestep.h>
+#include <scheduler.h>
+#include <pathfinding.h>
+#include <profiler.h>
+#include <random.h>
+#include <command_log.h>
+#include <spsc_queue.h>
+#include <selection_set.h>
+#include <foraging.h>
+#include <lod.h>
+#include <unit_chunks.h>
+
+// Everything needed to run the game's simulation. Nothing in here may depend
+// on GL or GLFW, so that it can be built into rts_sim and run headless.
+
+namespace engine {
+
+    // Keeps the SpatialGrids in step with Position and Worker components being
+    // added and removed. Units (entities with a Worker) go in the unit grid
+    // that selection, avoidance and the job system search; everything else
+    // with a Position, such as items and caches, goes in props if given, so
+    // those searches never see it. Props are not expected to move. Unit moves
+    // are reported by MovementSystem itself.
+    class SpatialIndexSystem : public entityx::System<SpatialIndexSystem>, public entityx::Receiver<SpatialIndexSystem> {
+    public:
+        SpatialIndexSystem(SpatialGrid& grid, SpatialGrid* props = nullptr) : grid(grid), props(props) {}
+
+        void configure(entityx::EventManager& eventManager) {
+            eventManager.subscribe<entityx::ComponentAddedEvent<Position>>(*this);
+            eventManager.subscribe<entityx::ComponentRemovedEvent<Position>>(*this);
+            eventManager.subscribe<entityx::ComponentAddedEvent<Worker>>(*this);
+            eventManager.subscribe<entityx::ComponentRemovedEvent<Worker>>(*this);
+            eventManager.subscribe<entityx::EntityDestroyedEvent>(*this);
+        }
+
+        void update(entityx::EntityManager& es, entityx::EventManager& events, entityx::TimeDelta dt) override {}
+
+        void receive(const entityx::ComponentAddedEvent<Position>& event) {
+            auto& value = event.component->value;
+            glm::vec2 position(value.x, value.y);
+            if (event.entity.has_component<Worker>()) {
+                grid.insert(event.entity.id(), position);
+            } else if (props) {
+                props->insert(event.entity.id(), position);
+            }
+        }
+
+        void receive(const entityx::ComponentRemovedEvent<Position>& event) {
+            remove(event.entity.id());
+        }
+
+        void receive(const entityx::ComponentAddedEvent<Worker>& event) {
+            auto position = event.entity.component<Position>();
+            if (!position) return;
+            if (props) props->remove(event.entity.id());
+            grid.insert(event.entity.id(), glm::vec2(position->value.x, position->value.y));
+        }
+
+        // Also sent while the entity is destroyed, after EntityDestroyedEvent;
+        // by then it is in neither grid and stays out
+        void receive(const entityx::ComponentRemovedEvent<Worker>& event) {
+            auto position = event.entity.component<Position>();
+            if (!position || !grid.contains(event.entity.id())) return;
+            grid.remove(event.entity.id());
+            if (props) props->insert(event.entity.id(), glm::vec2(position->value.x, position->value.y));
+        }
+
+        void receive(const entityx::EntityDestroyedEvent& event) {
+            remove(event.entity.id());
+        }
+
+    private:
+        void remove(entityx::Entity::Id id) {
+            grid.remove(id);
+            if (props) props->remove(id);
+        }
+
+        SpatialGrid& grid;
+        SpatialGrid* props;
+    };
+
+    // Runs the best movement kernel the CPU supports over the awake units'
+    // chunks in UnitChunks, one chunk per parallel task. Each chunk's lanes
+    // are structure-of-arrays already, so the kernel works on them in place
+    // and sleeping units, in archetypes without the Awake tag, cost nothing.
+    //
+    // The lanes hold the positions. Each tick only the velocities, which the
+    // job and avoidance systems write, come in from the components, and the
+    // results go back out to them for everything else that reads them. Only
+    // the spatial grid update stays on the calling thread.
+    class MovementSystem : public entityx::System<MovementSystem> {
+    public:
+        MovementSystem(SpatialGrid& grid, ThreadPool& pool, SimulationLod& lod, UnitChunks& units)
+            : grid(grid), pool(pool), lod(lod), units(units), kernel(kernels::best()) {}
+
+        void update(entityx::EntityManager& es, entityx::EventManager& events, entityx::TimeDelta dt) override {
+            units.syncAwake(lod);
+            units.view<UnitLink, PositionLane<0>, PositionLane<1>, PositionLane<2>,
+                       VelocityLane<0>, VelocityLane<1>, VelocityLane<2>, Awake>(chunks);
+
+            float step = static_cast<float>(dt);
+            pool.parallelFor(chunks.size(), 1, [this, step](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; c++) {
+                    const ChunkRef& chunk = chunks[c];
+                    size_t count = chunk.size();
+                    const UnitLink* links = chunk.array<UnitLink>();
+                    MovementLanes lanes = lanesOf(chunk);
+                    for (size_t i = 0; i < count; i++) {
+                        const glm::vec3& velocity = links[i].velocity->value;
+                        lanes.vx[i] = velocity.x; lanes.vy[i] = velocity.y; lanes.vz[i] = velocity.z;
+                    }
+
+                    kernel.kernel(lanes, 0, count, step);
+
+                    for (size_t i = 0; i < count; i++) {
+                        Position& position = *links[i].position;
+                        position.previous = position.value;
+                        position.value = glm::vec3(lanes.px[i], lanes.py[i], lanes.pz[i]);
+                        links[i].velocity->value = glm::vec3(lanes.vx[i], lanes.vy[i], lanes.vz[i]);
+                    }
+                }
+            });
+
+            // a unit that stood still this tick has previous == value, so it can
+            // sleep without a jump in the interpolated position
+            sleeping.clear();
+            for (const ChunkRef& chunk : chunks) {
+                const UnitLink* links = chunk.array<UnitLink>();
+                MovementLanes lanes = lanesOf(chunk);
+                for (size_t i = 0; i < chunk.size(); i++) {
+                    grid.update(links[i].id, glm::vec2(lanes.px[i], lanes.py[i]));
+                    if (lanes.vx[i] == 0 && lanes.vy[i] == 0 && lanes.vz[i] == 0 &&
+                        !es.get(links[i].id).has_component<Job>()) {
+                        sleeping.push_back(links[i].id);
+                    }
+                }
+            }
+            for (auto id : sleeping) {
+                units.sleep(id, lod);
+            }
+        }
+
+        void setKernel(kernels::Entry kernel) {
+            this->kernel = kernel;
+        }
+
+        const char* kernelName() const {
+            return kernel.name;
+        }
+
+        // Entities in the chunks, and how many of them are awake
+        size_t trackedUnits() const { return units.size(); }
+        size_t awakeUnits() const { return units.awakeCount(); }
+
+    private:
+        static MovementLanes lanesOf(const ChunkRef& chunk) {
+            return MovementLanes {
+                &chunk.array<PositionLane<0>>()->value, &chunk.array<PositionLane<1>>()->value,
+                &chunk.array<PositionLane<2>>()->value, &chunk.array<VelocityLane<0>>()->value,
+                &chunk.array<VelocityLane<1>>()->value, &chunk.array<VelocityLane<2>>()->value,
+            };
+        }
+
+        SpatialGrid& grid;
+        ThreadPool& pool;
+        SimulationLod& lod;
+        UnitChunks& units;
+        kernels::Entry kernel;
+        std::vector<ChunkRef> chunks;
+        std::vector<entityx::Entity::Id> sleeping;
+    };
+
+    // Turns sprites to face where they are heading, walking the awake units'
+    // chunks in UnitChunks in parallel. It reads the velocities MovementSystem
+    // left in the lanes, which are what the components hold until the job and
+    // avoidance systems run after it. Only a presentation matter, so it
+    // follows SimulationLod's buckets: units out of view are turned every few
+    // ticks and sleeping ones not at all.
+    class SpriteOrientationSystem : public entityx::System<SpriteOrientationSystem> {
+    public:
+        SpriteOrientationSystem(ThreadPool& pool, const SimulationLod& lod, UnitChunks& units)
+            : pool(pool), lod(lod), units(units) {}
+
+        void update(entityx::EntityManager& es, entityx::EventManager& events, entityx::TimeDelta dt) override {
+            units.syncAwake(lod);
+            units.view<UnitLink, SpriteLink, PositionLane<0>, PositionLane<1>,
+                       VelocityLane<0>, VelocityLane<1>, Awake>(chunks);
+            oriented.assign(chunks.size(), 0);
+
+            pool.parallelFor(chunks.size(), 1, [this](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; c++) {
+                    const ChunkRef& chunk = chunks[c];
+                    const UnitLink* links = chunk.array<UnitLink>();
+                    const SpriteLink* sprites = chunk.array<SpriteLink>();
+                    const PositionLane<0>* px = chunk.array<PositionLane<0>>();
+                    const PositionLane<1>* py = chunk.array<PositionLane<1>>();
+                    const VelocityLane<0>* vx = chunk.array<VelocityLane<0>>();
+                    const VelocityLane<1>* vy = chunk.array<VelocityLane<1>>();
+                    for (size_t i = 0; i < chunk.size(); i++) {
+                        entityx::Entity::Id id = links[i].id;
+                        if (!lod.due(lod.bucket(id, glm::vec2(px[i].value, py[i].value)), id, tick)) continue;
+                        oriented[c]++;
+                        // the angle only depends on the ratio, so there is no need to normalize
+                        if (vx[i].value != 0) {
+                            sprites[i].sprite->rotation = (float) (atan(vy[i].value / vx[i].value) - M_PI_2);
+                        }
+                    }
+                }
+            });
+            tick++;
+        }
+
+        size_t orientedCount() const {
+            size_t total = 0;
+            for (auto count : oriented) total += count;
+            return total;
+        }
+
+    private:
+        ThreadPool& pool;
+        const SimulationLod& lod;
+        UnitChunks& units;
+        std::vector<ChunkRef> chunks;
+        std::vector<size_t> oriented; // per chunk
+        uint64_t tick = 0;
+    };
+
+    struct SelectionStartedEvent {
+        SelectionStartedEvent(Selection selection) : selection(selection) {}
+        Selection selection;
+    };
+
+    struct SelectionChangedEvent {
+        SelectionChangedEvent(Selection selection) : selection(selection) {}
+        Selection selection;
+    };
+
+    struct SelectionEndedEvent {
+        SelectionEndedEvent(Selection selection) : selection(selection) {}
+        Selection selection;
+    };
+
+    // Keeps the selected units in a SelectionSet rather than as Selection
+    // components, so dragging a box never assigns or removes components and a
+    // membership test is an array lookup. Each select() only touches the units
+    // inside the box and the ones selected last time, and applies the
+    // difference. CONTROL_GROUPS saved selections can be stored and recalled.
+    class SelectionSystem : public entityx::System<SelectionSystem>, public entityx::Receiver<SelectionSystem> {
+    public:
+        static const uint CONTROL_GROUPS = 10;
+
+        // With a CommandBuffer the difference is applied when it is flushed,
+        // so select() can run alongside systems that read the selection
+        SelectionSystem(SpatialGrid& grid, CommandBuffer* commands = nullptr)
+            : selection(0, 0, 0, 0, 0), grid(grid), commands(commands), groups(CONTROL_GROUPS) {}
+
+        void configure(entityx::EventManager& eventManager) {
+            eventManager.subscribe<SelectionStartedEvent>(*this);
+            eventManager.subscribe<SelectionChangedEvent>(*this);
+            eventManager.subscribe<SelectionEndedEvent>(*this);
+            eventManager.subscribe<entityx::EntityDestroyedEvent>(*this);
+        }
+
+        void update(entityx::EntityManager &entities, entityx::EventManager &events, entityx::TimeDelta dt) {
+            if (isSelecting) {
+                select(entities, selection);
+            }
+        }
+
+        void select(entityx::EntityManager& entities, const Selection& box) {
+            inside.clear();
+            grid.queryRect(box.minX, box.minY, box.maxX, box.maxY, inside);
+
+            added.clear();
+            removed.clear();
+            stamp++;
+            for (auto id : inside) {
+                if (id.index() >= marks.size()) {
+                    marks.resize(id.index() + 1, 0);
+                }
+                marks[id.index()] = stamp;
+                if (!current.contains(id)) {
+                    added.push_back(id);
+                }
+            }
+            for (auto id : current) {
+                if (id.index() >= marks.size() || marks[id.index()] != stamp) {
+                    removed.push_back(id);
+                }
+            }
+
+            if (added.empty() && removed.empty()) return;
+            if (commands) {
+                commands->push([this]() { applyDifference(); });
+            } else {
+                applyDifference();
+            }
+        }
+
+        void receive(const SelectionStartedEvent &event) {
+            selection = event.selection;
+            isSelecting = true;
+        }
+
+        void receive(const SelectionChangedEvent &event) {
+            selection = event.selection;
+        }
+
+        void receive(const SelectionEndedEvent &event) {
+            isSelecting = false;
+        }
+
+        void receive(const entityx::EntityDestroyedEvent& event) {
+            current.erase(event.entity.id());
+            for (auto& group : groups) {
+                group.erase(event.entity.id());
+            }
+        }
+
+        const SelectionSet& selected() const { return current; }
+        bool isSelected(entityx::Entity::Id id) const { return current.contains(id); }
+
+        // The box of the current or most recent drag
+        const Selection& box() const { return selection; }
+        bool selecting() const { return isSelecting; }
+
+        // Puts back the box and whether it is still being dragged, e.g. from a snapshot load
+        void restoreBox(const Selection& box, bool selecting) {
+            selection = box;
+            isSelecting = selecting;
+        }
+
+        // Adds a unit to the selection from outside, e.g. from a snapshot load
+        void adoptSelected(entityx::Entity::Id id) {
+            current.insert(id);
+        }
+
+        // Stores the current selection as control group n
+        void saveGroup(uint n) {
+            if (n < groups.size()) {
+                groups[n] = current;
+            }
+        }
+
+        // Makes control group n the current selection
+        void recallGroup(uint n) {
+            if (n < groups.size()) {
+                current = groups[n];
+            }
+        }
+
+        const SelectionSet& group(uint n) const { return groups[n]; }
+
+    private:
+        void applyDifference() {
+            for (auto id : removed) {
+                current.erase(id);
+            }
+            for (auto id : added) {
+                current.insert(id);
+            }
+        }
+
+        Selection selection;
+        bool isSelecting = false;
+        SpatialGrid& grid;
+        CommandBuffer* commands;
+        SelectionSet current;
+        std::vector<SelectionSet> groups;
+        std::vector<entityx::Entity::Id> inside, added, removed;
+        std::vector<uint> marks;
+        uint stamp = 0;
+    };
+
+    struct JobAddedEvent {
+        JobAddedEvent(Job job) : job(job) {}
+        Job job;
+    };
+
+    // Hands jobs out to Worker entities. An order given while units are selected
+    // goes to every selected unit once; any other job waits in a priority queue
+    // per JobType and is matched, once per tick, to the nearest idle worker
+    // able to do it. Idle workers live in their own spatial grid, so a match
+    // is a local ring search rather than a scan of every unit, and at most
+    // maxAssignmentsPerTick jobs are matched per tick however long the queues
+    // grow. Idle workers are counted per job type they can do, so a type no
+    // idle worker can do is passed over without searching or using up any of
+    // the tick's matches.
+    //
+    // Units walk to their job along the flow field for its target cell, shared
+    // through the FlowFieldCache by every unit heading there, and go straight
+    // for the target once inside its cell. Jobs marked direct (short trips
+    // with nothing in the way) skip the flow field and go straight all along,
+    // until a wall goes up across them. A target inside a wall is reached
+    // at the nearest cell the unit can get to, and a unit walled off from the
+    // target stops and drops its job rather than walking through. Since units
+    // in a group cannot all stand on the target, a unit also arrives when it
+    // touches one that already arrived there and is either within the order's
+    // groupRadius or has stopped getting any closer.
+    class JobSystem : public entityx::System<JobSystem>, public entityx::Receiver<JobSystem> {
+    public:
+        JobSystem(ThreadPool& pool, SpatialGrid& grid, FlowFieldCache& flowFields, const SelectionSet& selection,
+                  const SimulationLod& lod, size_t maxAssignmentsPerTick = 1024)
+            : pool(pool), grid(grid), flowFields(flowFields), selection(selection), lod(lod), commands(pool.size()),
+              idle(grid.cellSize()), maxAssignmentsPerTick(maxAssignmentsPerTick) {}
+
+        void configure(entityx::EventManager& eventManager) {
+            eventManager.subscribe<JobAddedEvent>(*this);
+            eventManager.subscribe<entityx::ComponentAddedEvent<Worker>>(*this);
+            eventManager.subscribe<entityx::ComponentRemovedEvent<Worker>>(*this);
+            eventManager.subscribe<entityx::ComponentAddedEvent<Job>>(*this);
+            eventManager.subscribe<entityx::ComponentRemovedEvent<Job>>(*this);
+            eventManager.subscribe<entityx::EntityDestroyedEvent>(*this);
+        }
+
+        void update(entityx::EntityManager& es, entityx::EventManager& events, entityx::TimeDelta dt) override {
+            working.clear();
+            // fields are fetched here, on one thread; units in a group usually sit next to each other
+            const FlowField* field = nullptr;
+            const GridMap& map = flowFields.map();
+            bool mapChanged = map.version() != checkedMapVersion;
+            checkedMapVersion = map.version();
+            es.each<Position, Velocity, Job>([this, &field, &map, mapChanged](entityx::Entity entity, Position& position,
+                                                                               Velocity& velocity, Job& job) {
+                glm::vec2 target(job.target.x, job.target.y);
+                // a wall put up across a direct trip sends the rest of it by flow field
+                if (job.direct && mapChanged && !map.clearLine(glm::vec2(position.value.x, position.value.y), target)) {
+                    job.direct = false;
+                }
+                if (job.direct) {
+                    working.push_back(Working { entity, &position, &velocity, &job, nullptr });
+                    return;
+                }
+                if (!field || field->target() != map.cellOf(target)) {
+                    field = &flowFields.get(target);
+                }
+                working.push_back(Working { entity, &position, &velocity, &job, field });
+            });
+
+            // steering runs in parallel; finished jobs are removed afterwards through the command buffer
+            pool.parallelFor(working.size(), ThreadPool::cacheChunk(sizeof(Working) + sizeof(Job)), [this](size_t begin, size_t end) {
+                const GridMap& map = flowFields.map();
+                for (size_t i = begin; i < end; i++) {
+                    Working& w = working[i];
+                    glm::vec2 position(w.position->value.x, w.position->value.y);
+                    // a direct trip is headed straight for its target the whole way
+                    bool atGoal = !w.field || w.field->goal(position);
+                    // a blocked target is stood in for by the middle of the goal cell the unit reached
+                    glm::vec3 goal = w.job->target;
+                    if (w.field && atGoal && map.cellOf(position) != w.field->target()) {
+                        goal = glm::vec3(map.center(map.cellOf(position)), goal.z);
+                    }
+                    auto direction = goal - w.position->value;
+                    float distance = glm::length(direction);
+                    if (distance < w.job->closest - 0.001f) {
+                        w.job->closest = distance;
+                        w.job->stalledTicks = 0;
+                    } else {
+                        w.job->stalledTicks++;
+                    }
+                    bool settled = (distance < w.job->groupRadius || w.job->stalledTicks > STALL_TICKS) && touchesArrived(w);
+                    if (distance < w.job->arriveRadius || settled) {
+                        uint32_t index = w.entity.id().index();
+                        glm::vec3 target = w.job->target;
+                        commands.push([this, index, target]() { arrivedAt[index] = target; });
+                        commands.remove<Job>(w.entity);
+                        w.velocity->value.x = 0;
+                        w.velocity->value.y = 0;
+                        w.velocity->value.z = 0;
+                    } else {
+                        auto speed = 0.2f;
+                        glm::vec2 flow = atGoal ? glm::vec2(0.0f) : w.field->direction(position);
+                        if (atGoal) {
+                            w.velocity->value = glm::normalize(direction) * speed;
+                        } else if (flow.x != 0 || flow.y != 0) {
+                            w.velocity->value = glm::vec3(flow, 0.0f) * speed;
+                        } else {
+                            // walls cut the unit off from every goal cell; it stops and drops the job
+                            commands.remove<Job>(w.entity);
+                            w.velocity->value = glm::vec3(0.0f);
+                        }
+                    }
+                }
+            });
+            commands.flush();
+            flowFields.trim();
+
+            // the order jobs were finished in depends on which thread ran which
+            // chunk; sort so idle workers are matched the same way every run
+            std::sort(becameIdle.begin(), becameIdle.end());
+            for (auto id : becameIdle) {
+                if (!es.valid(id)) continue;
+                entityx::Entity entity = es.get(id);
+                if (entity.has_component<Worker>() && !entity.has_component<Job>()) {
+                    addIdle(entity);
+                }
+            }
+            becameIdle.clear();
+            refreshIdlePositions(es);
+
+            if (!orders.empty()) {
+                giveOrders(es);
+            }
+            if (pendingJobs() > 0 && !idleIds.empty()) {
+                assign(es);
+            }
+        }
+
+        void receive(const JobAddedEvent& event) {
+            orders.push_back(event.job);
+        }
+
+        void receive(const entityx::ComponentAddedEvent<Worker>& event) {
+            becameIdle.push_back(event.entity.id());
+        }
+
+        void receive(const entityx::ComponentRemovedEvent<Worker>& event) {
+            removeIdle(event.entity.id());
+        }
+
+        void receive(const entityx::ComponentAddedEvent<Job>& event) {
+            removeIdle(event.entity.id());
+            uint32_t index = event.entity.id().index();
+            if (index >= arrivedAt.size()) {
+                arrivedAt.resize(index + 1, nowhere());
+            }
+            arrivedAt[index] = nowhere();
+        }
+
+        // Deferred to the next update: entityx also removes components while
+        // destroying an entity, after EntityDestroyedEvent has gone out
+        void receive(const entityx::ComponentRemovedEvent<Job>& event) {
+            becameIdle.push_back(event.entity.id());
+        }
+
+        void receive(const entityx::EntityDestroyedEvent& event) {
+            removeIdle(event.entity.id());
+            uint32_t index = event.entity.id().index();
+            if (index < arrivedAt.size()) {
+                arrivedAt[index] = nowhere();
+            }
+        }
+
+        size_t pendingJobs() const {
+            size_t count = 0;
+            for (auto& queue : pending) count += queue.size();
+            return count;
+        }
+
+        size_t idleWorkers() const { return idleIds.size(); }
+
+        // Idle workers able to do type
+        size_t idleWorkers(JobType type) const { return idleCapable[(uint) type]; }
+
+        // The jobs waiting for a worker, in the order they would be handed out
+        // if there were a worker for every type
+        void queuedJobs(std::vector<Job>& out) const {
+            std::vector<std::priority_queue<Pending>> copy(pending, pending + JOB_TYPE_COUNT);
+            for (;;) {
+                int best = -1;
+                for (uint t = 0; t < JOB_TYPE_COUNT; t++) {
+                    if (!copy[t].empty() && (best < 0 || copy[best].top() < copy[t].top())) best = (int) t;
+                }
+                if (best < 0) return;
+                out.push_back(copy[best].top().job);
+                copy[best].pop();
+            }
+        }
+
+        // Adds a job straight to the waiting queue, behind any of equal priority
+        void queueJob(const Job& job) {
+            enqueue(job);
+        }
+
+    private:
+        struct Working {
+            entityx::Entity entity;
+            Position* position;
+            Velocity* velocity;
+            Job* job;
+            const FlowField* field;
+        };
+
+        struct Pending {
+            Job job;
+            uint64_t sequence;
+            float searchRadius; // how far the next search for a worker looks
+
+            // std::priority_queue pops the largest: highest priority, then oldest
+            bool operator<(const Pending& other) const {
+                if (job.priority != other.job.priority) return job.priority < other.job.priority;
+                return sequence > other.sequence;
+            }
+        };
+
+        bool touchesArrived(const Working& w) const {
+            bool touching = false;
+            uint32_t self = w.entity.id().index();
+            glm::vec3 target = w.job->target;
+            grid.forEachInRadiusWhile(glm::vec2(w.position->value.x, w.position->value.y), CONTACT_RADIUS,
+                [&](const SpatialGrid::Entry& entry) {
+                    uint32_t other = entry.id.index();
+                    touching = other != self && other < arrivedAt.size() && arrivedAt[other] == target;
+                    return !touching;
+                });
+            return touching;
+        }
+
+        void giveOrders(entityx::EntityManager& es) {
+            group.clear();
+            for (auto id : selection) {
+                if (!es.valid(id)) continue;
+                entityx::Entity entity = es.get(id);
+                auto worker = entity.component<Worker>();
+                if (worker && worker->canDo(orders.back().type)) group.push_back(entity);
+            }
+            // in entity order, as the selection was built in whatever order the grid returned
+            std::sort(group.begin(), group.end(), [](const entityx::Entity& a, const entityx::Entity& b) {
+                return a.id() < b.id();
+            });
+
+            // the latest order wins, earlier ones this tick are overridden
+            Job order = orders.back();
+            order.groupRadius = std::max(order.groupRadius, GROUP_SPACING * std::sqrt((float) group.size()));
+            for (entityx::Entity entity : group) {
+                if (entity.has_component<Job>()) {
+                    entity.remove<Job>();
+                }
+                entity.assign_from_copy<Job>(order);
+            }
+
+            if (group.empty()) {
+                for (auto& job : orders) {
+                    enqueue(job);
+                }
+            }
+            orders.clear();
+        }
+
+        void enqueue(const Job& job) {
+            pending[(uint) job.type].push(Pending { job, sequence++, SEARCH_RADIUS });
+        }
+
+        // Greedy in priority order: each job takes the nearest idle worker that
+        // can do it. Only the types some idle worker can do take part, so jobs
+        // nobody idle can do wait without holding up the ones behind them. The
+        // search stops at the job's searchRadius, which doubles every time it
+        // comes up empty, so a job far from any worker costs a bounded search
+        // per tick and still finds one within a few ticks.
+        void assign(entityx::EntityManager& es) {
+            size_t budget = maxAssignmentsPerTick;
+            for (auto& jobs : skipped) jobs.clear();
+            while (budget > 0) {
+                int best = -1;
+                for (uint t = 0; t < JOB_TYPE_COUNT; t++) {
+                    if (pending[t].empty() || idleCapable[t] == 0) continue;
+                    if (best < 0 || pending[best].top() < pending[t].top()) best = (int) t;
+                }
+                if (best < 0) break;
+
+                Pending next = pending[best].top();
+                pending[best].pop();
+                budget--;
+
+                JobType type = next.job.type;
+                idle.nearest(glm::vec2(next.job.target.x, next.job.target.y), 1, found, [this, type](const SpatialGrid::Entry& entry) {
+                    return (idleCapabilities[idleSlots[entry.id.index()]] & jobBit(type)) != 0;
+                }, next.searchRadius);
+                if (found.empty()) {
+                    next.searchRadius *= 2;
+                    skipped[best].push_back(next);
+                    continue;
+                }
+
+                entityx::Entity entity = es.get(found[0].id);
+                entity.assign_from_copy<Job>(next.job);
+            }
+
+            for (uint t = 0; t < JOB_TYPE_COUNT; t++) {
+                for (auto& job : skipped[t]) {
+                    pending[t].push(job);
+                }
+            }
+        }
+
+        // Idle units can still drift. A bounded slice of their grid entries is
+        // brought up to date every tick, round robin, so the refresh never costs
+        // a pass over every idle worker. Sleeping ones cannot have moved.
+        void refreshIdlePositions(entityx::EntityManager& es) {
+            size_t count = std::min(idleIds.size(), maxAssignmentsPerTick * 4);
+            for (size_t n = 0; n < count; n++) {
+                if (refreshCursor >= idleIds.size()) refreshCursor = 0;
+                auto id = idleIds[refreshCursor++];
+                if (!lod.isAwake(id)) continue;
+                auto position = es.get(id).component<Position>();
+                idle.update(id, glm::vec2(position->value.x, position->value.y));
+            }
+        }
+
+        void addIdle(entityx::Entity entity) {
+            auto position = entity.component<Position>();
+            auto worker = entity.component<Worker>();
+            if (!position || !worker) return;
+
+            uint32_t index = entity.id().index();
+            if (index >= idleSlots.size()) {
+                idleSlots.resize(index + 1, NOT_IDLE);
+            }
+            if (idleSlots[index] != NOT_IDLE) return;
+
+            idleSlots[index] = (uint32_t) idleIds.size();
+            idleIds.push_back(entity.id());
+            idleCapabilities.push_back(worker->capabilities);
+            countIdle(worker->capabilities, 1);
+            idle.insert(entity.id(), glm::vec2(position->value.x, position->value.y));
+        }
+
+        void removeIdle(entityx::Entity::Id id) {
+            uint32_t index = id.index();
+            if (index >= idleSlots.size() || idleSlots[index] == NOT_IDLE) return;
+
+            uint32_t slot = idleSlots[index];
+            countIdle(idleCapabilities[slot], -1);
+            idleIds[slot] = idleIds.back();
+            idleCapabilities[slot] = idleCapabilities.back();
+            idleSlots[idleIds[slot].index()] = slot;
+            idleIds.pop_back();
+            idleCapabilities.pop_back();
+            idleSlots[index] = NOT_IDLE;
+            idle.remove(id);
+        }
+
+        void countIdle(uint capabilities, int change) {
+            for (uint t = 0; t < JOB_TYPE_COUNT; t++) {
+                if (capabilities & jobBit((JobType) t)) idleCapable[t] += change;
+            }
+        }
+
+        enum : uint32_t { NOT_IDLE = 0xffffffffu };
+        static constexpr float CONTACT_RADIUS = 0.035f;
+        static constexpr float GROUP_SPACING = 0.02f;
+        static constexpr uint STALL_TICKS = 30;
+        static constexpr float SEARCH_RADIUS = 0.25f;
+        static glm::vec3 nowhere() { return glm::vec3(INFINITY); }
+
+        ThreadPool& pool;
+        SpatialGrid& grid;
+        FlowFieldCache& flowFields;
+        const SelectionSet& selection;
+        const SimulationLod& lod;
+        CommandBuffer commands;
+        std::vector<Working> working;
+
+        std::vector<Job> orders;
+        std::vector<entityx::Entity> group;
+        std::priority_queue<Pending> pending[JOB_TYPE_COUNT]; // by JobType
+        std::vector<Pending> skipped[JOB_TYPE_COUNT];
+        uint64_t sequence = 0;
+
+        SpatialGrid idle;
+        std::vector<entityx::Entity::Id> idleIds, becameIdle;
+        std::vector<uint32_t> idleSlots;
+        std::vector<uint> idleCapabilities; // alongside idleIds
+        size_t idleCapable[JOB_TYPE_COUNT] = {}; // idle workers able to do each JobType
+        size_t refreshCursor = 0;
+        uint64_t checkedMapVersion = 0; // direct jobs were last checked against this layout
+        // where each unit last finished a job, for arriving by contact
+        std::vector<glm::vec3> arrivedAt;
+        std::vector<SpatialGrid::Entry> found;
+        size_t maxAssignmentsPerTick;
+    };
+
+    struct AvoidanceSettings {
+        float radius = 0.05f;        // neighbours further than this are ignored
+        size_t maxNeighbors = 8;
+        float unitRadius = 0.015f;
+        float timeHorizon = 0.5f;    // seconds ahead a collision is looked for
+        float separationWeight = 0.1f;
+        float avoidanceWeight = 1.0f;
+    };
+
+    // Keeps moving units from walking through each other. Runs after the job
+    // steering has set each unit's preferred velocity and adjusts it with
+    //  - separation: a push away from every neighbour closer than radius, and
+    //  - reciprocal avoidance: for neighbours on course to pass closer than two
+    //    unit radii within timeHorizon, half of the sideways correction needed
+    //    to clear them (the other unit takes the other half), RVO style.
+    // Each unit only reacts to the maxNeighbors nearest within radius (ties
+    // broken by entity index), so the answer never depends on the grid's hash
+    // layout. Units are steered in grid cell order and everything in reach of
+    // a cell is gathered once for all its units, bucketed finer when crowded,
+    // so the per-unit cost stays about flat as the crowd grows in size or in
+    // density. Units standing still are obstacles only and are never pushed.
+    class AvoidanceSystem : public entityx::System<AvoidanceSystem> {
+    public:
+        AvoidanceSystem(SpatialGrid& grid, ThreadPool& pool, const SimulationLod& lod, AvoidanceSettings settings = AvoidanceSettings())
+            : grid(grid), pool(pool), lod(lod), settings(settings) {}
+
+        void update(entityx::EntityManager& es, entityx::EventManager& events, entityx::TimeDelta dt) override {
+            // anything in the grid not moving (asleep, or without a Velocity)
+            // counts as standing still; only last tick's movers need clearing
+            for (auto& m : moving) {
+                velocities[m.index] = glm::vec2(0.0f);
+            }
+            moving.clear();
+            for (auto id : lod.awakeUnits()) {
+                entityx::Entity entity = es.get(id);
+                auto position = entity.component<Position>();
+                auto velocity = entity.component<Velocity>();
+                if (!position || !velocity || (velocity->value.x == 0 && velocity->value.y == 0)) continue;
+
+                uint32_t index = id.index();
+                if (index >= velocities.size()) {
+                    velocities.resize(index + 1);
+                }
+                velocities[index] = glm::vec2(velocity->value.x, velocity->value.y);
+                glm::vec2 at(position->value.x, position->value.y);
+                moving.push_back(Moving { index, cellKey(at), at, velocity.get() });
+            }
+            // the result for a unit does not depend on the order units are steered in
+            std::sort(moving.begin(), moving.end(), [](const Moving& a, const Moving& b) { return a.cell < b.cell; });
+            scratch.resize(pool.size() + 1);
+
+            // every unit reads the velocities gathered above and writes only its own
+            pool.parallelFor(moving.size(), ThreadPool::cacheChunk(sizeof(Moving) + sizeof(glm::vec2) * 8), [this](size_t begin, size_t end) {
+                int worker = ThreadPool::workerIndex();
+                auto& local = scratch[worker >= 0 && (size_t) worker + 1 < scratch.size() ? worker + 1 : 0];
+                // the grid has changed since the last tick
+                local.cell = ~(uint64_t) 0;
+                for (size_t i = begin; i < end; i++) {
+                    Moving& m = moving[i];
+                    glm::vec2 preferred = velocities[m.index];
+                    glm::vec2 v = preferred + steer(m, preferred, local);
+                    float speed = glm::length(preferred);
+                    float length = glm::length(v);
+                    if (length > speed) {
+                        v *= speed / length;
+                    }
+                    m.velocity->value.x = v.x;
+                    m.velocity->value.y = v.y;
+                }
+            });
+        }
+
+        const AvoidanceSettings& getSettings() const { return settings; }
+        void setSettings(const AvoidanceSettings& settings) { this->settings = settings; }
+
+    private:
+        struct Moving {
+            uint32_t index;
+            uint64_t cell;
+            glm::vec2 position;
+            Velocity* velocity;
+        };
+
+        // an entry near the cell being steered, with the velocity it had this tick
+        struct Candidate {
+            uint32_t index;
+            glm::vec2 position, velocity;
+        };
+
+        struct Neighbor {
+            float distanceSquared;
+            uint32_t index;
+            glm::vec2 offset, velocity;
+
+            bool operator<(const Neighbor& other) const {
+                return distanceSquared < other.distanceSquared ||
+                       (distanceSquared == other.distanceSquared && index < other.index);
+            }
+        };
+
+        // Per thread: everything within radius of the last cell steered, bucketed
+        // on a finer grid of about four entries a bucket, and the nearest list
+        struct Scratch {
+            uint64_t cell = ~(uint64_t) 0;
+            std::vector<Candidate> found, candidates;
+            std::vector<uint32_t> buckets, cursor;
+            glm::vec2 origin;
+            float bucketSize, inverseBucketSize;
+            int side;
+            std::vector<Neighbor> nearest;
+
+            glm::ivec2 bucketOf(glm::vec2 position) const {
+                glm::vec2 at = (position - origin) * inverseBucketSize;
+                return glm::ivec2(std::min(std::max((int) std::floor(at.x), 0), side - 1),
+                                  std::min(std::max((int) std::floor(at.y), 0), side - 1));
+            }
+        };
+
+        // The grid cell, rows first, biased so the order is row-major across negative cells too
+        uint64_t cellKey(glm::vec2 position) const {
+            glm::ivec2 cell = grid.cellOf(position);
+            return ((uint64_t) ((uint32_t) cell.y ^ 0x80000000u) << 32) | ((uint32_t) cell.x ^ 0x80000000u);
+        }
+
+        // Every entry in the cells radius could reach from anywhere in the unit's cell,
+        // gathered and bucketed once for all the units in it
+        void gatherCandidates(uint64_t key, Scratch& scratch) const {
+            scratch.cell = key;
+            scratch.found.clear();
+            glm::ivec2 cell((int32_t) ((uint32_t) key ^ 0x80000000u), (int32_t) ((uint32_t) (key >> 32) ^ 0x80000000u));
+            int reach = (int) std::ceil(settings.radius / grid.cellSize());
+            grid.forEachInCells(cell - reach, cell + reach, [&](const SpatialGrid::Entry& entry) {
+                uint32_t index = entry.id.index();
+                glm::vec2 velocity = index < velocities.size() ? velocities[index] : glm::vec2(0.0f);
+                scratch.found.push_back(Candidate { index, entry.position, velocity });
+            });
+
+            // a short list is quicker to scan than to sort
+            float width = (float) (2 * reach + 1) * grid.cellSize();
+            size_t count = scratch.found.size();
+            scratch.side = count <= 128 ? 1 : std::min(64, (int) std::ceil(std::sqrt(count * 0.25f)));
+            scratch.origin = glm::vec2(cell - reach) * grid.cellSize();
+            scratch.bucketSize = width / (float) scratch.side;
+            scratch.inverseBucketSize = (float) scratch.side / width;
+
+            auto& buckets = scratch.buckets;
+            if (scratch.side == 1) {
+                buckets.assign({ 0, (uint32_t) count });
+                std::swap(scratch.found, scratch.candidates);
+                return;
+            }
+
+            // counting sort into buckets
+            buckets.assign((size_t) scratch.side * scratch.side + 1, 0);
+            for (auto& candidate : scratch.found) {
+                glm::ivec2 at = scratch.bucketOf(candidate.position);
+                buckets[at.y * scratch.side + at.x + 1]++;
+            }
+            for (size_t i = 1; i < buckets.size(); i++) {
+                buckets[i] += buckets[i - 1];
+            }
+            scratch.cursor.assign(buckets.begin(), buckets.end() - 1);
+            scratch.candidates.resize(scratch.found.size());
+            for (auto& candidate : scratch.found) {
+                glm::ivec2 at = scratch.bucketOf(candidate.position);
+                scratch.candidates[scratch.cursor[at.y * scratch.side + at.x]++] = candidate;
+            }
+        }
+
+        glm::vec2 steer(const Moving& m, glm::vec2 velocity, Scratch& scratch) const {
+            if (scratch.cell != m.cell) gatherCandidates(m.cell, scratch);
+
+            // keep the maxNeighbors closest, sorted, visiting buckets in rings
+            // outwards until no closer entry can be left
+            auto& nearest = scratch.nearest;
+            nearest.clear();
+            size_t limit = settings.maxNeighbors;
+            float radiusSquared = settings.radius * settings.radius;
+            auto visit = [&](int x, int y) {
+                if (x < 0 || y < 0 || x >= scratch.side || y >= scratch.side) return;
+                uint32_t bucket = (uint32_t) (y * scratch.side + x);
+                for (uint32_t i = scratch.buckets[bucket]; i < scratch.buckets[bucket + 1]; i++) {
+                    auto& candidate = scratch.candidates[i];
+                    glm::vec2 offset = m.position - candidate.position;
+                    float distanceSquared = glm::dot(offset, offset);
+                    if (distanceSquared > radiusSquared || candidate.index == m.index) continue;
+                    Neighbor neighbor { distanceSquared, candidate.index, offset, candidate.velocity };
+
+                    // insertion into a short sorted list, dropping the furthest once it is full
+                    size_t at = nearest.size();
+                    if (at == limit) {
+                        if (!(neighbor < nearest[at - 1])) continue;
+                        at--;
+                    } else {
+                        nearest.push_back(neighbor);
+                    }
+                    for (; at > 0 && neighbor < nearest[at - 1]; at--) {
+                        nearest[at] = nearest[at - 1];
+                    }
+                    nearest[at] = neighbor;
+                }
+            };
+
+            glm::ivec2 origin = scratch.bucketOf(m.position);
+            for (int ring = 0; limit > 0 && ring <= scratch.side; ring++) {
+                // anything in this ring is at least (ring - 1) buckets away; a
+                // little is taken off so rounding never skips an equal distance
+                float gap = (float) (ring - 1) * scratch.bucketSize * 0.99f;
+                if (gap > settings.radius) break;
+                if (gap > 0 && nearest.size() == limit && gap * gap > nearest.back().distanceSquared) break;
+
+                for (int y = origin.y - ring; y <= origin.y + ring; y++) {
+                    bool edgeRow = y == origin.y - ring || y == origin.y + ring;
+                    int step = edgeRow ? 1 : std::max(1, 2 * ring);
+                    for (int x = origin.x - ring; x <= origin.x + ring; x += step) {
+                        visit(x, y);
+                    }
+                }
+            }
+
+            glm::vec2 separation(0.0f), avoidance(0.0f);
+            float diameter = settings.unitRadius * 2;
+            for (auto& neighbor : nearest) {
+                glm::vec2 offset = neighbor.offset;
+                float distance = std::sqrt(neighbor.distanceSquared);
+                if (distance > 0) {
+                    separation += offset / distance * (1.0f - distance / settings.radius);
+                }
+
+                // closest approach along the relative velocity
+                glm::vec2 relative = velocity - neighbor.velocity;
+                float speedSquared = glm::dot(relative, relative);
+                if (speedSquared > 0) {
+                    float t = -glm::dot(offset, relative) / speedSquared;
+                    if (t > 0 && t < settings.timeHorizon) {
+                        glm::vec2 miss = offset + relative * t;
+                        float missDistance = glm::length(miss);
+                        if (missDistance < diameter && missDistance > 0) {
+                            float urgency = 1.0f - t / settings.timeHorizon;
+                            avoidance += miss / missDistance * ((diameter - missDistance) / settings.timeHorizon * 0.5f * urgency);
+                        }
+                    }
+                }
+            }
+
+            return separation * settings.separationWeight + avoidance * settings.avoidanceWeight;
+        }
+
+        SpatialGrid& grid;
+        ThreadPool& pool;
+        const SimulationLod& lod;
+        AvoidanceSettings settings;
+        std::vector<Moving> moving;
+        std::vector<glm::vec2> velocities;
+        // one per pool worker plus one for the calling thread
+        std::vector<Scratch> scratch;
+    };
+
+    // The simulated world without any rendering. World adds the render systems
+    // on top; the headless runner and the benchmarks use this directly.
+    //
+    // Player input goes through commands (addUnit, addJob, blockArea, the selection calls)
+    // that are applied at the start of the next tick. Together with the seeded
+    // random and fixed ticks this makes a run deterministic: the same seed and
+    // the same commands on the same ticks give the same state, bit for bit,
+    // whatever the thread count. record() writes the commands and per-tick
+    // state hashes to a CommandLogWriter so the run can be replayed.
+    class Simulation : public entityx::EntityX {
+    public:
+        Simulation(float cellSize = 0.05f, unsigned threads = ThreadPool::defaultThreadCount())
+            : grid(cellSize), props(cellSize), pool(threads), scheduler(entities, events, pool), flowFields(map) {
+            lod.configure(events);
+            units.configure(events);
+            systems.add<SpatialIndexSystem>(grid, &props);
+            auto movement = systems.add<MovementSystem>(grid, pool, lod, units);
+            auto orientation = systems.add<SpriteOrientationSystem>(pool, lod, units);
+            auto selection = systems.add<SelectionSystem>(grid, &scheduler.commands());
+            auto job = systems.add<JobSystem>(pool, grid, flowFields, selection->selected(), lod);
+            auto foraging = systems.add<ForagingSystem>(pool, random, &map, cellSize);
+            auto avoidance = systems.add<AvoidanceSystem>(grid, pool, lod);
+            systems.configure();
+            lod.setSelection(&selection->selected());
+
+            // Selection changes are deferred until the end of the tick, so the job
+            // system still sees last tick's selection as it did when it ran first
+            scheduler.add("MovementSystem", movement,
+                          SystemAccess().write<Position, Velocity, SpatialGrid, SimulationLod, UnitChunks>());
+            scheduler.add("SpriteOrientationSystem", orientation,
+                          SystemAccess().read<Position, Velocity, SelectionSet, SimulationLod>().write<Sprite, UnitChunks>());
+            scheduler.add("SelectionSystem", selection,
+                          SystemAccess().read<Position, SpatialGrid, SelectionSet>());
+            scheduler.add("JobSystem", job,
+                          SystemAccess().read<Position, SelectionSet, Worker, GridMap, SpatialGrid>().write<Velocity, Job, FlowFieldCache, SimulationLod>().structural());
+            scheduler.add("ForagingSystem", foraging,
+                          SystemAccess().read<Position, GridMap>().write<Item, ItemCache, ItemSpawner, Forager, Job, Random, SimulationLod>().structural());
+            scheduler.add("AvoidanceSystem", avoidance,
+                          SystemAccess().read<Position, SpatialGrid, SimulationLod>().write<Velocity>());
+        }
+
+        entityx::Entity spawnUnit(float x, float y, TextureHandle texture = INVALID_TEXTURE) {
+            entityx::Entity entity = entities.create();
+            entity.assign<Position>(x, y, 0.0f);
+            entity.assign<Velocity>(0.0f, 0.0f, 0.0f);
+            entity.assign<Sprite>(texture, 0.05f, random.range(-1.0f, 1.0f));
+            entity.assign<Worker>();
+            return entity;
+        }
+
+        // A unit that forages on its own whenever it has no other job
+        entityx::Entity spawnForager(float x, float y, TextureHandle texture = INVALID_TEXTURE, uint capacity = 1) {
+            entityx::Entity entity = spawnUnit(x, y, texture);
+            entity.assign<Forager>(capacity);
+            return entity;
+        }
+
+        entityx::Entity spawnItem(float x, float y, uint amount = 1) {
+            return systems.system<ForagingSystem>()->spawnItem(entities, x, y, amount);
+        }
+
+        entityx::Entity spawnItemCache(float x, float y) {
+            return systems.system<ForagingSystem>()->spawnCache(entities, x, y);
+        }
+
+        entityx::Entity spawnItemSpawner(float x, float y, ItemSpawner spawner = ItemSpawner()) {
+            return systems.system<ForagingSystem>()->spawnSpawner(entities, x, y, spawner);
+        }
+
+        // Runs as many fixed simulation ticks as the frame time allows and returns
+        // how many ran. With the fixed timestep disabled the simulation steps once
+        // with the raw frame time.
+        uint advance(entityx::TimeDelta dt) {
+            if (fixedTimestep) {
+                return timestep.advance(dt, [this](double tickLength) { step(tickLength); });
+            }
+            step(dt);
+            return 1;
+        }
+
+        void step(entityx::TimeDelta dt) {
+            RTS_PROFILE_ZONE("Simulation::step");
+            applyCommands();
+            scheduler.run(dt);
+
+            if (recorder && recorder->header().hashInterval > 0 && tickCount % recorder->header().hashInterval == 0) {
+                recorder->hash(tickCount, stateHash());
+            }
+            tickCount++;
+        }
+
+        // Applies the queued commands now, recording them against the current
+        // tick. step() does this first thing; call it directly only when
+        // updating systems one at a time.
+        void applyCommands() {
+            if (commandSource) {
+                PlayerCommand command;
+                while (commandSource->pop(command)) {
+                    enqueue(command);
+                }
+            }
+            for (auto& command : queued) {
+                if (recorder) {
+                    recorder->command(tickCount, command);
+                }
+                apply(command);
+            }
+            queued.clear();
+        }
+
+        // A drag updates the selection every frame but only the latest box
+        // matters by the time the tick runs, so a ChangeSelection replaces one
+        // queued right before it
+        void enqueue(const PlayerCommand& command) {
+            if (command.type == CommandType::ChangeSelection && !queued.empty() &&
+                queued.back().type == CommandType::ChangeSelection) {
+                queued.back() = command;
+                return;
+            }
+            queued.push_back(command);
+        }
+
+        // Commands pushed into source by another thread (say, input running
+        // apart from a simulation thread) are taken at the start of each tick,
+        // after anything enqueued directly. The simulation only pops; the
+        // queue must outlive it or be detached with nullptr.
+        void setCommandSource(SpscQueue<PlayerCommand>* source) {
+            commandSource = source;
+        }
+
+        // Must be called before the first tick, with a writer whose header has
+        // this simulation's seed and tick rate. Forces fixed ticks.
+        void record(CommandLogWriter* writer) {
+            recorder = writer;
+            fixedTimestep = true;
+        }
+
+        void stopRecording() {
+            if (recorder) {
+                recorder->end(tickCount);
+                recorder = nullptr;
+            }
+        }
+
+        void seed(uint64_t seed) {
+            random.reseed(seed);
+        }
+
+        uint64_t tick() const {
+            return tickCount;
+        }
+
+        // For restoring a snapshot; the next step() runs this tick
+        void setTick(uint64_t tick) {
+            tickCount = tick;
+        }
+
+        // FNV-1a over every unit's simulated state, in entity order
+        uint64_t stateHash() {
+            uint64_t hash = 14695981039346656037ull;
+            auto mix = [&hash](const void* data, size_t size) {
+                auto bytes = static_cast<const unsigned char*>(data);
+                for (size_t i = 0; i < size; i++) {
+                    hash = (hash ^ bytes[i]) * 1099511628211ull;
+                }
+            };
+
+            uint64_t state = random.state();
+            mix(&state, sizeof(state));
+            auto selection = systems.system<SelectionSystem>();
+            entities.each<Position, Velocity>([&mix, &selection](entityx::Entity entity, Position& position, Velocity& velocity) {
+                uint64_t id = entity.id().id();
+                mix(&id, sizeof(id));
+                mix(&position.value, sizeof(position.value));
+                mix(&velocity.value, sizeof(velocity.value));
+                auto job = entity.component<Job>();
+                uint8_t flags = (job ? 1 : 0) | (selection->isSelected(entity.id()) ? 2 : 0);
+                mix(&flags, sizeof(flags));
+                if (job) {
+                    mix(&job->target, sizeof(job->target));
+                }
+                auto forager = entity.component<Forager>();
+                if (forager) {
+                    mix(&forager->carried, sizeof(forager->carried));
+                }
+            });
+            return hash;
+        }
+
+        // Fraction of the way from the previous tick to the current one
+        float interpolation() const {
+            return fixedTimestep ? (float) timestep.alpha() : 1.0f;
+        }
+
+        void setFixedTimestep(bool enabled) {
+            fixedTimestep = enabled;
+        }
+
+        FixedTimestep& getTimestep() {
+            return timestep;
+        }
+
+        // Spawns a unit with unitTexture at the start of the next tick
+        void addUnit(float x, float y) {
+            enqueue(PlayerCommand::spawnUnit(x, y));
+        }
+
+        void addTarget(glm::vec3 target) {
+            addJob(Job(target));
+        }
+
+        void addJob(Job job) {
+            enqueue(PlayerCommand::addJob(job));
+        }
+
+        // Places a forager (with unitTexture), an ItemCache or an ItemSpawner at the start of the next tick
+        void addForaging(ForagingSpawn what, float x, float y) {
+            enqueue(PlayerCommand::spawnForaging(what, x, y));
+        }
+
+        // Blocks (or clears) the pathfinding map under the rectangle
+        void blockArea(glm::vec2 min, glm::vec2 max, bool blocked = true) {
+            enqueue(PlayerCommand::blockArea(min, max, blocked));
+        }
+
+        void startSelection(Selection selection) {
+            enqueue(PlayerCommand::selection(CommandType::StartSelection, selection));
+        }
+
+        void changeSelection(Selection selection) {
+            enqueue(PlayerCommand::selection(CommandType::ChangeSelection, selection));
+        }
+
+        void stopSelection(Selection selection) {
+            enqueue(PlayerCommand::selection(CommandType::StopSelection, selection));
+        }
+
+        // Stores the selection as control group n, below SelectionSystem::CONTROL_GROUPS
+        void saveGroup(uint n) {
+            enqueue(PlayerCommand::group(CommandType::SaveGroup, n));
+        }
+
+        void recallGroup(uint n) {
+            enqueue(PlayerCommand::group(CommandType::RecallGroup, n));
+        }
+
+        SpatialGrid grid;  // units
+        SpatialGrid props; // everything else with a Position: items, caches, spawners
+        ThreadPool pool;
+        SystemScheduler scheduler;
+        GridMap map;
+        FlowFieldCache flowFields;
+        Random random;
+        SimulationLod lod;
+        UnitChunks units; // the hot columns of movement and orientation
+        TextureHandle unitTexture = INVALID_TEXTURE;
+
+    private:
+        void apply(const PlayerCommand& command) {
+            switch (command.type) {
+                case CommandType::SpawnUnit:
+                    spawnUnit(command.values[0], command.values[1], unitTexture);
+                    break;
+                case CommandType::SpawnForaging:
+                    switch ((ForagingSpawn) command.extra[0]) {
+                        case ForagingSpawn::Forager:
+                            spawnForager(command.values[0], command.values[1], unitTexture);
+                            break;
+                        case ForagingSpawn::Cache:
+                            spawnItemCache(command.values[0], command.values[1]);
+                            break;
+                        case ForagingSpawn::Spawner:
+                            spawnItemSpawner(command.values[0], command.values[1]);
+                            break;
+                    }
+                    break;
+                case CommandType::AddJob:
+                    events.emit<JobAddedEvent>(command.job());
+                    break;
+                case CommandType::StartSelection:
+                    events.emit<SelectionStartedEvent>(command.selection());
+                    break;
+                case CommandType::ChangeSelection:
+                    events.emit<SelectionChangedEvent>(command.selection());
+                    break;
+                case CommandType::StopSelection:
+                    events.emit<SelectionEndedEvent>(command.selection());
+                    break;
+                case CommandType::BlockArea:
+                    map.block(glm::vec2(command.values[0], command.values[1]),
+                              glm::vec2(command.values[2], command.values[3]), command.extra[0] != 0);
+                    break;
+                case CommandType::SaveGroup:
+                    systems.system<SelectionSystem>()->saveGroup((uint) command.extra[0]);
+                    break;
+                case CommandType::RecallGroup:
+                    systems.system<SelectionSystem>()->recallGroup((uint) command.extra[0]);
+                    break;
+            }
+        }
+
+        FixedTimestep timestep;
+        bool fixedTimestep = true;
+        std::vector<PlayerCommand> queued;
+        SpscQueue<PlayerCommand>* commandSource = nullptr;
+        CommandLogWriter* recorder = nullptr;
+        uint64_t tickCount = 0;
+    };
+}
+
+#endif//RTS_SIMULATION_H
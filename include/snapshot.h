@@ -0,0 +1,742 @@
+#ifndef RTS_SNAPSHOT_H
+#define RTS_SNAPSHOT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mapped_file.h>
+#include <simulation.h>
+
+namespace engine {
+
+    // Binary world snapshot, little-endian throughout:
+    //
+    //   header   "RTSSNAP\0", u16 version, u16 column count, u32 reserved,
+    //            u64 entity count, u64 tick, u64 random seed, u64 random state
+    //   columns  one descriptor per column: u32 id, u16 version, u16 reserved,
+    //            u32 stride, u32 reserved, u64 count, u64 offset
+    //   blocks   count * stride bytes per column at its offset, 64-byte aligned
+    //
+    // Every entity with a Position is saved. The mask column holds a u16 per
+    // entity saying which components it has, and each component column one
+    // fixed-size record per entity that has the component, in entity order. The
+    // queued jobs column is the JobSystem's waiting queue, in hand-out order.
+    // The map column is a u8 per GridMap cell, row by row, nonzero where it is
+    // blocked, and the selection box column the SelectionSystem's one box.
+    // Loaders skip columns they do not know and refuse ones whose version they
+    // do not, so columns can be added without breaking older files.
+    enum class SnapshotColumn : uint32_t {
+        Mask = 1,
+        Position,
+        Velocity,
+        Sprite,
+        Job,
+        Selection,
+        Worker,
+        QueuedJob,
+        Item,
+        ItemCache,
+        ItemSpawner,
+        Forager,
+        MapBlocked,
+        SelectionBox,
+    };
+
+    enum SnapshotMask : uint16_t {
+        HAS_VELOCITY = 1 << 0,
+        HAS_SPRITE = 1 << 1,
+        HAS_JOB = 1 << 2,
+        HAS_SELECTION = 1 << 3,
+        HAS_WORKER = 1 << 4,
+        HAS_ITEM = 1 << 5,
+        HAS_ITEM_CACHE = 1 << 6,
+        HAS_ITEM_SPAWNER = 1 << 7,
+        HAS_FORAGER = 1 << 8,
+    };
+
+    // Version 2 of the mask column widened it to u16; version 2 of the job
+    // columns added arriveRadius and flags
+    inline uint16_t snapshotColumnVersion(SnapshotColumn id) {
+        switch (id) {
+            case SnapshotColumn::Mask:
+            case SnapshotColumn::Job:
+            case SnapshotColumn::QueuedJob:
+                return 2;
+            default:
+                return 1;
+        }
+    }
+
+    struct PositionRecord {
+        float value[3];
+        float previous[3];
+    };
+
+    struct VelocityRecord {
+        float value[3];
+    };
+
+    struct SpriteRecord {
+        uint32_t texture;
+        float uv[4];
+        float scale;
+        float rotation;
+    };
+
+    enum JobRecordFlags : uint32_t {
+        JOB_DIRECT = 1 << 0,
+    };
+
+    struct JobRecord {
+        float target[3];
+        uint32_t type;
+        int32_t priority;
+        float groupRadius;
+        float closest;
+        uint32_t stalledTicks;
+        float arriveRadius;
+        uint32_t flags;
+    };
+
+    struct SelectionRecord {
+        uint32_t cursor;
+        float minX, minY, maxX, maxY;
+    };
+
+    struct WorkerRecord {
+        uint32_t capabilities;
+    };
+
+    struct ItemRecord {
+        uint32_t amount;
+    };
+
+    struct ItemCacheRecord {
+        uint32_t stored;
+    };
+
+    struct ItemSpawnerRecord {
+        float interval;
+        float radius;
+        uint32_t amount;
+        float timer;
+    };
+
+    // claimed is the row of the item the forager is on its way to pick up, or NO_CLAIM
+    struct ForagerRecord {
+        uint32_t capacity;
+        uint32_t carried;
+        uint32_t claimed;
+    };
+
+    enum SelectionBoxFlags : uint32_t {
+        BOX_SELECTING = 1 << 0,
+    };
+
+    struct SelectionBoxRecord {
+        uint32_t cursor;
+        float minX, minY, maxX, maxY;
+        uint32_t flags;
+    };
+
+    static_assert(sizeof(PositionRecord) == 24 && sizeof(VelocityRecord) == 12 && sizeof(SpriteRecord) == 28 &&
+                  sizeof(JobRecord) == 40 && sizeof(SelectionRecord) == 20 && sizeof(WorkerRecord) == 4 &&
+                  sizeof(ItemRecord) == 4 && sizeof(ItemCacheRecord) == 4 && sizeof(ItemSpawnerRecord) == 16 &&
+                  sizeof(ForagerRecord) == 12 && sizeof(SelectionBoxRecord) == 24,
+                  "snapshot records must have no padding");
+
+    const char SNAPSHOT_MAGIC[8] = { 'R', 'T', 'S', 'S', 'N', 'A', 'P', '\0' };
+    const uint16_t SNAPSHOT_VERSION = 1;
+    const size_t SNAPSHOT_ALIGNMENT = 64;
+    const uint32_t NO_CLAIM = 0xffffffffu;
+
+    struct SnapshotHeader {
+        char magic[8];
+        uint16_t version;
+        uint16_t columnCount;
+        uint32_t reserved;
+        uint64_t entityCount;
+        uint64_t tick;
+        uint64_t randomSeed;
+        uint64_t randomState;
+    };
+
+    struct SnapshotColumnHeader {
+        uint32_t id;
+        uint16_t version;
+        uint16_t reserved;
+        uint32_t stride;
+        uint32_t reserved2;
+        uint64_t count;
+        uint64_t offset;
+    };
+
+    static_assert(sizeof(SnapshotHeader) == 48 && sizeof(SnapshotColumnHeader) == 32,
+                  "snapshot headers must have no padding");
+
+    // The whole world gathered into columns, ready to write out
+    class Snapshot {
+    public:
+        // Gathers the simulation's state. Must run on the simulation's thread
+        // between ticks; it only copies, all file work happens in write().
+        //
+        // Only the walk over Position is serial. The rows are then split into
+        // fixed chunks that gather their records on the simulation's pool, and
+        // each column is the chunks' records concatenated in chunk order, so
+        // the file comes out the same whatever the thread count.
+        void capture(Simulation& simulation) {
+            RTS_PROFILE_ZONE("Snapshot::capture");
+            ThreadPool& pool = simulation.pool;
+            captured.clear();
+            rows.clear();
+            uint32_t indices = 0;
+            simulation.entities.each<Position>([this, &indices](entityx::Entity entity, Position& position) {
+                captured.push_back(CapturedRow { entity, &position });
+                indices = std::max(indices, entity.id().index() + 1);
+            });
+            rows.assign(indices, NO_CLAIM);
+            masks.resize(captured.size());
+            positions.resize(captured.size());
+
+            size_t chunkCount = (captured.size() + CHUNK_ROWS - 1) / CHUNK_ROWS;
+            if (chunks.size() < chunkCount) chunks.resize(chunkCount);
+            auto selection = simulation.systems.system<SelectionSystem>();
+            auto foraging = simulation.systems.system<ForagingSystem>();
+            pool.parallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; c++) {
+                    gather(simulation, *selection, *foraging, c);
+                }
+            });
+
+            concatenate(pool, chunkCount, &Chunk::velocities, velocities);
+            concatenate(pool, chunkCount, &Chunk::sprites, sprites);
+            concatenate(pool, chunkCount, &Chunk::jobs, jobs);
+            concatenate(pool, chunkCount, &Chunk::selections, selections);
+            concatenate(pool, chunkCount, &Chunk::workers, workers);
+            concatenate(pool, chunkCount, &Chunk::items, items);
+            concatenate(pool, chunkCount, &Chunk::itemCaches, itemCaches);
+            concatenate(pool, chunkCount, &Chunk::itemSpawners, itemSpawners);
+            concatenate(pool, chunkCount, &Chunk::foragers, foragers);
+            // claims were gathered as entity indices; every row is known now
+            pool.parallelFor(foragers.size(), ThreadPool::cacheChunk(sizeof(ForagerRecord)), [this](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    uint32_t& claimed = foragers[i].claimed;
+                    if (claimed != NO_CLAIM) claimed = claimed < rows.size() ? rows[claimed] : NO_CLAIM;
+                }
+            });
+
+            const GridMap& map = simulation.map;
+            blocked.resize(map.cellCount());
+            for (int y = 0; y < map.rows(); y++) {
+                for (int x = 0; x < map.columns(); x++) {
+                    glm::ivec2 cell(x, y);
+                    blocked[map.index(cell)] = map.blocked(cell) ? 1 : 0;
+                }
+            }
+            const Selection& box = selection->box();
+            selectionBox = SelectionBoxRecord { box.cursor, box.minX, box.minY, box.maxX, box.maxY,
+                                                selection->selecting() ? (uint32_t) BOX_SELECTING : 0u };
+
+            queued.clear();
+            queuedJobs.clear();
+            simulation.systems.system<JobSystem>()->queuedJobs(queuedJobs);
+            for (auto& job : queuedJobs) {
+                queued.push_back(record(job));
+            }
+
+            tick = simulation.tick();
+            randomSeed = simulation.random.seed();
+            randomState = simulation.random.state();
+        }
+
+        size_t entityCount() const { return masks.size(); }
+
+        // Size of the file write() produces
+        size_t size() const {
+            size_t offset = 0;
+            layout([&offset](SnapshotColumn, const void*, size_t, size_t, size_t end) { offset = end; });
+            return offset;
+        }
+
+        bool write(const std::string& path, std::string& error) const {
+            RTS_PROFILE_ZONE("Snapshot::write");
+            if (!hostIsLittleEndian()) {
+                error = "snapshots are only written on little-endian hosts";
+                return false;
+            }
+
+            FILE* file = fopen(path.c_str(), "wb");
+            if (!file) {
+                error = "unable to open '" + path + "'";
+                return false;
+            }
+
+            SnapshotHeader header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+            header.version = SNAPSHOT_VERSION;
+            header.columnCount = COLUMN_COUNT;
+            header.entityCount = masks.size();
+            header.tick = tick;
+            header.randomSeed = randomSeed;
+            header.randomState = randomState;
+            bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+            layout([&](SnapshotColumn id, const void*, size_t stride, size_t count, size_t end) {
+                SnapshotColumnHeader column;
+                memset(&column, 0, sizeof(column));
+                column.id = (uint32_t) id;
+                column.version = snapshotColumnVersion(id);
+                column.stride = (uint32_t) stride;
+                column.count = count;
+                column.offset = end - stride * count;
+                ok = ok && fwrite(&column, sizeof(column), 1, file) == 1;
+            });
+
+            size_t written = sizeof(SnapshotHeader) + sizeof(SnapshotColumnHeader) * COLUMN_COUNT;
+            static const char zeroes[SNAPSHOT_ALIGNMENT] = {};
+            layout([&](SnapshotColumn, const void* data, size_t stride, size_t count, size_t end) {
+                size_t start = end - stride * count;
+                ok = ok && fwrite(zeroes, 1, start - written, file) == start - written;
+                ok = ok && (count == 0 || fwrite(data, stride, count, file) == count);
+                written = end;
+            });
+
+            ok = fclose(file) == 0 && ok;
+            if (!ok) {
+                error = "unable to write '" + path + "'";
+            }
+            return ok;
+        }
+
+    private:
+        // One chunk's records for every column but mask and position, which
+        // are written straight into their row
+        struct Chunk {
+            std::vector<VelocityRecord> velocities;
+            std::vector<SpriteRecord> sprites;
+            std::vector<JobRecord> jobs;
+            std::vector<SelectionRecord> selections;
+            std::vector<WorkerRecord> workers;
+            std::vector<ItemRecord> items;
+            std::vector<ItemCacheRecord> itemCaches;
+            std::vector<ItemSpawnerRecord> itemSpawners;
+            std::vector<ForagerRecord> foragers;
+        };
+
+        struct CapturedRow {
+            entityx::Entity entity;
+            const Position* position;
+        };
+
+        // Fills chunk c from its rows. Chunks share nothing but rows[], where
+        // each writes only the entity indices of its own rows.
+        void gather(Simulation& simulation, const SelectionSystem& selection, const ForagingSystem& foraging, size_t c) {
+            Chunk& chunk = chunks[c];
+            chunk.velocities.clear();
+            chunk.sprites.clear();
+            chunk.jobs.clear();
+            chunk.selections.clear();
+            chunk.workers.clear();
+            chunk.items.clear();
+            chunk.itemCaches.clear();
+            chunk.itemSpawners.clear();
+            chunk.foragers.clear();
+
+            const Selection& box = selection.box();
+            size_t end = std::min(captured.size(), (c + 1) * CHUNK_ROWS);
+            for (size_t row = c * CHUNK_ROWS; row < end; row++) {
+                entityx::Entity entity = captured[row].entity;
+                const Position& position = *captured[row].position;
+                uint16_t mask = 0;
+                rows[entity.id().index()] = (uint32_t) row;
+                positions[row] = PositionRecord {
+                    { position.value.x, position.value.y, position.value.z },
+                    { position.previous.x, position.previous.y, position.previous.z } };
+
+                if (auto velocity = entity.component<Velocity>()) {
+                    mask |= HAS_VELOCITY;
+                    chunk.velocities.push_back(VelocityRecord { { velocity->value.x, velocity->value.y, velocity->value.z } });
+                }
+                if (auto sprite = entity.component<Sprite>()) {
+                    mask |= HAS_SPRITE;
+                    chunk.sprites.push_back(SpriteRecord { sprite->texture,
+                        { sprite->uv.x, sprite->uv.y, sprite->uv.z, sprite->uv.w }, sprite->scale, sprite->rotation });
+                }
+                if (auto job = entity.component<Job>()) {
+                    mask |= HAS_JOB;
+                    chunk.jobs.push_back(record(*job));
+                }
+                if (selection.isSelected(entity.id())) {
+                    mask |= HAS_SELECTION;
+                    chunk.selections.push_back(SelectionRecord { box.cursor, box.minX, box.minY, box.maxX, box.maxY });
+                }
+                if (auto worker = entity.component<Worker>()) {
+                    mask |= HAS_WORKER;
+                    chunk.workers.push_back(WorkerRecord { worker->capabilities });
+                }
+                if (auto item = entity.component<Item>()) {
+                    mask |= HAS_ITEM;
+                    chunk.items.push_back(ItemRecord { item->amount });
+                }
+                if (auto cache = entity.component<ItemCache>()) {
+                    mask |= HAS_ITEM_CACHE;
+                    chunk.itemCaches.push_back(ItemCacheRecord { cache->stored });
+                }
+                if (auto spawner = entity.component<ItemSpawner>()) {
+                    mask |= HAS_ITEM_SPAWNER;
+                    chunk.itemSpawners.push_back(ItemSpawnerRecord { spawner->interval, spawner->radius, spawner->amount, spawner->timer });
+                }
+                if (auto forager = entity.component<Forager>()) {
+                    mask |= HAS_FORAGER;
+                    entityx::Entity::Id claim = foraging.claimedItem(entity.id());
+                    bool claimed = claim != entityx::Entity::INVALID && simulation.entities.valid(claim);
+                    chunk.foragers.push_back(ForagerRecord { forager->capacity, forager->carried, claimed ? claim.index() : NO_CLAIM });
+                }
+                masks[row] = mask;
+            }
+        }
+
+        // Sizes column to the sum of the chunks' parts and copies each part in
+        template <typename R>
+        void concatenate(ThreadPool& pool, size_t chunkCount, std::vector<R> Chunk::*part, std::vector<R>& column) {
+            offsets.resize(chunkCount + 1);
+            offsets[0] = 0;
+            for (size_t c = 0; c < chunkCount; c++) {
+                offsets[c + 1] = offsets[c] + (chunks[c].*part).size();
+            }
+            column.resize(offsets[chunkCount]);
+            pool.parallelFor(chunkCount, 1, [&](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; c++) {
+                    std::copy((chunks[c].*part).begin(), (chunks[c].*part).end(), column.begin() + offsets[c]);
+                }
+            });
+        }
+
+        static JobRecord record(const Job& job) {
+            return JobRecord { { job.target.x, job.target.y, job.target.z }, (uint32_t) job.type, job.priority,
+                               job.groupRadius, job.closest, job.stalledTicks, job.arriveRadius,
+                               job.direct ? (uint32_t) JOB_DIRECT : 0u };
+        }
+
+        // Calls f(id, data, stride, count, end) for every column in file order,
+        // where end is the offset just past the column's block
+        template <typename F>
+        void layout(F f) const {
+            size_t offset = sizeof(SnapshotHeader) + sizeof(SnapshotColumnHeader) * COLUMN_COUNT;
+            auto column = [&](SnapshotColumn id, const void* data, size_t stride, size_t count) {
+                offset = (offset + SNAPSHOT_ALIGNMENT - 1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+                offset += stride * count;
+                f(id, data, stride, count, offset);
+            };
+            column(SnapshotColumn::Mask, masks.data(), sizeof(uint16_t), masks.size());
+            column(SnapshotColumn::Position, positions.data(), sizeof(PositionRecord), positions.size());
+            column(SnapshotColumn::Velocity, velocities.data(), sizeof(VelocityRecord), velocities.size());
+            column(SnapshotColumn::Sprite, sprites.data(), sizeof(SpriteRecord), sprites.size());
+            column(SnapshotColumn::Job, jobs.data(), sizeof(JobRecord), jobs.size());
+            column(SnapshotColumn::Selection, selections.data(), sizeof(SelectionRecord), selections.size());
+            column(SnapshotColumn::Worker, workers.data(), sizeof(WorkerRecord), workers.size());
+            column(SnapshotColumn::QueuedJob, queued.data(), sizeof(JobRecord), queued.size());
+            column(SnapshotColumn::Item, items.data(), sizeof(ItemRecord), items.size());
+            column(SnapshotColumn::ItemCache, itemCaches.data(), sizeof(ItemCacheRecord), itemCaches.size());
+            column(SnapshotColumn::ItemSpawner, itemSpawners.data(), sizeof(ItemSpawnerRecord), itemSpawners.size());
+            column(SnapshotColumn::Forager, foragers.data(), sizeof(ForagerRecord), foragers.size());
+            column(SnapshotColumn::MapBlocked, blocked.data(), sizeof(uint8_t), blocked.size());
+            column(SnapshotColumn::SelectionBox, &selectionBox, sizeof(SelectionBoxRecord), 1);
+        }
+
+        static const uint16_t COLUMN_COUNT = 14;
+        enum : size_t { CHUNK_ROWS = 16384 };
+
+        std::vector<uint16_t> masks;
+        std::vector<PositionRecord> positions;
+        std::vector<VelocityRecord> velocities;
+        std::vector<SpriteRecord> sprites;
+        std::vector<JobRecord> jobs;
+        std::vector<SelectionRecord> selections;
+        std::vector<WorkerRecord> workers;
+        std::vector<JobRecord> queued;
+        std::vector<ItemRecord> items;
+        std::vector<ItemCacheRecord> itemCaches;
+        std::vector<ItemSpawnerRecord> itemSpawners;
+        std::vector<ForagerRecord> foragers;
+        std::vector<uint8_t> blocked;
+        SelectionBoxRecord selectionBox = {};
+        std::vector<Job> queuedJobs;
+        std::vector<uint32_t> rows; // by entity index, the row it was captured in
+        std::vector<CapturedRow> captured;
+        std::vector<Chunk> chunks;
+        std::vector<size_t> offsets;
+        uint64_t tick = 0;
+        uint64_t randomSeed = 1;
+        uint64_t randomState = 1;
+    };
+
+    // Saves without holding up the frame: save() captures the world on the
+    // calling thread, then writes the file on a thread of its own. A save
+    // started while the previous one is still writing waits for it first.
+    class SnapshotWriter {
+    public:
+        ~SnapshotWriter() {
+            wait();
+        }
+
+        void save(Simulation& simulation, const std::string& path) {
+            wait();
+            snapshot.capture(simulation);
+            finished = false;
+            thread = std::thread([this, path]() {
+                succeeded = snapshot.write(path, failure);
+                finished = true;
+            });
+        }
+
+        bool busy() const { return thread.joinable() && !finished; }
+
+        // Blocks until the save in progress is on disk and returns whether it worked
+        bool wait() {
+            if (thread.joinable()) {
+                thread.join();
+            }
+            return succeeded;
+        }
+
+        const Snapshot& last() const { return snapshot; }
+        const std::string& error() const { return failure; }
+
+    private:
+        Snapshot snapshot;
+        std::thread thread;
+        std::atomic<bool> finished { true };
+        bool succeeded = true;
+        std::string failure;
+    };
+
+    // Loads a snapshot into a simulation that has no entities yet. The file is
+    // mapped and every record read straight out of its column; nothing is
+    // parsed per entity beyond the mask byte. Returns false with error set if
+    // the file is not a snapshot this build can read.
+    inline bool loadSnapshot(Simulation& simulation, const std::string& path, std::string& error) {
+        RTS_PROFILE_ZONE("loadSnapshot");
+        if (!hostIsLittleEndian()) {
+            error = "snapshots are only read on little-endian hosts";
+            return false;
+        }
+        if (simulation.entities.size() > 0) {
+            error = "snapshots can only be loaded into an empty simulation";
+            return false;
+        }
+
+        MappedFile file(path);
+        if (!file.ok()) {
+            error = "unable to open '" + path + "'";
+            return false;
+        }
+
+        SnapshotHeader header;
+        if (file.size() < sizeof(header)) {
+            error = "not a snapshot";
+            return false;
+        }
+        memcpy(&header, file.data(), sizeof(header));
+        if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+            error = "not a snapshot";
+            return false;
+        }
+        if (header.version != SNAPSHOT_VERSION) {
+            error = "unsupported snapshot version " + std::to_string(header.version);
+            return false;
+        }
+        if (file.size() < sizeof(header) + sizeof(SnapshotColumnHeader) * header.columnCount) {
+            error = "truncated column table";
+            return false;
+        }
+
+        struct Column {
+            const unsigned char* data = nullptr;
+            uint64_t count = 0;
+        };
+        const uint32_t strides[] = { 0, sizeof(uint16_t), sizeof(PositionRecord), sizeof(VelocityRecord), sizeof(SpriteRecord),
+                                     sizeof(JobRecord), sizeof(SelectionRecord), sizeof(WorkerRecord), sizeof(JobRecord),
+                                     sizeof(ItemRecord), sizeof(ItemCacheRecord), sizeof(ItemSpawnerRecord), sizeof(ForagerRecord),
+                                     sizeof(uint8_t), sizeof(SelectionBoxRecord) };
+        const uint32_t known = sizeof(strides) / sizeof(strides[0]);
+        Column columns[known];
+
+        for (uint16_t c = 0; c < header.columnCount; c++) {
+            SnapshotColumnHeader column;
+            memcpy(&column, file.data() + sizeof(header) + sizeof(column) * c, sizeof(column));
+            if (column.id == 0 || column.id >= known) continue;
+            if (column.version != snapshotColumnVersion((SnapshotColumn) column.id) || column.stride != strides[column.id]) {
+                error = "unsupported version of column " + std::to_string(column.id);
+                return false;
+            }
+            if (column.offset % alignof(JobRecord) != 0 || column.offset > file.size() ||
+                column.count > (file.size() - column.offset) / column.stride) {
+                error = "column " + std::to_string(column.id) + " is out of bounds";
+                return false;
+            }
+            columns[column.id] = Column { file.data() + column.offset, column.count };
+        }
+
+        const Column& maskColumn = columns[(uint32_t) SnapshotColumn::Mask];
+        const uint16_t* masks = reinterpret_cast<const uint16_t*>(maskColumn.data);
+        if (maskColumn.count != header.entityCount || columns[(uint32_t) SnapshotColumn::Position].count != header.entityCount) {
+            error = "mask or position column does not cover every entity";
+            return false;
+        }
+
+        // check the column sizes against the masks before touching the simulation
+        uint64_t expected[known] = {};
+        for (uint64_t i = 0; i < maskColumn.count; i++) {
+            uint16_t mask = masks[i];
+            if (mask & HAS_VELOCITY) expected[(uint32_t) SnapshotColumn::Velocity]++;
+            if (mask & HAS_SPRITE) expected[(uint32_t) SnapshotColumn::Sprite]++;
+            if (mask & HAS_JOB) expected[(uint32_t) SnapshotColumn::Job]++;
+            if (mask & HAS_SELECTION) expected[(uint32_t) SnapshotColumn::Selection]++;
+            if (mask & HAS_WORKER) expected[(uint32_t) SnapshotColumn::Worker]++;
+            if (mask & HAS_ITEM) expected[(uint32_t) SnapshotColumn::Item]++;
+            if (mask & HAS_ITEM_CACHE) expected[(uint32_t) SnapshotColumn::ItemCache]++;
+            if (mask & HAS_ITEM_SPAWNER) expected[(uint32_t) SnapshotColumn::ItemSpawner]++;
+            if (mask & HAS_FORAGER) expected[(uint32_t) SnapshotColumn::Forager]++;
+        }
+        for (SnapshotColumn id : { SnapshotColumn::Velocity, SnapshotColumn::Sprite, SnapshotColumn::Job,
+                                   SnapshotColumn::Selection, SnapshotColumn::Worker, SnapshotColumn::Item,
+                                   SnapshotColumn::ItemCache, SnapshotColumn::ItemSpawner, SnapshotColumn::Forager }) {
+            if (columns[(uint32_t) id].count != expected[(uint32_t) id]) {
+                error = "column " + std::to_string((uint32_t) id) + " does not match the entity masks";
+                return false;
+            }
+        }
+
+        const Column& foragerColumn = columns[(uint32_t) SnapshotColumn::Forager];
+        auto foragers = reinterpret_cast<const ForagerRecord*>(foragerColumn.data);
+        for (uint64_t i = 0; i < foragerColumn.count; i++) {
+            uint32_t claimed = foragers[i].claimed;
+            if (claimed != NO_CLAIM && (claimed >= maskColumn.count || !(masks[claimed] & HAS_ITEM))) {
+                error = "a forager claims something that is not an item";
+                return false;
+            }
+        }
+
+        // files from before these columns keep the map as it is and take the box from the selected units
+        const Column& blockedColumn = columns[(uint32_t) SnapshotColumn::MapBlocked];
+        if (blockedColumn.data && blockedColumn.count != simulation.map.cellCount()) {
+            error = "the map column does not match the map's size";
+            return false;
+        }
+        const Column& boxColumn = columns[(uint32_t) SnapshotColumn::SelectionBox];
+        if (boxColumn.data && boxColumn.count != 1) {
+            error = "the selection box column must hold one box";
+            return false;
+        }
+
+        auto positions = reinterpret_cast<const PositionRecord*>(columns[(uint32_t) SnapshotColumn::Position].data);
+        auto velocities = reinterpret_cast<const VelocityRecord*>(columns[(uint32_t) SnapshotColumn::Velocity].data);
+        auto sprites = reinterpret_cast<const SpriteRecord*>(columns[(uint32_t) SnapshotColumn::Sprite].data);
+        auto jobs = reinterpret_cast<const JobRecord*>(columns[(uint32_t) SnapshotColumn::Job].data);
+        auto selections = reinterpret_cast<const SelectionRecord*>(columns[(uint32_t) SnapshotColumn::Selection].data);
+        auto workers = reinterpret_cast<const WorkerRecord*>(columns[(uint32_t) SnapshotColumn::Worker].data);
+        auto items = reinterpret_cast<const ItemRecord*>(columns[(uint32_t) SnapshotColumn::Item].data);
+        auto itemCaches = reinterpret_cast<const ItemCacheRecord*>(columns[(uint32_t) SnapshotColumn::ItemCache].data);
+        auto itemSpawners = reinterpret_cast<const ItemSpawnerRecord*>(columns[(uint32_t) SnapshotColumn::ItemSpawner].data);
+        auto toJob = [](const JobRecord& record) {
+            Job job(glm::vec3(record.target[0], record.target[1], record.target[2]), (JobType) record.type, record.priority);
+            job.groupRadius = record.groupRadius;
+            job.closest = record.closest;
+            job.stalledTicks = record.stalledTicks;
+            job.arriveRadius = record.arriveRadius;
+            job.direct = (record.flags & JOB_DIRECT) != 0;
+            return job;
+        };
+
+        auto selectionSystem = simulation.systems.system<SelectionSystem>();
+        auto foraging = simulation.systems.system<ForagingSystem>();
+        // claims refer to rows, so they are made once every row has its entity
+        std::vector<entityx::Entity::Id> created;
+        std::vector<std::pair<entityx::Entity::Id, uint32_t>> claims;
+        if (foragerColumn.count > 0) created.reserve(maskColumn.count);
+        for (uint64_t i = 0; i < maskColumn.count; i++) {
+            uint16_t mask = masks[i];
+            entityx::Entity entity = simulation.entities.create();
+            if (foragerColumn.count > 0) created.push_back(entity.id());
+
+            const PositionRecord& position = *positions++;
+            auto restored = entity.assign<Position>(position.value[0], position.value[1], position.value[2]);
+            restored->previous = glm::vec3(position.previous[0], position.previous[1], position.previous[2]);
+
+            if (mask & HAS_VELOCITY) {
+                const VelocityRecord& velocity = *velocities++;
+                entity.assign<Velocity>(velocity.value[0], velocity.value[1], velocity.value[2]);
+            }
+            if (mask & HAS_SPRITE) {
+                const SpriteRecord& sprite = *sprites++;
+                entity.assign<Sprite>(sprite.texture, sprite.scale, sprite.rotation,
+                                      glm::vec4(sprite.uv[0], sprite.uv[1], sprite.uv[2], sprite.uv[3]));
+            }
+            // workers before jobs, so the JobSystem sees a busy worker rather than an idle one
+            if (mask & HAS_WORKER) {
+                entity.assign<Worker>(workers++->capabilities);
+            }
+            if (mask & HAS_ITEM) {
+                entity.assign<Item>(items++->amount);
+            }
+            if (mask & HAS_ITEM_CACHE) {
+                entity.assign<ItemCache>()->stored = itemCaches++->stored;
+            }
+            if (mask & HAS_ITEM_SPAWNER) {
+                const ItemSpawnerRecord& spawner = *itemSpawners++;
+                entity.assign<ItemSpawner>(spawner.interval, spawner.radius, spawner.amount)->timer = spawner.timer;
+            }
+            if (mask & HAS_FORAGER) {
+                const ForagerRecord& forager = *foragers++;
+                entity.assign<Forager>(forager.capacity)->carried = forager.carried;
+                if (forager.claimed != NO_CLAIM) claims.push_back(std::make_pair(entity.id(), forager.claimed));
+            }
+            if (mask & HAS_JOB) {
+                entity.assign_from_copy<Job>(toJob(*jobs++));
+            }
+            if (mask & HAS_SELECTION) {
+                const SelectionRecord& selection = *selections++;
+                selectionSystem->adoptSelected(entity.id());
+                if (!boxColumn.data) {
+                    selectionSystem->restoreBox(Selection(selection.cursor, selection.minX, selection.minY, selection.maxX, selection.maxY), false);
+                }
+            }
+        }
+
+        if (blockedColumn.data) {
+            GridMap& map = simulation.map;
+            for (uint64_t i = 0; i < blockedColumn.count; i++) {
+                map.setBlocked(glm::ivec2((int) (i % map.columns()), (int) (i / map.columns())), blockedColumn.data[i] != 0);
+            }
+        }
+        if (boxColumn.data) {
+            SelectionBoxRecord box;
+            memcpy(&box, boxColumn.data, sizeof(box));
+            selectionSystem->restoreBox(Selection(box.cursor, box.minX, box.minY, box.maxX, box.maxY), (box.flags & BOX_SELECTING) != 0);
+        }
+
+        for (auto& claim : claims) {
+            foraging->adoptClaim(created[claim.second], claim.first);
+        }
+
+        const Column& queued = columns[(uint32_t) SnapshotColumn::QueuedJob];
+        auto jobSystem = simulation.systems.system<JobSystem>();
+        for (uint64_t i = 0; i < queued.count; i++) {
+            jobSystem->queueJob(toJob(reinterpret_cast<const JobRecord*>(queued.data)[i]));
+        }
+
+        simulation.random.restore(header.randomSeed, header.randomState);
+        simulation.setTick(header.tick);
+        return true;
+    }
+}
+
+#endif//RTS_SNAPSHOT_H
@@ -0,0 +1,263 @@
+#ifndef RTS_SPATIAL_H
+#define RTS_SPATIAL_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+#include <glm/glm.hpp>
+#include <entityx/entityx.h>
+
+namespace engine {
+
+    // Uniform spatial hash over world x/y. Each entity lives in exactly one cell
+    // and only changes bucket when it crosses a cell border, so moving units
+    // cost a float compare per tick in the common case.
+    class SpatialGrid {
+    public:
+        struct Entry {
+            entityx::Entity::Id id;
+            glm::vec2 position;
+        };
+
+        SpatialGrid(float cellSize = 0.05f) : _cellSize(cellSize), _inverseCellSize(1.0f / cellSize) {}
+
+        void insert(entityx::Entity::Id id, glm::vec2 position) {
+            uint32_t index = id.index();
+            if (index >= _slots.size()) {
+                _slots.resize(index + 1);
+            }
+            if (_slots[index].cell != nullptr) {
+                update(id, position);
+                return;
+            }
+            auto key = keyFor(cellOf(position));
+            auto& cell = _cells[key];
+            _slots[index] = Slot { &cell, key, (uint32_t) cell.size() };
+            cell.push_back(Entry { id, position });
+            _size++;
+        }
+
+        void update(entityx::Entity::Id id, glm::vec2 position) {
+            uint32_t index = id.index();
+            if (index >= _slots.size() || _slots[index].cell == nullptr) {
+                insert(id, position);
+                return;
+            }
+
+            Slot& slot = _slots[index];
+            auto key = keyFor(cellOf(position));
+            if (key == slot.key) {
+                (*slot.cell)[slot.offset].position = position;
+                return;
+            }
+
+            removeFromCell(slot);
+            auto& cell = _cells[key];
+            slot = Slot { &cell, key, (uint32_t) cell.size() };
+            cell.push_back(Entry { id, position });
+        }
+
+        void remove(entityx::Entity::Id id) {
+            uint32_t index = id.index();
+            if (index >= _slots.size() || _slots[index].cell == nullptr) {
+                return;
+            }
+            removeFromCell(_slots[index]);
+            _slots[index] = Slot();
+            _size--;
+        }
+
+        void clear() {
+            _cells.clear();
+            _slots.clear();
+            _size = 0;
+        }
+
+        bool contains(entityx::Entity::Id id) const {
+            return id.index() < _slots.size() && _slots[id.index()].cell != nullptr;
+        }
+
+        size_t size() const { return _size; }
+        float cellSize() const { return _cellSize; }
+
+        // Calls f(entry) for every entry strictly inside the rectangle
+        template <typename F>
+        void forEachInRect(float minX, float minY, float maxX, float maxY, F f) const {
+            glm::ivec2 lo = cellOf(glm::vec2(minX, minY));
+            glm::ivec2 hi = cellOf(glm::vec2(maxX, maxY));
+            for (int cy = lo.y; cy <= hi.y; cy++) {
+                for (int cx = lo.x; cx <= hi.x; cx++) {
+                    auto found = _cells.find(keyFor(glm::ivec2(cx, cy)));
+                    if (found == _cells.end()) continue;
+                    for (auto& entry : found->second) {
+                        auto& p = entry.position;
+                        if (p.x > minX && p.y > minY && p.x < maxX && p.y < maxY) {
+                            f(entry);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Calls f(entry) for every entry in the cells lo..hi, inclusive, without looking at positions
+        template <typename F>
+        void forEachInCells(glm::ivec2 lo, glm::ivec2 hi, F f) const {
+            for (int cy = lo.y; cy <= hi.y; cy++) {
+                for (int cx = lo.x; cx <= hi.x; cx++) {
+                    auto found = _cells.find(keyFor(glm::ivec2(cx, cy)));
+                    if (found == _cells.end()) continue;
+                    for (auto& entry : found->second) {
+                        f(entry);
+                    }
+                }
+            }
+        }
+
+        void queryRect(float minX, float minY, float maxX, float maxY, std::vector<entityx::Entity::Id>& out) const {
+            forEachInRect(minX, minY, maxX, maxY, [&out](const Entry& entry) { out.push_back(entry.id); });
+        }
+
+        template <typename F>
+        void forEachInRadius(glm::vec2 center, float radius, F f) const {
+            float radiusSquared = radius * radius;
+            glm::ivec2 lo = cellOf(center - glm::vec2(radius, radius));
+            glm::ivec2 hi = cellOf(center + glm::vec2(radius, radius));
+            for (int cy = lo.y; cy <= hi.y; cy++) {
+                for (int cx = lo.x; cx <= hi.x; cx++) {
+                    auto found = _cells.find(keyFor(glm::ivec2(cx, cy)));
+                    if (found == _cells.end()) continue;
+                    for (auto& entry : found->second) {
+                        auto d = entry.position - center;
+                        if (glm::dot(d, d) <= radiusSquared) {
+                            f(entry);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Like forEachInRadius, but starts with the center's own cell and stops
+        // as soon as f(entry) returns false, so a caller can bound its work in
+        // crowded cells
+        template <typename F>
+        void forEachInRadiusWhile(glm::vec2 center, float radius, F f) const {
+            float radiusSquared = radius * radius;
+            glm::ivec2 origin = cellOf(center);
+            glm::ivec2 lo = cellOf(center - glm::vec2(radius, radius));
+            glm::ivec2 hi = cellOf(center + glm::vec2(radius, radius));
+            auto visit = [&](glm::ivec2 cell) {
+                auto found = _cells.find(keyFor(cell));
+                if (found == _cells.end()) return true;
+                for (auto& entry : found->second) {
+                    auto d = entry.position - center;
+                    if (glm::dot(d, d) <= radiusSquared && !f(entry)) return false;
+                }
+                return true;
+            };
+
+            if (!visit(origin)) return;
+            for (int cy = lo.y; cy <= hi.y; cy++) {
+                for (int cx = lo.x; cx <= hi.x; cx++) {
+                    if (cx == origin.x && cy == origin.y) continue;
+                    if (!visit(glm::ivec2(cx, cy))) return;
+                }
+            }
+        }
+
+        void queryRadius(glm::vec2 center, float radius, std::vector<entityx::Entity::Id>& out) const {
+            forEachInRadius(center, radius, [&out](const Entry& entry) { out.push_back(entry.id); });
+        }
+
+        // The k entries closest to center that pass accept(entry), nearest first.
+        // Searches rings of cells outwards and stops once the next ring cannot
+        // contain anything closer than the current k-th best, or at maxRadius.
+        template <typename Accept>
+        void nearest(glm::vec2 center, size_t k, std::vector<Entry>& out, Accept accept, float maxRadius = INFINITY) const {
+            out.clear();
+            if (k == 0 || _size == 0) return;
+
+            std::vector<std::pair<float, Entry>> best;
+            glm::ivec2 origin = cellOf(center);
+            int maxRing = std::isinf(maxRadius) ? std::numeric_limits<int>::max() : (int) std::ceil(maxRadius * _inverseCellSize) + 1;
+            float maxRadiusSquared = maxRadius * maxRadius;
+            size_t visited = 0;
+
+            for (int ring = 0; ring <= maxRing; ring++) {
+                // anything in this ring is at least (ring - 1) cells away
+                if (best.size() == k) {
+                    float ringDistance = (ring - 1) * _cellSize;
+                    if (ringDistance > 0 && ringDistance * ringDistance > best.back().first) break;
+                }
+
+                for (int cy = origin.y - ring; cy <= origin.y + ring; cy++) {
+                    bool edgeRow = cy == origin.y - ring || cy == origin.y + ring;
+                    int step = edgeRow ? 1 : std::max(1, 2 * ring);
+                    for (int cx = origin.x - ring; cx <= origin.x + ring; cx += step) {
+                        auto found = _cells.find(keyFor(glm::ivec2(cx, cy)));
+                        if (found == _cells.end()) continue;
+                        visited += found->second.size();
+                        for (auto& entry : found->second) {
+                            auto d = entry.position - center;
+                            float distanceSquared = glm::dot(d, d);
+                            if (distanceSquared > maxRadiusSquared) continue;
+                            if (best.size() == k && distanceSquared >= best.back().first) continue;
+                            if (!accept(entry)) continue;
+
+                            auto at = std::upper_bound(best.begin(), best.end(), distanceSquared,
+                                [](float value, const std::pair<float, Entry>& e) { return value < e.first; });
+                            best.insert(at, std::make_pair(distanceSquared, entry));
+                            if (best.size() > k) best.pop_back();
+                        }
+                    }
+                }
+
+                // every entry has been seen, no need to keep widening
+                if (visited >= _size) break;
+            }
+
+            for (auto& pair : best) {
+                out.push_back(pair.second);
+            }
+        }
+
+        void nearest(glm::vec2 center, size_t k, std::vector<Entry>& out) const {
+            nearest(center, k, out, [](const Entry&) { return true; });
+        }
+
+        glm::ivec2 cellOf(glm::vec2 position) const {
+            return glm::ivec2((int) std::floor(position.x * _inverseCellSize), (int) std::floor(position.y * _inverseCellSize));
+        }
+
+    private:
+        struct Slot {
+            std::vector<Entry>* cell = nullptr;
+            uint64_t key = 0;
+            uint32_t offset = 0;
+        };
+
+        static uint64_t keyFor(glm::ivec2 cell) {
+            return ((uint64_t) (uint32_t) cell.x << 32) | (uint32_t) cell.y;
+        }
+
+        // swap-back removal, patching the slot of the entry that moved
+        void removeFromCell(Slot& slot) {
+            auto& cell = *slot.cell;
+            if (slot.offset + 1 != cell.size()) {
+                cell[slot.offset] = cell.back();
+                _slots[cell[slot.offset].id.index()].offset = slot.offset;
+            }
+            cell.pop_back();
+        }
+
+        float _cellSize, _inverseCellSize;
+        // unordered_map never moves its values, so slots can point straight at cells
+        std::unordered_map<uint64_t, std::vector<Entry>> _cells;
+        std::vector<Slot> _slots;
+        size_t _size = 0;
+    };
+}
+
+#endif//RTS_SPATIAL_H
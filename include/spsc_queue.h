@@ -0,0 +1,73 @@
+#ifndef RTS_SPSC_QUEUE_H
+#define RTS_SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace engine {
+
+    // Bounded lock-free queue for exactly one producer thread and one consumer
+    // thread, e.g. the input thread handing PlayerCommands to a simulation
+    // thread. Each side only writes its own index, so a push or pop is a
+    // plain copy plus one release store; the indices sit on separate cache
+    // lines so the two threads do not fight over one.
+    template <typename T>
+    class SpscQueue {
+    public:
+        // capacity is rounded up to a power of two
+        explicit SpscQueue(size_t capacity = 1024) : _head(0), _tail(0) {
+            size_t size = 2;
+            while (size < capacity) size *= 2;
+            _slots.resize(size);
+            _mask = size - 1;
+        }
+
+        SpscQueue(const SpscQueue&) = delete;
+        SpscQueue& operator=(const SpscQueue&) = delete;
+
+        // Producer only. False when the queue is full; nothing is dropped silently.
+        bool push(const T& value) {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail - _head.load(std::memory_order_acquire) == _slots.size()) {
+                return false;
+            }
+            _slots[tail & _mask] = value;
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer only. False when the queue is empty.
+        bool pop(T& out) {
+            size_t head = _head.load(std::memory_order_relaxed);
+            if (head == _tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+            out = _slots[head & _mask];
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Only exact from the consumer's side; a hint from anywhere else
+        bool empty() const {
+            return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+        }
+
+        size_t capacity() const { return _slots.size(); }
+
+    private:
+        static const size_t CACHE_LINE = 64;
+
+        // padding rather than alignas, so the queue can live on the heap
+        // without C++17's aligned new
+        std::vector<T> _slots;
+        size_t _mask;
+        char _padHead[CACHE_LINE];
+        std::atomic<size_t> _head;
+        char _padTail[CACHE_LINE - sizeof(std::atomic<size_t>)];
+        std::atomic<size_t> _tail;
+        char _padEnd[CACHE_LINE - sizeof(std::atomic<size_t>)];
+    };
+}
+
+#endif//RTS_SPSC_QUEUE_H
@@ -0,0 +1,217 @@
+#ifndef RTS_STREAM_BUFFER_H
+#define RTS_STREAM_BUFFER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+
+#include <gl_state.h>
+
+// glBufferStorage is only there if glad was generated with GL 4.4 or
+// ARB_buffer_storage; without either only the orphaning path is built
+#if defined(GL_VERSION_4_4) || defined(GL_ARB_buffer_storage)
+#define RTS_BUFFER_STORAGE 1
+#endif
+
+namespace engine {
+
+    struct StreamBufferStats {
+        uint64_t frames = 0;
+        uint64_t waits = 0;         // regions the GPU was still reading when their turn came round
+        double waitUs = 0;          // time spent in those waits
+        uint64_t reallocations = 0; // times a frame outgrew the regions
+    };
+
+    // Per-frame data (sprite instances, the drag box) streamed to the GPU
+    // without waiting on draws that still read earlier frames.
+    //
+    // PERSISTENT: one buffer holding `regions` frame-sized regions, mapped
+    // once for its whole life. Each frame writes the next region in turn, and
+    // a fence placed after that frame's draws says when the region may be
+    // written again, so the CPU only ever waits if it gets `regions` frames
+    // ahead of the GPU. Needs GL 4.4 or ARB_buffer_storage.
+    //
+    // ORPHAN: the fallback for plain GL 3.3. Every map() first orphans the
+    // storage with glBufferData(nullptr), so the driver hands out fresh memory
+    // while the old is still being drawn from, and then maps it.
+    //
+    // Either way map() returns memory the frame is written into directly,
+    // with no copy on the CPU side. Any thread may write into it between
+    // map() and unmap(); map, unmap and fence make GL calls and belong on the
+    // context's thread, as do init and cleanup.
+    class StreamBuffer {
+    public:
+        enum Mode { PERSISTENT, ORPHAN };
+        enum : uint32_t { DEFAULT_REGIONS = 3 };
+
+        // regionBytes is the starting size of a frame; map() grows it as needed
+        void init(GLenum target, size_t regionBytes, uint regions = DEFAULT_REGIONS, bool allowPersistent = true) {
+            cleanup();
+            _target = target;
+            _mode = allowPersistent && persistentSupported() ? PERSISTENT : ORPHAN;
+            _regions = _mode == PERSISTENT ? std::max(1u, regions) : 1;
+            allocate(std::max<size_t>(1, regionBytes));
+        }
+
+        void cleanup() {
+            if (_buffer == 0) return;
+            for (auto& fence : _fences) {
+                if (fence) glDeleteSync(fence);
+                fence = nullptr;
+            }
+            GLState& gl = GLState::instance();
+            if (_base) {
+                gl.bindBuffer(_target, _buffer);
+                glUnmapBuffer(_target);
+            }
+            gl.deletedBuffer(_buffer);
+            glDeleteBuffers(1, &_buffer);
+            _buffer = 0;
+            _base = nullptr;
+            _mapped = nullptr;
+        }
+
+        // Whether the current context can map a buffer persistently
+        static bool persistentSupported() {
+            bool supported = false;
+#ifdef GL_VERSION_4_4
+            supported = supported || GLAD_GL_VERSION_4_4;
+#endif
+#ifdef GL_ARB_buffer_storage
+            supported = supported || GLAD_GL_ARB_buffer_storage;
+#endif
+            return supported;
+        }
+
+        // Moves on to the next region and returns where this frame's bytes
+        // go, waiting first if the GPU may still be reading that region.
+        // Leaves the buffer bound to the target.
+        void* map(size_t bytes) {
+            if (bytes > _regionBytes) {
+                allocate(std::max(bytes, _regionBytes * 2));
+                _stats.reallocations++;
+            }
+            _stats.frames++;
+            _region = (_region + 1) % _regions;
+            GLState::instance().bindBuffer(_target, _buffer);
+
+            if (_mode == PERSISTENT) {
+                wait(_region);
+                _mapped = _base + _region * _regionBytes;
+            } else {
+                glBufferData(_target, _regionBytes, nullptr, GL_STREAM_DRAW);
+                _mapped = static_cast<unsigned char*>(glMapBufferRange(_target, 0, std::max<size_t>(1, bytes),
+                                                                       GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+            }
+            return _mapped;
+        }
+
+        // Ends the frame's writes. False if GL lost the contents (possible
+        // when unmapping after a mode switch, say) and the frame has to be
+        // written again.
+        bool unmap() {
+            if (_mode == PERSISTENT || !_mapped) return true;
+            _mapped = nullptr;
+            GLState::instance().bindBuffer(_target, _buffer);
+            return glUnmapBuffer(_target) == GL_TRUE;
+        }
+
+        // Call once the last draw reading the current region has been issued
+        void fence() {
+            if (_mode != PERSISTENT) return;
+            if (_fences[_region]) glDeleteSync(_fences[_region]);
+            _fences[_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+
+        // Byte offset of the current region in buffer(), for attribute pointers
+        size_t offset() const { return _mode == PERSISTENT ? _region * _regionBytes : 0; }
+
+        uint buffer() const { return _buffer; }
+        Mode mode() const { return _mode; }
+        uint regions() const { return _regions; }
+        size_t regionBytes() const { return _regionBytes; }
+
+        const StreamBufferStats& stats() const { return _stats; }
+        void resetStats() { _stats = StreamBufferStats(); }
+
+    private:
+        // Fresh storage for `regions` regions of regionBytes. GL keeps the old
+        // buffer alive for draws still reading it, so nothing waits here.
+        void allocate(size_t regionBytes) {
+            for (auto& fence : _fences) {
+                if (fence) glDeleteSync(fence);
+            }
+            _fences.assign(_regions, nullptr);
+
+            GLState& gl = GLState::instance();
+            if (_buffer != 0) {
+                if (_base) {
+                    gl.bindBuffer(_target, _buffer);
+                    glUnmapBuffer(_target);
+                }
+                gl.deletedBuffer(_buffer);
+                glDeleteBuffers(1, &_buffer);
+                _base = nullptr;
+            }
+
+            // regions start on a 256-byte boundary, which any attribute or uniform offset accepts
+            _regionBytes = (regionBytes + REGION_ALIGNMENT - 1) / REGION_ALIGNMENT * REGION_ALIGNMENT;
+            _region = _regions - 1;
+            glGenBuffers(1, &_buffer);
+            gl.bindBuffer(_target, _buffer);
+#ifdef RTS_BUFFER_STORAGE
+            if (_mode == PERSISTENT) {
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                glBufferStorage(_target, _regionBytes * _regions, nullptr, flags);
+                _base = static_cast<unsigned char*>(glMapBufferRange(_target, 0, _regionBytes * _regions, flags));
+                if (_base) return;
+                // the driver claimed support but would not map; carry on orphaning
+                gl.deletedBuffer(_buffer);
+                glDeleteBuffers(1, &_buffer);
+                glGenBuffers(1, &_buffer);
+                gl.bindBuffer(_target, _buffer);
+                _mode = ORPHAN;
+                _regions = 1;
+                _region = 0;
+                _fences.assign(1, nullptr);
+            }
+#endif
+            glBufferData(_target, _regionBytes, nullptr, GL_STREAM_DRAW);
+        }
+
+        void wait(uint region) {
+            GLsync fence = _fences[region];
+            if (!fence) return;
+            GLenum status = glClientWaitSync(fence, 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED) {
+                _stats.waits++;
+                auto start = std::chrono::steady_clock::now();
+                do {
+                    status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, WAIT_SLICE_NS);
+                } while (status == GL_TIMEOUT_EXPIRED);
+                _stats.waitUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            }
+            glDeleteSync(fence);
+            _fences[region] = nullptr;
+        }
+
+        enum : size_t { REGION_ALIGNMENT = 256 };
+        static const GLuint64 WAIT_SLICE_NS = 1000000;
+
+        GLenum _target = GL_ARRAY_BUFFER;
+        Mode _mode = ORPHAN;
+        uint _buffer = 0;
+        uint _regions = 1;
+        uint _region = 0;
+        size_t _regionBytes = 0;
+        unsigned char* _base = nullptr;   // whole persistent mapping
+        unsigned char* _mapped = nullptr; // this frame's region
+        std::vector<GLsync> _fences;      // by region, placed after the draws that read it
+        StreamBufferStats _stats;
+    };
+}
+
+#endif//RTS_STREAM_BUFFER_H
@@ -1,14 +1,23 @@
 #ifndef RTS_TEXTURE_H
 #define RTS_TEXTURE_H
 
+#include <chrono>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <list>
 #include <map>
 #include <string>
+#include <vector>
 #include <glad/glad.h>
+#include <glm/glm.hpp>
 
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
+#include <atlas.h>
+#include <components.h>
+#include <gl_state.h>
+#include <image_decoder.h>
+#include <profiler.h>
+#include <texture_cache.h>
 
 namespace engine
 {
@@ -16,8 +25,7 @@ namespace engine
     public:
         Texture(const unsigned char* data, const uint width, const uint height, const bool hasAlpha) : width(width), height(height) {
             glGenTextures(1, &texture);
-            glBindTexture(1, texture);
-            glBindTexture(GL_TEXTURE_2D, texture);
+            GLState::instance().bindTexture(texture);
 
             if (hasAlpha) {
                 glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
@@ -28,12 +36,34 @@ namespace engine
             glGenerateMipmap(GL_TEXTURE_2D);
         }
 
+        // Empty RGBA texture with its whole mip chain allocated, to be filled
+        // with upload(), used for atlas pages
+        Texture(const uint width, const uint height) : width(width), height(height) {
+            glGenTextures(1, &texture);
+            GLState::instance().bindTexture(texture);
+            for (uint level = 0; level < mipLevels(width, height); level++) {
+                glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, mipDimension(width, level), mipDimension(height, level), 0,
+                             GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            }
+        }
+
+        void upload(uint x, uint y, uint w, uint h, const unsigned char* rgba, uint level = 0) {
+            GLState::instance().bindTexture(texture);
+            glTexSubImage2D(GL_TEXTURE_2D, level, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+        }
+
+        void generateMipmaps() {
+            GLState::instance().bindTexture(texture);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+
         void use() {
-            glBindTexture(GL_TEXTURE_2D, texture);
+            GLState::instance().bindTexture(texture);
         }
 
         void cleanup() {
             if (texture != 0) {
+                GLState::instance().deletedTexture(texture);
                 glDeleteTextures(1, &texture);
                 texture = 0;
             }
@@ -44,41 +74,306 @@ namespace engine
     };
 
 
+    // Where a loaded image ended up: an atlas page and its uv rectangle on it
+    // as (u, v, width, height)
+    struct TextureRegion {
+        uint page;
+        glm::vec4 uv;
+        uint width, height;
+    };
+
+    // Hands out integer handles for images packed into atlas pages. load()
+    // decodes a batch on the worker pool and blocks until it is uploaded;
+    // loadAsync() returns at once with a handle that draws as a placeholder
+    // until uploadPending(), called once a frame on the GL thread, has
+    // uploaded the decoded image within its byte budget.
+    //
+    // With a texture cache open (see bake_textures), images baked into it skip
+    // the decode and go up straight from the mapped file with their mip chain.
     class TextureManager {
     public:
-        void load(std::string filename) {
-            if (textureMap.find(filename) != textureMap.end()) {
-                return;
+        TextureManager(uint pageSize = 1024, unsigned decodeThreads = 2)
+            : packer(pageSize, pageSize, 2), pool(decodeThreads), decoder(pool) {}
+
+        // Maps a cache written by bake_textures; images missing from it or
+        // changed since it was baked are still decoded from their files
+        bool useCache(const std::string& path) {
+            std::string error;
+            if (!cache.open(path, error)) {
+                std::cerr << "Not using texture cache: " << error << std::endl;
+                return false;
             }
+            return true;
+        }
+
+        TextureHandle load(const std::string& filename) {
+            return load(std::vector<std::string> { filename })[0];
+        }
 
-            int width, height, numChannels;
-            unsigned char* data = stbi_load(filename.c_str(), &width, &height, &numChannels, 0);
+        // Decodes every image, packs them together and uploads into the atlas pages.
+        // Loading in batches packs tighter than loading one at a time.
+        std::vector<TextureHandle> load(const std::vector<std::string>& filenames) {
+            RTS_PROFILE_ZONE("TextureManager::load");
+            std::vector<TextureHandle> result(filenames.size(), INVALID_TEXTURE);
+            std::vector<size_t> pending;
+            std::vector<std::future<DecodedImage>> decoding;
+            std::vector<size_t> loaded;
+            std::vector<Loaded> images;
+            std::vector<AtlasSize> sizes;
 
-            if (data) {
-                textureMap.insert(std::make_pair(filename, Texture(data, width, height, numChannels > 3)));
-            } else {
-                std::cerr << "Unable to load texture '" << filename << "'" << std::endl;
+            for (size_t i = 0; i < filenames.size(); i++) {
+                auto found = handles.find(filenames[i]);
+                if (found != handles.end()) {
+                    result[i] = found->second;
+                    continue;
+                }
+                if (const TextureCacheEntry* entry = cached(filenames[i])) {
+                    loaded.push_back(i);
+                    sizes.push_back(AtlasSize { entry->width, entry->height });
+                    images.push_back(Loaded { DecodedImage(), entry });
+                    continue;
+                }
+                pending.push_back(i);
+                decoding.push_back(decoder.decode(filenames[i]));
             }
 
-            stbi_image_free(data);
+            for (size_t i = 0; i < decoding.size(); i++) {
+                DecodedImage image = decoder.wait(decoding[i]);
+                if (image.ok()) {
+                    loaded.push_back(pending[i]);
+                    sizes.push_back(AtlasSize { image.width, image.height });
+                    images.push_back(Loaded { std::move(image), nullptr });
+                } else {
+                    std::cerr << "Unable to load texture '" << filenames[pending[i]] << "'" << std::endl;
+                }
+            }
+
+            auto rects = packer.insert(sizes);
+            std::vector<bool> dirty;
+            for (size_t i = 0; i < rects.size(); i++) {
+                TextureHandle handle = regions.size();
+                regions.push_back(place(rects[i], images[i], dirty));
+                completions.push_back(ready(true));
+                handles.insert(std::make_pair(filenames[loaded[i]], handle));
+                result[loaded[i]] = handle;
+            }
+            generateMipmaps(dirty);
+
+            return result;
         }
 
-        Texture* get(std::string id) {
-            auto iterator = textureMap.find(id);
-            if (iterator == textureMap.end()) {
-                return nullptr;
-            } else {
-                return &iterator->second;
+        // Returns at once; the handle draws as the placeholder until the image
+        // is decoded and uploadPending() has uploaded it
+        TextureHandle loadAsync(const std::string& filename) {
+            auto found = handles.find(filename);
+            if (found != handles.end()) {
+                return found->second;
+            }
+
+            TextureHandle handle = regions.size();
+            regions.push_back(placeholder());
+            std::promise<bool> done;
+            completions.push_back(done.get_future().share());
+            const TextureCacheEntry* entry = cached(filename);
+            loading.push_back(PendingLoad { handle, entry ? std::future<DecodedImage>() : decoder.decode(filename),
+                                            entry, std::move(done) });
+            handles.insert(std::make_pair(filename, handle));
+            return handle;
+        }
+
+        // Becomes true once the handle's image is uploaded, false if it failed
+        // to decode (the handle then keeps drawing as the placeholder)
+        std::shared_future<bool> loaded(TextureHandle handle) const {
+            return completions[handle];
+        }
+
+        // Uploads decoded images until byteBudget bytes of pixels have gone to
+        // the GPU this call; the last one may overshoot it, so a single image
+        // larger than the budget still goes up. Call once a frame on the GL
+        // thread. Returns how many were uploaded.
+        size_t uploadPending(size_t byteBudget = 4 * 1024 * 1024) {
+            if (loading.empty()) return 0;
+            RTS_PROFILE_ZONE("TextureManager::uploadPending");
+
+            size_t uploaded = 0, bytes = 0;
+            std::vector<bool> dirty;
+            for (auto it = loading.begin(); it != loading.end() && bytes < byteBudget;) {
+                if (it->cached) {
+                    AtlasRect rect = packer.insert(it->cached->width, it->cached->height);
+                    regions[it->handle] = place(rect, Loaded { DecodedImage(), it->cached }, dirty);
+                    bytes += it->cached->dataSize;
+                    uploaded++;
+                    it->done.set_value(true);
+                    it = loading.erase(it);
+                    continue;
+                }
+                if (it->image.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                    ++it;
+                    continue;
+                }
+
+                DecodedImage image = it->image.get();
+                if (image.ok()) {
+                    AtlasRect rect = packer.insert(image.width, image.height);
+                    regions[it->handle] = place(rect, Loaded { image, nullptr }, dirty);
+                    bytes += image.bytes();
+                    uploaded++;
+                    it->done.set_value(true);
+                } else {
+                    std::cerr << "Unable to load texture '" << image.filename << "'" << std::endl;
+                    it->done.set_value(false);
+                }
+                it = loading.erase(it);
             }
+            generateMipmaps(dirty);
+
+            return uploaded;
+        }
+
+        size_t pendingLoads() const {
+            return loading.size();
+        }
+
+        // Name lookup for cold paths only; the render path works on handles
+        TextureHandle find(const std::string& filename) const {
+            auto iterator = handles.find(filename);
+            return iterator == handles.end() ? INVALID_TEXTURE : iterator->second;
+        }
+
+        bool valid(TextureHandle handle) const {
+            return handle < regions.size();
+        }
+
+        const TextureRegion& region(TextureHandle handle) const {
+            return regions[handle];
+        }
+
+        Texture& page(uint page) {
+            return pages[page];
+        }
+
+        const AtlasPacker& atlas() const {
+            return packer;
         }
 
         void cleanup() {
-            for (auto pair : textureMap) {
-                pair.second.cleanup();
+            for (auto& load : loading) {
+                load.done.set_value(false);
             }
+            loading.clear();
+            for (auto& page : pages) {
+                page.cleanup();
+            }
+            pages.clear();
+            regions.clear();
+            completions.clear();
+            handles.clear();
+            packer.clear();
+            hasPlaceholder = false;
         }
     private:
-        std::map<std::string, Texture> textureMap;
+        // Pixels to upload: decoded from a file, or a cache entry with its mips
+        struct Loaded {
+            DecodedImage image;
+            const TextureCacheEntry* cached;
+        };
+
+        struct PendingLoad {
+            TextureHandle handle;
+            std::future<DecodedImage> image; // not valid for a cached image
+            const TextureCacheEntry* cached;
+            std::promise<bool> done;
+        };
+
+        const TextureCacheEntry* cached(const std::string& filename) const {
+            return cache.isOpen() ? cache.find(filename) : nullptr;
+        }
+
+        // Uploads to rect, opening atlas pages as needed. A decoded image marks
+        // its page for mipmap generation; a cached one brings its own levels.
+        TextureRegion place(const AtlasRect& rect, const Loaded& loaded, std::vector<bool>& dirty) {
+            while (pages.size() <= rect.page) {
+                pages.push_back(Texture(packer.pageWidth(pages.size()), packer.pageHeight(pages.size())));
+            }
+            dirty.resize(pages.size(), false);
+
+            Texture& page = pages[rect.page];
+            if (loaded.cached) {
+                const TextureCacheEntry& entry = *loaded.cached;
+                for (uint level = 0; level < entry.mipCount; level++) {
+                    uint x = rect.x >> level, y = rect.y >> level;
+                    uint pageWidth = mipDimension(page.width, level), pageHeight = mipDimension(page.height, level);
+                    if (x >= pageWidth || y >= pageHeight) break;
+                    // the rect's corner rounds down at each level, so clip what no longer fits
+                    uint w = std::min(mipDimension(entry.width, level), pageWidth - x);
+                    uint h = std::min(mipDimension(entry.height, level), pageHeight - y);
+                    glPixelStorei(GL_UNPACK_ROW_LENGTH, mipDimension(entry.width, level));
+                    page.upload(x, y, w, h, cache.level(entry, level), level);
+                }
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            } else {
+                page.upload(rect.x, rect.y, rect.width, rect.height, loaded.image.pixels.get());
+                dirty[rect.page] = true;
+            }
+
+            return TextureRegion {
+                rect.page,
+                glm::vec4((float) rect.x / page.width, (float) rect.y / page.height,
+                          (float) rect.width / page.width, (float) rect.height / page.height),
+                rect.width, rect.height
+            };
+        }
+
+        void generateMipmaps(const std::vector<bool>& dirty) {
+            for (size_t page = 0; page < dirty.size(); page++) {
+                if (dirty[page]) pages[page].generateMipmaps();
+            }
+        }
+
+        // A small magenta and black checkerboard, uploaded on first use
+        const TextureRegion& placeholder() {
+            if (!hasPlaceholder) {
+                const uint size = 8;
+                std::vector<unsigned char> rgba(size * size * 4);
+                for (uint y = 0; y < size; y++) {
+                    for (uint x = 0; x < size; x++) {
+                        unsigned char* pixel = &rgba[(y * size + x) * 4];
+                        bool odd = ((x / 4) + (y / 4)) % 2 != 0;
+                        pixel[0] = odd ? 255 : 0;
+                        pixel[1] = 0;
+                        pixel[2] = odd ? 255 : 0;
+                        pixel[3] = 255;
+                    }
+                }
+                DecodedImage image;
+                image.width = image.height = size;
+                image.pixels.reset(rgba.data(), [](unsigned char*) {});
+                std::vector<bool> dirty;
+                placeholderRegion = place(packer.insert(size, size), Loaded { image, nullptr }, dirty);
+                generateMipmaps(dirty);
+                hasPlaceholder = true;
+            }
+            return placeholderRegion;
+        }
+
+        static std::shared_future<bool> ready(bool value) {
+            std::promise<bool> promise;
+            promise.set_value(value);
+            return promise.get_future().share();
+        }
+
+        std::map<std::string, TextureHandle> handles;
+        std::vector<TextureRegion> regions;
+        std::vector<std::shared_future<bool>> completions;
+        std::vector<Texture> pages;
+        AtlasPacker packer;
+
+        ThreadPool pool;
+        ImageDecoder decoder;
+        TextureCache cache;
+        std::list<PendingLoad> loading;
+        TextureRegion placeholderRegion;
+        bool hasPlaceholder = false;
     };
 } // namespace engine
 
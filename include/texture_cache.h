@@ -0,0 +1,297 @@
+#ifndef RTS_TEXTURE_CACHE_H
+#define RTS_TEXTURE_CACHE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+#include <mapped_file.h>
+
+namespace engine {
+
+    // Textures decoded ahead of time by bake_textures, little-endian:
+    //
+    //   header   "RTSTEXC\0", u32 version, u32 entry count
+    //   entries  per texture: u32 name offset, u32 name length, u64 source size,
+    //            i64 source mtime, u32 width, u32 height, u32 mip count,
+    //            u32 format, u64 data offset, u64 data size
+    //   names    the source paths as given to load(), not terminated
+    //   data     per texture, its mip chain level 0 first, 64-byte aligned
+    //
+    // An entry is stale once its source file exists with another size or
+    // modification time; TextureManager then decodes the PNG instead. Only
+    // RGBA8 is baked so far; format leaves room for block-compressed data.
+    struct TextureCacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t entryCount;
+    };
+
+    struct TextureCacheEntry {
+        uint32_t nameOffset;
+        uint32_t nameLength;
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        uint32_t width;
+        uint32_t height;
+        uint32_t mipCount;
+        uint32_t format;
+        uint64_t dataOffset;
+        uint64_t dataSize;
+    };
+
+    static_assert(sizeof(TextureCacheHeader) == 16 && sizeof(TextureCacheEntry) == 56,
+                  "texture cache headers must have no padding");
+
+    enum TextureCacheFormat : uint32_t {
+        TEXTURE_FORMAT_RGBA8 = 0,
+    };
+
+    const char TEXTURE_CACHE_MAGIC[8] = { 'R', 'T', 'S', 'T', 'E', 'X', 'C', '\0' };
+    const uint32_t TEXTURE_CACHE_VERSION = 1;
+    const size_t TEXTURE_CACHE_ALIGNMENT = 64;
+
+    inline uint mipLevels(uint width, uint height) {
+        uint levels = 1;
+        while (width > 1 || height > 1) {
+            width = std::max(1u, width / 2);
+            height = std::max(1u, height / 2);
+            levels++;
+        }
+        return levels;
+    }
+
+    inline uint mipDimension(uint size, uint level) {
+        return std::max(1u, size >> level);
+    }
+
+    // Appends rgba and every level below it, each a 2x2 box filter of the one
+    // above (edge pixels repeat on odd sizes), as glGenerateMipmap would
+    inline void buildMipChain(const unsigned char* rgba, uint width, uint height, std::vector<unsigned char>& out) {
+        size_t start = out.size();
+        out.insert(out.end(), rgba, rgba + (size_t) width * height * 4);
+
+        size_t source = start;
+        for (uint level = 1; level < mipLevels(width, height); level++) {
+            uint sourceWidth = mipDimension(width, level - 1), sourceHeight = mipDimension(height, level - 1);
+            uint w = mipDimension(width, level), h = mipDimension(height, level);
+            size_t target = out.size();
+            out.resize(target + (size_t) w * h * 4);
+
+            for (uint y = 0; y < h; y++) {
+                uint y0 = std::min(y * 2, sourceHeight - 1), y1 = std::min(y * 2 + 1, sourceHeight - 1);
+                for (uint x = 0; x < w; x++) {
+                    uint x0 = std::min(x * 2, sourceWidth - 1), x1 = std::min(x * 2 + 1, sourceWidth - 1);
+                    for (uint c = 0; c < 4; c++) {
+                        uint sum = out[source + ((size_t) y0 * sourceWidth + x0) * 4 + c] +
+                                   out[source + ((size_t) y0 * sourceWidth + x1) * 4 + c] +
+                                   out[source + ((size_t) y1 * sourceWidth + x0) * 4 + c] +
+                                   out[source + ((size_t) y1 * sourceWidth + x1) * 4 + c];
+                        out[target + ((size_t) y * w + x) * 4 + c] = (unsigned char) ((sum + 2) / 4);
+                    }
+                }
+            }
+            source = target;
+        }
+    }
+
+    // Size and modification time of a source image, false if it does not exist
+    inline bool sourceStamp(const std::string& path, uint64_t& size, int64_t& time) {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) return false;
+        size = (uint64_t) info.st_size;
+        time = (int64_t) info.st_mtime;
+        return true;
+    }
+
+    // A mapped cache file. Pixels are read straight out of the mapping, so a
+    // cached texture costs no decode and no heap copy on the way to the GPU.
+    class TextureCache {
+    public:
+        bool open(const std::string& path, std::string& error) {
+            close();
+            if (!hostIsLittleEndian()) {
+                error = "texture caches are only read on little-endian hosts";
+                return false;
+            }
+
+            std::unique_ptr<MappedFile> mapped(new MappedFile(path));
+            if (!mapped->ok()) {
+                error = "unable to open '" + path + "'";
+                return false;
+            }
+
+            TextureCacheHeader header;
+            if (mapped->size() < sizeof(header)) {
+                error = "not a texture cache";
+                return false;
+            }
+            memcpy(&header, mapped->data(), sizeof(header));
+            if (memcmp(header.magic, TEXTURE_CACHE_MAGIC, sizeof(TEXTURE_CACHE_MAGIC)) != 0) {
+                error = "not a texture cache";
+                return false;
+            }
+            if (header.version != TEXTURE_CACHE_VERSION) {
+                error = "unsupported texture cache version " + std::to_string(header.version);
+                return false;
+            }
+            if ((mapped->size() - sizeof(header)) / sizeof(TextureCacheEntry) < header.entryCount) {
+                error = "truncated entry table";
+                return false;
+            }
+
+            auto entries = reinterpret_cast<const TextureCacheEntry*>(mapped->data() + sizeof(header));
+            for (uint32_t i = 0; i < header.entryCount; i++) {
+                const TextureCacheEntry& entry = entries[i];
+                if (entry.format != TEXTURE_FORMAT_RGBA8 || entry.width == 0 || entry.height == 0 ||
+                    entry.mipCount != mipLevels(entry.width, entry.height) ||
+                    entry.dataSize != chainBytes(entry.width, entry.height) ||
+                    entry.dataOffset > mapped->size() || entry.dataSize > mapped->size() - entry.dataOffset ||
+                    entry.nameOffset > mapped->size() || entry.nameLength > mapped->size() - entry.nameOffset) {
+                    error = "entry " + std::to_string(i) + " is malformed";
+                    index.clear();
+                    return false;
+                }
+                std::string name(reinterpret_cast<const char*>(mapped->data() + entry.nameOffset), entry.nameLength);
+                index[name] = &entry;
+            }
+
+            file = std::move(mapped);
+            return true;
+        }
+
+        void close() {
+            index.clear();
+            file.reset();
+        }
+
+        bool isOpen() const { return file != nullptr; }
+        size_t size() const { return index.size(); }
+
+        // The entry baked from name, or nullptr if there is none or it is stale
+        const TextureCacheEntry* find(const std::string& name) const {
+            auto found = index.find(name);
+            if (found == index.end()) return nullptr;
+
+            // a cache shipped without its sources is never stale
+            uint64_t size;
+            int64_t time;
+            const TextureCacheEntry* entry = found->second;
+            if (sourceStamp(name, size, time) && (size != entry->sourceSize || time != entry->sourceTime)) {
+                return nullptr;
+            }
+            return entry;
+        }
+
+        const unsigned char* level(const TextureCacheEntry& entry, uint level) const {
+            const unsigned char* pixels = file->data() + entry.dataOffset;
+            for (uint l = 0; l < level; l++) {
+                pixels += (size_t) mipDimension(entry.width, l) * mipDimension(entry.height, l) * 4;
+            }
+            return pixels;
+        }
+
+        static uint64_t chainBytes(uint width, uint height) {
+            uint64_t bytes = 0;
+            for (uint level = 0; level < mipLevels(width, height); level++) {
+                bytes += (uint64_t) mipDimension(width, level) * mipDimension(height, level) * 4;
+            }
+            return bytes;
+        }
+
+    private:
+        std::unique_ptr<MappedFile> file;
+        std::map<std::string, const TextureCacheEntry*> index;
+    };
+
+    // Collects baked textures in memory and writes the cache file in one go
+    class TextureCacheWriter {
+    public:
+        void add(const std::string& name, const unsigned char* rgba, uint width, uint height,
+                 uint64_t sourceSize, int64_t sourceTime) {
+            Pending texture;
+            texture.name = name;
+            texture.entry.sourceSize = sourceSize;
+            texture.entry.sourceTime = sourceTime;
+            texture.entry.width = width;
+            texture.entry.height = height;
+            texture.entry.mipCount = mipLevels(width, height);
+            texture.entry.format = TEXTURE_FORMAT_RGBA8;
+            buildMipChain(rgba, width, height, texture.pixels);
+            texture.entry.dataSize = texture.pixels.size();
+            textures.push_back(std::move(texture));
+        }
+
+        bool write(const std::string& path, std::string& error) {
+            if (!hostIsLittleEndian()) {
+                error = "texture caches are only written on little-endian hosts";
+                return false;
+            }
+
+            // lay out names after the entry table, then the aligned pixel data
+            size_t offset = sizeof(TextureCacheHeader) + sizeof(TextureCacheEntry) * textures.size();
+            for (auto& texture : textures) {
+                texture.entry.nameOffset = (uint32_t) offset;
+                texture.entry.nameLength = (uint32_t) texture.name.size();
+                offset += texture.name.size();
+            }
+            for (auto& texture : textures) {
+                offset = (offset + TEXTURE_CACHE_ALIGNMENT - 1) / TEXTURE_CACHE_ALIGNMENT * TEXTURE_CACHE_ALIGNMENT;
+                texture.entry.dataOffset = offset;
+                offset += texture.pixels.size();
+            }
+
+            FILE* file = fopen(path.c_str(), "wb");
+            if (!file) {
+                error = "unable to open '" + path + "'";
+                return false;
+            }
+
+            TextureCacheHeader header;
+            memcpy(header.magic, TEXTURE_CACHE_MAGIC, sizeof(TEXTURE_CACHE_MAGIC));
+            header.version = TEXTURE_CACHE_VERSION;
+            header.entryCount = (uint32_t) textures.size();
+            bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+            for (auto& texture : textures) {
+                ok = ok && fwrite(&texture.entry, sizeof(texture.entry), 1, file) == 1;
+            }
+            size_t written = sizeof(TextureCacheHeader) + sizeof(TextureCacheEntry) * textures.size();
+            for (auto& texture : textures) {
+                ok = ok && fwrite(texture.name.data(), 1, texture.name.size(), file) == texture.name.size();
+                written += texture.name.size();
+            }
+            static const char zeroes[TEXTURE_CACHE_ALIGNMENT] = {};
+            for (auto& texture : textures) {
+                size_t padding = texture.entry.dataOffset - written;
+                ok = ok && fwrite(zeroes, 1, padding, file) == padding;
+                ok = ok && fwrite(texture.pixels.data(), 1, texture.pixels.size(), file) == texture.pixels.size();
+                written = texture.entry.dataOffset + texture.pixels.size();
+            }
+
+            ok = fclose(file) == 0 && ok;
+            if (!ok) {
+                error = "unable to write '" + path + "'";
+            }
+            return ok;
+        }
+
+        size_t size() const { return textures.size(); }
+
+    private:
+        struct Pending {
+            std::string name;
+            TextureCacheEntry entry = {};
+            std::vector<unsigned char> pixels;
+        };
+
+        std::vector<Pending> textures;
+    };
+}
+
+#endif//RTS_TEXTURE_CACHE_H
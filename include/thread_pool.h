@@ -0,0 +1,192 @@
+#ifndef RTS_THREAD_POOL_H
+#define RTS_THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace engine {
+
+    // Work-stealing pool. Every worker owns a deque: it pushes and pops its own
+    // tasks at the back and, when it runs dry, steals from the front of the others.
+    // Threads that are not workers (the main thread) help out while they wait in
+    // parallelFor instead of blocking.
+    class ThreadPool {
+    public:
+        typedef std::function<void()> Task;
+
+        explicit ThreadPool(unsigned threads = defaultThreadCount()) : _pending(0), _stopping(false), _next(0) {
+            for (unsigned i = 0; i < threads; i++) {
+                _queues.emplace_back(new Queue());
+            }
+            for (unsigned i = 0; i < threads; i++) {
+                _threads.emplace_back([this, i]() { workerLoop(i); });
+            }
+        }
+
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(_sleepMutex);
+                _stopping = true;
+            }
+            _wake.notify_all();
+            for (auto& thread : _threads) {
+                thread.join();
+            }
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // One less than the core count: the calling thread does its share in parallelFor
+        static unsigned defaultThreadCount() {
+            unsigned cores = std::thread::hardware_concurrency();
+            return cores > 1 ? cores - 1 : 0;
+        }
+
+        // Items per chunk so that one chunk's data fits comfortably in L1
+        static size_t cacheChunk(size_t bytesPerItem, size_t cacheBytes = 16 * 1024) {
+            return std::max<size_t>(64, cacheBytes / std::max<size_t>(1, bytesPerItem));
+        }
+
+        // Index of the pool worker running the calling thread, or -1 for any other thread
+        static int workerIndex() {
+            return currentWorker();
+        }
+
+        size_t size() const { return _threads.size(); }
+
+        void submit(Task task) {
+            if (_threads.empty()) {
+                task();
+                return;
+            }
+
+            int self = currentWorker();
+            size_t target = self >= 0 && currentPool() == this ? (size_t) self : _next.fetch_add(1) % _queues.size();
+            // counted before it is visible so a worker never sees _pending underflow
+            _pending.fetch_add(1);
+            {
+                std::lock_guard<std::mutex> lock(_queues[target]->mutex);
+                _queues[target]->tasks.push_back(std::move(task));
+            }
+            {
+                std::lock_guard<std::mutex> lock(_sleepMutex);
+            }
+            _wake.notify_one();
+        }
+
+        // Calls f(begin, end) over [0, count) split into chunks of chunkSize and
+        // returns once every chunk has run
+        template <typename F>
+        void parallelFor(size_t count, size_t chunkSize, F f) {
+            if (count == 0) return;
+            chunkSize = std::max<size_t>(1, chunkSize);
+            size_t chunks = (count + chunkSize - 1) / chunkSize;
+            if (_threads.empty() || chunks == 1) {
+                f((size_t) 0, count);
+                return;
+            }
+
+            std::atomic<size_t> remaining(chunks);
+            for (size_t c = 0; c < chunks; c++) {
+                size_t begin = c * chunkSize;
+                size_t end = std::min(count, begin + chunkSize);
+                submit([&f, &remaining, begin, end]() {
+                    f(begin, end);
+                    remaining.fetch_sub(1, std::memory_order_release);
+                });
+            }
+
+            waitUntil([&remaining]() { return remaining.load(std::memory_order_acquire) == 0; });
+        }
+
+        // Runs queued tasks on the calling thread until done() returns true
+        template <typename P>
+        void waitUntil(P done) {
+            while (!done()) {
+                if (!runOne()) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        static int& currentWorker() {
+            static thread_local int index = -1;
+            return index;
+        }
+
+        static ThreadPool*& currentPool() {
+            static thread_local ThreadPool* pool = nullptr;
+            return pool;
+        }
+
+        bool pop(size_t index, Task& task) {
+            auto& queue = *_queues[index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty()) return false;
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+            return true;
+        }
+
+        bool steal(size_t victim, Task& task) {
+            auto& queue = *_queues[victim];
+            std::unique_lock<std::mutex> lock(queue.mutex, std::try_to_lock);
+            if (!lock.owns_lock() || queue.tasks.empty()) return false;
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            return true;
+        }
+
+        // Runs one task from the caller's own queue or stolen from another
+        bool runOne() {
+            int self = currentPool() == this ? currentWorker() : -1;
+            Task task;
+            bool found = self >= 0 && pop((size_t) self, task);
+            size_t start = self >= 0 ? (size_t) self + 1 : _next.load();
+            for (size_t i = 0; !found && i < _queues.size(); i++) {
+                found = steal((start + i) % _queues.size(), task);
+            }
+            if (!found) return false;
+
+            _pending.fetch_sub(1);
+            task();
+            return true;
+        }
+
+        void workerLoop(size_t index) {
+            currentWorker() = (int) index;
+            currentPool() = this;
+            while (true) {
+                if (runOne()) continue;
+
+                std::unique_lock<std::mutex> lock(_sleepMutex);
+                _wake.wait(lock, [this]() { return _stopping || _pending.load() > 0; });
+                if (_stopping && _pending.load() == 0) return;
+            }
+        }
+
+        std::vector<std::unique_ptr<Queue>> _queues;
+        std::vector<std::thread> _threads;
+        std::mutex _sleepMutex;
+        std::condition_variable _wake;
+        std::atomic<size_t> _pending;
+        bool _stopping;
+        std::atomic<size_t> _next;
+    };
+}
+
+#endif//RTS_THREAD_POOL_H
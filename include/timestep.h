@@ -0,0 +1,73 @@
+#ifndef RTS_TIMESTEP_H
+#define RTS_TIMESTEP_H
+
+#include <cmath>
+#include <cstdint>
+
+namespace engine {
+
+    // Accumulator for running the simulation at a fixed tick rate independent of
+    // the frame rate. Frames longer than maxFrameTime are clamped (a hitch should
+    // not teleport units), and at most maxStepsPerFrame ticks run per frame;
+    // whatever backlog is left after that is dropped so a slow machine cannot
+    // fall into a spiral of ever longer catch-up frames.
+    class FixedTimestep {
+    public:
+        FixedTimestep(double tickRate = 30.0, uint maxStepsPerFrame = 5, double maxFrameTime = 0.25)
+            : _tickLength(1.0 / tickRate), _maxStepsPerFrame(maxStepsPerFrame), _maxFrameTime(maxFrameTime) {}
+
+        // Calls step(tickLength) as many times as the elapsed time allows and
+        // returns how many ticks ran
+        template <typename F>
+        uint advance(double frameTime, F step) {
+            if (frameTime < 0) {
+                frameTime = 0;
+            } else if (frameTime > _maxFrameTime) {
+                frameTime = _maxFrameTime;
+            }
+            _accumulator += frameTime;
+
+            uint steps = 0;
+            while (_accumulator >= _tickLength && steps < _maxStepsPerFrame) {
+                step(_tickLength);
+                _accumulator -= _tickLength;
+                _tick++;
+                steps++;
+            }
+
+            if (_accumulator >= _tickLength) {
+                double backlog = std::floor(_accumulator / _tickLength);
+                _droppedTicks += (uint64_t) backlog;
+                _accumulator -= backlog * _tickLength;
+            }
+
+            return steps;
+        }
+
+        // How far the current frame is between the last two ticks, in [0, 1)
+        double alpha() const { return _accumulator / _tickLength; }
+
+        double tickLength() const { return _tickLength; }
+        double tickRate() const { return 1.0 / _tickLength; }
+        uint64_t tick() const { return _tick; }
+        uint64_t droppedTicks() const { return _droppedTicks; }
+
+        void setTickRate(double tickRate) {
+            _accumulator *= (1.0 / tickRate) / _tickLength;
+            _tickLength = 1.0 / tickRate;
+        }
+
+        void setMaxStepsPerFrame(uint maxStepsPerFrame) { _maxStepsPerFrame = maxStepsPerFrame; }
+        void setMaxFrameTime(double maxFrameTime) { _maxFrameTime = maxFrameTime; }
+
+    private:
+        double _tickLength;
+        uint _maxStepsPerFrame;
+        double _maxFrameTime;
+        double _accumulator = 0;
+        uint64_t _tick = 0;
+        uint64_t _droppedTicks = 0;
+    };
+}
+
+#endif//RTS_TIMESTEP_H
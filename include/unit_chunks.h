@@ -0,0 +1,177 @@
+#ifndef RTS_UNIT_CHUNKS_H
+#define RTS_UNIT_CHUNKS_H
+
+#include <cstdint>
+#include <vector>
+#include <entityx/entityx.h>
+
+#include <archetype.h>
+#include <components.h>
+#include <lod.h>
+
+namespace engine {
+
+    // One axis of a unit's position or velocity. A component per axis makes
+    // each of them a plain float array in every chunk, which is what the
+    // movement kernels load 4 or 8 at a time.
+    template <int Axis>
+    struct PositionLane {
+        float value;
+    };
+
+    template <int Axis>
+    struct VelocityLane {
+        float value;
+    };
+
+    // The entityx entity a row mirrors, and its components to copy in and out of.
+    // entityx never moves a component once assigned, so the pointers stay good
+    // until the row goes.
+    struct UnitLink {
+        entityx::Entity::Id id;
+        Position* position;
+        Velocity* velocity;
+    };
+
+    struct SpriteLink {
+        Sprite* sprite;
+    };
+
+    // Tags the units SimulationLod has awake; sleeping units sit in archetypes
+    // without it, so the views below never visit them
+    struct Awake {};
+
+    // The hot per-unit data of MovementSystem and SpriteOrientationSystem, in
+    // ArchetypeStorage chunks instead of entityx's pools: every entity with a
+    // Position and a Velocity gets a row, kept in step with the components by
+    // their added and removed events, plus a SpriteLink if it has a Sprite.
+    //
+    // entityx stays the store everything else reads. The position lanes are
+    // the master copy while a unit is tracked; MovementSystem brings the
+    // velocities in from the components each tick and writes both back out.
+    class UnitChunks : public entityx::Receiver<UnitChunks> {
+    public:
+        void configure(entityx::EventManager& eventManager) {
+            eventManager.subscribe<entityx::ComponentAddedEvent<Position>>(*this);
+            eventManager.subscribe<entityx::ComponentAddedEvent<Velocity>>(*this);
+            eventManager.subscribe<entityx::ComponentAddedEvent<Sprite>>(*this);
+            eventManager.subscribe<entityx::ComponentRemovedEvent<Position>>(*this);
+            eventManager.subscribe<entityx::ComponentRemovedEvent<Velocity>>(*this);
+            eventManager.subscribe<entityx::ComponentRemovedEvent<Sprite>>(*this);
+            eventManager.subscribe<entityx::EntityDestroyedEvent>(*this);
+        }
+
+        void receive(const entityx::ComponentAddedEvent<Position>& event) { track(event.entity); }
+        void receive(const entityx::ComponentAddedEvent<Velocity>& event) { track(event.entity); }
+        void receive(const entityx::ComponentRemovedEvent<Position>& event) { untrack(event.entity.id()); }
+        void receive(const entityx::ComponentRemovedEvent<Velocity>& event) { untrack(event.entity.id()); }
+        void receive(const entityx::EntityDestroyedEvent& event) { untrack(event.entity.id()); }
+
+        void receive(const entityx::ComponentAddedEvent<Sprite>& event) {
+            EntityHandle handle = handleOf(event.entity.id());
+            if (storage.valid(handle)) storage.assign<SpriteLink>(handle, SpriteLink { event.component.get() });
+        }
+
+        // Also sent while the entity is destroyed, after it has left the chunks
+        void receive(const entityx::ComponentRemovedEvent<Sprite>& event) {
+            EntityHandle handle = handleOf(event.entity.id());
+            if (storage.valid(handle)) storage.remove<SpriteLink>(handle);
+        }
+
+        // Brings the Awake tags in line with lod. SimulationLod wakes units
+        // itself (a new Job, a new Velocity) and others may wake or sleep them
+        // by hand, so this follows its set rather than every way in; it costs
+        // nothing when the set has not changed since the last call.
+        void syncAwake(const SimulationLod& lod) {
+            if (syncedChanges == lod.changes()) return;
+            size_t awake = 0;
+            for (auto id : lod.awakeUnits()) {
+                EntityHandle handle = handleOf(id);
+                if (!storage.valid(handle)) continue;
+                awake++;
+                if (!storage.has<Awake>(handle)) storage.assign<Awake>(handle);
+            }
+            // someone else put units to sleep
+            if (awake < storage.count<Awake>()) {
+                asleep.clear();
+                storage.each<UnitLink, Awake>([&](EntityHandle handle, UnitLink& link, Awake&) {
+                    if (!lod.isAwake(link.id)) asleep.push_back(handle);
+                });
+                for (auto handle : asleep) storage.remove<Awake>(handle);
+            }
+            syncedChanges = lod.changes();
+        }
+
+        // Puts a unit to sleep in lod and here at once, so the next syncAwake() has nothing to do
+        void sleep(entityx::Entity::Id id, SimulationLod& lod) {
+            bool synced = syncedChanges == lod.changes();
+            lod.sleep(id);
+            EntityHandle handle = handleOf(id);
+            if (storage.valid(handle)) storage.remove<Awake>(handle);
+            if (synced) syncedChanges = lod.changes();
+        }
+
+        // Every chunk holding all of Cs; see ChunkRef
+        template <typename... Cs>
+        void view(std::vector<ChunkRef>& chunks) const {
+            storage.chunks<Cs...>(chunks);
+        }
+
+        size_t size() const { return storage.size(); }
+        size_t awakeCount() const { return storage.count<Awake>(); }
+
+    private:
+        enum : uint64_t { UNSYNCED = ~0ull };
+
+        EntityHandle handleOf(entityx::Entity::Id id) const {
+            uint32_t index = id.index();
+            if (index >= handles.size()) return EntityHandle();
+            EntityHandle handle = handles[index];
+            UnitLink* link = storage.get<UnitLink>(handle);
+            return link && link->id == id ? handle : EntityHandle();
+        }
+
+        // New rows start without the Awake tag; syncAwake() adds it
+        void track(entityx::Entity entity) {
+            if (storage.valid(handleOf(entity.id()))) return;
+            auto position = entity.component<Position>();
+            auto velocity = entity.component<Velocity>();
+            if (!position || !velocity) return;
+
+            uint32_t index = entity.id().index();
+            if (index >= handles.size()) handles.resize(index + 1);
+            // a row left behind by an id whose index was recycled
+            storage.destroy(handles[index]);
+
+            EntityHandle handle = storage.create();
+            handles[index] = handle;
+            const glm::vec3& p = position->value;
+            const glm::vec3& v = velocity->value;
+            storage.assign<UnitLink>(handle, UnitLink { entity.id(), position.get(), velocity.get() });
+            storage.assign<PositionLane<0>>(handle, PositionLane<0> { p.x });
+            storage.assign<PositionLane<1>>(handle, PositionLane<1> { p.y });
+            storage.assign<PositionLane<2>>(handle, PositionLane<2> { p.z });
+            storage.assign<VelocityLane<0>>(handle, VelocityLane<0> { v.x });
+            storage.assign<VelocityLane<1>>(handle, VelocityLane<1> { v.y });
+            storage.assign<VelocityLane<2>>(handle, VelocityLane<2> { v.z });
+            auto sprite = entity.component<Sprite>();
+            if (sprite) storage.assign<SpriteLink>(handle, SpriteLink { sprite.get() });
+            // the new row needs its tag whether or not lod saw anything change
+            syncedChanges = UNSYNCED;
+        }
+
+        void untrack(entityx::Entity::Id id) {
+            EntityHandle handle = handleOf(id);
+            if (!storage.valid(handle)) return;
+            storage.destroy(handle);
+            handles[id.index()] = EntityHandle();
+        }
+
+        ArchetypeStorage storage;
+        std::vector<EntityHandle> handles; // by entity index; checked against UnitLink::id
+        std::vector<EntityHandle> asleep;
+        uint64_t syncedChanges = UNSYNCED;
+    };
+}
+
+#endif//RTS_UNIT_CHUNKS_H
@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "image_decoder.h"
+#include "texture_cache.h"
+
+// Decodes images ahead of time into a texture cache that TextureManager maps
+// at startup instead of decoding PNGs, mip chains included.
+//
+//   bake_textures OUTPUT [--threads N] FILE...
+//
+// Each FILE is stored under the path exactly as given, which has to match the
+// name the game loads it by (e.g. res/ant.png, run from the project root).
+// The texture_cache CMake target bakes res/*.png into res/textures.cache.
+
+using Clock = std::chrono::steady_clock;
+
+int main(int argc, char** argv) {
+    std::string output;
+    std::vector<std::string> files;
+    unsigned threads = engine::ThreadPool::defaultThreadCount();
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            threads = (unsigned) atoi(argv[++i]);
+        } else if (arg[0] == '-') {
+            output.clear();
+            break;
+        } else if (output.empty()) {
+            output = arg;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (output.empty() || files.empty()) {
+        fprintf(stderr, "usage: %s OUTPUT [--threads N] FILE...\n", argv[0]);
+        return 1;
+    }
+
+    auto start = Clock::now();
+    engine::ThreadPool pool(threads);
+    engine::ImageDecoder decoder(pool);
+    std::vector<std::future<engine::DecodedImage>> decoding;
+    for (auto& file : files) {
+        decoding.push_back(decoder.decode(file));
+    }
+
+    engine::TextureCacheWriter writer;
+    size_t sourceBytes = 0;
+    for (size_t i = 0; i < files.size(); i++) {
+        engine::DecodedImage image = decoder.wait(decoding[i]);
+        uint64_t size;
+        int64_t time;
+        if (!image.ok() || !engine::sourceStamp(files[i], size, time)) {
+            fprintf(stderr, "Unable to decode '%s'\n", files[i].c_str());
+            return 1;
+        }
+        writer.add(files[i], image.pixels.get(), image.width, image.height, size, time);
+        sourceBytes += size;
+        printf("%-40s %5u x %-5u %2u levels\n", files[i].c_str(), image.width, image.height,
+               engine::mipLevels(image.width, image.height));
+    }
+
+    std::string error;
+    if (!writer.write(output, error)) {
+        fprintf(stderr, "%s: %s\n", output.c_str(), error.c_str());
+        return 1;
+    }
+
+    FILE* file = fopen(output.c_str(), "rb");
+    long outputBytes = 0;
+    if (file) {
+        fseek(file, 0, SEEK_END);
+        outputBytes = ftell(file);
+        fclose(file);
+    }
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    printf("%zu textures, %.1f KB of PNG baked to %.1f KB in %.1f ms\n", writer.size(),
+           sourceBytes / 1024.0, outputBytes / 1024.0, ms);
+
+    return 0;
+}
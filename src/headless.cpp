@@ -0,0 +1,197 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "simulation.h"
+#include "snapshot.h"
+
+// Steps a Simulation for a fixed number of ticks as fast as possible, with no
+// window or GL context. Meant for build and perf machines without a GPU.
+//
+//   headless [--entities N] [--ticks N] [--tick-rate HZ] [--orders-every N]
+//            [--threads N] [--walls N] [--seed N] [--record FILE]
+//            [--save FILE] [--load FILE] [--schedule] [--profile FILE]
+//
+// --schedule prints the system schedule with the last tick's timings and its
+// critical path. --walls places N random wall segments on the pathfinding map.
+// --profile writes a Chrome trace of the run to FILE and prints p50/p95/p99
+// tick and per-system times. --record writes the run's commands and a state
+// hash every tick to FILE, for `replay FILE` to check determinism against.
+// --load starts from a snapshot instead of spawning --entities units, and
+// --save writes one after the last tick; both report size and throughput.
+
+using Clock = std::chrono::steady_clock;
+
+static float randomCoordinate() {
+    return (float) rand() / RAND_MAX * 2 - 1;
+}
+
+static long fileSize(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return 0;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+int main(int argc, char** argv) {
+    uint entityCount = 10000;
+    uint ticks = 1000;
+    double tickRate = 30.0;
+    uint ordersEvery = 30;
+    unsigned threads = engine::ThreadPool::defaultThreadCount();
+    bool dumpSchedule = false;
+    uint walls = 0;
+    std::string profilePath;
+    std::string recordPath;
+    std::string savePath;
+    std::string loadPath;
+    uint64_t seed = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--entities" && hasValue) {
+            entityCount = (uint) atoi(argv[++i]);
+        } else if (arg == "--ticks" && hasValue) {
+            ticks = (uint) atoi(argv[++i]);
+        } else if (arg == "--tick-rate" && hasValue) {
+            tickRate = atof(argv[++i]);
+        } else if (arg == "--orders-every" && hasValue) {
+            ordersEvery = (uint) atoi(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            threads = (unsigned) atoi(argv[++i]);
+        } else if (arg == "--walls" && hasValue) {
+            walls = (uint) atoi(argv[++i]);
+        } else if (arg == "--seed" && hasValue) {
+            seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--record" && hasValue) {
+            recordPath = argv[++i];
+        } else if (arg == "--save" && hasValue) {
+            savePath = argv[++i];
+        } else if (arg == "--load" && hasValue) {
+            loadPath = argv[++i];
+        } else if (arg == "--profile" && hasValue) {
+            profilePath = argv[++i];
+        } else if (arg == "--schedule") {
+            dumpSchedule = true;
+        } else {
+            fprintf(stderr, "usage: %s [--entities N] [--ticks N] [--tick-rate HZ] [--orders-every N] [--threads N] [--walls N] [--seed N] [--record FILE] [--save FILE] [--load FILE] [--schedule] [--profile FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (!loadPath.empty() && !recordPath.empty()) {
+        // a recording has to start from an empty world to be replayable
+        fprintf(stderr, "--load and --record cannot be used together\n");
+        return 1;
+    }
+
+    engine::Profiler& profiler = engine::Profiler::instance();
+    profiler.setEnabled(!profilePath.empty());
+
+    srand((unsigned) seed);
+    engine::Simulation simulation(0.05f, threads);
+    simulation.seed(seed);
+    simulation.getTimestep().setTickRate(tickRate);
+
+    std::unique_ptr<engine::CommandLogWriter> recorder;
+    if (!recordPath.empty()) {
+        engine::CommandLogHeader header;
+        header.seed = seed;
+        header.tickLength = simulation.getTimestep().tickLength();
+        recorder.reset(new engine::CommandLogWriter(recordPath, header));
+        if (!recorder->ok()) {
+            fprintf(stderr, "Unable to open '%s'\n", recordPath.c_str());
+            return 1;
+        }
+        simulation.record(recorder.get());
+    }
+
+    // walls and units go in as commands too, so a recording replays from an empty world
+    for (uint w = 0; w < walls; w++) {
+        glm::vec2 start(randomCoordinate(), randomCoordinate());
+        glm::vec2 size = rand() % 2 ? glm::vec2(0.4f, 0.03f) : glm::vec2(0.03f, 0.4f);
+        simulation.blockArea(start, start + size);
+    }
+
+    auto start = Clock::now();
+    if (!loadPath.empty()) {
+        std::string error;
+        if (!engine::loadSnapshot(simulation, loadPath, error)) {
+            fprintf(stderr, "%s: %s\n", loadPath.c_str(), error.c_str());
+            return 1;
+        }
+        entityCount = (uint) simulation.entities.size();
+    } else {
+        for (uint u = 0; u < entityCount; u++) {
+            simulation.addUnit(randomCoordinate(), randomCoordinate());
+        }
+    }
+    simulation.applyCommands();
+    double spawnMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    double tickLength = simulation.getTimestep().tickLength();
+    start = Clock::now();
+    for (uint tick = 0; tick < ticks; tick++) {
+        if (ordersEvery > 0 && tick % ordersEvery == 0) {
+            simulation.addTarget(glm::vec3(randomCoordinate(), randomCoordinate(), 0.0f));
+        }
+        simulation.step(tickLength);
+        profiler.endFrame();
+    }
+    double runSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    simulation.stopRecording();
+
+    printf("entities:      %u\n", entityCount);
+    printf("threads:       %u + caller\n", threads);
+    printf("ticks:         %u (%.1f s simulated at %.0f Hz)\n", ticks, ticks * tickLength, tickRate);
+    if (!loadPath.empty()) {
+        double megabytes = (double) fileSize(loadPath) / (1024 * 1024);
+        printf("load:          %.1f ms, %.1f MB (%.0f MB/s)\n", spawnMs, megabytes, megabytes * 1000 / spawnMs);
+    } else {
+        printf("spawn:         %.1f ms\n", spawnMs);
+    }
+    printf("run:           %.3f s\n", runSeconds);
+    printf("ticks/s:       %.1f\n", ticks / runSeconds);
+    printf("us/tick:       %.1f\n", runSeconds * 1e6 / ticks);
+    printf("ns/entity/tick %.2f\n", entityCount > 0 ? runSeconds * 1e9 / ticks / entityCount : 0.0);
+    printf("flow fields:   %llu built, %llu reused\n", (unsigned long long) simulation.flowFields.builds(),
+           (unsigned long long) simulation.flowFields.hits());
+    printf("state hash:    %016llx\n", (unsigned long long) simulation.stateHash());
+
+    if (!savePath.empty()) {
+        engine::SnapshotWriter writer;
+        start = Clock::now();
+        writer.save(simulation, savePath);
+        double captureMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (!writer.wait()) {
+            fprintf(stderr, "%s: %s\n", savePath.c_str(), writer.error().c_str());
+            return 1;
+        }
+        double saveMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        double megabytes = (double) writer.last().size() / (1024 * 1024);
+        printf("save:          %.1f ms capture + %.1f ms write, %.1f MB (%.0f MB/s)\n",
+               captureMs, saveMs - captureMs, megabytes, megabytes * 1000 / saveMs);
+    }
+
+    if (dumpSchedule) {
+        simulation.scheduler.dump(stdout);
+    }
+
+    if (!profilePath.empty()) {
+        FILE* trace = fopen(profilePath.c_str(), "w");
+        if (!trace) {
+            fprintf(stderr, "Unable to open '%s'\n", profilePath.c_str());
+            return 1;
+        }
+        profiler.writeChromeTrace(trace);
+        fclose(trace);
+        profiler.writeStats(stdout);
+    }
+
+    return 0;
+}
@@ -1,4 +1,9 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
 
 #include <glad/glad.h>
@@ -8,14 +13,59 @@
 
 #include "engine.h"
 
-void updateSelection(engine::Selection& selection, double dragStartX, double dragStartY, double dragEndX, double dragEndY) {
-    selection.minX = (dragStartX < dragEndX ? dragStartX : dragEndX) / 800.0f * 2 - 1;
-    selection.minY = 1 - (dragStartY > dragEndY ? dragStartY : dragEndY) / 600.0f * 2;
-    selection.maxX = (dragStartX > dragEndX ? dragStartX : dragEndX) / 800.0f * 2 - 1;
-    selection.maxY = 1 - (dragStartY < dragEndY ? dragStartY : dragEndY) / 600.0f * 2;
+void updateSelection(engine::Selection& selection, const engine::Camera& camera, double dragStartX, double dragStartY, double dragEndX, double dragEndY) {
+    glm::vec2 start = camera.screenToWorld(glm::vec2(dragStartX, dragStartY));
+    glm::vec2 end = camera.screenToWorld(glm::vec2(dragEndX, dragEndY));
+    selection.minX = glm::min(start.x, end.x);
+    selection.minY = glm::min(start.y, end.y);
+    selection.maxX = glm::max(start.x, end.x);
+    selection.maxY = glm::max(start.y, end.y);
 }
 
+// game [--profile FILE] [--seed N] [--record FILE] [--texture-cache FILE]
+//      [--gl-stats] [--frames N]
+//
+// --profile records every frame and writes a Chrome trace to FILE on exit,
+// plus p50/p95/p99 frame and per-system times to stdout. --record writes the
+// session's commands and state hashes to FILE; `replay FILE` runs it again
+// headless and checks it ends up in the same state. --texture-cache maps a
+// cache baked by bake_textures, res/textures.cache by default when present.
+// --gl-stats checks the GL state cache against the driver every frame and
+// prints issued and skipped binds per frame on exit; --frames quits after N
+// frames. Together they run unattended under Mesa's llvmpipe, e.g.
+// `LIBGL_ALWAYS_SOFTWARE=1 xvfb-run ./build/game --gl-stats --frames 300`.
+//
+// WASD or the arrow keys pan the camera, as does dragging with the middle
+// mouse button; the scroll wheel zooms around the cursor. Ctrl+0-9 stores
+// the selection as a control group and 0-9 selects it again.
 int main(int argc, char** argv) {
+    std::string profilePath;
+    std::string recordPath;
+    std::string textureCachePath = "res/textures.cache";
+    bool requireTextureCache = false;
+    bool glStats = false;
+    uint64_t maxFrames = 0;
+    uint64_t seed = 1;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--profile" && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if (arg == "--record" && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--texture-cache" && i + 1 < argc) {
+            textureCachePath = argv[++i];
+            requireTextureCache = true;
+        } else if (arg == "--gl-stats") {
+            glStats = true;
+        } else if (arg == "--frames" && i + 1 < argc) {
+            maxFrames = strtoull(argv[++i], nullptr, 10);
+        }
+    }
+    engine::Profiler& profiler = engine::Profiler::instance();
+    profiler.setEnabled(!profilePath.empty());
+
     glfwSetErrorCallback([](int error, const char* description) {
         std::cerr << "GLFW Error (" << error << "):\n" << description << std::endl;
     });
@@ -48,62 +98,117 @@ int main(int argc, char** argv) {
 
     engine::InputManager input(window);
     engine::TextureManager textures;
+    uint64_t cacheSize;
+    int64_t cacheTime;
+    if (requireTextureCache || engine::sourceStamp(textureCachePath, cacheSize, cacheTime)) {
+        textures.useCache(textureCachePath);
+    }
 
     engine::EntityRenderer renderer;
-    renderer.init();
     engine::SelectionBoxRenderer selectionRenderer;
-    selectionRenderer.init();
+    if (!renderer.init() || !selectionRenderer.init()) {
+        std::cerr << "Unable to build the shaders" << std::endl;
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return -1;
+    }
 
-    engine::World world(renderer, selectionRenderer, textures);
+    int windowWidth, windowHeight;
+    glfwGetWindowSize(window, &windowWidth, &windowHeight);
+    engine::Camera camera(windowWidth, windowHeight);
+
+    engine::World world(renderer, selectionRenderer, textures, camera, seed);
+
+    std::unique_ptr<engine::CommandLogWriter> recorder;
+    if (!recordPath.empty()) {
+        engine::CommandLogHeader header;
+        header.seed = seed;
+        header.tickLength = world.getTimestep().tickLength();
+        recorder.reset(new engine::CommandLogWriter(recordPath, header));
+        if (recorder->ok()) {
+            world.record(recorder.get());
+        } else {
+            std::cerr << "Unable to open '" << recordPath << "'" << std::endl;
+        }
+    }
 
     double lastTime = glfwGetTime();
     double currentTime;
     double deltaTime;
 
     bool isRightMouseButtonPressed = false;
-    bool isSelecting = false;
-    float startX, startY, curX, curY;
+    bool isMiddleMouseButtonPressed = false;
+    float curX = 0, curY = 0;
     engine::Selection selection(0, 0, 0, 0, 0);
 
     input.registerKeyCallback([&](engine::InputManager* input, int key, int scancode, int action, int mods){
         if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
             glfwSetWindowShouldClose(window, GLFW_TRUE);
         }
+        if (key >= GLFW_KEY_0 && key <= GLFW_KEY_9 && action == GLFW_PRESS) {
+            if (mods & GLFW_MOD_CONTROL) {
+                world.saveGroup((uint) (key - GLFW_KEY_0));
+            } else {
+                world.recallGroup((uint) (key - GLFW_KEY_0));
+            }
+        }
     });
 
     input.registerMouseButtonCallback([&](engine::InputManager* input, int button, int action, int mods) {
         if (button == GLFW_MOUSE_BUTTON_RIGHT) {
             if (!isRightMouseButtonPressed && action == GLFW_PRESS) {
-                world.addTarget(glm::vec3(curX / 800.0f * 2 - 1, 1 - curY / 600.0f * 2, 0.0f));
+                glm::vec2 target = camera.screenToWorld(glm::vec2(curX, curY));
+                world.addTarget(glm::vec3(target, 0.0f));
             }
             isRightMouseButtonPressed = action == GLFW_PRESS;
+        } else if (button == GLFW_MOUSE_BUTTON_MIDDLE) {
+            isMiddleMouseButtonPressed = action == GLFW_PRESS;
         }
     });
 
     input.registerCursorPosCallback([&](engine::InputManager* input, double xpos, double ypos) {
+        if (isMiddleMouseButtonPressed) {
+            camera.panPixels(glm::vec2((float) xpos - curX, (float) ypos - curY));
+        }
         curX = (float) xpos;
         curY = (float) ypos;
     });
 
-    input.registerDragStartedCallback([&selection, &world](engine::InputManager* input, double startedX, double startedY, double endedX, double endedY) {
-        updateSelection(selection, startedX, startedY, endedX, endedY);
+    input.registerScrollCallback([&](engine::InputManager* input, double xoffset, double yoffset) {
+        camera.zoomAt(glm::vec2(curX, curY), std::pow(1.1f, (float) yoffset));
+    });
+
+    input.registerResizeCallback([&](engine::InputManager* input, int width, int height) {
+        camera.setViewport(width, height);
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        glViewport(0, 0, framebufferWidth, framebufferHeight);
+    });
+
+    input.registerDragStartedCallback([&selection, &world, &camera](engine::InputManager* input, double startedX, double startedY, double endedX, double endedY) {
+        updateSelection(selection, camera, startedX, startedY, endedX, endedY);
         world.startSelection(selection);
     });
 
-    input.registerDragMovedCallback([&selection, &world](engine::InputManager* input, double startedX, double startedY, double endedX, double endedY) {
-        updateSelection(selection, startedX, startedY, endedX, endedY);
+    input.registerDragMovedCallback([&selection, &world, &camera](engine::InputManager* input, double startedX, double startedY, double endedX, double endedY) {
+        updateSelection(selection, camera, startedX, startedY, endedX, endedY);
         world.changeSelection(selection);
     });
 
-    input.registerDragEndedCallback([&selection, &world](engine::InputManager* input, double startedX, double startedY, double endedX, double endedY) {
-        updateSelection(selection, startedX, startedY, endedX, endedY);
+    input.registerDragEndedCallback([&selection, &world, &camera](engine::InputManager* input, double startedX, double startedY, double endedX, double endedY) {
+        updateSelection(selection, camera, startedX, startedY, endedX, endedY);
         world.stopSelection(selection);
     });
 
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    while (!glfwWindowShouldClose(window)) {
+    engine::GLState& glState = engine::GLState::instance();
+    glState.resetStats();
+    uint64_t frames = 0;
+    bool glStateOk = true;
+
+    while (!glfwWindowShouldClose(window) && (maxFrames == 0 || frames < maxFrames)) {
         glClearColor(0.2f, 0.3f, 0.4f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT);
 
@@ -111,10 +216,53 @@ int main(int argc, char** argv) {
         deltaTime = currentTime - lastTime;
         lastTime = currentTime;
 
-        world.update(deltaTime);
+        textures.uploadPending();
+
+        glm::vec2 pan(0.0f);
+        if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) pan.x -= 1;
+        if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) pan.x += 1;
+        if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) pan.y -= 1;
+        if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) pan.y += 1;
+        // a viewport height per second, whatever the zoom
+        camera.pan(pan * camera.halfExtent().y * 2.0f * (float) deltaTime);
+
+        {
+            RTS_PROFILE_ZONE("World::update");
+            world.update(deltaTime);
+        }
+
+        {
+            RTS_PROFILE_ZONE("glfwPollEvents");
+            glfwPollEvents();
+        }
+        input.dispatch();
+        {
+            RTS_PROFILE_ZONE("glfwSwapBuffers");
+            glfwSwapBuffers(window);
+        }
+        if (glStats) {
+            glStateOk = glState.verify(stderr) && glStateOk;
+        }
+        profiler.endFrame();
+        frames++;
+    }
 
-        glfwPollEvents();
-        glfwSwapBuffers(window);
+    if (glStats) {
+        glState.writeStats(stdout, frames);
+        printf("state cache:     %s\n", glStateOk ? "matched the driver every frame" : "MISMATCHED, see above");
+    }
+
+    world.stopRecording();
+
+    if (!profilePath.empty()) {
+        FILE* trace = fopen(profilePath.c_str(), "w");
+        if (trace) {
+            profiler.writeChromeTrace(trace);
+            fclose(trace);
+        } else {
+            std::cerr << "Unable to open '" << profilePath << "'" << std::endl;
+        }
+        profiler.writeStats(stdout);
     }
 
     textures.cleanup();
@@ -124,5 +272,5 @@ int main(int argc, char** argv) {
     glfwDestroyWindow(window);
     glfwTerminate();
 
-    return 0;
+    return glStateOk ? 0 : 1;
 }
\ No newline at end of file
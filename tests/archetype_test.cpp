@@ -0,0 +1,148 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include "archetype.h"
+#include "check.h"
+
+// ArchetypeStorage against a plain map of what every entity should hold,
+// through random creates, destroys, assigns and removes: handles stay
+// valid exactly as long as their entity, components keep their values as
+// entities move between archetypes, and views visit exactly the entities
+// that have what they ask for, in aligned arrays.
+
+struct A { uint32_t value; };
+struct B { double value; };
+struct C { uint8_t value; };
+
+struct Expected {
+    engine::EntityHandle handle;
+    bool hasA, hasB, hasC;
+    uint32_t a;
+    double b;
+    uint8_t c;
+};
+
+static bool aligned(const void* p) {
+    return ((uintptr_t) p % engine::CHUNK_ALIGNMENT) == 0;
+}
+
+// Every entity the view visits has A and B with the values it should, and every entity that has both is visited once
+static void checkView(const engine::ArchetypeStorage& storage, const std::vector<Expected>& live) {
+    std::vector<engine::ChunkRef> chunks;
+    storage.chunks<A, B>(chunks);
+    std::map<uint32_t, int> visits;
+    for (auto& chunk : chunks) {
+        CHECK(chunk.size() > 0 && chunk.size() <= chunk.archetype->capacity());
+        const A* a = chunk.array<A>();
+        const B* b = chunk.array<B>();
+        CHECK(aligned(a) && aligned(b) && aligned(chunk.handles()));
+        for (size_t i = 0; i < chunk.size(); i++) {
+            engine::EntityHandle handle = chunk.handles()[i];
+            visits[handle.index]++;
+            CHECK(storage.get<A>(handle) == &a[i] && storage.get<B>(handle) == &b[i]);
+        }
+    }
+
+    size_t both = 0;
+    for (auto& e : live) {
+        if (!e.hasA || !e.hasB) {
+            CHECK(visits.count(e.handle.index) == 0);
+            continue;
+        }
+        both++;
+        CHECK(visits[e.handle.index] == 1);
+    }
+    size_t counted = storage.count<A, B>();
+    CHECK(visits.size() == both);
+    CHECK(counted == both);
+}
+
+static void checkAll(const engine::ArchetypeStorage& storage, const std::vector<Expected>& live,
+                     const std::vector<engine::EntityHandle>& dead) {
+    CHECK(storage.size() == live.size());
+    for (auto& e : live) {
+        CHECK(storage.valid(e.handle));
+        CHECK(storage.has<A>(e.handle) == e.hasA && storage.has<B>(e.handle) == e.hasB && storage.has<C>(e.handle) == e.hasC);
+        if (e.hasA) CHECK(storage.get<A>(e.handle)->value == e.a);
+        if (e.hasB) CHECK(storage.get<B>(e.handle)->value == e.b);
+        if (e.hasC) CHECK(storage.get<C>(e.handle)->value == e.c);
+    }
+    for (auto handle : dead) {
+        CHECK(!storage.valid(handle));
+        CHECK(storage.get<A>(handle) == nullptr);
+    }
+    checkView(storage, live);
+}
+
+int main() {
+    srand(22);
+    engine::ArchetypeStorage storage;
+    std::vector<Expected> live;
+    std::vector<engine::EntityHandle> dead;
+
+    for (int round = 0; round < 20; round++) {
+        for (int op = 0; op < 2000; op++) {
+            int choice = rand() % 8;
+            if (choice < 3 || live.empty()) {
+                Expected e = {};
+                e.handle = storage.create();
+                live.push_back(e);
+            } else if (choice == 3) {
+                // swap-back: whoever moves into the hole keeps its handle
+                size_t i = (size_t) rand() % live.size();
+                storage.destroy(live[i].handle);
+                dead.push_back(live[i].handle);
+                live[i] = live.back();
+                live.pop_back();
+            } else {
+                Expected& e = live[(size_t) rand() % live.size()];
+                switch (choice) {
+                    case 4:
+                        e.hasA = true; e.a = (uint32_t) rand();
+                        storage.assign<A>(e.handle, A { e.a });
+                        break;
+                    case 5:
+                        e.hasB = true; e.b = rand() * 0.5;
+                        storage.assign<B>(e.handle, B { e.b });
+                        break;
+                    case 6:
+                        e.hasC = !e.hasC; e.c = (uint8_t) rand();
+                        if (e.hasC) storage.assign<C>(e.handle, C { e.c });
+                        else storage.remove<C>(e.handle);
+                        break;
+                    default:
+                        e.hasA = false;
+                        storage.remove<A>(e.handle);
+                        break;
+                }
+            }
+        }
+        checkAll(storage, live, dead);
+    }
+
+    // recycled indices get a new generation, so the old handles stay dead
+    std::vector<engine::EntityHandle> freed;
+    for (int i = 0; i < 100; i++) {
+        freed.push_back(live.back().handle);
+        storage.destroy(live.back().handle);
+        live.pop_back();
+    }
+    dead.insert(dead.end(), freed.begin(), freed.end());
+    size_t recycled = 0;
+    for (int i = 0; i < 100; i++) {
+        engine::EntityHandle handle = storage.create();
+        for (auto old : freed) {
+            if (old.index == handle.index && old.generation != handle.generation) recycled++;
+        }
+        CHECK(!storage.has<A>(handle) && !storage.has<B>(handle));
+        live.push_back(Expected { handle, false, false, false, 0, 0, 0 });
+    }
+    CHECK(recycled == 100);
+    checkAll(storage, live, dead);
+
+    if (checkFailures() == 0) printf("archetype_test: ok\n");
+    return checkFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "atlas.h"
+#include "check.h"
+
+// AtlasPacker: gutters on every side, no overlaps, and report()'s numbers.
+
+// No two rects on a page may come within 2 * padding of each other, and none
+// within padding of the page's edges
+static void checkLayout(const engine::AtlasPacker& packer, const std::vector<engine::AtlasRect>& rects, uint padding) {
+    for (size_t i = 0; i < rects.size(); i++) {
+        auto& a = rects[i];
+        CHECK(a.page < packer.pageCount());
+        if (a.page >= packer.pageCount()) continue;
+        CHECK(a.x >= padding && a.y >= padding);
+        CHECK(a.x + a.width + padding <= packer.pageWidth(a.page));
+        CHECK(a.y + a.height + padding <= packer.pageHeight(a.page));
+        for (size_t j = i + 1; j < rects.size(); j++) {
+            auto& b = rects[j];
+            if (a.page != b.page) continue;
+            bool apart = a.x + a.width + 2 * padding <= b.x || b.x + b.width + 2 * padding <= a.x ||
+                         a.y + a.height + 2 * padding <= b.y || b.y + b.height + 2 * padding <= a.y;
+            CHECK(apart);
+        }
+    }
+}
+
+// report() agrees with the rects that were handed out
+static void checkReport(const engine::AtlasPacker& packer, const std::vector<engine::AtlasRect>& rects) {
+    auto stats = packer.report();
+    CHECK(stats.size() == packer.pageCount());
+    for (uint page = 0; page < stats.size(); page++) {
+        uint count = 0;
+        size_t used = 0;
+        for (auto& rect : rects) {
+            if (rect.page != page) continue;
+            count++;
+            used += (size_t) rect.width * rect.height;
+        }
+        CHECK(stats[page].width == packer.pageWidth(page));
+        CHECK(stats[page].height == packer.pageHeight(page));
+        CHECK(stats[page].rects == count);
+        CHECK(stats[page].usedPixels == used);
+        CHECK(stats[page].occupancy == (float) used / ((size_t) stats[page].width * stats[page].height));
+    }
+}
+
+// 30x30 with a 1 pixel gutter all round is a 32x32 slot, and 64 of those tile a 256x256 page exactly
+static void testExactFit() {
+    engine::AtlasPacker packer(256, 256, 1);
+    std::vector<engine::AtlasSize> sizes(64, engine::AtlasSize { 30, 30 });
+    auto rects = packer.insert(sizes);
+    CHECK(packer.pageCount() == 1);
+    checkLayout(packer, rects, 1);
+    checkReport(packer, rects);
+    auto stats = packer.report();
+    CHECK(stats.size() == 1 && stats[0].rects == 64 && stats[0].usedPixels == 64 * 900);
+
+    // one more has to open a second page
+    rects.push_back(packer.insert(30, 30));
+    CHECK(packer.pageCount() == 2);
+    CHECK(rects.back().page == 1 && rects.back().x == 1 && rects.back().y == 1);
+    checkReport(packer, rects);
+}
+
+static void testOversized() {
+    engine::AtlasPacker packer(64, 64, 2);
+    std::vector<engine::AtlasRect> rects;
+    rects.push_back(packer.insert(10, 10));
+    rects.push_back(packer.insert(100, 20));
+    rects.push_back(packer.insert(10, 10));
+    CHECK(packer.pageCount() == 2);
+    CHECK(rects[1].page == 1 && packer.pageWidth(1) == 104 && packer.pageHeight(1) == 24);
+    CHECK(rects[2].page == 0);
+    checkLayout(packer, rects, 2);
+    checkReport(packer, rects);
+}
+
+static void testMixed() {
+    srand(7);
+    std::vector<engine::AtlasSize> sizes;
+    for (int i = 0; i < 400; i++) {
+        sizes.push_back(engine::AtlasSize { 8 + (uint) rand() % 57, 8 + (uint) rand() % 57 });
+    }
+    engine::AtlasPacker packer(512, 512, 2);
+    auto rects = packer.insert(sizes);
+    checkLayout(packer, rects, 2);
+    checkReport(packer, rects);
+    for (size_t i = 0; i < rects.size(); i++) {
+        CHECK(rects[i].width == sizes[i].width && rects[i].height == sizes[i].height);
+    }
+
+    auto stats = packer.report();
+    for (uint page = 0; page < stats.size(); page++) {
+        printf("page %u: %ux%u, %u rects, %.1f%% occupied\n", page, stats[page].width, stats[page].height,
+               stats[page].rects, stats[page].occupancy * 100);
+    }
+    // every page but the last was closed for being full
+    for (uint page = 0; page + 1 < stats.size(); page++) {
+        CHECK(stats[page].occupancy > 0.6f);
+    }
+}
+
+int main() {
+    testExactFit();
+    testOversized();
+    testMixed();
+    if (checkFailures() == 0) printf("atlas_test: ok\n");
+    return checkFailures() == 0 ? 0 : 1;
+}
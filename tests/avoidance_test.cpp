@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "check.h"
+#include "simulation.h"
+
+// AvoidanceSystem against a brute force search: every unit reacts to exactly
+// the maxNeighbors nearest, ties broken by entity index, whatever the grid's
+// hash layout and whatever order the units were spawned in.
+
+static float randomCoordinate() {
+    return (float) rand() / RAND_MAX * 2 - 1;
+}
+
+struct Unit {
+    entityx::Entity entity;
+    glm::vec2 position, preferred;
+};
+
+struct Neighbor {
+    float distanceSquared;
+    uint32_t index;
+    glm::vec2 offset, velocity;
+};
+
+// The same arithmetic as AvoidanceSystem::steer, over a list sorted by hand
+static glm::vec2 expectVelocity(const Unit& unit, const std::vector<Unit>& units, const engine::AvoidanceSettings& settings) {
+    std::vector<Neighbor> nearest;
+    for (auto& other : units) {
+        if (other.entity == unit.entity) continue;
+        glm::vec2 offset = unit.position - other.position;
+        float distanceSquared = glm::dot(offset, offset);
+        if (distanceSquared > settings.radius * settings.radius) continue;
+        nearest.push_back(Neighbor { distanceSquared, other.entity.id().index(), offset, other.preferred });
+    }
+    std::sort(nearest.begin(), nearest.end(), [](const Neighbor& a, const Neighbor& b) {
+        return a.distanceSquared < b.distanceSquared || (a.distanceSquared == b.distanceSquared && a.index < b.index);
+    });
+    if (nearest.size() > settings.maxNeighbors) nearest.resize(settings.maxNeighbors);
+
+    glm::vec2 separation(0.0f), avoidance(0.0f);
+    float diameter = settings.unitRadius * 2;
+    for (auto& neighbor : nearest) {
+        float distance = std::sqrt(neighbor.distanceSquared);
+        if (distance > 0) {
+            separation += neighbor.offset / distance * (1.0f - distance / settings.radius);
+        }
+        glm::vec2 relative = unit.preferred - neighbor.velocity;
+        float speedSquared = glm::dot(relative, relative);
+        if (speedSquared > 0) {
+            float t = -glm::dot(neighbor.offset, relative) / speedSquared;
+            if (t > 0 && t < settings.timeHorizon) {
+                glm::vec2 miss = neighbor.offset + relative * t;
+                float missDistance = glm::length(miss);
+                if (missDistance < diameter && missDistance > 0) {
+                    float urgency = 1.0f - t / settings.timeHorizon;
+                    avoidance += miss / missDistance * ((diameter - missDistance) / settings.timeHorizon * 0.5f * urgency);
+                }
+            }
+        }
+    }
+
+    glm::vec2 v = unit.preferred + (separation * settings.separationWeight + avoidance * settings.avoidanceWeight);
+    float speed = glm::length(unit.preferred);
+    float length = glm::length(v);
+    if (length > speed) {
+        v *= speed / length;
+    }
+    return v;
+}
+
+// A crowd straddling cells on both sides of the origin, with some units
+// stacked on the same spot so distances tie
+static std::vector<glm::vec2> makeCrowd(size_t count, float spread) {
+    std::vector<glm::vec2> positions;
+    for (size_t i = 0; i < count; i++) {
+        if (i % 10 == 9) {
+            positions.push_back(positions[i - 5]);
+        } else {
+            positions.push_back(glm::vec2(randomCoordinate() * spread, randomCoordinate() * spread));
+        }
+    }
+    return positions;
+}
+
+// Spawns the crowd in the given order and checks every unit after one avoidance pass
+static void steerCrowd(const std::vector<glm::vec2>& positions, const std::vector<size_t>& order, unsigned threads) {
+    engine::Simulation simulation(0.05f, threads);
+    std::vector<Unit> units(positions.size());
+    for (size_t i : order) {
+        auto entity = simulation.spawnUnit(positions[i].x, positions[i].y);
+        // one in four stands still and is only an obstacle
+        glm::vec2 preferred = i % 4 == 0 ? glm::vec2(0.0f) : glm::vec2(randomCoordinate(), randomCoordinate()) * 0.2f;
+        entity.component<engine::Velocity>()->value = glm::vec3(preferred, 0.0f);
+        units[i] = Unit { entity, positions[i], preferred };
+    }
+    simulation.systems.update<engine::SpatialIndexSystem>(1.0 / 30);
+    simulation.systems.update<engine::AvoidanceSystem>(1.0 / 30);
+
+    auto settings = simulation.systems.system<engine::AvoidanceSystem>()->getSettings();
+    for (auto& unit : units) {
+        auto velocity = unit.entity.component<engine::Velocity>()->value;
+        glm::vec2 actual(velocity.x, velocity.y);
+        glm::vec2 expected = unit.preferred == glm::vec2(0.0f) ? unit.preferred : expectVelocity(unit, units, settings);
+        bool same = memcmp(&actual, &expected, sizeof(glm::vec2)) == 0;
+        if (!same) {
+            fprintf(stderr, "unit at (%g, %g): steered to (%g, %g), expected (%g, %g)\n", unit.position.x, unit.position.y,
+                    actual.x, actual.y, expected.x, expected.y);
+        }
+        CHECK(same);
+    }
+}
+
+static void testCrowd(float spread) {
+    auto positions = makeCrowd(2000, spread);
+    std::vector<size_t> forward(positions.size()), backward;
+    for (size_t i = 0; i < forward.size(); i++) forward[i] = i;
+    backward.assign(forward.rbegin(), forward.rend());
+
+    srand(12);
+    steerCrowd(positions, forward, 0);
+    // spawned the other way round, the entity indices and the cells' contents come out in a different order
+    srand(12);
+    steerCrowd(positions, backward, 2);
+}
+
+int main() {
+    srand(11);
+    // hundreds of units in reach of each, and a handful
+    testCrowd(0.12f);
+    testCrowd(0.6f);
+
+    if (checkFailures() == 0) printf("avoidance_test: ok\n");
+    return checkFailures() == 0 ? 0 : 1;
+}
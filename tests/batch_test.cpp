@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "batch.h"
+#include "check.h"
+
+// SpriteBatchBuilder without GL: grouping by texture, write() against the
+// sprites it was given, and the empty frame.
+
+struct SpriteData {
+    uint texture;
+    engine::SpriteInstance instance;
+};
+
+static bool same(const engine::SpriteInstance& a, const engine::SpriteInstance& b) {
+    return a.position == b.position && a.rotation == b.rotation && a.scale == b.scale && a.tint == b.tint &&
+           a.uv == b.uv;
+}
+
+// Textures in an order that keeps switching, with a page only used once
+static std::vector<SpriteData> makeSprites(uint count) {
+    const uint textures[] = { 3, 1, 3, 3, 2, 1, 0, 3, 1, 2 };
+    std::vector<SpriteData> sprites;
+    for (uint i = 0; i < count; i++) {
+        uint texture = i == count / 2 ? 7 : textures[i % 10];
+        sprites.push_back(SpriteData { texture, engine::SpriteInstance(glm::vec3((float) i, (float) texture, 0.5f),
+            i * 0.25f, 1.0f + i % 3, glm::vec3(0.0f, 1.0f, (float) (i % 2)), glm::vec4(0.1f * (i % 4), 0.0f, 0.25f, 0.5f)) });
+    }
+    return sprites;
+}
+
+static void testEmpty() {
+    engine::SpriteBatchBuilder batches;
+    batches.begin();
+    batches.end();
+    CHECK(batches.size() == 0);
+    CHECK(batches.batches().empty());
+    CHECK(batches.stats().drawCalls == 0);
+    CHECK(batches.stats().instances == 0);
+    batches.write(nullptr);
+}
+
+static void testGrouping() {
+    std::vector<SpriteData> sprites = makeSprites(1001);
+    engine::SpriteBatchBuilder batches;
+    // the second frame checks that begin() forgets the first
+    for (int frame = 0; frame < 2; frame++) {
+        batches.begin();
+        for (auto& sprite : sprites) {
+            batches.add(sprite.texture, sprite.instance);
+        }
+        batches.end();
+    }
+
+    CHECK(batches.size() == sprites.size());
+    CHECK(batches.batches().size() == 5);
+    CHECK(batches.stats().drawCalls == 5);
+    CHECK(batches.stats().instances == sprites.size());
+
+    // one batch per texture, back to back, covering every instance
+    uint next = 0;
+    std::vector<uint> seen;
+    for (auto& batch : batches.batches()) {
+        CHECK(batch.first == next);
+        for (uint texture : seen) {
+            CHECK(texture != batch.texture);
+        }
+        seen.push_back(batch.texture);
+        next += batch.count;
+    }
+    CHECK(next == sprites.size());
+
+    std::vector<engine::SpriteInstance> out(batches.size());
+    batches.write(out.data());
+
+    // within a batch, instances keep the order they were added in
+    for (auto& batch : batches.batches()) {
+        uint slot = batch.first;
+        for (auto& sprite : sprites) {
+            if (sprite.texture != batch.texture) continue;
+            CHECK(slot < batch.first + batch.count);
+            if (slot < out.size()) CHECK(same(out[slot], sprite.instance));
+            slot++;
+        }
+        CHECK(slot == batch.first + batch.count);
+    }
+
+    // disjoint ranges, as threads write them, land exactly where a whole write does
+    std::vector<engine::SpriteInstance> pieces(batches.size());
+    for (size_t begin = 0; begin < sprites.size(); begin += 97) {
+        batches.write(pieces.data(), begin, std::min(sprites.size(), begin + 97));
+    }
+    for (size_t i = 0; i < out.size(); i++) {
+        CHECK(same(pieces[i], out[i]));
+    }
+}
+
+int main() {
+    testEmpty();
+    testGrouping();
+    if (checkFailures() == 0) printf("batch_test: ok\n");
+    return checkFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,24 @@
+#ifndef RTS_TESTS_CHECK_H
+#define RTS_TESTS_CHECK_H
+
+#include <cstdio>
+
+// Just enough for the test executables: a failed CHECK says where and carries
+// on, and main returns checkFailures() so ctest sees the result
+inline int& checkFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition)                                                                   \
+    do {                                                                                   \
+        if (!(condition)) {                                                                \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            checkFailures()++;                                                             \
+        }                                                                                  \
+    } while (0)
+
+// Returned by tests that need something this machine lacks, such as a GL context
+const int TEST_SKIPPED = 77;
+
+#endif//RTS_TESTS_CHECK_H
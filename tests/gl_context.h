@@ -0,0 +1,46 @@
+#ifndef RTS_TESTS_GL_CONTEXT_H
+#define RTS_TESTS_GL_CONTEXT_H
+
+#include <cstdio>
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+// A hidden window holding a GL 3.3 core context for the tests that need real
+// GL. Where there is none to be had, e.g. no display, create() says why and
+// the test returns TEST_SKIPPED.
+class TestContext {
+public:
+    ~TestContext() {
+        if (window) glfwDestroyWindow(window);
+        if (initialized) glfwTerminate();
+    }
+
+    bool create() {
+        initialized = glfwInit() != 0;
+        if (!initialized) {
+            fprintf(stderr, "skipped: unable to initialize GLFW\n");
+            return false;
+        }
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        window = glfwCreateWindow(64, 64, "test", nullptr, nullptr);
+        if (!window) {
+            fprintf(stderr, "skipped: unable to create a GL 3.3 context\n");
+            return false;
+        }
+        glfwMakeContextCurrent(window);
+        if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+            fprintf(stderr, "skipped: unable to initialize GLAD\n");
+            return false;
+        }
+        return true;
+    }
+
+private:
+    GLFWwindow* window = nullptr;
+    bool initialized = false;
+};
+
+#endif//RTS_TESTS_GL_CONTEXT_H
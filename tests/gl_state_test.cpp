@@ -0,0 +1,177 @@
+#include <cstdio>
+
+#include "check.h"
+#include "gl_context.h"
+#include "gl_state.h"
+#include "shader.h"
+
+// GLState against a real context: which binds are issued or skipped, and
+// verify() agreeing with what GL reports, including after binds behind its
+// back. Also ShaderProgram::build() failing cleanly on bad shaders.
+
+static const char* VERTEX = R"(
+    #version 330 core
+    layout(location=0) in vec2 aPosition;
+    out vec3 vColor;
+    void main() {
+        vColor = vec3(aPosition, 1.0);
+        gl_Position = vec4(aPosition, 0.0, 1.0);
+    }
+)";
+
+static const char* FRAGMENT = R"(
+    #version 330 core
+    in vec3 vColor;
+    out vec4 fColor;
+    uniform float uAlpha;
+    void main() {
+        fColor = vec4(vColor, uAlpha);
+    }
+)";
+
+// Compiles, but calls a function no shader defines, so it cannot link
+static const char* UNLINKABLE = R"(
+    #version 330 core
+    in vec3 vColor;
+    out vec4 fColor;
+    vec4 shade(vec3 color);
+    void main() {
+        fColor = shade(vColor);
+    }
+)";
+
+static bool verified(const engine::GLState& gl) {
+    FILE* out = tmpfile();
+    bool ok = gl.verify(out ? out : stderr);
+    if (out) fclose(out);
+    return ok;
+}
+
+static bool counted(engine::GLState::Kind kind, uint64_t issued, uint64_t skipped) {
+    const engine::GLBindStats& stats = engine::GLState::instance().stats(kind);
+    if (stats.issued == issued && stats.skipped == skipped) return true;
+    fprintf(stderr, "kind %d: %llu issued, %llu skipped; expected %llu and %llu\n", (int) kind,
+            (unsigned long long) stats.issued, (unsigned long long) stats.skipped,
+            (unsigned long long) issued, (unsigned long long) skipped);
+    return false;
+}
+
+static void testBinds() {
+    using engine::GLState;
+    GLState& gl = GLState::instance();
+    gl.invalidate();
+    gl.resetStats();
+    CHECK(verified(gl));
+
+    engine::ShaderProgram a, b;
+    CHECK(a.build(VERTEX, FRAGMENT));
+    CHECK(b.build(VERTEX, FRAGMENT));
+    gl.useProgram(a.id());
+    gl.useProgram(a.id());
+    gl.useProgram(b.id());
+    CHECK(counted(GLState::PROGRAM, 2, 1));
+    CHECK(verified(gl));
+
+    // the element buffer binding belongs to the vertex array, so changing
+    // vertex array forgets it and binding it again is issued
+    GLuint vaos[2], buffers[3];
+    glGenVertexArrays(2, vaos);
+    glGenBuffers(3, buffers);
+    gl.bindVertexArray(vaos[0]);
+    gl.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[0]);
+    gl.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[0]);
+    CHECK(verified(gl));
+    gl.bindVertexArray(vaos[1]);
+    CHECK(verified(gl));
+    gl.bindVertexArray(vaos[0]);
+    gl.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[0]);
+    CHECK(counted(GLState::VERTEX_ARRAY, 3, 0));
+    CHECK(counted(GLState::ELEMENT_BUFFER, 2, 1));
+    CHECK(verified(gl));
+
+    gl.bindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+    gl.bindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+    gl.bindBuffer(GL_ARRAY_BUFFER, buffers[2]);
+    CHECK(counted(GLState::ARRAY_BUFFER, 2, 1));
+    CHECK(verified(gl));
+
+    // each unit keeps its own binding; switching unit is tracked as well
+    GLuint textures[2];
+    glGenTextures(2, textures);
+    gl.bindTexture(textures[0]);
+    gl.bindTexture(textures[0]);
+    gl.bindTexture(textures[1], 1);
+    CHECK(verified(gl));
+    gl.bindTexture(textures[0], 0);
+    CHECK(counted(GLState::TEXTURE, 2, 2));
+    CHECK(counted(GLState::ACTIVE_TEXTURE, 2, 0));
+    CHECK(verified(gl));
+
+    // GL hands deleted names out again, so a reported delete forces the next bind
+    gl.deletedTexture(textures[1]);
+    glDeleteTextures(1, &textures[1]);
+    GLuint reused;
+    glGenTextures(1, &reused);
+    gl.bindTexture(reused, 1);
+    CHECK(counted(GLState::TEXTURE, 3, 2));
+    CHECK(verified(gl));
+
+    // binds behind its back are caught by verify() until invalidate()
+    glBindVertexArray(vaos[1]);
+    glUseProgram(a.id());
+    CHECK(!verified(gl));
+    gl.invalidate();
+    CHECK(verified(gl));
+    gl.bindVertexArray(vaos[1]);
+    gl.useProgram(a.id());
+    CHECK(counted(GLState::VERTEX_ARRAY, 4, 0));
+    CHECK(counted(GLState::PROGRAM, 3, 1));
+    CHECK(verified(gl));
+
+    // a deleted program is forgotten, so the next one with its name is bound
+    a.cleanup();
+    CHECK(a.build(VERTEX, FRAGMENT));
+    gl.useProgram(a.id());
+    CHECK(counted(GLState::PROGRAM, 4, 1));
+    CHECK(verified(gl));
+
+    glDeleteTextures(1, &textures[0]);
+    glDeleteTextures(1, &reused);
+    glDeleteBuffers(3, buffers);
+    glDeleteVertexArrays(2, vaos);
+    gl.invalidate();
+    a.cleanup();
+    b.cleanup();
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+// A shader that does not compile, or a program that does not link, fails
+// the build and leaves no program behind
+static void testShaderFailures() {
+    engine::ShaderProgram program;
+    CHECK(program.build(VERTEX, FRAGMENT));
+    CHECK(program.id() != 0);
+    CHECK(program.uniform("uAlpha") >= 0);
+
+    fprintf(stderr, "expected: a compile error and a link error follow\n");
+    CHECK(!program.build(VERTEX, "#version 330 core\nvoid main() { this is not glsl }\n"));
+    CHECK(program.id() == 0);
+    CHECK(program.uniform("uAlpha") == -1);
+
+    CHECK(!program.build(VERTEX, UNLINKABLE));
+    CHECK(program.id() == 0);
+
+    CHECK(program.build(VERTEX, FRAGMENT));
+    CHECK(program.id() != 0);
+    program.cleanup();
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+int main() {
+    TestContext context;
+    if (!context.create()) return TEST_SKIPPED;
+    testBinds();
+    testShaderFailures();
+    if (checkFailures() == 0) printf("gl_state_test: ok\n");
+    return checkFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "check.h"
+#include "simulation.h"
+
+// The movement kernels against each other, and MovementSystem's columns
+// against a plain integration of the components while units come and go.
+
+static float randomCoordinate() {
+    return (float) rand() / RAND_MAX * 2 - 1;
+}
+
+// Every kernel has to match the scalar one bit for bit
+static void testKernels() {
+    engine::MovementArrays reference;
+    reference.resize(1003);
+    for (size_t i = 0; i < reference.size(); i++) {
+        reference.px[i] = randomCoordinate() * 1.2f; reference.py[i] = randomCoordinate() * 1.2f; reference.pz[i] = 0;
+        reference.vx[i] = randomCoordinate() * 5; reference.vy[i] = randomCoordinate() * 5; reference.vz[i] = randomCoordinate();
+    }
+
+    auto kernels = engine::kernels::available();
+    std::vector<engine::MovementArrays> results(kernels.size(), reference);
+    for (int step = 0; step < 100; step++) {
+        for (size_t k = 0; k < kernels.size(); k++) {
+            // odd ranges so the SIMD kernels also run their scalar tails
+            kernels[k].kernel(results[k].lanes(), 0, 501, 1.0f / 30.0f);
+            kernels[k].kernel(results[k].lanes(), 501, results[k].size(), 1.0f / 30.0f);
+        }
+    }
+
+    size_t bytes = reference.size() * sizeof(float);
+    for (size_t k = 1; k < kernels.size(); k++) {
+        auto& a = results[0];
+        auto& b = results[k];
+        bool same = memcmp(a.px.data(), b.px.data(), bytes) == 0 && memcmp(a.py.data(), b.py.data(), bytes) == 0
+            && memcmp(a.pz.data(), b.pz.data(), bytes) == 0 && memcmp(a.vx.data(), b.vx.data(), bytes) == 0
+            && memcmp(a.vy.data(), b.vy.data(), bytes) == 0 && memcmp(a.vz.data(), b.vz.data(), bytes) == 0;
+        if (!same) fprintf(stderr, "movement kernel '%s' does not match the scalar kernel\n", kernels[k].name);
+        CHECK(same);
+    }
+    printf("%zu movement kernels agree\n", kernels.size());
+}
+
+struct Expected {
+    glm::vec3 position, velocity;
+};
+
+static void bounce(float& position, float& velocity) {
+    if (position > 1) {
+        position = 1;
+        velocity *= -1;
+    } else if (position < -1) {
+        position = -1;
+        velocity *= -1;
+    }
+}
+
+// Integrates what the components say, the way MovementSystem did before it had columns
+static std::map<uint64_t, Expected> expect(engine::Simulation& simulation, float dt) {
+    std::map<uint64_t, Expected> expected;
+    simulation.entities.each<engine::Position, engine::Velocity>(
+        [&](entityx::Entity entity, engine::Position& position, engine::Velocity& velocity) {
+            Expected e { position.value, velocity.value };
+            if (simulation.lod.isAwake(entity.id())) {
+                e.position += e.velocity * dt;
+                bounce(e.position.x, e.velocity.x);
+                bounce(e.position.y, e.velocity.y);
+            }
+            expected[entity.id().id()] = e;
+        });
+    return expected;
+}
+
+static void checkStep(engine::Simulation& simulation, float dt) {
+    auto expected = expect(simulation, dt);
+    simulation.systems.update<engine::MovementSystem>(dt);
+
+    auto movement = simulation.systems.system<engine::MovementSystem>();
+    CHECK(movement->trackedUnits() == expected.size());
+    size_t awake = 0;
+    for (auto id : simulation.lod.awakeUnits()) {
+        if (expected.count(id.id())) awake++;
+    }
+    CHECK(movement->awakeUnits() == awake);
+
+    simulation.entities.each<engine::Position, engine::Velocity>(
+        [&](entityx::Entity entity, engine::Position& position, engine::Velocity& velocity) {
+            auto found = expected.find(entity.id().id());
+            CHECK(found != expected.end());
+            if (found == expected.end()) return;
+            CHECK(memcmp(&position.value, &found->second.position, sizeof(glm::vec3)) == 0);
+            CHECK(memcmp(&velocity.value, &found->second.velocity, sizeof(glm::vec3)) == 0);
+        });
+}
+
+static void testColumns() {
+    const float dt = 1.0f / 30.0f;
+    engine::Simulation simulation(0.05f, 2);
+    std::vector<entityx::Entity> units;
+    for (int i = 0; i < 3000; i++) {
+        auto unit = simulation.spawnUnit(randomCoordinate(), randomCoordinate());
+        // a third stand still and fall asleep
+        if (i % 3 != 0) unit.component<engine::Velocity>()->value = glm::vec3(randomCoordinate(), randomCoordinate(), 0.0f);
+        units.push_back(unit);
+    }
+    for (int t = 0; t < 5; t++) checkStep(simulation, dt);
+
+    // leave the columns by losing a component or being destroyed
+    for (size_t i = 0; i < units.size(); i += 7) units[i].remove<engine::Velocity>();
+    for (size_t i = 3; i < units.size(); i += 11) units[i].destroy();
+    for (int t = 0; t < 3; t++) checkStep(simulation, dt);
+
+    // come back with a Velocity, arrive new, and wake from sleep by hand or with a job
+    for (size_t i = 0; i < units.size(); i += 14) {
+        if (units[i].valid()) units[i].assign<engine::Velocity>(0.5f, -0.25f, 0.0f);
+    }
+    for (int i = 0; i < 500; i++) {
+        simulation.spawnUnit(randomCoordinate(), randomCoordinate()).component<engine::Velocity>()->value =
+            glm::vec3(randomCoordinate(), 0.0f, 0.0f);
+    }
+    for (size_t i = 6; i < units.size(); i += 9) {
+        if (!units[i].valid() || simulation.lod.isAwake(units[i].id()) || !units[i].has_component<engine::Velocity>()) continue;
+        units[i].component<engine::Velocity>()->value = glm::vec3(0.0f, 0.75f, 0.0f);
+        simulation.lod.wake(units[i].id());
+    }
+    for (size_t i = 12; i < units.size(); i += 9) {
+        if (units[i].valid() && !units[i].has_component<engine::Job>()) units[i].assign<engine::Job>(0.0f, 0.0f, 0.0f);
+    }
+    for (int t = 0; t < 5; t++) checkStep(simulation, dt);
+
+    // put to sleep from outside MovementSystem
+    for (auto id : std::vector<entityx::Entity::Id>(simulation.lod.awakeUnits().begin(), simulation.lod.awakeUnits().end())) {
+        if (id.index() % 5 == 0) {
+            simulation.entities.get(id).component<engine::Velocity>()->value = glm::vec3(0.0f);
+            simulation.lod.sleep(id);
+        }
+    }
+    for (int t = 0; t < 3; t++) checkStep(simulation, dt);
+}
+
+int main() {
+    srand(3);
+    testKernels();
+    testColumns();
+    if (checkFailures() == 0) printf("movement_test: ok\n");
+    return checkFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "snapshot.h"
+
+// Snapshot round trips: the map's blocked cells and the selection box come
+// back with the entities, and files written before those columns existed
+// still load.
+
+static const char* PATH = "snapshot_test.snap";
+
+static float randomCoordinate() {
+    return (float) rand() / RAND_MAX * 1.8f - 0.9f;
+}
+
+static bool sameBox(const engine::Selection& a, const engine::Selection& b) {
+    return a.cursor == b.cursor && a.minX == b.minX && a.minY == b.minY && a.maxX == b.maxX && a.maxY == b.maxY;
+}
+
+// Units on the left, a wall down the middle with a gap, and the ones in a
+// box still being dragged sent to the right, so their paths depend on the map
+static void build(engine::Simulation& simulation) {
+    srand(4);
+    for (int i = 0; i < 400; i++) {
+        simulation.spawnUnit(randomCoordinate() * 0.4f - 0.5f, randomCoordinate());
+    }
+    simulation.blockArea(glm::vec2(-0.05f, -1.0f), glm::vec2(0.05f, 0.3f));
+    simulation.startSelection(engine::Selection(1, -0.9f, -0.5f, -0.3f, 0.5f));
+    simulation.step(1.0 / 30);
+    simulation.addTarget(glm::vec3(0.6f, -0.2f, 0.0f));
+    for (int t = 0; t < 20; t++) simulation.step(1.0 / 30);
+    // the drag goes on after the order
+    simulation.changeSelection(engine::Selection(1, -0.8f, -0.6f, -0.2f, 0.2f));
+    simulation.step(1.0 / 30);
+}
+
+static void testRoundTrip() {
+    engine::Simulation saved(0.05f, 0);
+    build(saved);
+
+    engine::SnapshotWriter writer;
+    writer.save(saved, PATH);
+    CHECK(writer.wait());
+
+    engine::Simulation loaded(0.05f, 0);
+    std::string error;
+    bool ok = engine::loadSnapshot(loaded, PATH, error);
+    if (!ok) fprintf(stderr, "load failed: %s\n", error.c_str());
+    CHECK(ok);
+    if (!ok) return;
+
+    size_t blocked = 0;
+    for (int y = 0; y < saved.map.rows(); y++) {
+        for (int x = 0; x < saved.map.columns(); x++) {
+            glm::ivec2 cell(x, y);
+            CHECK(loaded.map.blocked(cell) == saved.map.blocked(cell));
+            if (saved.map.blocked(cell)) blocked++;
+        }
+    }
+    CHECK(blocked > 0);
+
+    auto savedSelection = saved.systems.system<engine::SelectionSystem>();
+    auto loadedSelection = loaded.systems.system<engine::SelectionSystem>();
+    CHECK(sameBox(loadedSelection->box(), savedSelection->box()));
+    CHECK(loadedSelection->selecting() && savedSelection->selecting());
+    CHECK(loaded.stateHash() == saved.stateHash());
+
+    // the restored drag keeps selecting, and the units keep walking round the wall
+    for (int t = 0; t < 60; t++) {
+        saved.step(1.0 / 30);
+        loaded.step(1.0 / 30);
+    }
+    CHECK(loaded.stateHash() == saved.stateHash());
+}
+
+// Renames the map and box columns to ids this build does not know, as a file
+// from before them would look to it
+static void forgetNewColumns(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "r+b");
+    CHECK(file != nullptr);
+    if (!file) return;
+    engine::SnapshotHeader header;
+    CHECK(fread(&header, sizeof(header), 1, file) == 1);
+    for (uint16_t c = 0; c < header.columnCount; c++) {
+        long at = (long) (sizeof(header) + sizeof(engine::SnapshotColumnHeader) * c);
+        engine::SnapshotColumnHeader column;
+        fseek(file, at, SEEK_SET);
+        CHECK(fread(&column, sizeof(column), 1, file) == 1);
+        if (column.id == (uint32_t) engine::SnapshotColumn::MapBlocked || column.id == (uint32_t) engine::SnapshotColumn::SelectionBox) {
+            column.id += 1000;
+            fseek(file, at, SEEK_SET);
+            CHECK(fwrite(&column, sizeof(column), 1, file) == 1);
+        }
+    }
+    fclose(file);
+}
+
+static void testOlderFile() {
+    engine::Simulation saved(0.05f, 0);
+    build(saved);
+    engine::Snapshot snapshot;
+    snapshot.capture(saved);
+    std::string error;
+    CHECK(snapshot.write(PATH, error));
+    forgetNewColumns(PATH);
+
+    engine::Simulation loaded(0.05f, 0);
+    bool ok = engine::loadSnapshot(loaded, PATH, error);
+    if (!ok) fprintf(stderr, "load failed: %s\n", error.c_str());
+    CHECK(ok);
+    if (!ok) return;
+
+    // the map stays open, and the box is the one the selected units were saved with
+    for (int y = 0; y < loaded.map.rows(); y++) {
+        for (int x = 0; x < loaded.map.columns(); x++) {
+            CHECK(!loaded.map.blocked(glm::ivec2(x, y)));
+        }
+    }
+    auto loadedSelection = loaded.systems.system<engine::SelectionSystem>();
+    CHECK(sameBox(loadedSelection->box(), saved.systems.system<engine::SelectionSystem>()->box()));
+    CHECK(!loadedSelection->selecting());
+}
+
+int main() {
+    testRoundTrip();
+    testOlderFile();
+    remove(PATH);
+    if (checkFailures() == 0) printf("snapshot_test: ok\n");
+    return checkFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,317 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "check.h"
+#include "gl_context.h"
+#include "render.h"
+#include "stream_buffer.h"
+#include "thread_pool.h"
+
+// StreamBuffer against a real context: a region is never handed out again
+// before the fence placed after its last use has signaled, growing while
+// regions are still in flight neither waits nor disturbs what they hold, and
+// EntityRenderer's workers write the frame straight into the mapped region.
+//
+// The fence calls are wrapped in glad's function pointers. Each fence reports
+// itself busy for a few polls before the real wait, as a GPU a few frames
+// behind would, so every reuse has to go through the wait.
+
+struct Fence {
+    GLsync sync;
+    uint buffer;
+    size_t offset;
+    int busyPolls;
+    bool signaled, deleted;
+};
+
+static std::vector<Fence> fences;
+static int busyPolls = 0;
+static PFNGLFENCESYNCPROC realFenceSync;
+static PFNGLCLIENTWAITSYNCPROC realClientWaitSync;
+static PFNGLDELETESYNCPROC realDeleteSync;
+
+static Fence* find(GLsync sync) {
+    for (auto& fence : fences) {
+        if (fence.sync == sync && !fence.deleted) return &fence;
+    }
+    return nullptr;
+}
+
+static GLsync APIENTRY fenceSync(GLenum condition, GLbitfield flags) {
+    GLsync sync = realFenceSync(condition, flags);
+    fences.push_back(Fence { sync, 0, 0, busyPolls, false, false });
+    return sync;
+}
+
+static GLenum APIENTRY clientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout) {
+    Fence* fence = find(sync);
+    if (fence && fence->busyPolls > 0) {
+        fence->busyPolls--;
+        return GL_TIMEOUT_EXPIRED;
+    }
+    GLenum status = realClientWaitSync(sync, flags, timeout);
+    if (fence && (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)) fence->signaled = true;
+    return status;
+}
+
+static void APIENTRY deleteSync(GLsync sync) {
+    Fence* fence = find(sync);
+    if (fence) fence->deleted = true;
+    realDeleteSync(sync);
+}
+
+static void spyOnFences() {
+    realFenceSync = glad_glFenceSync;
+    realClientWaitSync = glad_glClientWaitSync;
+    realDeleteSync = glad_glDeleteSync;
+    glad_glFenceSync = fenceSync;
+    glad_glClientWaitSync = clientWaitSync;
+    glad_glDeleteSync = deleteSync;
+}
+
+// Places the frame's fence and notes which region it guards
+static void fence(engine::StreamBuffer& stream) {
+    size_t placed = fences.size();
+    stream.fence();
+    if (fences.size() > placed) {
+        fences.back().buffer = stream.buffer();
+        fences.back().offset = stream.offset();
+    }
+}
+
+static uint32_t pattern(uint frame, size_t word) {
+    return frame * 0x9e3779b9u ^ (uint32_t) word;
+}
+
+static void writePattern(void* region, uint frame, size_t words) {
+    auto out = static_cast<uint32_t*>(region);
+    for (size_t i = 0; i < words; i++) out[i] = pattern(frame, i);
+}
+
+static bool holdsPattern(const std::vector<uint32_t>& readBack, size_t from, uint frame, size_t words) {
+    for (size_t i = 0; i < words; i++) {
+        if (readBack[from + i] != pattern(frame, i)) {
+            fprintf(stderr, "frame %u: word %zu does not match what was written\n", frame, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Stands in for the frame's draws: the GPU reads the region into check's slot
+static void copyRegion(const engine::StreamBuffer& stream, uint check, size_t slot, size_t bytes) {
+    glBindBuffer(GL_COPY_READ_BUFFER, stream.buffer());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, check);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, stream.offset(), slot, bytes);
+}
+
+static std::vector<uint32_t> readCheck(uint check, size_t bytes) {
+    std::vector<uint32_t> readBack(bytes / sizeof(uint32_t));
+    glBindBuffer(GL_COPY_READ_BUFFER, check);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, bytes, readBack.data());
+    return readBack;
+}
+
+static uint makeCheck(size_t bytes) {
+    uint check = 0;
+    glGenBuffers(1, &check);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, check);
+    glBufferData(GL_COPY_WRITE_BUFFER, bytes, nullptr, GL_STATIC_READ);
+    return check;
+}
+
+// Frames go round the regions in turn, each one written while the GPU still
+// reads the ones before it, and what the GPU reads is what was written
+static void testRotation(bool persistent) {
+    const uint frames = 30;
+    const size_t words = 4096, bytes = words * sizeof(uint32_t);
+    fences.clear();
+    busyPolls = 3;
+
+    engine::StreamBuffer stream;
+    stream.init(GL_ARRAY_BUFFER, bytes, 3, persistent);
+    CHECK(stream.mode() == (persistent ? engine::StreamBuffer::PERSISTENT : engine::StreamBuffer::ORPHAN));
+    uint check = makeCheck(bytes * frames);
+
+    std::vector<size_t> offsets;
+    for (uint f = 0; f < frames; f++) {
+        void* region = stream.map(bytes);
+        CHECK(region != nullptr);
+        if (!region) break;
+        // every fence ever placed on this region has signaled before it comes back
+        for (auto& placed : fences) {
+            if (placed.buffer == stream.buffer() && placed.offset == stream.offset()) CHECK(placed.signaled);
+        }
+        offsets.push_back(stream.offset());
+        writePattern(region, f, words);
+        CHECK(stream.unmap());
+        copyRegion(stream, check, bytes * f, bytes);
+        fence(stream);
+    }
+    engine::GLState::instance().invalidate();
+
+    // the last `regions` frames all went to different regions
+    uint regions = stream.regions();
+    for (size_t a = offsets.size() - regions; a < offsets.size(); a++) {
+        for (size_t b = a + 1; b < offsets.size(); b++) CHECK(offsets[a] != offsets[b]);
+    }
+    if (persistent) {
+        CHECK(regions == 3);
+        CHECK(fences.size() == frames);
+        // each region's first turn has nothing to wait for; every later one waits on its busy fence
+        CHECK(stream.stats().waits == frames - regions);
+    } else {
+        CHECK(fences.empty());
+        CHECK(stream.stats().waits == 0);
+    }
+    CHECK(stream.stats().frames == frames);
+    CHECK(stream.stats().reallocations == 0);
+
+    std::vector<uint32_t> readBack = readCheck(check, bytes * frames);
+    for (uint f = 0; f < frames; f++) CHECK(holdsPattern(readBack, words * f, f, words));
+
+    glDeleteBuffers(1, &check);
+    stream.cleanup();
+    for (auto& placed : fences) CHECK(placed.deleted);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+// A frame that outgrows the regions while earlier ones are still being read
+// gets fresh storage without waiting, and the earlier frames read what they
+// were given
+static void testGrowth(bool persistent) {
+    const size_t words = 1024, bytes = words * sizeof(uint32_t);
+    const size_t bigWords = words * 4, bigBytes = bytes * 4;
+    fences.clear();
+    // far more polls than the test makes, so a wait would be seen
+    busyPolls = 1000;
+
+    engine::StreamBuffer stream;
+    stream.init(GL_ARRAY_BUFFER, bytes, 3, persistent);
+    uint check = makeCheck(bytes * 2 + bigBytes);
+
+    for (uint f = 0; f < 2; f++) {
+        void* region = stream.map(bytes);
+        CHECK(region != nullptr);
+        if (!region) return;
+        writePattern(region, f, words);
+        CHECK(stream.unmap());
+        copyRegion(stream, check, bytes * f, bytes);
+        fence(stream);
+    }
+
+    void* region = stream.map(bigBytes);
+    CHECK(region != nullptr);
+    if (!region) return;
+    CHECK(stream.stats().reallocations == 1);
+    CHECK(stream.stats().waits == 0);
+    CHECK(stream.regionBytes() >= bigBytes);
+    if (persistent) {
+        // the in-flight fences went with the old storage, unwaited
+        CHECK(fences.size() == 2);
+        for (auto& placed : fences) CHECK(placed.deleted && !placed.signaled);
+    }
+    writePattern(region, 2, bigWords);
+    CHECK(stream.unmap());
+    copyRegion(stream, check, bytes * 2, bigBytes);
+    fence(stream);
+    engine::GLState::instance().invalidate();
+
+    std::vector<uint32_t> readBack = readCheck(check, bytes * 2 + bigBytes);
+    CHECK(holdsPattern(readBack, 0, 0, words));
+    CHECK(holdsPattern(readBack, words, 1, words));
+    CHECK(holdsPattern(readBack, words * 2, 2, bigWords));
+
+    glDeleteBuffers(1, &check);
+    stream.cleanup();
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+static bool same(const engine::SpriteInstance& a, const engine::SpriteInstance& b) {
+    return memcmp(&a, &b, sizeof(engine::SpriteInstance)) == 0;
+}
+
+// EntityRenderer::render() with a pool: the workers fill the mapped region,
+// which has to end up exactly as a serial write() lays the frame out,
+// including on the frame that outgrows the starting regions
+static void testRenderer() {
+    fences.clear();
+    busyPolls = 0;
+
+    engine::TextureManager textures(256, 0);
+    // a missing file draws as the placeholder, which opens atlas page 0
+    engine::TextureHandle handle = textures.loadAsync("missing.png");
+    uint page = textures.region(handle).page;
+
+    // draws go to a framebuffer of the test's own; a hidden window may not have a usable one
+    GLuint framebuffer, color;
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, 64, 64);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+    CHECK(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+    glViewport(0, 0, 64, 64);
+
+    engine::EntityRenderer renderer;
+    CHECK(renderer.init());
+    engine::ThreadPool pool(3);
+
+    for (uint count : { 500u, 20000u, 20000u, 3000u }) {
+        engine::SpriteBatchBuilder batches;
+        batches.begin();
+        for (uint i = 0; i < count; i++) {
+            float f = (float) i;
+            batches.add(page, engine::SpriteInstance(glm::vec3(f, -f, count), f * 0.01f, 1.0f + f, glm::vec3(0.5f),
+                                                     glm::vec4(0.0f, 0.0f, 1.0f, 1.0f)));
+        }
+        batches.end();
+
+        renderer.use();
+        renderer.render(batches, textures, glm::mat4(1.0f), &pool);
+
+        std::vector<engine::SpriteInstance> expected(count), written(count);
+        batches.write(expected.data());
+        const engine::StreamBuffer& stream = renderer.instances();
+        glBindBuffer(GL_COPY_READ_BUFFER, stream.buffer());
+        glGetBufferSubData(GL_COPY_READ_BUFFER, stream.offset(), sizeof(engine::SpriteInstance) * count, written.data());
+        engine::GLState::instance().invalidate();
+
+        size_t mismatched = 0;
+        for (uint i = 0; i < count; i++) {
+            if (!same(expected[i], written[i])) mismatched++;
+        }
+        CHECK(mismatched == 0);
+    }
+    CHECK(renderer.streamStats().frames == 4);
+    CHECK(renderer.streamStats().reallocations == 1);
+
+    renderer.cleanup();
+    textures.cleanup();
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &color);
+    CHECK(glGetError() == GL_NO_ERROR);
+}
+
+int main() {
+    TestContext context;
+    if (!context.create()) return TEST_SKIPPED;
+    spyOnFences();
+
+    bool persistent = engine::StreamBuffer::persistentSupported();
+    if (!persistent) fprintf(stderr, "no persistent mapping here; only the orphaning path is tested\n");
+    if (persistent) {
+        testRotation(true);
+        testGrowth(true);
+    }
+    testRotation(false);
+    testGrowth(false);
+    testRenderer();
+
+    if (checkFailures() == 0) printf("stream_buffer_test: ok\n");
+    return checkFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "texture.h"
+
+// TextureManager's async path with GL stubbed out: decodes completing on the
+// pool, handles drawing as the placeholder until their upload, and
+// uploadPending() keeping to its byte budget. The stubs go into glad's
+// function pointers, so no context or window is needed.
+
+struct Upload {
+    GLuint texture;
+    GLint level, x, y;
+    GLsizei width, height;
+    std::vector<unsigned char> rgba;
+};
+
+static GLuint nextTexture = 1, bound = 0;
+static std::vector<Upload> uploads;
+
+static void APIENTRY genTextures(GLsizei n, GLuint* textures) {
+    for (GLsizei i = 0; i < n; i++) textures[i] = nextTexture++;
+}
+static void APIENTRY deleteTextures(GLsizei, const GLuint*) {}
+static void APIENTRY bindTexture(GLenum, GLuint texture) { bound = texture; }
+static void APIENTRY activeTexture(GLenum) {}
+static void APIENTRY texImage2D(GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void*) {}
+static void APIENTRY generateMipmap(GLenum) {}
+static void APIENTRY pixelStorei(GLenum, GLint) {}
+static void APIENTRY texSubImage2D(GLenum, GLint level, GLint x, GLint y, GLsizei width, GLsizei height, GLenum, GLenum,
+                                   const void* pixels) {
+    auto bytes = static_cast<const unsigned char*>(pixels);
+    uploads.push_back(Upload { bound, level, x, y, width, height,
+                               std::vector<unsigned char>(bytes, bytes + (size_t) width * height * 4) });
+}
+
+static void stubGl() {
+    glad_glGenTextures = genTextures;
+    glad_glDeleteTextures = deleteTextures;
+    glad_glBindTexture = bindTexture;
+    glad_glActiveTexture = activeTexture;
+    glad_glTexImage2D = texImage2D;
+    glad_glGenerateMipmap = generateMipmap;
+    glad_glPixelStorei = pixelStorei;
+    glad_glTexSubImage2D = texSubImage2D;
+}
+
+static size_t uploadedBytes(size_t from) {
+    size_t bytes = 0;
+    for (size_t i = from; i < uploads.size(); i++) {
+        bytes += uploads[i].rgba.size();
+    }
+    return bytes;
+}
+
+// The pixel every test image has at (x, y); seed tells the images apart
+static void pixel(uint seed, uint x, uint y, unsigned char* rgb) {
+    rgb[0] = (unsigned char) (seed * 37 + x);
+    rgb[1] = (unsigned char) (seed * 11 + y);
+    rgb[2] = (unsigned char) (x ^ y);
+}
+
+// A binary PPM, which stb_image reads as well as PNG without needing an encoder here
+static std::string writeImage(uint seed, uint width, uint height) {
+    std::string path = "texture_test_" + std::to_string(seed) + ".ppm";
+    FILE* file = fopen(path.c_str(), "wb");
+    CHECK(file != nullptr);
+    if (!file) return path;
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+    for (uint y = 0; y < height; y++) {
+        for (uint x = 0; x < width; x++) {
+            unsigned char rgb[3];
+            pixel(seed, x, y, rgb);
+            fwrite(rgb, 1, 3, file);
+        }
+    }
+    fclose(file);
+    return path;
+}
+
+static bool sameRegion(const engine::TextureRegion& a, const engine::TextureRegion& b) {
+    return a.page == b.page && a.uv == b.uv && a.width == b.width && a.height == b.height;
+}
+
+// The upload for a region has the image's pixels, placed where the region says
+static bool uploadedAt(const Upload& upload, const engine::TextureManager& textures, engine::TextureHandle handle, uint seed) {
+    const engine::TextureRegion& region = textures.region(handle);
+    if (upload.level != 0 || (uint) upload.width != region.width || (uint) upload.height != region.height) return false;
+    for (uint y = 0; y < region.height; y++) {
+        for (uint x = 0; x < region.width; x++) {
+            unsigned char rgb[3];
+            pixel(seed, x, y, rgb);
+            const unsigned char* rgba = &upload.rgba[(y * region.width + x) * 4];
+            if (memcmp(rgba, rgb, 3) != 0 || rgba[3] != 255) return false;
+        }
+    }
+    return true;
+}
+
+// Decodes finish on the pool while the handles draw as the placeholder, then swap in on upload
+static void testAsync(std::vector<std::string>& files) {
+    engine::TextureManager textures(256, 2);
+    std::vector<engine::TextureHandle> handles;
+    for (uint seed = 0; seed < 6; seed++) {
+        files.push_back(writeImage(seed, 20 + seed, 12 + 2 * seed));
+        handles.push_back(textures.loadAsync(files.back()));
+    }
+    files.push_back("texture_test_missing.ppm");
+    engine::TextureHandle missing = textures.loadAsync(files.back());
+
+    // nothing but the placeholder has gone up yet, and every handle draws as it
+    CHECK(uploads.size() == 1 && uploads[0].width == 8 && uploads[0].height == 8);
+    const engine::TextureRegion placeholder = textures.region(handles[0]);
+    for (auto handle : handles) {
+        CHECK(sameRegion(textures.region(handle), placeholder));
+        CHECK(textures.loaded(handle).wait_for(std::chrono::seconds(0)) != std::future_status::ready);
+    }
+    CHECK(textures.loadAsync(files[2]) == handles[2]);
+
+    size_t before = uploads.size(), uploaded = 0;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (textures.pendingLoads() > 0 && std::chrono::steady_clock::now() < deadline) {
+        uploaded += textures.uploadPending();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(textures.pendingLoads() == 0);
+    CHECK(uploaded == handles.size());
+    CHECK(uploads.size() - before == handles.size());
+
+    for (uint seed = 0; seed < handles.size(); seed++) {
+        auto handle = handles[seed];
+        auto done = textures.loaded(handle);
+        CHECK(done.wait_for(std::chrono::seconds(0)) == std::future_status::ready && done.get());
+        CHECK(!sameRegion(textures.region(handle), placeholder));
+        CHECK(textures.region(handle).width == 20 + seed && textures.region(handle).height == 12 + 2 * seed);
+        bool found = false;
+        for (size_t i = before; i < uploads.size(); i++) {
+            found = found || uploadedAt(uploads[i], textures, handle, seed);
+        }
+        CHECK(found);
+    }
+
+    // a file that does not decode reports failure and keeps the placeholder
+    auto failed = textures.loaded(missing);
+    CHECK(failed.wait_for(std::chrono::seconds(0)) == std::future_status::ready && !failed.get());
+    CHECK(sameRegion(textures.region(missing), placeholder));
+    textures.cleanup();
+}
+
+// With no decode threads every image is decoded by the time loadAsync returns,
+// so each uploadPending() call is limited by the budget alone
+static void testBudget(std::vector<std::string>& files) {
+    engine::TextureManager textures(512, 0);
+    const size_t imageBytes = 32 * 32 * 4;
+    std::vector<engine::TextureHandle> handles;
+    for (uint seed = 10; seed < 20; seed++) {
+        files.push_back(writeImage(seed, 32, 32));
+        handles.push_back(textures.loadAsync(files.back()));
+    }
+
+    // three fit under two and a half images' worth: the third crosses it and the fourth waits
+    const size_t budget = imageBytes * 5 / 2;
+    const size_t expected[] = { 3, 3, 3, 1, 0 };
+    for (size_t call = 0; call < 5; call++) {
+        size_t before = uploads.size();
+        size_t uploaded = textures.uploadPending(budget);
+        CHECK(uploaded == expected[call]);
+        CHECK(uploadedBytes(before) == uploaded * imageBytes);
+        CHECK(textures.pendingLoads() == 10 - std::min<size_t>(10, 3 * (call + 1)));
+    }
+    for (auto handle : handles) {
+        CHECK(textures.loaded(handle).get());
+    }
+
+    // an image bigger than the whole budget still goes up, alone
+    files.push_back(writeImage(20, 64, 64));
+    textures.loadAsync(files.back());
+    files.push_back(writeImage(21, 8, 8));
+    textures.loadAsync(files.back());
+    size_t before = uploads.size();
+    CHECK(textures.uploadPending(1) == 1);
+    CHECK(uploadedBytes(before) == 64 * 64 * 4);
+    CHECK(textures.uploadPending(1) == 1);
+    CHECK(textures.pendingLoads() == 0);
+    textures.cleanup();
+}
+
+int main() {
+    stubGl();
+    std::vector<std::string> files;
+    testAsync(files);
+    testBudget(files);
+    for (auto& file : files) {
+        remove(file.c_str());
+    }
+    if (checkFailures() == 0) printf("texture_test: ok\n");
+    return checkFailures() == 0 ? 0 : 1;
+}